@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+// Just enough of a test framework for the host tests, every failed check is reported and
+// makes the test exit with a failure once main() returns through CHECK_RESULT().
+namespace host_test
+{
+    inline int &failures()
+    {
+        static int s_failures = 0;
+
+        return s_failures;
+    }
+}
+
+#define CHECK(condition)                                                                       \
+    do                                                                                         \
+    {                                                                                          \
+        if (!(condition))                                                                      \
+        {                                                                                      \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            ::host_test::failures()++;                                                         \
+        }                                                                                      \
+    } while (0)
+
+#define CHECK_RESULT() (::host_test::failures() ? (std::fprintf(stderr, "%d checks failed\n", ::host_test::failures()), EXIT_FAILURE) : EXIT_SUCCESS)
@@ -0,0 +1,365 @@
+#include "check.h"
+
+#include "hardware/compression.h"
+#include "hardware/storage.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace hardware::storage;
+
+// Files go to a temporary directory, which is always mounted.
+namespace hardware
+{
+    namespace storage
+    {
+        bool wait(const type storage_type, uint32_t timeout_ms)
+        {
+            return true;
+        }
+    }
+}
+
+namespace
+{
+    constexpr size_t BLOCK_SIZE = 1024;
+    // Mirrors the file layout in compression.cpp.
+    constexpr size_t FILE_HEADER_SIZE = 16;
+    constexpr size_t BLOCK_HEADER_SIZE = 8;
+    constexpr size_t TRAILER_SIZE = 24;
+    constexpr uint32_t STORED_FLAG = 0x80000000;
+
+    std::string s_directory;
+
+    std::string path(const char *name)
+    {
+        return s_directory + "/" + name;
+    }
+
+    // Text-like data that compresses, with every third block noise that does not.
+    std::vector<uint8_t> make_data(size_t size, uint32_t seed)
+    {
+        static const char WORDS[] = "the quick brown fox jumps over the lazy dog while the log rotates ";
+        std::mt19937 random(seed);
+        std::vector<uint8_t> data(size);
+
+        for (size_t i = 0; i < size; i++)
+            data[i] = (i / BLOCK_SIZE) % 3 == 2 ? random() : WORDS[(i + i / 97) % (sizeof(WORDS) - 1)];
+
+        return data;
+    }
+
+    std::vector<uint8_t> load(const std::string &name)
+    {
+        std::vector<uint8_t> data;
+        FILE *file = fopen(name.c_str(), "rb");
+        int byte;
+
+        while (file && (byte = fgetc(file)) != EOF)
+            data.push_back(byte);
+
+        if (file)
+            fclose(file);
+
+        return data;
+    }
+
+    std::vector<uint8_t> read_all(compressed_reader &reader)
+    {
+        std::vector<uint8_t> data(reader.size());
+
+        data.resize(reader.read(0, data.data(), data.size()));
+
+        return data;
+    }
+
+    std::vector<uint8_t> compress(const std::vector<uint8_t> &input)
+    {
+        std::vector<uint8_t> output(lz4::bound(input.size()));
+        std::vector<uint16_t> hash_table(lz4::HASH_ENTRIES);
+
+        output.resize(lz4::compress(input.data(), input.size(), output.data(), output.size(), hash_table.data()));
+
+        return output;
+    }
+
+    // Decompresses into a buffer of exactly capacity bytes, so anything past it is caught by the
+    // sanitizer the test is built with.
+    size_t decompress(const std::vector<uint8_t> &input, size_t capacity, std::vector<uint8_t> &output)
+    {
+        output.assign(capacity, 0);
+
+        const size_t size = lz4::decompress(input.data(), input.size(), output.data(), capacity);
+
+        output.resize(size);
+
+        return size;
+    }
+
+    void test_lz4_round_trip()
+    {
+        std::vector<std::vector<uint8_t>> inputs = {
+            {},
+            {42},
+            std::vector<uint8_t>(13, 'a'),
+            std::vector<uint8_t>(lz4::MAX_BLOCK_SIZE, 0),
+            make_data(lz4::MAX_BLOCK_SIZE, 1),
+        };
+
+        for (size_t size = 1; size < 40; size++)
+            inputs.push_back(make_data(size, size));
+
+        std::mt19937 random(2);
+        std::vector<uint8_t> noise(4096);
+
+        for (auto &byte : noise)
+            byte = random();
+
+        inputs.push_back(noise);
+
+        for (const auto &input : inputs)
+        {
+            const auto compressed = compress(input);
+            std::vector<uint8_t> output;
+
+            CHECK(!compressed.empty());
+            CHECK(decompress(compressed, input.size(), output) == input.size());
+            CHECK(output == input);
+        }
+
+        // Runs shrink, noise does not fit into less than it takes.
+        CHECK(compress(std::vector<uint8_t>(4096, 7)).size() < 64);
+
+        std::vector<uint8_t> output(noise.size() - 1);
+        std::vector<uint16_t> hash_table(lz4::HASH_ENTRIES);
+
+        CHECK(lz4::compress(noise.data(), noise.size(), output.data(), output.size(), hash_table.data()) == 0);
+    }
+
+    void test_lz4_malformed()
+    {
+        const auto input = make_data(4096, 3);
+        const auto compressed = compress(input);
+        std::vector<uint8_t> output;
+
+        // Too small an output is refused, not overrun.
+        CHECK(decompress(compressed, input.size() - 1, output) == 0);
+
+        // A cut off block stops short, whatever it produces is the start of the original.
+        for (size_t size = 0; size < compressed.size(); size++)
+        {
+            const std::vector<uint8_t> truncated(compressed.begin(), compressed.begin() + size);
+
+            decompress(truncated, input.size(), output);
+
+            CHECK(output.size() < input.size());
+            CHECK(std::equal(output.begin(), output.end(), input.begin()));
+        }
+
+        std::mt19937 random(4);
+
+        for (size_t i = 0; i < compressed.size(); i++)
+        {
+            auto corrupted = compressed;
+
+            corrupted[i] ^= 1 << (random() % 8);
+
+            CHECK(decompress(corrupted, input.size(), output) <= input.size());
+        }
+
+        // A match reaching back before the start of the output.
+        const std::vector<uint8_t> reaching_back = {0x10, 'x', 0x02, 0x00, 0x00};
+
+        CHECK(decompress(reaching_back, 64, output) == 0);
+    }
+
+    void write_file(const std::string &name, const std::vector<uint8_t> &data)
+    {
+        compressed_writer writer(name.c_str(), BLOCK_SIZE);
+
+        CHECK(writer.is_open());
+        CHECK(writer.write(data.data(), data.size()) == data.size());
+        CHECK(writer.close());
+
+        const auto statistics = writer.get_statistics();
+
+        CHECK(statistics.blocks == (data.size() + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        CHECK(statistics.stored_blocks > 0 && statistics.stored_blocks < statistics.blocks);
+    }
+
+    void test_files()
+    {
+        const auto data = make_data(7 * BLOCK_SIZE + 300, 5);
+
+        write_file(path("data.rcz"), data);
+
+        compressed_reader reader(path("data.rcz").c_str());
+
+        CHECK(reader.is_open());
+        CHECK(reader.size() == data.size());
+        CHECK(read_all(reader) == data);
+
+        // Reads across block boundaries, from the file and from memory alike.
+        const auto file = load(path("data.rcz"));
+        compressed_reader mapped(file.data(), file.size());
+        std::mt19937 random(6);
+
+        CHECK(mapped.is_open());
+
+        for (int i = 0; i < 200; i++)
+        {
+            const size_t offset = random() % data.size();
+            const size_t size = random() % (3 * BLOCK_SIZE);
+            const size_t expected = std::min(size, data.size() - offset);
+            std::vector<uint8_t> from_file(size), from_memory(size);
+
+            CHECK(reader.read(offset, from_file.data(), size) == expected);
+            CHECK(mapped.read(offset, from_memory.data(), size) == expected);
+            CHECK(std::equal(from_file.begin(), from_file.begin() + expected, data.begin() + offset));
+            CHECK(std::equal(from_memory.begin(), from_memory.begin() + expected, data.begin() + offset));
+        }
+
+        uint8_t byte;
+
+        CHECK(reader.read(data.size(), &byte, 1) == 0);
+    }
+
+    // Reads as much as the reader claims to hold, within reason for a corrupted size.
+    size_t read_some(compressed_reader &reader, std::vector<uint8_t> &output)
+    {
+        output.assign(16 * BLOCK_SIZE, 0);
+        output.resize(reader.read(0, output.data(), output.size()));
+
+        return output.size();
+    }
+
+    void test_unclosed_file()
+    {
+        const auto data = make_data(5 * BLOCK_SIZE + 10, 7);
+
+        write_file(path("unclosed.rcz"), data);
+
+        // Without the index and the trailer, as left by a writer that lost power.
+        auto file = load(path("unclosed.rcz"));
+
+        file.resize(file.size() - TRAILER_SIZE - 6 * sizeof(uint32_t));
+
+        compressed_reader reader(file.data(), file.size());
+
+        CHECK(reader.is_open());
+        CHECK(read_all(reader) == data);
+    }
+
+    void test_truncated_files()
+    {
+        const auto data = make_data(6 * BLOCK_SIZE + 500, 8);
+
+        write_file(path("truncated.rcz"), data);
+
+        const auto file = load(path("truncated.rcz"));
+        std::vector<uint8_t> output;
+
+        // Whatever is left of the blocks reads back as the start of the data.
+        for (size_t size = 0; size < file.size(); size += 5)
+        {
+            const std::vector<uint8_t> truncated(file.begin(), file.begin() + size);
+            compressed_reader reader(truncated.data(), truncated.size());
+
+            CHECK(reader.is_open() == (size >= FILE_HEADER_SIZE));
+            CHECK(read_some(reader, output) <= data.size());
+            CHECK(std::equal(output.begin(), output.end(), data.begin()));
+        }
+    }
+
+    void test_corrupted_files()
+    {
+        const auto data = make_data(4 * BLOCK_SIZE + 100, 9);
+
+        write_file(path("corrupted.rcz"), data);
+
+        const auto file = load(path("corrupted.rcz"));
+        std::mt19937 random(10);
+        std::vector<uint8_t> output;
+
+        // Stored blocks have no checksum, so only memory safety and the bounds are checked.
+        for (size_t i = 0; i < file.size(); i++)
+        {
+            auto corrupted = file;
+
+            corrupted[i] ^= 1 << (random() % 8);
+
+            compressed_reader reader(corrupted.data(), corrupted.size());
+
+            CHECK(read_some(reader, output) <= 16 * BLOCK_SIZE);
+        }
+    }
+
+    void test_oversized_stored_block()
+    {
+        // A stored block claiming more bytes than a block holds, with no trailer so the index is
+        // rebuilt from it.
+        std::vector<uint8_t> file(FILE_HEADER_SIZE + BLOCK_HEADER_SIZE + lz4::bound(BLOCK_SIZE), 0x5a);
+        const uint32_t header[4] = {0x315a4352, BLOCK_SIZE, 0, 0};
+        const uint32_t stored_size = STORED_FLAG | lz4::bound(BLOCK_SIZE);
+        const uint16_t sizes[2] = {BLOCK_SIZE, 0xb10c};
+
+        memcpy(file.data(), header, sizeof(header));
+        memcpy(file.data() + FILE_HEADER_SIZE, &stored_size, sizeof(stored_size));
+        memcpy(file.data() + FILE_HEADER_SIZE + sizeof(stored_size), sizes, sizeof(sizes));
+
+        compressed_reader reader(file.data(), file.size());
+        std::vector<uint8_t> output;
+
+        CHECK(reader.is_open());
+        CHECK(read_some(reader, output) == 0);
+    }
+
+    void test_wrapping_trailer()
+    {
+        const auto data = make_data(3 * BLOCK_SIZE, 11);
+
+        write_file(path("wrapping.rcz"), data);
+
+        // block_count * 4 wraps to 0 in 32 bits, which made the trailer look consistent.
+        auto file = load(path("wrapping.rcz"));
+        const uint32_t forged[2] = {static_cast<uint32_t>(file.size() - TRAILER_SIZE), 0x40000000};
+
+        memcpy(file.data() + file.size() - TRAILER_SIZE, forged, sizeof(forged));
+
+        compressed_reader reader(file.data(), file.size());
+
+        CHECK(reader.is_open());
+        CHECK(read_all(reader) == data);
+    }
+}
+
+int main()
+{
+    char directory[] = "/tmp/compression_XXXXXX";
+
+    if (!mkdtemp(directory))
+        return EXIT_FAILURE;
+
+    s_directory = directory;
+
+    test_lz4_round_trip();
+    test_lz4_malformed();
+    test_files();
+    test_unclosed_file();
+    test_truncated_files();
+    test_corrupted_files();
+    test_oversized_stored_block();
+    test_wrapping_trailer();
+
+    for (const char *name : {"data.rcz", "unclosed.rcz", "truncated.rcz", "corrupted.rcz", "wrapping.rcz"})
+        unlink(path(name).c_str());
+
+    rmdir(directory);
+
+    return CHECK_RESULT();
+}
@@ -0,0 +1,307 @@
+#include "check.h"
+
+#include "hardware/espnow_protocol.h"
+
+#include <cstring>
+#include <deque>
+#include <set>
+#include <vector>
+
+using namespace hardware::espnow_protocol;
+
+namespace
+{
+    constexpr size_t PEERS = 4;
+    constexpr size_t POOL_SIZE = 8;
+
+    struct node;
+
+    // Stands in for ESP-NOW: frames arrive after a fixed latency, unicast frames picked by
+    // index are lost, and the sender learns the outcome when the frame would have arrived.
+    class medium
+    {
+    public:
+        struct port
+        {
+            bool send(const uint8_t *mac, const uint8_t *frame, size_t size);
+
+            bool add(const uint8_t *mac)
+            {
+                return true;
+            }
+
+            void remove(const uint8_t *mac)
+            {
+            }
+
+            int64_t now_us();
+
+            void lock()
+            {
+            }
+
+            void unlock()
+            {
+            }
+
+            medium *mp_medium;
+            node *mp_node;
+        };
+
+        void attach(node &target)
+        {
+            m_nodes.push_back(&target);
+        }
+
+        void lose(uint32_t unicast_index)
+        {
+            m_lost.insert(unicast_index);
+        }
+
+        // Delivers until nothing is in flight, replies included.
+        void run();
+
+        int64_t m_now = 1000000;
+        int64_t m_latency_us = 1000;
+
+    private:
+        friend struct port;
+
+        struct flight
+        {
+            int64_t arrival;
+            node *source;
+            uint8_t destination[MAC_SIZE];
+            std::vector<uint8_t> frame;
+            bool lost;
+        };
+
+        std::vector<node *> m_nodes;
+        std::deque<flight> m_flights;
+        std::set<uint32_t> m_lost;
+        uint32_t m_unicast_count = 0;
+    };
+
+    struct node
+    {
+        node(medium &shared, uint8_t id) : m_port{&shared, this}, m_link(m_port)
+        {
+            memset(m_mac, id, sizeof(m_mac));
+
+            shared.attach(*this);
+
+            m_link.set_receive_callback([](const uint8_t *, const uint8_t *, size_t, void *user_data)
+                                        { static_cast<node *>(user_data)->m_received++; }, this);
+            m_link.set_paired_callback([](const uint8_t *, void *user_data)
+                                       { static_cast<node *>(user_data)->m_paired++; }, this);
+        }
+
+        peer_stats stats(const node &other)
+        {
+            peer_stats result = {};
+
+            CHECK(m_link.get_stats(other.m_mac, result));
+
+            return result;
+        }
+
+        uint8_t m_mac[MAC_SIZE];
+        medium::port m_port;
+        hardware::espnow_protocol::link<medium::port, PEERS, POOL_SIZE> m_link;
+        uint32_t m_received = 0;
+        uint32_t m_paired = 0;
+    };
+
+    bool medium::port::send(const uint8_t *mac, const uint8_t *frame, size_t size)
+    {
+        const bool broadcast = !memcmp(mac, BROADCAST_MAC, MAC_SIZE);
+        flight sent = {mp_medium->m_now + mp_medium->m_latency_us, mp_node, {}, std::vector<uint8_t>(frame, frame + size), false};
+
+        memcpy(sent.destination, mac, MAC_SIZE);
+
+        if (!broadcast)
+            sent.lost = mp_medium->m_lost.count(mp_medium->m_unicast_count++) != 0;
+
+        mp_medium->m_flights.push_back(std::move(sent));
+
+        return true;
+    }
+
+    int64_t medium::port::now_us()
+    {
+        return mp_medium->m_now;
+    }
+
+    void medium::run()
+    {
+        while (!m_flights.empty())
+        {
+            const flight current = std::move(m_flights.front());
+            const bool broadcast = !memcmp(current.destination, BROADCAST_MAC, MAC_SIZE);
+
+            m_flights.pop_front();
+
+            m_now = std::max(m_now, current.arrival);
+
+            if (!current.lost)
+                for (auto target : m_nodes)
+                    if (target != current.source && (broadcast || !memcmp(target->m_mac, current.destination, MAC_SIZE)))
+                        target->m_link.on_receive(current.source->m_mac, current.frame.data(), current.frame.size());
+
+            current.source->m_link.on_send_done(current.destination, broadcast || !current.lost);
+        }
+    }
+
+    void test_pairing()
+    {
+        medium air;
+        node a(air, 0xa);
+        node b(air, 0xb);
+        node bystander(air, 0xc);
+
+        a.m_link.start_pairing(1000);
+        b.m_link.start_pairing(1000);
+
+        // a's beacon reaches b, b answers and sends its own beacon, a answers that.
+        a.m_link.poll();
+        air.run();
+        b.m_link.poll();
+        air.run();
+        a.m_link.poll();
+        air.run();
+        b.m_link.poll();
+        bystander.m_link.poll();
+
+        peer_stats stats = {};
+
+        CHECK(a.m_paired == 1);
+        CHECK(b.m_paired == 1);
+        CHECK(a.m_link.get_stats(b.m_mac, stats));
+        CHECK(b.m_link.get_stats(a.m_mac, stats));
+        CHECK(bystander.m_paired == 0);
+        CHECK(!bystander.m_link.get_stats(a.m_mac, stats));
+
+        // Beacons stop once the pairing window is over.
+        air.m_now += 2000 * 1000;
+        a.m_link.poll();
+        air.run();
+        b.m_link.poll();
+        CHECK(b.m_paired == 1);
+    }
+
+    void test_loss_accounting()
+    {
+        medium air;
+        node a(air, 0xa);
+        node b(air, 0xb);
+        const uint8_t payload[] = {1, 2, 3};
+
+        CHECK(a.m_link.add_peer(b.m_mac));
+        CHECK(b.m_link.add_peer(a.m_mac));
+
+        air.lose(2);
+        air.lose(3);
+        air.lose(6);
+
+        for (int i = 0; i < 8; i++)
+            CHECK(a.m_link.send(b.m_mac, payload, sizeof(payload)));
+
+        air.run();
+        CHECK(b.m_link.poll() == 0);
+
+        const peer_stats sent = a.stats(b);
+        const peer_stats received = b.stats(a);
+
+        CHECK(sent.sent == 8);
+        CHECK(sent.delivered == 5);
+        CHECK(sent.failed == 3);
+        CHECK(received.received == 5);
+        CHECK(received.lost == 3);
+        CHECK(b.m_received == 5);
+
+        // Frames from unknown senders are not counted or delivered.
+        node stranger(air, 0xd);
+
+        CHECK(stranger.m_link.add_peer(b.m_mac));
+        CHECK(stranger.m_link.send(b.m_mac, payload, sizeof(payload)));
+        air.run();
+        b.m_link.poll();
+        CHECK(b.m_received == 5);
+    }
+
+    void test_round_trip()
+    {
+        medium air;
+        node a(air, 0xa);
+        node b(air, 0xb);
+
+        CHECK(a.m_link.add_peer(b.m_mac));
+        CHECK(b.m_link.add_peer(a.m_mac));
+
+        air.m_latency_us = 1500;
+        CHECK(a.m_link.ping(b.m_mac));
+        air.run();
+
+        peer_stats stats = a.stats(b);
+
+        CHECK(stats.rtt_us == 3000);
+        CHECK(stats.rtt_min_us == 3000);
+        CHECK(stats.rtt_max_us == 3000);
+
+        // The average moves an eighth of the way to every new sample.
+        air.m_latency_us = 500;
+        CHECK(a.m_link.ping(b.m_mac));
+        air.run();
+
+        stats = a.stats(b);
+
+        CHECK(stats.rtt_us == 3000 - 3000 / 8 + 1000 / 8);
+        CHECK(stats.rtt_min_us == 1000);
+        CHECK(stats.rtt_max_us == 3000);
+
+        // Pings and pongs are not data, the receive callback never sees them.
+        b.m_link.poll();
+        a.m_link.poll();
+        CHECK(a.m_received == 0);
+        CHECK(b.m_received == 0);
+    }
+
+    void test_pool_exhaustion()
+    {
+        medium air;
+        node a(air, 0xa);
+        node b(air, 0xb);
+        const uint8_t payload[MAX_PAYLOAD_SIZE] = {};
+
+        CHECK(a.m_link.add_peer(b.m_mac));
+        CHECK(b.m_link.add_peer(a.m_mac));
+
+        for (size_t i = 0; i < POOL_SIZE + 3; i++)
+            CHECK(a.m_link.send(b.m_mac, payload, sizeof(payload)));
+
+        CHECK(!a.m_link.send(b.m_mac, payload, sizeof(payload) + 1));
+
+        air.run();
+
+        CHECK(b.m_link.poll() == 3);
+        CHECK(b.m_received == POOL_SIZE);
+        CHECK(b.stats(a).received == POOL_SIZE + 3);
+        CHECK(b.stats(a).lost == 0);
+
+        // The pool is usable again once drained.
+        CHECK(a.m_link.send(b.m_mac, payload, 1));
+        air.run();
+        CHECK(b.m_link.poll() == 0);
+        CHECK(b.m_received == POOL_SIZE + 1);
+    }
+}
+
+int main()
+{
+    test_pairing();
+    test_loss_accounting();
+    test_round_trip();
+    test_pool_exhaustion();
+
+    return CHECK_RESULT();
+}
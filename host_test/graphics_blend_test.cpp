@@ -0,0 +1,191 @@
+#include "check.h"
+
+#include "hardware/graphics_blend.h"
+
+#include <chrono>
+#include <vector>
+
+#include <lvgl.h>
+
+using namespace hardware::graphics;
+
+// graphics_blend.cpp also holds the renderer hook, which this test does not draw through.
+extern "C"
+{
+    lv_disp_t *_lv_refr_get_disp_refreshing(void)
+    {
+        return nullptr;
+    }
+
+    void lv_draw_sw_blend_basic(lv_draw_ctx_t *draw_ctx, const lv_draw_sw_blend_dsc_t *dsc)
+    {
+    }
+
+    bool _lv_area_intersect(lv_area_t *res_p, const lv_area_t *a1_p, const lv_area_t *a2_p)
+    {
+        return false;
+    }
+}
+
+namespace
+{
+    constexpr size_t STRIPE_PIXELS = 240 * 40;
+    constexpr uint32_t ITERATIONS = 200;
+
+    // Swapped RGB565 with every channel taking the value, or what is left of it, so the
+    // pixels of 0 to 63 against each other cover all pairs of channel values.
+    uint16_t make_pixel(uint32_t value)
+    {
+        const uint16_t rgb565 = (value & 31) << 11 | value << 5 | value >> 1;
+
+        return rgb565 << 8 | rgb565 >> 8;
+    }
+
+    lv_color_t to_color(uint16_t pixel)
+    {
+        lv_color_t color;
+
+        color.full = pixel;
+
+        return color;
+    }
+
+    void make_pairs(std::vector<uint16_t> &foreground, std::vector<uint16_t> &background)
+    {
+        for (uint32_t fg = 0; fg < 64; fg++)
+        {
+            for (uint32_t bg = 0; bg < 64; bg++)
+            {
+                foreground.push_back(make_pixel(fg));
+                background.push_back(make_pixel(bg));
+            }
+        }
+    }
+
+    uint16_t lvgl_fill_mix(uint16_t color, uint16_t dest, uint8_t opa)
+    {
+        uint16_t premultiplied[3];
+
+        lv_color_premult(to_color(color), opa, premultiplied);
+
+        return lv_color_mix_premult(premultiplied, to_color(dest), 255 - opa).full;
+    }
+
+    void test_mix()
+    {
+        std::vector<uint16_t> src, background;
+
+        make_pairs(src, background);
+
+        for (uint32_t opa = 0; opa < 256; opa++)
+        {
+            std::vector<uint16_t> reference = background, dispatched = background;
+            uint32_t mismatches = 0;
+
+            blend::reference::mix(reference.data(), src.data(), opa, src.size());
+            blend::mix(dispatched.data(), src.data(), opa, src.size());
+
+            for (size_t i = 0; i < src.size(); i++)
+            {
+                const uint16_t expected = lv_color_mix(to_color(src[i]), to_color(background[i]), opa).full;
+
+                mismatches += reference[i] != expected || dispatched[i] != expected;
+            }
+
+            CHECK(mismatches == 0);
+        }
+    }
+
+    void test_fill_mix()
+    {
+        std::vector<uint16_t> colors, background;
+
+        make_pairs(colors, background);
+
+        for (uint32_t opa = 0; opa < 256; opa++)
+        {
+            uint32_t mismatches = 0;
+
+            for (uint32_t value = 0; value < 64; value++)
+            {
+                const uint16_t color = make_pixel(value);
+                std::vector<uint16_t> reference = background, dispatched = background;
+
+                blend::reference::fill_mix(reference.data(), color, opa, background.size());
+                blend::fill_mix(dispatched.data(), color, opa, background.size());
+
+                for (size_t i = 0; i < background.size(); i++)
+                {
+                    const uint16_t expected = lvgl_fill_mix(color, background[i], opa);
+
+                    mismatches += reference[i] != expected || dispatched[i] != expected;
+                }
+            }
+
+            CHECK(mismatches == 0);
+        }
+    }
+
+    template <typename kernel>
+    double measure(kernel run)
+    {
+        const auto start = std::chrono::steady_clock::now();
+
+        for (uint32_t i = 0; i < ITERATIONS; i++)
+            run(static_cast<uint8_t>(64 + i % 128));
+
+        const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+
+        return elapsed.count();
+    }
+
+    void print_timing(const char *name, double reference_us, double lvgl_us)
+    {
+        const double pixels = double(STRIPE_PIXELS) * ITERATIONS;
+
+        std::printf("%-9s reference %.0fus, LVGL %.0fus, %.0f vs %.0f Mpx/s\n", name, reference_us, lvgl_us, pixels / reference_us, pixels / lvgl_us);
+    }
+
+    // The reference kernels on the host against the loops lv_draw_sw_blend runs, one draw stripe at a time.
+    void benchmark()
+    {
+        std::vector<uint16_t> dest(STRIPE_PIXELS), src(STRIPE_PIXELS);
+
+        for (size_t i = 0; i < STRIPE_PIXELS; i++)
+        {
+            src[i] = i * 0x9e37;
+            dest[i] = i * 0x7f4b;
+        }
+
+        uint16_t *d = dest.data();
+        const uint16_t *s = src.data();
+        auto lv_dest = reinterpret_cast<lv_color_t *>(d);
+        auto lv_src = reinterpret_cast<const lv_color_t *>(s);
+
+        print_timing("fill_mix", measure([&](uint8_t opa) { blend::reference::fill_mix(d, 0x1f00, opa, STRIPE_PIXELS); }),
+                     measure([&](uint8_t opa)
+                             {
+                                 uint16_t premultiplied[3];
+
+                                 lv_color_premult(to_color(0x1f00), opa, premultiplied);
+
+                                 for (size_t i = 0; i < STRIPE_PIXELS; i++)
+                                     lv_dest[i] = lv_color_mix_premult(premultiplied, lv_dest[i], 255 - opa);
+                             }));
+        print_timing("mix", measure([&](uint8_t opa) { blend::reference::mix(d, s, opa, STRIPE_PIXELS); }),
+                     measure([&](uint8_t opa)
+                             {
+                                 for (size_t i = 0; i < STRIPE_PIXELS; i++)
+                                     lv_dest[i] = lv_color_mix(lv_src[i], lv_dest[i], opa);
+                             }));
+    }
+}
+
+int main()
+{
+    test_mix();
+    test_fill_mix();
+    benchmark();
+
+    return CHECK_RESULT();
+}
@@ -0,0 +1,338 @@
+#include "check.h"
+#include "power_cut_flash_device.h"
+
+#include "hardware/journal.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace hardware::storage;
+
+namespace
+{
+    constexpr size_t SECTOR_SIZE = 4096;
+    constexpr size_t SLOT_SIZE = journal::CHECKPOINT_SECTORS * SECTOR_SIZE;
+    // Two checkpoint slots and a log of two sectors.
+    constexpr size_t DEVICE_SIZE = 2 * SLOT_SIZE + 2 * SECTOR_SIZE;
+    constexpr size_t LOG_OFFSET = 2 * SLOT_SIZE;
+    // A 12 character key with a uint64_t value makes a 32 byte record, 128 to a sector, and a
+    // 22 byte checkpoint entry.
+    constexpr size_t RECORD_SIZE = 32;
+    constexpr size_t ENTRY_SIZE = 22;
+
+    using state = std::map<std::string, uint64_t>;
+
+    std::string s_path;
+
+    std::unique_ptr<flash_device> open_device()
+    {
+        return make_file_flash_device(s_path.c_str(), DEVICE_SIZE, SECTOR_SIZE);
+    }
+
+    void remove_device()
+    {
+        unlink(s_path.c_str());
+    }
+
+    std::vector<uint8_t> save_device()
+    {
+        std::vector<uint8_t> image(DEVICE_SIZE);
+
+        CHECK(open_device()->read(0, image.data(), image.size()));
+
+        return image;
+    }
+
+    void restore_device(const std::vector<uint8_t> &image)
+    {
+        FILE *file = fopen(s_path.c_str(), "wb");
+
+        CHECK(file && fwrite(image.data(), 1, image.size(), file) == image.size());
+
+        if (file)
+            fclose(file);
+    }
+
+    std::string key(uint32_t index)
+    {
+        char name[13];
+
+        snprintf(name, sizeof(name), "key-%08u", static_cast<unsigned>(index));
+
+        return name;
+    }
+
+    // What the journal holds for the keys the model knows of.
+    state read_state(journal &store, size_t keys)
+    {
+        state result;
+
+        for (uint32_t i = 0; i < keys; i++)
+        {
+            uint64_t value;
+
+            if (store.load(key(i).c_str(), value))
+                result[key(i)] = value;
+        }
+
+        return result;
+    }
+
+    void test_recovery()
+    {
+        remove_device();
+
+        {
+            journal store(open_device(), 0);
+
+            for (uint32_t i = 0; i < 5; i++)
+                CHECK(store.store(key(i).c_str(), uint64_t(i)));
+
+            CHECK(store.commit());
+            CHECK(store.remove(key(2).c_str()));
+            CHECK(store.store(key(4).c_str(), uint64_t(40)));
+            CHECK(store.commit());
+        }
+
+        journal store(open_device(), 0);
+
+        CHECK(read_state(store, 5) == (state{{key(0), 0}, {key(1), 1}, {key(3), 3}, {key(4), 40}}));
+        // A removal carries no value, its record is 8 bytes shorter.
+        CHECK(store.get_statistics().log_used == 7 * RECORD_SIZE - 8);
+    }
+
+    void test_torn_record()
+    {
+        remove_device();
+
+        {
+            journal store(open_device(), 0);
+
+            for (uint32_t i = 0; i < 5; i++)
+                CHECK(store.store(key(i).c_str(), uint64_t(i)));
+
+            CHECK(store.commit());
+        }
+
+        // The start of a record after the last one, as left by a power cut in the middle of a
+        // sector: magic and generation are right, the rest is missing.
+        {
+            auto device = open_device();
+            uint8_t start[16];
+
+            CHECK(device->read(LOG_OFFSET, start, sizeof(start)));
+            CHECK(device->write(LOG_OFFSET + 5 * RECORD_SIZE, start, sizeof(start)));
+        }
+
+        uint32_t generation;
+
+        {
+            journal store(open_device(), 0);
+            const auto statistics = store.get_statistics();
+
+            CHECK(read_state(store, 5).size() == 5);
+            CHECK(statistics.torn_records == 1);
+            CHECK(statistics.log_used == 0);
+
+            generation = statistics.generation;
+
+            // Lands in a fresh log, not on the torn bytes.
+            CHECK(store.store(key(5).c_str(), uint64_t(5)));
+            CHECK(store.commit());
+        }
+
+        journal store(open_device(), 0);
+
+        CHECK(read_state(store, 6).size() == 6);
+        CHECK(store.get_statistics().torn_records == 0);
+        CHECK(store.get_statistics().generation == generation);
+    }
+
+    void test_stale_records()
+    {
+        remove_device();
+
+        {
+            journal store(open_device(), 0);
+
+            // Fills the first log sector and half the second one.
+            for (uint32_t i = 0; i < 200; i++)
+            {
+                CHECK(store.store(key(0).c_str(), uint64_t(i)));
+                CHECK(store.commit());
+            }
+
+            CHECK(store.store(key(0).c_str(), uint64_t(500)));
+            CHECK(store.checkpoint());
+
+            // The new generation ends exactly where the records of the old one go on.
+            for (uint32_t i = 0; i < SECTOR_SIZE / RECORD_SIZE; i++)
+            {
+                CHECK(store.store(key(1).c_str(), uint64_t(i)));
+                CHECK(store.commit());
+            }
+
+            CHECK(store.get_statistics().log_used == SECTOR_SIZE);
+        }
+
+        journal store(open_device(), 0);
+
+        CHECK(read_state(store, 2) == (state{{key(0), 500}, {key(1), SECTOR_SIZE / RECORD_SIZE - 1}}));
+        CHECK(store.get_statistics().log_used == SECTOR_SIZE);
+        CHECK(store.get_statistics().torn_records == 0);
+    }
+
+    // Power cuts while a checkpoint is written: in the slot erase, in the data, between the
+    // data and the header, and in the header.
+    void test_checkpoint_cut()
+    {
+        const state committed = {{key(0), 1}, {key(1), 2}, {key(2), 3}};
+
+        remove_device();
+
+        {
+            journal store(open_device(), 0);
+
+            for (const auto &[name, value] : committed)
+                CHECK(store.store(name.c_str(), value));
+
+            CHECK(store.commit());
+        }
+
+        const auto image = save_device();
+        const uint32_t generation = journal(open_device(), 0).get_statistics().generation;
+
+        for (size_t budget : {SLOT_SIZE - 1, SLOT_SIZE + 30, SLOT_SIZE + 3 * ENTRY_SIZE, SLOT_SIZE + 3 * ENTRY_SIZE + 10})
+        {
+            restore_device(image);
+
+            {
+                journal store(std::make_unique<host_test::power_cut_flash_device>(open_device(), budget), 0);
+
+                CHECK(store.store(key(0).c_str(), uint64_t(100)));
+                CHECK(!store.checkpoint());
+            }
+
+            {
+                journal store(open_device(), 0);
+
+                CHECK(read_state(store, 3) == committed);
+                CHECK(store.get_statistics().generation == generation);
+
+                CHECK(store.store(key(3).c_str(), uint64_t(4)));
+                CHECK(store.checkpoint());
+            }
+
+            journal store(open_device(), 0);
+            state expected = committed;
+
+            expected[key(3)] = 4;
+
+            CHECK(read_state(store, 4) == expected);
+            CHECK(store.get_statistics().generation == generation + 1);
+        }
+    }
+
+    // Cuts the power at every point of a run of commits that fills the log several times, so
+    // records, log erases and checkpoints are all hit. Every key comes back either as it was
+    // after the last commit that succeeded or as the commit in flight would have left it.
+    void test_power_cut()
+    {
+        constexpr uint32_t KEYS = 6;
+        constexpr uint32_t COMMITS = 150;
+
+        for (size_t budget = 0;; budget += 89)
+        {
+            state durable, in_flight;
+            bool cut;
+
+            remove_device();
+
+            {
+                auto device = std::make_unique<host_test::power_cut_flash_device>(open_device(), budget);
+                auto &power = *device;
+                journal store(std::move(device), 0);
+
+                for (uint32_t commit = 0; commit < COMMITS && !power.is_cut(); commit++)
+                {
+                    in_flight = durable;
+
+                    for (uint32_t i = 0; i < 3; i++)
+                    {
+                        const std::string name = key((commit + i) % KEYS);
+
+                        CHECK(store.store(name.c_str(), uint64_t(commit * 10 + i)));
+                        in_flight[name] = commit * 10 + i;
+                    }
+
+                    if (commit % 5 == 4 && in_flight.erase(key(commit % KEYS)))
+                        CHECK(store.remove(key(commit % KEYS).c_str()));
+
+                    if (!store.commit())
+                        break;
+
+                    durable = in_flight;
+                }
+
+                cut = power.is_cut();
+            }
+
+            state recovered;
+
+            {
+                journal store(open_device(), 0);
+
+                recovered = read_state(store, KEYS);
+
+                for (uint32_t i = 0; i < KEYS; i++)
+                {
+                    const auto was = durable.find(key(i)), would_be = in_flight.find(key(i)), is = recovered.find(key(i));
+                    auto same = [&](state::const_iterator it, const state &from)
+                    {
+                        return it == from.end() ? is == recovered.end() : is != recovered.end() && is->second == it->second;
+                    };
+
+                    CHECK(same(was, durable) || same(would_be, in_flight));
+                }
+
+                CHECK(store.store(key(KEYS).c_str(), uint64_t(budget)));
+                CHECK(store.commit());
+            }
+
+            journal store(open_device(), 0);
+
+            recovered[key(KEYS)] = budget;
+
+            CHECK(read_state(store, KEYS + 1) == recovered);
+
+            if (!cut)
+                break;
+        }
+    }
+}
+
+int main()
+{
+    char directory[] = "/tmp/journal_XXXXXX";
+
+    if (!mkdtemp(directory))
+        return EXIT_FAILURE;
+
+    s_path = std::string(directory) + "/journal.bin";
+
+    test_recovery();
+    test_torn_record();
+    test_stale_records();
+    test_checkpoint_cut();
+    test_power_cut();
+
+    remove_device();
+    rmdir(directory);
+
+    return CHECK_RESULT();
+}
@@ -0,0 +1,200 @@
+#include "check.h"
+
+#include "hardware/ota_delta.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace hardware;
+
+namespace
+{
+    constexpr size_t IMAGE_SIZE = 96 * 1024;
+    constexpr size_t SECTOR_SIZE = 4096;
+
+    std::string s_directory;
+
+    // The patch as it would come off the network, in uneven pieces.
+    class file_source : public ota::source
+    {
+    public:
+        explicit file_source(const std::string &path) : m_path(path)
+        {
+        }
+
+        ~file_source() override
+        {
+            if (mp_file)
+                fclose(mp_file);
+        }
+
+        bool open(size_t &total) override
+        {
+            mp_file = fopen(m_path.c_str(), "rb");
+
+            if (!mp_file)
+                return false;
+
+            fseek(mp_file, 0, SEEK_END);
+            total = ftell(mp_file);
+            fseek(mp_file, 0, SEEK_SET);
+
+            return true;
+        }
+
+        ssize_t read(uint8_t *data, size_t size) override
+        {
+            return fread(data, 1, std::min<size_t>(size, 1000), mp_file);
+        }
+
+    private:
+        std::string m_path;
+        FILE *mp_file = nullptr;
+    };
+
+    std::string path(const char *name)
+    {
+        return s_directory + "/" + name;
+    }
+
+    void save(const std::string &name, const std::vector<uint8_t> &data)
+    {
+        FILE *file = fopen(name.c_str(), "wb");
+
+        CHECK(file && fwrite(data.data(), 1, data.size(), file) == data.size());
+
+        if (file)
+            fclose(file);
+    }
+
+    bool make_patch(const std::string &base, const std::string &target, const std::string &patch)
+    {
+        const std::string command = "python3 " MAKE_DELTA " create " + base + " " + target + " " + patch + " > /dev/null";
+
+        return !std::system(command.c_str());
+    }
+
+    // A firmware update in miniature: code that stays, code that moved with its addresses
+    // rewritten, and code that is new.
+    void make_images(std::vector<uint8_t> &base, std::vector<uint8_t> &target)
+    {
+        std::mt19937 random(1);
+
+        base.resize(IMAGE_SIZE);
+
+        for (auto &byte : base)
+            byte = random();
+
+        target.assign(base.begin(), base.begin() + IMAGE_SIZE / 4);
+
+        for (size_t i = 0; i < 3000; i++)
+            target.push_back(random());
+
+        for (size_t i = IMAGE_SIZE / 4; i < IMAGE_SIZE / 2; i++)
+            target.push_back(i % 61 ? base[i] : base[i] + 4);
+
+        target.insert(target.end(), base.begin() + IMAGE_SIZE / 2, base.end() - 1000);
+    }
+
+    // Patches the base held in a file backed partition and returns what came out.
+    bool apply(const std::string &base, const std::string &patch, std::vector<uint8_t> &output)
+    {
+        ota::delta_source delta(std::make_unique<file_source>(patch), storage::make_file_flash_device(base.c_str(), IMAGE_SIZE, SECTOR_SIZE));
+        size_t total = 0;
+
+        output.clear();
+
+        if (!delta.open(total))
+            return false;
+
+        uint8_t chunk[777];
+
+        for (;;)
+        {
+            const ssize_t count = delta.read(chunk, sizeof(chunk));
+
+            if (count < 0)
+                return false;
+
+            if (!count)
+                return output.size() == total;
+
+            output.insert(output.end(), chunk, chunk + count);
+        }
+    }
+
+    void test_apply()
+    {
+        std::vector<uint8_t> base, target, output;
+
+        make_images(base, target);
+        save(path("base.bin"), base);
+        save(path("target.bin"), target);
+
+        CHECK(make_patch(path("base.bin"), path("target.bin"), path("update.patch")));
+        CHECK(apply(path("base.bin"), path("update.patch"), output));
+        CHECK(output == target);
+    }
+
+    void test_different_base()
+    {
+        std::vector<uint8_t> base, target, output;
+
+        make_images(base, target);
+
+        base[IMAGE_SIZE - 1] ^= 1;
+        save(path("other.bin"), base);
+
+        CHECK(!apply(path("other.bin"), path("update.patch"), output));
+        CHECK(output.empty());
+    }
+
+    void test_corrupted_patch()
+    {
+        std::vector<uint8_t> patch;
+        FILE *file = fopen(path("update.patch").c_str(), "rb");
+        int byte;
+
+        while (file && (byte = fgetc(file)) != EOF)
+            patch.push_back(byte);
+
+        if (file)
+            fclose(file);
+
+        // Whatever the last byte encodes, the patch either stops parsing or the image comes
+        // out wrong and the final hash catches it.
+        CHECK(patch.size() > 80);
+        patch.back() ^= 0x80;
+        save(path("corrupted.patch"), patch);
+
+        std::vector<uint8_t> output;
+
+        CHECK(!apply(path("base.bin"), path("corrupted.patch"), output));
+    }
+}
+
+int main()
+{
+    char directory[] = "/tmp/ota_delta_XXXXXX";
+
+    if (!mkdtemp(directory))
+        return EXIT_FAILURE;
+
+    s_directory = directory;
+
+    test_apply();
+    test_different_base();
+    test_corrupted_patch();
+
+    for (const char *name : {"base.bin", "target.bin", "other.bin", "update.patch", "corrupted.patch"})
+        unlink(path(name).c_str());
+
+    rmdir(directory);
+
+    return CHECK_RESULT();
+}
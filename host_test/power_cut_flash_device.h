@@ -0,0 +1,78 @@
+#pragma once
+
+#include "hardware/flash_device.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace host_test
+{
+    // Loses power after a budget of programmed bytes and erased sectors. The write that runs
+    // out programs only the bytes that fit, an erase that does not fit leaves the sector as it
+    // was, and after that every call fails as if the chip were gone.
+    class power_cut_flash_device : public hardware::storage::flash_device
+    {
+    public:
+        power_cut_flash_device(std::unique_ptr<hardware::storage::flash_device> device, size_t budget)
+            : mp_device(std::move(device)), m_budget(budget)
+        {
+        }
+
+        size_t size() const override
+        {
+            return mp_device->size();
+        }
+
+        size_t sector_size() const override
+        {
+            return mp_device->sector_size();
+        }
+
+        bool is_cut() const
+        {
+            return m_cut;
+        }
+
+        bool read(size_t offset, void *data, size_t size) override
+        {
+            return !m_cut && mp_device->read(offset, data, size);
+        }
+
+        bool write(size_t offset, const void *data, size_t size) override
+        {
+            if (m_cut)
+                return false;
+
+            const size_t programmed = std::min(size, m_budget);
+
+            m_budget -= programmed;
+
+            if (programmed < size)
+                m_cut = true;
+
+            return mp_device->write(offset, data, programmed) && !m_cut;
+        }
+
+        bool erase(size_t offset, size_t size) override
+        {
+            // An erase costs as much as a sector of programming.
+            if (m_cut || m_budget < size)
+            {
+                m_cut = true;
+
+                return false;
+            }
+
+            m_budget -= size;
+
+            return mp_device->erase(offset, size);
+        }
+
+    private:
+        std::unique_ptr<hardware::storage::flash_device> mp_device;
+        size_t m_budget;
+        bool m_cut = false;
+    };
+}
@@ -0,0 +1,264 @@
+#include "check.h"
+#include "power_cut_flash_device.h"
+
+#include "hardware/ring_log.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace hardware::storage;
+
+namespace
+{
+    constexpr size_t SECTORS = 6;
+    constexpr size_t SECTOR_SIZE = 4096;
+    // Slot 0 of every sector holds the header.
+    constexpr uint32_t RECORDS_PER_SECTOR = SECTOR_SIZE / ring_log::RECORD_SIZE - 1;
+
+    std::string s_path;
+
+    std::unique_ptr<flash_device> open_device()
+    {
+        return make_file_flash_device(s_path.c_str(), SECTORS * SECTOR_SIZE, SECTOR_SIZE);
+    }
+
+    void remove_device()
+    {
+        unlink(s_path.c_str());
+    }
+
+    uint64_t timestamp_of(uint32_t index)
+    {
+        return 100 + index * 10ULL;
+    }
+
+    // Record n carries its own index, so what comes back can be checked without a copy.
+    bool append(ring_log &log, uint32_t index)
+    {
+        uint8_t payload[ring_log::PAYLOAD_SIZE];
+
+        for (size_t i = 0; i < sizeof(payload); i++)
+            payload[i] = index * 7 + i;
+
+        return log.append(index & 0xffff, payload, 4 + index % 32, timestamp_of(index));
+    }
+
+    bool is_intact(const ring_log::entry &record)
+    {
+        if (record.type != (record.sequence & 0xffff) || record.size != 4 + record.sequence % 32 || record.timestamp != timestamp_of(record.sequence))
+            return false;
+
+        for (size_t i = 0; i < record.size; i++)
+            if (record.data[i] != static_cast<uint8_t>(record.sequence * 7 + i))
+                return false;
+
+        return true;
+    }
+
+    std::vector<ring_log::entry> read_all(ring_log &log)
+    {
+        std::vector<ring_log::entry> records;
+        ring_log::entry record;
+
+        for (ring_log::cursor position = log.begin(); log.read(position, record);)
+            records.push_back(record);
+
+        return records;
+    }
+
+    // Every record is intact and they follow each other without a gap.
+    bool is_run(const std::vector<ring_log::entry> &records)
+    {
+        for (size_t i = 0; i < records.size(); i++)
+            if (!is_intact(records[i]) || records[i].sequence != records[0].sequence + i)
+                return false;
+
+        return true;
+    }
+
+    uint32_t seek(ring_log &log, uint64_t timestamp)
+    {
+        ring_log::cursor position;
+        ring_log::entry record;
+
+        if (!log.seek(timestamp, position) || !log.read(position, record))
+            return UINT32_MAX;
+
+        return record.sequence;
+    }
+
+    void test_recovery()
+    {
+        remove_device();
+
+        {
+            ring_log log(open_device());
+
+            for (uint32_t i = 0; i < 100; i++)
+                CHECK(append(log, i));
+
+            CHECK(log.flush());
+        }
+
+        ring_log log(open_device());
+        auto records = read_all(log);
+
+        CHECK(records.size() == 100);
+        CHECK(is_run(records));
+        CHECK(!records.empty() && records[0].sequence == 0);
+
+        // Numbering goes on where it stopped.
+        CHECK(append(log, 100));
+        CHECK(log.flush());
+
+        records = read_all(log);
+
+        CHECK(records.size() == 101);
+        CHECK(is_run(records));
+    }
+
+    void test_wraparound()
+    {
+        constexpr uint32_t COUNT = SECTORS * RECORDS_PER_SECTOR * 3 + 17;
+
+        remove_device();
+
+        {
+            ring_log log(open_device());
+
+            for (uint32_t i = 0; i < COUNT; i++)
+                CHECK(append(log, i));
+        }
+
+        ring_log log(open_device());
+        const auto records = read_all(log);
+
+        // The oldest sector is erased to make room, everything younger survives.
+        CHECK(records.size() >= (SECTORS - 1) * RECORDS_PER_SECTOR);
+        CHECK(records.size() <= SECTORS * RECORDS_PER_SECTOR);
+        CHECK(is_run(records));
+        CHECK(!records.empty() && records.back().sequence == COUNT - 1);
+        CHECK(log.get_statistics().used_sectors == SECTORS);
+    }
+
+    void test_seek()
+    {
+        constexpr uint32_t COUNT = 4 * RECORDS_PER_SECTOR;
+
+        remove_device();
+
+        ring_log log(open_device());
+
+        for (uint32_t i = 0; i < COUNT; i++)
+            CHECK(append(log, i));
+
+        CHECK(log.flush());
+
+        CHECK(seek(log, 0) == 0);
+        CHECK(seek(log, timestamp_of(70) - 5) == 70);
+        CHECK(seek(log, timestamp_of(RECORDS_PER_SECTOR)) == RECORDS_PER_SECTOR);
+        CHECK(seek(log, timestamp_of(COUNT - 1)) == COUNT - 1);
+        CHECK(seek(log, timestamp_of(COUNT)) == UINT32_MAX);
+
+        // The next record opens a sector whose header waits in the batch with it, the search
+        // must not stop there.
+        CHECK(append(log, COUNT));
+        CHECK(seek(log, timestamp_of(COUNT - 20)) == COUNT - 20);
+    }
+
+    void test_corrupt_header()
+    {
+        // Left behind by test_seek: sector 2 holds the third sector's worth of records.
+        {
+            auto device = open_device();
+            const uint8_t zeros[16] = {};
+
+            CHECK(device->write(2 * SECTOR_SIZE, zeros, sizeof(zeros)));
+        }
+
+        ring_log log(open_device());
+
+        CHECK(seek(log, timestamp_of(RECORDS_PER_SECTOR + 30)) == RECORDS_PER_SECTOR + 30);
+        CHECK(seek(log, timestamp_of(2 * RECORDS_PER_SECTOR + 30)) == 2 * RECORDS_PER_SECTOR + 30);
+        CHECK(seek(log, timestamp_of(3 * RECORDS_PER_SECTOR + 30)) == 3 * RECORDS_PER_SECTOR + 30);
+
+        // The records behind the broken header are still there for readers.
+        const auto records = read_all(log);
+
+        CHECK(records.size() == 4 * RECORDS_PER_SECTOR + 1);
+        CHECK(is_run(records));
+    }
+
+    // Cuts the power at every point of a run that fills three sectors in torn batches, headers
+    // and erases included. What was flushed survives, and the log goes on after what is left.
+    void test_power_cut()
+    {
+        constexpr uint32_t COUNT = 3 * RECORDS_PER_SECTOR;
+        constexpr size_t MAX_BUDGET = 3 * SECTOR_SIZE + (COUNT + 3) * ring_log::RECORD_SIZE;
+
+        for (size_t budget = 0; budget <= MAX_BUDGET; budget += 97)
+        {
+            uint32_t durable = 0;
+
+            remove_device();
+
+            {
+                auto device = std::make_unique<host_test::power_cut_flash_device>(open_device(), budget);
+                auto &power = *device;
+                ring_log log(std::move(device), 4);
+
+                for (uint32_t i = 0; i < COUNT && !power.is_cut(); i++)
+                {
+                    if (!append(log, i))
+                        break;
+
+                    if (i % 5 == 4 && log.flush())
+                        durable = i + 1;
+                }
+            }
+
+            ring_log log(open_device(), 4);
+            auto records = read_all(log);
+            const size_t recovered = records.size();
+
+            CHECK(recovered >= durable);
+            CHECK(is_run(records));
+            CHECK(records.empty() || records[0].sequence == 0);
+
+            for (uint32_t i = 0; i < 3; i++)
+                CHECK(append(log, recovered + i));
+
+            CHECK(log.flush());
+
+            records = read_all(log);
+
+            CHECK(records.size() == recovered + 3);
+            CHECK(is_run(records));
+        }
+    }
+}
+
+int main()
+{
+    char directory[] = "/tmp/ring_log_XXXXXX";
+
+    if (!mkdtemp(directory))
+        return EXIT_FAILURE;
+
+    s_path = std::string(directory) + "/log.bin";
+
+    test_recovery();
+    test_wraparound();
+    test_seek();
+    test_corrupt_header();
+    test_power_cut();
+
+    remove_device();
+    rmdir(directory);
+
+    return CHECK_RESULT();
+}
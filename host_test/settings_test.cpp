@@ -0,0 +1,179 @@
+#include "check.h"
+
+#include "hardware/settings.h"
+
+#include <esp_timer.h>
+
+using namespace hardware::storage;
+
+namespace
+{
+    constexpr uint32_t DEBOUNCE_MS = 100;
+
+    constexpr setting<uint8_t> VOLUME{"volume", 5};
+    constexpr setting<int32_t> OFFSET{"offset", -1};
+    constexpr setting<text<15>> NAME{"name", "device"};
+
+    using store = settings<VOLUME, OFFSET, NAME>;
+
+    // Lets a test look at the values after the store that owned the backend is gone.
+    class forwarding_backend : public settings_backend
+    {
+    public:
+        explicit forwarding_backend(settings_backend &target) : m_target(target)
+        {
+        }
+
+        bool read(const char *key, value_kind kind, void *value, size_t size) override
+        {
+            return m_target.read(key, kind, value, size);
+        }
+
+        bool write(const char *key, value_kind kind, const void *value) override
+        {
+            return m_target.write(key, kind, value);
+        }
+
+        bool commit() override
+        {
+            return m_target.commit();
+        }
+
+    private:
+        settings_backend &m_target;
+    };
+
+    void test_lazy_load()
+    {
+        auto backend = std::make_unique<memory_settings_backend>();
+        auto &memory = *backend;
+        const uint8_t stored = 9;
+
+        CHECK(memory.write("volume", value_kind::u8, &stored));
+
+        store values(std::move(backend), DEBOUNCE_MS);
+
+        // Only the wear counter is read up front.
+        CHECK(memory.get_statistics().reads == 1);
+        CHECK(values.get_statistics().loads == 0);
+
+        CHECK(values.get<VOLUME>() == 9);
+        CHECK(values.get<VOLUME>() == 9);
+        CHECK(memory.get_statistics().reads == 2);
+        CHECK(values.get_statistics().loads == 1);
+
+        // Missing values come from the defaults and are not written back.
+        CHECK(values.get<OFFSET>() == -1);
+        CHECK(!strcmp(values.get<NAME>(), "device"));
+        CHECK(memory.get_statistics().reads == 4);
+        CHECK(values.get_statistics().loads == 3);
+
+        host_test::advance_time(10 * DEBOUNCE_MS * 1000);
+        CHECK(memory.get_statistics().writes == 1);
+    }
+
+    void test_unchanged_values_are_skipped()
+    {
+        auto backend = std::make_unique<memory_settings_backend>();
+        auto &memory = *backend;
+        store values(std::move(backend), DEBOUNCE_MS);
+
+        values.set<VOLUME>(5);
+        values.set<NAME>("device");
+        values.set<NAME>("device with a name that is too long");
+        values.set<NAME>("device with a n");
+
+        host_test::advance_time(10 * DEBOUNCE_MS * 1000);
+
+        // The last set equals the truncated text stored before it.
+        CHECK(values.get_statistics().skipped_writes == 3);
+        CHECK(values.get_statistics().writes == 1);
+        CHECK(!strcmp(values.get<NAME>(), "device with a n"));
+        CHECK(memory.get_statistics().writes == 2);
+    }
+
+    void test_debounce()
+    {
+        auto backend = std::make_unique<memory_settings_backend>();
+        auto &memory = *backend;
+        store values(std::move(backend), DEBOUNCE_MS);
+
+        values.set<VOLUME>(1);
+        host_test::advance_time(DEBOUNCE_MS * 1000 / 2);
+        values.set<VOLUME>(2);
+        values.set<OFFSET>(40);
+        host_test::advance_time(DEBOUNCE_MS * 1000 / 2 - 1);
+
+        CHECK(memory.get_statistics().writes == 0);
+
+        // One commit for everything changed in the window, the wear counter included.
+        host_test::advance_time(1);
+
+        CHECK(memory.get_statistics().writes == 3);
+        CHECK(memory.get_statistics().commits == 1);
+        CHECK(values.get_statistics().writes == 2);
+        CHECK(values.get_statistics().commits == 1);
+        CHECK(values.get_statistics().lifetime_writes == 3);
+
+        uint8_t volume = 0;
+
+        CHECK(memory.read("volume", value_kind::u8, &volume, sizeof(volume)));
+        CHECK(volume == 2);
+
+        // Nothing dirty, nothing written.
+        values.flush();
+        CHECK(memory.get_statistics().writes == 3);
+    }
+
+    void test_failed_write_is_retried()
+    {
+        memory_settings_backend memory;
+
+        {
+            store values(std::make_unique<forwarding_backend>(memory), DEBOUNCE_MS);
+
+            memory.set_failing(true);
+            values.set<OFFSET>(12);
+            host_test::advance_time(2 * DEBOUNCE_MS * 1000);
+
+            CHECK(!memory.contains("offset"));
+            CHECK(values.get_statistics().commits == 0);
+
+            memory.set_failing(false);
+            values.flush();
+
+            CHECK(memory.contains("offset"));
+            CHECK(values.get_statistics().commits == 1);
+
+            // Whatever is pending when the store goes away is written on the way out.
+            values.set<NAME>("kitchen");
+
+            CHECK(!memory.contains("name"));
+        }
+
+        CHECK(memory.contains("name"));
+    }
+
+    void test_without_debounce()
+    {
+        auto backend = std::make_unique<memory_settings_backend>();
+        auto &memory = *backend;
+        store values(std::move(backend), 0);
+
+        values.set<VOLUME>(7);
+
+        CHECK(memory.contains("volume"));
+        CHECK(memory.get_statistics().commits == 1);
+    }
+}
+
+int main()
+{
+    test_lazy_load();
+    test_unchanged_values_are_skipped();
+    test_debounce();
+    test_failed_write_is_retried();
+    test_without_debounce();
+
+    return CHECK_RESULT();
+}
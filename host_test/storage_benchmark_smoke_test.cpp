@@ -0,0 +1,268 @@
+#include "check.h"
+
+#include "hardware/encryption.h"
+#include "hardware/storage_benchmark.h"
+
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace hardware::storage;
+
+// Checks the benchmark harness on Linux, not the storage: the files go to a temporary directory
+// on the host's file system and NVS is an in-memory map, so the numbers it prints say nothing
+// about LittleFS or NVS on flash. Only runs on the device can guide cache and block sizes.
+int64_t esp_timer_get_time()
+{
+    timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+namespace
+{
+    constexpr size_t PARTITION_SIZE = 1024 * 1024;
+
+    std::string s_directory;
+    mount_options s_mounted_with = {};
+    int s_mounts = 0;
+    bool s_mount_fails = false;
+
+    size_t directory_size(const std::string &path)
+    {
+        size_t total = 0;
+        DIR *directory = opendir(path.c_str());
+
+        if (!directory)
+            return 0;
+
+        while (const dirent *entry = readdir(directory))
+        {
+            if (entry->d_name[0] == '.')
+                continue;
+
+            const std::string child = path + "/" + entry->d_name;
+            struct stat info;
+
+            if (lstat(child.c_str(), &info))
+                continue;
+
+            if (S_ISDIR(info.st_mode))
+                total += directory_size(child);
+            else if (S_ISREG(info.st_mode))
+                total += info.st_size;
+        }
+
+        closedir(directory);
+
+        return total;
+    }
+}
+
+namespace hardware
+{
+    namespace storage
+    {
+        std::shared_future<bool> mount(const type storage_type, const char *mount_point, const mount_options &options)
+        {
+            std::promise<bool> result;
+
+            s_mounted_with = options;
+            s_mounts++;
+
+            result.set_value(!s_mount_fails);
+
+            return result.get_future().share();
+        }
+
+        void unmount(const type storage_type)
+        {
+        }
+
+        bool wait(const type storage_type, uint32_t timeout_ms)
+        {
+            return !s_mount_fails;
+        }
+
+        // A partition of PARTITION_SIZE bytes holding what the directory holds.
+        bool usage(const type storage_type, size_t &total_bytes, size_t &used_bytes)
+        {
+            total_bytes = PARTITION_SIZE;
+            used_bytes = directory_size(s_directory);
+
+            return true;
+        }
+
+        // Plain file access in place of AES, which needs mbedtls and the HMAC peripheral.
+        struct encrypted_file_implementation
+        {
+            int fd;
+        };
+
+        encrypted_file::encrypted_file(const char *path, mode open_mode, const uint8_t (&key)[ENCRYPTION_KEY_SIZE])
+            : mp_implementation(std::make_unique<encrypted_file_implementation>())
+        {
+            mp_implementation->fd = open(path, open_mode == mode::read ? O_RDONLY : O_RDWR | O_CREAT, 0644);
+        }
+
+        encrypted_file::~encrypted_file()
+        {
+            close();
+        }
+
+        bool encrypted_file::is_open()
+        {
+            return mp_implementation->fd >= 0;
+        }
+
+        size_t encrypted_file::read(uint64_t offset, void *data, size_t size)
+        {
+            const ssize_t count = pread(mp_implementation->fd, data, size, offset);
+
+            return count > 0 ? count : 0;
+        }
+
+        size_t encrypted_file::write(uint64_t offset, const void *data, size_t size)
+        {
+            const ssize_t count = pwrite(mp_implementation->fd, data, size, offset);
+
+            return count > 0 ? count : 0;
+        }
+
+        bool encrypted_file::close()
+        {
+            if (mp_implementation->fd < 0)
+                return true;
+
+            const bool closed = !::close(mp_implementation->fd);
+
+            mp_implementation->fd = -1;
+
+            return closed;
+        }
+    }
+}
+
+namespace
+{
+    benchmark::options make_options()
+    {
+        benchmark::options opts = benchmark::DEFAULT_OPTIONS;
+
+        opts.mount_point = s_directory.c_str();
+        opts.file_size = 64 * 1024;
+        opts.block_size = 4096;
+        opts.small_files = 8;
+        opts.fsync_iterations = 4;
+        opts.nvs_entries = 16;
+        opts.mount = {
+            .format_if_failed = false,
+            .grow = false,
+            .read_only = false,
+            .deferred = true,
+        };
+
+        return opts;
+    }
+
+    void test_run()
+    {
+        const benchmark::options opts = make_options();
+
+        s_mounts = 0;
+
+        const benchmark::results result = benchmark::run(opts);
+
+        benchmark::print(result);
+
+        // The mount time is taken with the options under test.
+        CHECK(s_mounts == 2);
+        CHECK(!s_mounted_with.format_if_failed);
+        CHECK(s_mounted_with.deferred);
+
+        CHECK(result.sequential_write.bytes == opts.file_size);
+        CHECK(result.sequential_read.bytes == opts.file_size);
+        CHECK(result.random_write.bytes == opts.file_size);
+        CHECK(result.random_read.bytes == opts.file_size);
+        CHECK(result.encrypted_write.bytes == opts.file_size);
+        CHECK(result.encrypted_read.bytes == opts.file_size);
+        CHECK(result.file_create.count == opts.small_files);
+        CHECK(result.file_delete.count == opts.small_files);
+        CHECK(result.fsync.count == opts.fsync_iterations);
+        CHECK(result.nvs_get.count == opts.nvs_entries);
+
+        // Nothing but the filler is left behind.
+        CHECK(directory_size(s_directory) == 0);
+    }
+
+    void test_fill()
+    {
+        benchmark::options opts = make_options();
+
+        opts.fill_percent = 50;
+
+        const benchmark::results result = benchmark::run(opts);
+
+        CHECK(result.fill_percent == 50);
+        CHECK(directory_size(s_directory) == PARTITION_SIZE / 2);
+
+        benchmark::remove(opts);
+
+        CHECK(directory_size(s_directory) == 0);
+    }
+
+    void test_failed_writes()
+    {
+        const benchmark::options opts = make_options();
+        const std::string path = s_directory + "/bench_seq";
+
+        // Every write to /dev/full fails with ENOSPC, which used to add -1 to the byte counts.
+        CHECK(!symlink("/dev/full", path.c_str()));
+
+        const benchmark::results result = benchmark::run(opts);
+
+        CHECK(result.sequential_write.bytes == 0);
+        CHECK(result.sequential_read.bytes == 0);
+        CHECK(result.random_write.bytes == 0);
+
+        unlink(path.c_str());
+    }
+
+    void test_failed_mount()
+    {
+        s_mount_fails = true;
+
+        const benchmark::results result = benchmark::run(make_options());
+
+        CHECK(result.sequential_write.bytes == 0);
+        CHECK(result.file_create.count == 0);
+
+        s_mount_fails = false;
+    }
+}
+
+int main()
+{
+    char directory[] = "/tmp/storage_benchmark_XXXXXX";
+
+    if (!mkdtemp(directory))
+        return EXIT_FAILURE;
+
+    s_directory = directory;
+
+    test_run();
+    test_fill();
+    test_failed_writes();
+    test_failed_mount();
+
+    rmdir(directory);
+
+    return CHECK_RESULT();
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+
+// Aborts like the real one, a failed call in a test is a bug in the test or the stubs.
+#define ESP_ERROR_CHECK(x)                                                                   \
+    do                                                                                       \
+    {                                                                                        \
+        const esp_err_t error_check = (x);                                                   \
+                                                                                             \
+        if (error_check != ESP_OK)                                                           \
+        {                                                                                    \
+            std::fprintf(stderr, "%s:%d: %s returned %d\n", __FILE__, __LINE__, #x, error_check); \
+            std::abort();                                                                    \
+        }                                                                                    \
+    } while (0)
+
+inline const char *esp_err_to_name(esp_err_t error)
+{
+    return error == ESP_OK ? "ESP_OK" : "error";
+}
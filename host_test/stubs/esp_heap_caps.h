@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+
+// Every allocation is internal and DMA capable on the host.
+#define MALLOC_CAP_DMA (1 << 3)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+inline void *heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps)
+{
+    return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+inline void heap_caps_free(void *data)
+{
+    free(data);
+}
@@ -0,0 +1,21 @@
+#include "esp_partition.h"
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+    return nullptr;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset, void *data, size_t size)
+{
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t offset, const void *data, size_t size)
+{
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    return ESP_ERR_NOT_FOUND;
+}
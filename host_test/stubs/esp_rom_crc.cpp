@@ -0,0 +1,16 @@
+#include "esp_rom_crc.h"
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    crc = ~crc;
+
+    while (len--)
+    {
+        crc ^= *buf++;
+
+        for (int bit = 0; bit < 8; bit++)
+            crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+    }
+
+    return ~crc;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <cstdint>
+
+// The ROM CRC-32 (IEEE 802.3, reflected), with the same inversion of seed and result.
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
@@ -0,0 +1,110 @@
+#include "esp_timer.h"
+
+#include <algorithm>
+#include <vector>
+
+struct esp_timer
+{
+    esp_timer_create_args_t args;
+    int64_t due;
+    uint64_t period;
+    bool active;
+};
+
+namespace
+{
+    int64_t s_now = 0;
+    std::vector<esp_timer *> s_timers;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle)
+{
+    *handle = new esp_timer{*args, 0, 0, false};
+
+    s_timers.push_back(*handle);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    if (timer->active)
+        return ESP_ERR_INVALID_STATE;
+
+    *timer = {timer->args, s_now + static_cast<int64_t>(timeout_us), 0, true};
+
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us)
+{
+    if (timer->active)
+        return ESP_ERR_INVALID_STATE;
+
+    *timer = {timer->args, s_now + static_cast<int64_t>(period_us), period_us, true};
+
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (!timer->active)
+        return ESP_ERR_INVALID_STATE;
+
+    timer->active = false;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    if (timer->active)
+        return ESP_ERR_INVALID_STATE;
+
+    s_timers.erase(std::find(s_timers.begin(), s_timers.end(), timer));
+
+    delete timer;
+
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    return timer->active;
+}
+
+int64_t esp_timer_get_time()
+{
+    return s_now;
+}
+
+namespace host_test
+{
+    void advance_time(int64_t us)
+    {
+        const int64_t end = s_now + us;
+
+        while (true)
+        {
+            esp_timer *next = nullptr;
+
+            for (auto timer : s_timers)
+                if (timer->active && timer->due <= end && (!next || timer->due < next->due))
+                    next = timer;
+
+            if (!next)
+                break;
+
+            s_now = next->due;
+
+            if (next->period)
+                next->due += next->period;
+            else
+                next->active = false;
+
+            next->args.callback(next->args.arg);
+        }
+
+        s_now = end;
+    }
+}
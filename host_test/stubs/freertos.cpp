@@ -0,0 +1,57 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+struct semaphore
+{
+    bool given;
+};
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_size, void *parameters, UBaseType_t priority, TaskHandle_t *handle)
+{
+    return pdFAIL;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    return 0;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    return pdPASS;
+}
+
+// Nothing can give a semaphore while the only thread waits, so taking never blocks.
+SemaphoreHandle_t xSemaphoreCreateBinary()
+{
+    return new semaphore{false};
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait)
+{
+    const bool given = semaphore->given;
+
+    semaphore->given = false;
+
+    return given ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    if (semaphore->given)
+        return pdFALSE;
+
+    semaphore->given = true;
+
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+    delete semaphore;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+
+// Just the FreeRTOS types and macros the host-built sources use. There is no scheduler on the
+// host: tasks fail to start, so the sources fall back to doing the work in the caller.
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL pdFALSE
+#define pdPASS pdTRUE
+#define portMAX_DELAY UINT32_MAX
+#define pdMS_TO_TICKS(ms) (static_cast<TickType_t>(ms))
+#define tskIDLE_PRIORITY 0
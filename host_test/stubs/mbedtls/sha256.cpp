@@ -0,0 +1,140 @@
+#include "sha256.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    constexpr uint32_t ROUND_CONSTANTS[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+    };
+
+    uint32_t rotate(uint32_t value, int count)
+    {
+        return (value >> count) | (value << (32 - count));
+    }
+
+    void compress(mbedtls_sha256_context *context, const uint8_t *block)
+    {
+        uint32_t w[64];
+
+        for (int i = 0; i < 16; i++)
+            w[i] = uint32_t(block[4 * i]) << 24 | uint32_t(block[4 * i + 1]) << 16 | uint32_t(block[4 * i + 2]) << 8 | block[4 * i + 3];
+
+        for (int i = 16; i < 64; i++)
+        {
+            const uint32_t s0 = rotate(w[i - 15], 7) ^ rotate(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            const uint32_t s1 = rotate(w[i - 2], 17) ^ rotate(w[i - 2], 19) ^ (w[i - 2] >> 10);
+
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t s[8];
+
+        memcpy(s, context->state, sizeof(s));
+
+        for (int i = 0; i < 64; i++)
+        {
+            const uint32_t t1 = s[7] + (rotate(s[4], 6) ^ rotate(s[4], 11) ^ rotate(s[4], 25)) + ((s[4] & s[5]) ^ (~s[4] & s[6])) + ROUND_CONSTANTS[i] + w[i];
+            const uint32_t t2 = (rotate(s[0], 2) ^ rotate(s[0], 13) ^ rotate(s[0], 22)) + ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+
+            memmove(s + 1, s, 7 * sizeof(uint32_t));
+
+            s[4] += t1;
+            s[0] = t1 + t2;
+        }
+
+        for (int i = 0; i < 8; i++)
+            context->state[i] += s[i];
+    }
+}
+
+void mbedtls_sha256_init(mbedtls_sha256_context *context)
+{
+    memset(context, 0, sizeof(*context));
+}
+
+void mbedtls_sha256_free(mbedtls_sha256_context *context)
+{
+}
+
+int mbedtls_sha256_starts(mbedtls_sha256_context *context, int is224)
+{
+    static constexpr uint32_t INITIAL[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+    memcpy(context->state, INITIAL, sizeof(INITIAL));
+
+    context->length = 0;
+    context->used = 0;
+
+    return is224 ? -1 : 0;
+}
+
+int mbedtls_sha256_update(mbedtls_sha256_context *context, const unsigned char *input, size_t size)
+{
+    context->length += size;
+
+    while (size)
+    {
+        const size_t count = std::min(size, sizeof(context->block) - context->used);
+
+        memcpy(context->block + context->used, input, count);
+
+        context->used += count;
+        input += count;
+        size -= count;
+
+        if (context->used == sizeof(context->block))
+        {
+            compress(context, context->block);
+
+            context->used = 0;
+        }
+    }
+
+    return 0;
+}
+
+int mbedtls_sha256_finish(mbedtls_sha256_context *context, unsigned char output[32])
+{
+    const uint64_t bits = context->length * 8;
+    const uint8_t padding = 0x80;
+    const uint8_t zero = 0;
+
+    mbedtls_sha256_update(context, &padding, 1);
+
+    while (context->used != 56)
+        mbedtls_sha256_update(context, &zero, 1);
+
+    for (int i = 7; i >= 0; i--)
+    {
+        const uint8_t byte = bits >> (8 * i);
+
+        mbedtls_sha256_update(context, &byte, 1);
+    }
+
+    for (int i = 0; i < 8; i++)
+        for (int j = 0; j < 4; j++)
+            output[4 * i + j] = context->state[i] >> (24 - 8 * j);
+
+    return 0;
+}
+
+int mbedtls_sha256(const unsigned char *input, size_t size, unsigned char output[32], int is224)
+{
+    mbedtls_sha256_context context;
+
+    mbedtls_sha256_init(&context);
+    mbedtls_sha256_starts(&context, is224);
+    mbedtls_sha256_update(&context, input, size);
+    mbedtls_sha256_finish(&context, output);
+
+    return 0;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// The mbedtls SHA-256 calls the host-built sources make, on a plain implementation.
+typedef struct
+{
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t block[64];
+    size_t used;
+} mbedtls_sha256_context;
+
+void mbedtls_sha256_init(mbedtls_sha256_context *context);
+void mbedtls_sha256_free(mbedtls_sha256_context *context);
+int mbedtls_sha256_starts(mbedtls_sha256_context *context, int is224);
+int mbedtls_sha256_update(mbedtls_sha256_context *context, const unsigned char *input, size_t size);
+int mbedtls_sha256_finish(mbedtls_sha256_context *context, unsigned char output[32]);
+int mbedtls_sha256(const unsigned char *input, size_t size, unsigned char output[32], int is224);
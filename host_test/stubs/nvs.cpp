@@ -0,0 +1,80 @@
+#include "nvs.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace
+{
+    std::map<std::string, std::map<std::string, uint32_t>> s_namespaces;
+    std::vector<std::string> s_handles;
+
+    std::map<std::string, uint32_t> *find(nvs_handle_t handle)
+    {
+        if (!handle || handle > s_handles.size() || s_handles[handle - 1].empty())
+            return nullptr;
+
+        return &s_namespaces[s_handles[handle - 1]];
+    }
+}
+
+esp_err_t nvs_open(const char *name_space, nvs_open_mode_t open_mode, nvs_handle_t *handle)
+{
+    s_handles.push_back(name_space);
+
+    *handle = s_handles.size();
+
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    if (find(handle))
+        s_handles[handle - 1].clear();
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+    auto values = find(handle);
+
+    if (!values)
+        return ESP_ERR_INVALID_ARG;
+
+    (*values)[key] = value;
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *value)
+{
+    auto values = find(handle);
+
+    if (!values)
+        return ESP_ERR_INVALID_ARG;
+
+    const auto found = values->find(key);
+
+    if (found == values->end())
+        return ESP_ERR_NVS_NOT_FOUND;
+
+    *value = found->second;
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle)
+{
+    auto values = find(handle);
+
+    if (!values)
+        return ESP_ERR_INVALID_ARG;
+
+    values->clear();
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return find(handle) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
@@ -0,0 +1,3 @@
+#pragma once
+
+// Everything optional is off on the host, the trace macros compile to nothing.
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+struct _lv_font_t;
+
+namespace hardware
+{
+    namespace assets
+    {
+        enum class kind : uint8_t
+        {
+            blob = 0,
+            image = 1,
+            font = 2,
+        };
+
+        struct asset
+        {
+            const uint8_t *data;
+            uint32_t size;
+            kind type;
+            uint8_t format;
+            uint16_t width;
+            uint16_t height;
+        };
+
+        // Image sources starting with this prefix are resolved by the asset decoder,
+        // e.g. lv_img_set_src(img, "P:icons/wifi").
+        constexpr const char *IMAGE_PREFIX = "P:";
+
+        constexpr uint32_t hash(const char *name)
+        {
+            uint32_t value = 0x811c9dc5;
+
+            while (*name)
+                value = (value ^ static_cast<uint8_t>(*name++)) * 0x01000193;
+
+            return value ? value : 1;
+        }
+
+        bool mount();
+        void unmount();
+        bool mounted();
+
+        bool find(uint32_t name_hash, asset &result);
+        bool find(const char *name, asset &result);
+
+        const _lv_font_t *font(const char *name);
+    }
+}
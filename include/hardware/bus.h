@@ -0,0 +1,344 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+namespace hardware
+{
+    // Typed publish/subscribe between subsystems. A topic is a statically allocated object
+    // whose message type and subscriber limit are fixed at compile time, every subscriber owns
+    // a bounded lock-free queue, and publishing copies the message into each queue without
+    // locks or allocation, from tasks and ISRs on either core alike.
+    namespace bus
+    {
+        constexpr size_t DEFAULT_SUBSCRIBERS = 4;
+
+        struct statistics
+        {
+            uint32_t published;
+            uint32_t delivered;
+            // Deliveries lost to a full subscriber queue.
+            uint32_t dropped;
+        };
+
+        // Bounded queue for many producers and one consumer, after Dmitry Vyukov's. Producers
+        // claim a cell with a compare-exchange and hand it over through the cell's sequence
+        // number, so a producer interrupted halfway only makes the consumer stop early. The
+        // sequences are stored relative to the cell index, a zero initialised queue is empty.
+        template <typename T, size_t Capacity>
+        class mpsc_queue
+        {
+            static_assert(Capacity && !(Capacity & (Capacity - 1)), "capacity must be a power of two");
+            static_assert(std::is_trivially_copyable_v<T>, "messages are copied in ISRs");
+
+        public:
+            bool push(const T &value)
+            {
+                uint32_t position = m_head.load(std::memory_order_relaxed);
+                cell *target;
+
+                while (true)
+                {
+                    target = &m_cells[position & (Capacity - 1)];
+
+                    const int32_t difference = static_cast<int32_t>(sequence(*target) - position);
+
+                    if (!difference)
+                    {
+                        if (m_head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                            break;
+                    }
+                    else if (difference < 0)
+                        return false;
+                    else
+                        position = m_head.load(std::memory_order_relaxed);
+                }
+
+                target->value = value;
+                target->sequence.store(position + 1 - index(*target), std::memory_order_release);
+
+                return true;
+            }
+
+            // Only ever called by the one consumer.
+            bool pop(T &value)
+            {
+                const uint32_t position = m_tail.load(std::memory_order_relaxed);
+                cell &target = m_cells[position & (Capacity - 1)];
+
+                if (static_cast<int32_t>(sequence(target) - (position + 1)) < 0)
+                    return false;
+
+                value = target.value;
+                target.sequence.store(position + Capacity - index(target), std::memory_order_release);
+                m_tail.store(position + 1, std::memory_order_relaxed);
+
+                return true;
+            }
+
+            size_t size() const
+            {
+                const uint32_t tail = m_tail.load(std::memory_order_relaxed);
+
+                return m_head.load(std::memory_order_relaxed) - tail;
+            }
+
+        private:
+            struct cell
+            {
+                std::atomic<uint32_t> sequence;
+                T value;
+            };
+
+            uint32_t index(const cell &target) const
+            {
+                return &target - m_cells.data();
+            }
+
+            uint32_t sequence(const cell &target) const
+            {
+                return target.sequence.load(std::memory_order_acquire) + index(target);
+            }
+
+            std::array<cell, Capacity> m_cells = {};
+            std::atomic<uint32_t> m_head = 0;
+            std::atomic<uint32_t> m_tail = 0;
+        };
+
+        template <typename T>
+        class channel;
+
+        template <typename T>
+        class endpoint
+        {
+        public:
+            virtual ~endpoint() = default;
+
+            uint32_t dropped() const
+            {
+                return m_dropped.load(std::memory_order_relaxed);
+            }
+
+        protected:
+            friend class channel<T>;
+
+            virtual bool push(const T &message) = 0;
+
+            channel<T> *mp_channel = nullptr;
+            TaskHandle_t mp_task = nullptr;
+            std::atomic<uint32_t> m_dropped = 0;
+        };
+
+        // The part of a topic that does not depend on its subscriber limit, what subsystems hand out.
+        template <typename T>
+        class channel
+        {
+            static_assert(std::is_trivially_copyable_v<T>, "messages are copied in ISRs");
+
+        public:
+            using message_type = T;
+
+            channel(const channel &) = delete;
+            channel &operator=(const channel &) = delete;
+
+            const char *name() const
+            {
+                return mp_name;
+            }
+
+            // Copies the message into every subscriber's queue and notifies the subscribers
+            // that asked for it. Never blocks, returns how many queues took the message.
+            uint32_t publish(const T &message)
+            {
+                const bool in_isr = xPortInIsrContext();
+                BaseType_t woken = pdFALSE;
+                uint32_t delivered = 0;
+
+                m_publishing.fetch_add(1, std::memory_order_acquire);
+
+                for (size_t i = 0; i < m_slot_count; i++)
+                {
+                    endpoint<T> *target = mp_slots[i].load(std::memory_order_acquire);
+
+                    if (!target)
+                        continue;
+
+                    if (!target->push(message))
+                    {
+                        target->m_dropped.fetch_add(1, std::memory_order_relaxed);
+                        m_dropped.fetch_add(1, std::memory_order_relaxed);
+
+                        continue;
+                    }
+
+                    delivered++;
+
+                    if (!target->mp_task)
+                        continue;
+
+                    if (in_isr)
+                        vTaskNotifyGiveFromISR(target->mp_task, &woken);
+                    else
+                        xTaskNotifyGive(target->mp_task);
+                }
+
+                m_publishing.fetch_sub(1, std::memory_order_release);
+
+                m_published.fetch_add(1, std::memory_order_relaxed);
+                m_delivered.fetch_add(delivered, std::memory_order_relaxed);
+
+                if (in_isr)
+                    portYIELD_FROM_ISR(woken);
+
+                return delivered;
+            }
+
+            statistics get_statistics() const
+            {
+                return {m_published.load(std::memory_order_relaxed), m_delivered.load(std::memory_order_relaxed), m_dropped.load(std::memory_order_relaxed)};
+            }
+
+            bool subscribe(endpoint<T> &target, TaskHandle_t notify)
+            {
+                if (target.mp_channel)
+                    return false;
+
+                target.mp_channel = this;
+                target.mp_task = notify;
+
+                for (size_t i = 0; i < m_slot_count; i++)
+                {
+                    endpoint<T> *expected = nullptr;
+
+                    if (mp_slots[i].compare_exchange_strong(expected, &target, std::memory_order_release))
+                        return true;
+                }
+
+                target.mp_channel = nullptr;
+
+                return false;
+            }
+
+            // Waits out publishes that may still hold the subscriber, not for use in ISRs.
+            void unsubscribe(endpoint<T> &target)
+            {
+                for (size_t i = 0; i < m_slot_count; i++)
+                {
+                    endpoint<T> *expected = &target;
+
+                    mp_slots[i].compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel);
+                }
+
+                while (m_publishing.load(std::memory_order_acquire))
+                    vTaskDelay(1);
+
+                target.mp_channel = nullptr;
+            }
+
+        protected:
+            constexpr channel(const char *name, std::atomic<endpoint<T> *> *slots, size_t slot_count)
+                : mp_name(name), mp_slots(slots), m_slot_count(slot_count)
+            {
+            }
+
+        private:
+            const char *mp_name;
+            std::atomic<endpoint<T> *> *mp_slots;
+            size_t m_slot_count;
+            std::atomic<uint32_t> m_publishing = 0;
+            std::atomic<uint32_t> m_published = 0;
+            std::atomic<uint32_t> m_delivered = 0;
+            std::atomic<uint32_t> m_dropped = 0;
+        };
+
+        template <typename T, size_t Subscribers>
+        struct subscriber_slots
+        {
+            std::array<std::atomic<endpoint<T> *>, Subscribers> m_slots = {};
+        };
+
+        // Declare as constinit at namespace or function scope, the subscriber table is part of
+        // the object. The table is a base so it exists before channel is handed its address.
+        template <typename T, size_t Subscribers = DEFAULT_SUBSCRIBERS>
+        class topic : private subscriber_slots<T, Subscribers>, public channel<T>
+        {
+            static_assert(Subscribers > 0, "a topic needs room for a subscriber");
+
+        public:
+            constexpr explicit topic(const char *name) : channel<T>(name, this->m_slots.data(), Subscribers)
+            {
+            }
+        };
+
+        template <typename T, size_t Capacity>
+        class subscriber final : public endpoint<T>
+        {
+        public:
+            subscriber() = default;
+
+            ~subscriber()
+            {
+                unsubscribe();
+            }
+
+            subscriber(const subscriber &) = delete;
+            subscriber &operator=(const subscriber &) = delete;
+
+            // With a notify task every delivery gives it a task notification, which receive()
+            // with a timeout waits on. Tasks that use their notifications otherwise poll instead.
+            bool subscribe(channel<T> &source, TaskHandle_t notify = nullptr)
+            {
+                return source.subscribe(*this, notify);
+            }
+
+            void unsubscribe()
+            {
+                if (this->mp_channel)
+                    this->mp_channel->unsubscribe(*this);
+            }
+
+            // Only from the subscribing task. A timeout needs the notify task to be the caller.
+            bool receive(T &message, uint32_t timeout_ms = 0)
+            {
+                if (m_queue.pop(message))
+                    return true;
+
+                if (!timeout_ms || this->mp_task != xTaskGetCurrentTaskHandle())
+                    return false;
+
+                const TickType_t limit = timeout_ms == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+                const TickType_t start = xTaskGetTickCount();
+
+                // Notifications left over from messages already taken can wake early, check again.
+                while (!m_queue.pop(message))
+                {
+                    const TickType_t elapsed = xTaskGetTickCount() - start;
+
+                    if (elapsed >= limit || !ulTaskNotifyTake(pdTRUE, limit - elapsed))
+                        return false;
+                }
+
+                return true;
+            }
+
+            size_t pending() const
+            {
+                return m_queue.size();
+            }
+
+        private:
+            bool push(const T &message) override
+            {
+                return m_queue.push(message);
+            }
+
+            mpsc_queue<T, Capacity> m_queue;
+        };
+    }
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "hardware/bus.h"
+
 #include <cstdint>
 #include <vector>
 #include <memory>
@@ -20,15 +22,26 @@ namespace hardware
 
         static void add(gpio_num_t pin, uint32_t id);
         static void remove(gpio_num_t pin);
+
+        // Samples the pins and publishes debounced events to key_events(): edges to the same
+        // state within 100 ms make one event with their ids or'ed together. The scheduler's
+        // input task runs it periodically.
+        static void tick();
+
+        // For apps that poll without the scheduler: ticks, then returns the next event from
+        // a subscription of its own, id 0 when there is none. Call it from one task only.
         static const key_event get_data();
 
+        static bus::channel<key_event> &key_events();
+
         ~button();
 
     private:
         static std::vector<std::unique_ptr<button>> s_buttons;
-        static std::vector<key_event> s_key_events;
+        // The event being debounced, id 0 when there is none.
+        static key_event s_pending;
 
-        static void tick();
+        static void publish_pending();
 
         button(gpio_num_t pin, uint32_t id);
 
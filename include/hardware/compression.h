@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace hardware
+{
+    namespace storage
+    {
+        // LZ4 block format, so blocks can be produced by any LZ4 implementation on the host.
+        namespace lz4
+        {
+            constexpr size_t HASH_ENTRIES = 1 << 12;
+            constexpr size_t MAX_BLOCK_SIZE = 0xffff;
+
+            constexpr size_t bound(size_t size)
+            {
+                return size + size / 255 + 16;
+            }
+
+            // Returns the compressed size, or 0 when the output does not fit into capacity.
+            size_t compress(const uint8_t *input, size_t size, uint8_t *output, size_t capacity, uint16_t *hash_table);
+
+            // Returns the decompressed size, or 0 when the input is malformed or does not fit.
+            size_t decompress(const uint8_t *input, size_t size, uint8_t *output, size_t capacity);
+        }
+
+        struct compressed_writer_implementation;
+        struct compressed_reader_implementation;
+
+        // Files made of independently compressed blocks followed by a block index, so readers
+        // only decompress the block they need. A file that was not closed can still be read,
+        // the index is then rebuilt by walking the block headers.
+        class compressed_writer
+        {
+        public:
+            static constexpr size_t DEFAULT_BLOCK_SIZE = 4096;
+
+            struct statistics
+            {
+                uint64_t input_bytes;
+                uint64_t output_bytes;
+                uint32_t blocks;
+                uint32_t stored_blocks;
+            };
+
+            explicit compressed_writer(const char *path, size_t block_size = DEFAULT_BLOCK_SIZE);
+            ~compressed_writer();
+
+            compressed_writer(const compressed_writer &) = delete;
+            compressed_writer(compressed_writer &&) = delete;
+            compressed_writer &operator=(const compressed_writer &) = delete;
+            compressed_writer &operator=(compressed_writer &&) = delete;
+
+            bool is_open();
+            size_t write(const void *data, size_t size);
+            bool close();
+
+            statistics get_statistics();
+
+        private:
+            std::unique_ptr<compressed_writer_implementation> mp_implementation;
+        };
+
+        class compressed_reader
+        {
+        public:
+            explicit compressed_reader(const char *path);
+            compressed_reader(const uint8_t *data, size_t size);
+            ~compressed_reader();
+
+            compressed_reader(const compressed_reader &) = delete;
+            compressed_reader(compressed_reader &&) = delete;
+            compressed_reader &operator=(const compressed_reader &) = delete;
+            compressed_reader &operator=(compressed_reader &&) = delete;
+
+            bool is_open();
+            uint64_t size();
+            size_t read(uint64_t offset, void *data, size_t size);
+
+        private:
+            std::unique_ptr<compressed_reader_implementation> mp_implementation;
+        };
+    }
+}
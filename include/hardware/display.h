@@ -1,5 +1,8 @@
 #pragma once
 
+#include "hardware/bus.h"
+
+#include <cstddef>
 #include <cstdint>
 #include <memory>
 
@@ -12,6 +15,11 @@ namespace hardware
     public:
         using transfer_done_callback_t = void (*)(void *);
 
+        struct transfer_event
+        {
+            int64_t timestamp_us;
+        };
+
         enum class brightness_level
         {
             min = 0,
@@ -38,8 +46,13 @@ namespace hardware
         uint16_t width();
         uint16_t height();
 
+        // Largest bitmap set_bitmap() sends in one DMA transfer.
+        size_t max_transfer_bytes();
+
         void set_backlight(brightness_level level);
         void set_transfer_done_callback(transfer_done_callback_t on_transfer_done, void *user_data);
+        // Published from the bus interrupt after the callback, for observers that can wait.
+        static bus::channel<transfer_event> &transfer_events();
         void set_bitmap(uint16_t x1, uint16_t x2, uint16_t y1, uint16_t y2, uint16_t *data);
 
     private:
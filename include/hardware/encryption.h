@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace hardware
+{
+    namespace storage
+    {
+        constexpr size_t ENCRYPTION_KEY_SIZE = 32;
+
+        // Derives a per purpose key with the HMAC peripheral from the eFuse key that also
+        // protects the NVS keys, so no key material is ever stored in flash. The eFuse key
+        // is put in place by provision_encryption_key().
+        bool derive_key(const char *purpose, uint8_t (&key)[ENCRYPTION_KEY_SIZE]);
+
+        struct encrypted_file_implementation;
+
+        // Files stored as independently encrypted blocks, AES-256-CBC with ESSIV initialisation
+        // vectors like dm-crypt, so any block can be read or rewritten on its own. Blocks go
+        // through DMA capable buffers, letting the AES accelerator work on them in one pass.
+        // Contents are kept confidential but not authenticated.
+        class encrypted_file
+        {
+        public:
+            static constexpr size_t BLOCK_SIZE = 4096;
+
+            enum class mode
+            {
+                read,
+                write,
+                update,
+            };
+
+            // Uses the key derived when the internal storage was mounted with encryption.
+            encrypted_file(const char *path, mode open_mode);
+            encrypted_file(const char *path, mode open_mode, const uint8_t (&key)[ENCRYPTION_KEY_SIZE]);
+            ~encrypted_file();
+
+            encrypted_file(const encrypted_file &) = delete;
+            encrypted_file(encrypted_file &&) = delete;
+            encrypted_file &operator=(const encrypted_file &) = delete;
+            encrypted_file &operator=(encrypted_file &&) = delete;
+
+            bool is_open();
+            uint64_t size();
+            size_t read(uint64_t offset, void *data, size_t size);
+            size_t write(uint64_t offset, const void *data, size_t size);
+            bool flush();
+            bool close();
+
+        private:
+            std::unique_ptr<encrypted_file_implementation> mp_implementation;
+        };
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace hardware
+{
+    struct espnow_implementation;
+
+    class espnow
+    {
+    public:
+        using receive_callback_t = void (*)(const uint8_t *mac, const uint8_t *data, size_t size, void *user_data);
+        using send_done_callback_t = void (*)(const uint8_t *mac, bool delivered, void *user_data);
+        using paired_callback_t = void (*)(const uint8_t *mac, void *user_data);
+
+        struct peer_stats
+        {
+            uint32_t sent;
+            uint32_t delivered;
+            uint32_t failed;
+            uint32_t received;
+            uint32_t lost;
+            uint32_t rtt_us;
+            uint32_t rtt_min_us;
+            uint32_t rtt_max_us;
+        };
+
+        static constexpr size_t MAX_PAYLOAD_SIZE = 242;
+
+        static espnow &get()
+        {
+            if (sp_instance)
+                return *sp_instance;
+
+            sp_instance = new espnow();
+
+            return *sp_instance;
+        };
+
+        ~espnow();
+
+        espnow(const espnow &) = delete;
+        espnow(espnow &&) = delete;
+        espnow &operator=(const espnow &) = delete;
+        espnow &operator=(espnow &&) = delete;
+
+        bool add_peer(const uint8_t *mac);
+        bool remove_peer(const uint8_t *mac);
+        bool get_stats(const uint8_t *mac, peer_stats &stats);
+
+        void start_pairing(uint32_t duration_ms);
+        void stop_pairing();
+
+        bool send(const uint8_t *mac, const void *data, size_t size);
+        bool ping(const uint8_t *mac);
+
+        void set_receive_callback(receive_callback_t on_receive, void *user_data);
+        void set_send_done_callback(send_done_callback_t on_send_done, void *user_data);
+        void set_paired_callback(paired_callback_t on_paired, void *user_data);
+
+        void poll();
+
+    private:
+        static espnow *sp_instance;
+
+        espnow();
+
+        std::unique_ptr<espnow_implementation> mp_implementation;
+    };
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace hardware
+{
+    namespace storage
+    {
+        // NOR flash semantics: erase sets a whole sector to 0xff, programming can only clear bits.
+        class flash_device
+        {
+        public:
+            virtual ~flash_device() = default;
+
+            virtual size_t size() const = 0;
+            virtual size_t sector_size() const = 0;
+
+            virtual bool read(size_t offset, void *data, size_t size) = 0;
+            virtual bool write(size_t offset, const void *data, size_t size) = 0;
+            virtual bool erase(size_t offset, size_t size) = 0;
+        };
+
+        // Data and app partitions alike.
+        std::unique_ptr<flash_device> make_partition_flash_device(const char *partition_label);
+
+        // Emulates a flash chip in a regular file, for running on the linux target or on a host.
+        std::unique_ptr<flash_device> make_file_flash_device(const char *path, size_t size, size_t sector_size = 4096);
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+struct _lv_font_t;
+
+namespace hardware
+{
+    namespace graphics
+    {
+        // Keeps decoded glyph bitmaps in PSRAM so compressed fonts are not decompressed again
+        // on every refresh. The cache is shared by all fonts and keyed by font, of which LVGL
+        // has one per size, and code point. The least recently drawn glyphs are evicted once
+        // the budget is spent.
+        namespace glyph_cache
+        {
+            static constexpr size_t DEFAULT_BUDGET = 256 * 1024;
+
+            struct statistics
+            {
+                uint32_t hits;
+                uint32_t misses;
+                uint32_t evictions;
+                // Glyphs that did not fit in the budget or PSRAM and were drawn uncached.
+                uint32_t uncached;
+                uint32_t entries;
+                size_t used_bytes;
+                size_t budget_bytes;
+            };
+
+            bool start(size_t budget_bytes = DEFAULT_BUDGET);
+            void stop();
+            void clear();
+
+            // Returns a copy of the font that draws through the cache, the same copy for every
+            // call. Fonts whose glyphs are stored uncompressed gain nothing and are returned as
+            // they are, this includes fonts from the asset pack and atlases baked with
+            // tools/bake_font_atlas.py.
+            const _lv_font_t *wrap(const _lv_font_t *font);
+
+            statistics get_statistics();
+        }
+    }
+}
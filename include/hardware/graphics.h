@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+struct _lv_disp_t;
+
+namespace hardware
+{
+    // Connects LVGL to the display. Rendering goes into two DMA capable buffers in internal
+    // RAM, so LVGL draws the next stripe while the previous one is on the bus, and a task
+    // pinned to one core runs the LVGL timers, sleeping until the next one is due. Large
+    // blends are split in two bands, the lower one blended by a helper on the other core.
+    namespace graphics
+    {
+        struct options
+        {
+            // Upper bound for the stripe height, also capped by the largest display transfer.
+            uint16_t max_buffer_lines;
+            int core;
+            uint32_t priority;
+            uint32_t stack_size;
+            uint32_t max_sleep_ms;
+            // Vector fill, copy and blend kernels for unmasked draws, see graphics_blend.h.
+            bool accelerated_blend;
+            // Core of the blend helper, negative or the render core to blend on one core only.
+            int blend_core;
+            // Smaller blends are not worth the handover to the other core.
+            uint32_t min_blend_pixels;
+        };
+
+        static constexpr options DEFAULT_OPTIONS = {
+            .max_buffer_lines = 40,
+            .core = 1,
+            .priority = 4,
+            .stack_size = 6144,
+            .max_sleep_ms = 30,
+            .accelerated_blend = true,
+            .blend_core = 0,
+            .min_blend_pixels = 4096,
+        };
+
+        bool start(const options &opts = DEFAULT_OPTIONS);
+        void stop();
+
+        // LVGL is not thread safe, any task other than the render task has to hold the lock
+        // while touching LVGL objects. The lock is recursive.
+        bool lock(uint32_t timeout_ms = UINT32_MAX);
+        void unlock();
+
+        // Runs the timer handler now rather than when the next timer is due.
+        void wake();
+
+        _lv_disp_t *get_display();
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+struct _lv_disp_drv_t;
+
+namespace hardware
+{
+    namespace graphics
+    {
+        // RGB565 fill, copy and opacity blend kernels for the LV_COLOR_16_SWAP layout, using
+        // the 128-bit PIE vector instructions on the ESP32-S3. The reference kernels are plain
+        // C++ and give the same pixels as LVGL, other targets use them directly: fill_mix as
+        // lv_color_premult with lv_color_mix_premult, mix as lv_color_mix.
+        namespace blend
+        {
+            void fill(uint16_t *dest, uint16_t color, size_t count);
+            void fill_mix(uint16_t *dest, uint16_t color, uint8_t opa, size_t count);
+            void copy(uint16_t *dest, const uint16_t *src, size_t count);
+            void mix(uint16_t *dest, const uint16_t *src, uint8_t opa, size_t count);
+
+            namespace reference
+            {
+                void fill(uint16_t *dest, uint16_t color, size_t count);
+                void fill_mix(uint16_t *dest, uint16_t color, uint8_t opa, size_t count);
+                void copy(uint16_t *dest, const uint16_t *src, size_t count);
+                void mix(uint16_t *dest, const uint16_t *src, uint8_t opa, size_t count);
+            }
+
+            // Compares every kernel with its reference on random pixels, lengths, alignments
+            // and opacities, returns the number of differing pixels.
+            uint32_t verify(uint32_t seed = 0x2545f491, uint32_t rounds = 256);
+
+            // Takes over unmasked normal blends of the software renderer, masked and other
+            // blend modes stay with LVGL. Refuses if verify() finds a difference.
+            bool install(_lv_disp_drv_t *driver);
+
+            struct timing
+            {
+                uint32_t reference_us;
+                uint32_t accelerated_us;
+            };
+
+            struct results
+            {
+                uint32_t pixels;
+                uint32_t iterations;
+                uint32_t mismatches;
+
+                timing fill;
+                timing fill_mix;
+                timing copy;
+                timing mix;
+            };
+
+            // Times each kernel against its reference on a buffer of one draw stripe.
+            results benchmark(size_t pixels = 240 * 40, uint32_t iterations = 50);
+            void print(const results &result);
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Plain C so lv_conf.h can route LV_MEM_CUSTOM_ALLOC and friends here. */
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    void *graphics_memory_alloc(size_t size);
+    void graphics_memory_free(void *data);
+    void *graphics_memory_realloc(void *data, size_t size);
+
+#ifdef __cplusplus
+}
+
+namespace hardware
+{
+    namespace graphics
+    {
+        // LVGL allocations up to the largest size class are served from slabs in internal
+        // SRAM, where object and style lookups during rendering are fast. Everything larger,
+        // and small allocations once the slab budget is spent, goes to PSRAM.
+        static constexpr size_t MEMORY_CLASS_SIZES[] = {16, 32, 48, 64, 96, 128, 192, 256};
+        static constexpr size_t MEMORY_CLASS_COUNT = sizeof(MEMORY_CLASS_SIZES) / sizeof(MEMORY_CLASS_SIZES[0]);
+        static constexpr size_t MEMORY_SLAB_SIZE = 4096;
+        static constexpr size_t MEMORY_INTERNAL_BUDGET = 64 * 1024;
+
+        struct memory_tier
+        {
+            size_t used_bytes;
+            size_t peak_bytes;
+            uint32_t allocations;
+            uint32_t failures;
+        };
+
+        struct memory_statistics
+        {
+            memory_tier internal;
+            memory_tier external;
+            uint32_t slabs;
+            uint32_t blocks_used[MEMORY_CLASS_COUNT];
+            uint32_t blocks_free[MEMORY_CLASS_COUNT];
+        };
+
+        memory_statistics get_memory_statistics();
+        void print_memory_statistics();
+    }
+}
+#endif
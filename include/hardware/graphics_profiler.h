@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+struct _lv_obj_t;
+struct _lv_obj_class_t;
+
+namespace hardware
+{
+    namespace graphics
+    {
+        // Attributes render time and pixels to the objects being drawn. Every object under the
+        // display's screens gets an event callback timing its main and post draw phases, which
+        // do not include its children, and each frame is closed by the display's monitor
+        // callback. Both go into fixed rings, so the report covers the most recent frames.
+        namespace profiler
+        {
+            static constexpr size_t FRAME_HISTORY = 128;
+            static constexpr size_t SAMPLE_HISTORY = 2048;
+            static constexpr size_t REPORT_ENTRIES = 12;
+
+            struct frame
+            {
+                uint32_t index;
+                // From the first draw of the frame until LVGL finished flushing it.
+                uint32_t render_us;
+                // Time spent inside object draw phases, the rest is layout and flush waits.
+                uint32_t draw_us;
+                uint32_t pixels;
+                uint16_t draws;
+            };
+
+            struct sample
+            {
+                uint32_t frame;
+                const _lv_obj_t *object;
+                const _lv_obj_class_t *type;
+                uint32_t draw_us;
+                uint32_t pixels;
+            };
+
+            struct options
+            {
+                uint32_t frame_budget_us;
+            };
+
+            static constexpr options DEFAULT_OPTIONS = {
+                .frame_budget_us = 30000,
+            };
+
+            // Attaches to every screen of the display, objects created later below them are
+            // picked up automatically. Screens created after start() need attach().
+            bool start(const options &opts = DEFAULT_OPTIONS);
+            void stop();
+            void attach(_lv_obj_t *root);
+            void clear();
+
+            // Copies out the newest entries, oldest first, and returns how many there were.
+            size_t get_frames(frame *result, size_t count);
+            size_t get_samples(sample *result, size_t count);
+
+            // Summary of frame times, the most expensive object types and instances, and the
+            // breakdown of the slowest frame still in the sample ring.
+            void report(FILE *output);
+            void print();
+
+            // Writes the summary followed by the raw frame and sample rings as CSV, e.g. to a
+            // file on the LittleFS partition.
+            bool save(const char *path);
+        }
+    }
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "hardware/flash_device.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+namespace hardware
+{
+    namespace storage
+    {
+        struct journal_implementation;
+
+        // Key-value store for state that changes too often for NVS. Values live in RAM,
+        // commit() appends only the keys changed since the last commit to a write-ahead
+        // log, so any number of updates to a key between commits costs one record. When
+        // the log fills up, the whole working set is written to the older of two checkpoint
+        // slots and the log starts over. After a crash the newest valid checkpoint is
+        // loaded and the log replayed up to the first torn record.
+        class journal
+        {
+        public:
+            static constexpr size_t MAX_KEY_LENGTH = 15;
+            static constexpr size_t MAX_VALUE_SIZE = 32;
+            static constexpr size_t CHECKPOINT_SECTORS = 2;
+            static constexpr uint32_t DEFAULT_COMMIT_INTERVAL_MS = 1000;
+
+            struct statistics
+            {
+                uint32_t keys;
+                uint32_t generation;
+                uint32_t log_used;
+                uint32_t log_size;
+                uint32_t commits;
+                uint32_t records_written;
+                uint32_t updates_coalesced;
+                uint32_t checkpoints;
+                uint32_t erases;
+                uint32_t bytes_written;
+                uint32_t torn_records;
+                uint32_t max_commit_us;
+            };
+
+            static journal &get()
+            {
+                if (sp_instance)
+                    return *sp_instance;
+
+                sp_instance = new journal(make_partition_flash_device(PARTITION_LABEL));
+
+                return *sp_instance;
+            }
+
+            // A commit_interval_ms of 0 leaves committing to the caller.
+            explicit journal(std::unique_ptr<flash_device> device, uint32_t commit_interval_ms = DEFAULT_COMMIT_INTERVAL_MS);
+            ~journal();
+
+            journal(const journal &) = delete;
+            journal(journal &&) = delete;
+            journal &operator=(const journal &) = delete;
+            journal &operator=(journal &&) = delete;
+
+            bool is_valid();
+
+            bool store(const char *key, const void *data, size_t size);
+            bool load(const char *key, void *data, size_t &size);
+            bool remove(const char *key);
+
+            template <typename T>
+            bool store(const char *key, const T &value)
+            {
+                static_assert(std::is_trivially_copyable_v<T> && sizeof(T) <= MAX_VALUE_SIZE);
+
+                return store(key, &value, sizeof(T));
+            }
+
+            template <typename T>
+            bool load(const char *key, T &value)
+            {
+                static_assert(std::is_trivially_copyable_v<T> && sizeof(T) <= MAX_VALUE_SIZE);
+
+                size_t size = sizeof(T);
+
+                return load(key, &value, size) && size == sizeof(T);
+            }
+
+            // Makes every change so far durable.
+            bool commit();
+            bool checkpoint();
+
+            statistics get_statistics();
+
+        private:
+            static constexpr const char *PARTITION_LABEL = "journal";
+
+            static journal *sp_instance;
+
+            std::unique_ptr<journal_implementation> mp_implementation;
+        };
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace hardware
+{
+    namespace ota
+    {
+        enum class status
+        {
+            idle,
+            running,
+            succeeded,
+            failed,
+        };
+
+        struct progress
+        {
+            status state;
+            size_t written;
+            size_t total;
+        };
+
+        struct options
+        {
+            const uint8_t *sha256;
+            bool show_progress;
+            bool reboot;
+        };
+
+        using health_check_t = bool (*)(void *user_data);
+
+        static constexpr options DEFAULT_OPTIONS = {
+            .sha256 = nullptr,
+            .show_progress = true,
+            .reboot = true,
+        };
+
+        // Streams an image into the inactive OTA slot. Fetching and flashing run on separate
+        // tasks connected by a small buffer queue, so network and flash latency overlap.
+        bool start_from_url(const char *url, const options &opts = DEFAULT_OPTIONS);
+        bool start_from_file(const char *path, const options &opts = DEFAULT_OPTIONS);
+
+        // Same, for patches made by tools/make_delta.py against the running image. The new
+        // image is assembled from the patch and the active slot while it is written.
+        bool start_delta_from_url(const char *url, const options &opts = DEFAULT_OPTIONS);
+        bool start_delta_from_file(const char *path, const options &opts = DEFAULT_OPTIONS);
+        void cancel();
+
+        progress get_progress();
+
+        // Call once the application is up after an update. Unless the check passes, the
+        // previous image is restored and the device reboots into it.
+        bool is_pending_verification();
+        void confirm(health_check_t check, void *user_data);
+    }
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+namespace hardware
+{
+    namespace provisioning
+    {
+        bool start();
+        void stop();
+        bool active();
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace hardware
+{
+    namespace graphics
+    {
+        // Instruments LVGL's image and gradient caches and its simple layer buffers, and in
+        // adaptive mode resizes the two caches from the hit rates of the last window within a
+        // shared memory budget. Layer buffer sizes and the shadow cache are compile time
+        // settings in lv_conf.h, for those the statistics only say which way to change them.
+        namespace render_cache
+        {
+            struct cache_statistics
+            {
+                uint32_t lookups;
+                uint32_t hits;
+                uint32_t misses;
+                // Entries closed to make room, only LVGL's image cache reports these.
+                uint32_t evictions;
+                // Misses on something that was cached recently, the cache is too small.
+                uint32_t refetches;
+                // Gradients too large for the cache, rendered into a temporary buffer.
+                uint32_t uncached;
+            };
+
+            struct layer_statistics
+            {
+                uint32_t layers;
+                // Drawn in several passes because LV_LAYER_SIMPLE_BUF_SIZE was smaller.
+                uint32_t chunked;
+                // LV_LAYER_SIMPLE_BUF_SIZE could not be allocated, the fallback was used.
+                uint32_t fallbacks;
+                uint32_t failures;
+                uint32_t largest_bytes;
+            };
+
+            struct statistics
+            {
+                cache_statistics images;
+                cache_statistics gradients;
+                layer_statistics layers;
+                uint16_t image_entries;
+                uint16_t images_cached;
+                // Decoded image data held in RAM by cached entries.
+                size_t image_bytes;
+                size_t gradient_bytes;
+                uint32_t resizes;
+            };
+
+            struct options
+            {
+                bool adaptive;
+                size_t memory_budget;
+                uint32_t window_ms;
+                uint16_t max_image_entries;
+            };
+
+            static constexpr options DEFAULT_OPTIONS = {
+                .adaptive = true,
+                .memory_budget = 256 * 1024,
+                .window_ms = 2000,
+                .max_image_entries = 32,
+            };
+
+            // Needs the display to be started, the counters run from boot.
+            bool start(const options &opts = DEFAULT_OPTIONS);
+            void stop();
+
+            statistics get_statistics();
+            void print_statistics();
+        }
+    }
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "hardware/flash_device.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace hardware
+{
+    namespace storage
+    {
+        struct ring_log_implementation;
+
+        // Append-only log of fixed-size, CRC protected records written circularly to a raw
+        // partition. Each sector starts with a header holding its sequence number and the
+        // timestamp of its first record, which is what seek() bisects over.
+        class ring_log
+        {
+        public:
+            static constexpr size_t RECORD_SIZE = 64;
+            static constexpr size_t PAYLOAD_SIZE = 44;
+            static constexpr size_t DEFAULT_BATCH_RECORDS = 4;
+
+            struct entry
+            {
+                uint64_t timestamp;
+                uint32_t sequence;
+                uint16_t type;
+                uint8_t size;
+                uint8_t data[PAYLOAD_SIZE];
+            };
+
+            struct cursor
+            {
+                uint32_t sector_sequence;
+                uint16_t slot;
+            };
+
+            struct statistics
+            {
+                uint32_t sectors;
+                uint32_t sector_size;
+                uint32_t used_sectors;
+                uint32_t records_written;
+                uint32_t batches;
+                uint32_t erases;
+                uint32_t torn_records;
+                uint32_t max_append_us;
+            };
+
+            static ring_log &get()
+            {
+                if (sp_instance)
+                    return *sp_instance;
+
+                sp_instance = new ring_log(make_partition_flash_device(PARTITION_LABEL));
+
+                return *sp_instance;
+            }
+
+            explicit ring_log(std::unique_ptr<flash_device> device, size_t batch_records = DEFAULT_BATCH_RECORDS);
+            ~ring_log();
+
+            ring_log(const ring_log &) = delete;
+            ring_log(ring_log &&) = delete;
+            ring_log &operator=(const ring_log &) = delete;
+            ring_log &operator=(ring_log &&) = delete;
+
+            bool is_valid();
+
+            // Timestamps must not go backwards for seek() to work, earlier ones are clamped.
+            bool append(uint16_t type, const void *data, size_t size, uint64_t timestamp);
+            bool flush();
+            void clear();
+
+            // Only records that have been flushed are visible to readers.
+            cursor begin();
+            bool seek(uint64_t timestamp, cursor &position);
+            bool read(cursor &position, entry &result);
+
+            statistics get_statistics();
+
+        private:
+            static constexpr const char *PARTITION_LABEL = "log";
+
+            static ring_log *sp_instance;
+
+            std::unique_ptr<ring_log_implementation> mp_implementation;
+        };
+    }
+}
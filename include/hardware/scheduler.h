@@ -0,0 +1,93 @@
+#pragma once
+
+#include "hardware/button.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace hardware
+{
+    // Owns the threads of the component. Rendering (graphics' own task), input, network and
+    // storage each get a task pinned to a core with an explicit priority and stack, so the
+    // polling that used to run on whatever task the app called from has a fixed home. The
+    // defaults keep rendering and input alone on core 1 and put network and storage on core 0
+    // next to the Wi-Fi driver, where a busy Wi-Fi stack can no longer delay a frame.
+    namespace scheduler
+    {
+        enum class role : uint8_t
+        {
+            RENDER,
+            INPUT,
+            NETWORK,
+            STORAGE,
+            COUNT,
+        };
+
+        static constexpr size_t ROLE_COUNT = static_cast<size_t>(role::COUNT);
+
+        struct task_options
+        {
+            const char *name;
+            int core;
+            uint32_t priority;
+            uint32_t stack_size;
+            // PSRAM stack, only for tasks that never run with the flash cache disabled. The
+            // render stack is always internal.
+            bool external_stack;
+            // How often the role's polling runs, 0 to only run posted jobs.
+            uint32_t period_ms;
+            uint8_t queue_length;
+        };
+
+        struct options
+        {
+            task_options tasks[ROLE_COUNT];
+            // Poll wifi::get() and espnow::get() from the network task, once the app uses them.
+            bool poll_wifi;
+            bool poll_espnow;
+        };
+
+        static constexpr options DEFAULT_OPTIONS = {
+            .tasks = {
+                {.name = "graphics", .core = 1, .priority = 5, .stack_size = 6144, .external_stack = false, .period_ms = 0, .queue_length = 0},
+                {.name = "input", .core = 1, .priority = 6, .stack_size = 3072, .external_stack = false, .period_ms = 10, .queue_length = 8},
+                {.name = "network", .core = 0, .priority = 4, .stack_size = 4096, .external_stack = false, .period_ms = 50, .queue_length = 8},
+                {.name = "storage", .core = 0, .priority = 2, .stack_size = 4096, .external_stack = false, .period_ms = 0, .queue_length = 16},
+            },
+            .poll_wifi = false,
+            .poll_espnow = false,
+        };
+
+        using key_callback_t = void (*)(const button::key_event &event, void *user_data);
+        using job_t = void (*)(void *arg);
+
+        // Starts graphics with the render role's placement and the other workers.
+        bool start(const options &opts = DEFAULT_OPTIONS);
+        void stop();
+
+        // Called from the input task for every debounced button event, set before start().
+        void set_key_callback(key_callback_t on_key, void *user_data);
+
+        // Queues a job on the input, network or storage task. The render task has no queue,
+        // other tasks reach LVGL through graphics::lock(). Jobs on a role given an external
+        // stack must not touch flash, NVS or the file system: those disable the cache and
+        // assert on a PSRAM stack.
+        bool post(role target, job_t job, void *arg, uint32_t timeout_ms = 0);
+
+        struct task_usage
+        {
+            char name[16];
+            int core;
+            uint32_t priority;
+            // Smallest amount of stack left so far, in bytes.
+            uint32_t stack_free;
+            uint32_t runtime_us;
+            // Share of one core since the previous call.
+            uint8_t cpu_percent;
+        };
+
+        // Fills usage with every task in the system, needs CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS.
+        size_t get_usage(task_usage *usage, size_t capacity);
+        void print_usage();
+    }
+}
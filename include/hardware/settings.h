@@ -0,0 +1,367 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+
+namespace hardware
+{
+    namespace storage
+    {
+        enum class value_kind : uint8_t
+        {
+            u8,
+            i8,
+            u16,
+            i16,
+            u32,
+            i32,
+            u64,
+            i64,
+            text,
+        };
+
+        template <size_t Capacity>
+        struct text
+        {
+        };
+
+        constexpr size_t SETTING_KEY_MAX_LENGTH = 15;
+
+        void invalid_setting_descriptor();
+
+        consteval size_t constant_length(const char *string)
+        {
+            size_t length = 0;
+
+            while (string[length])
+                length++;
+
+            return length;
+        }
+
+        consteval void validate_key(const char *key)
+        {
+            const size_t length = constant_length(key);
+
+            if (!length || length > SETTING_KEY_MAX_LENGTH)
+                invalid_setting_descriptor();
+        }
+
+        template <typename T>
+        struct value_traits;
+
+        template <>
+        struct value_traits<uint8_t>
+        {
+            static constexpr value_kind kind = value_kind::u8;
+        };
+
+        template <>
+        struct value_traits<int8_t>
+        {
+            static constexpr value_kind kind = value_kind::i8;
+        };
+
+        template <>
+        struct value_traits<uint16_t>
+        {
+            static constexpr value_kind kind = value_kind::u16;
+        };
+
+        template <>
+        struct value_traits<int16_t>
+        {
+            static constexpr value_kind kind = value_kind::i16;
+        };
+
+        template <>
+        struct value_traits<uint32_t>
+        {
+            static constexpr value_kind kind = value_kind::u32;
+        };
+
+        template <>
+        struct value_traits<int32_t>
+        {
+            static constexpr value_kind kind = value_kind::i32;
+        };
+
+        template <>
+        struct value_traits<uint64_t>
+        {
+            static constexpr value_kind kind = value_kind::u64;
+        };
+
+        template <>
+        struct value_traits<int64_t>
+        {
+            static constexpr value_kind kind = value_kind::i64;
+        };
+
+        template <typename T>
+        struct setting
+        {
+            using value_type = T;
+
+            static constexpr value_kind kind = value_traits<T>::kind;
+            static constexpr size_t storage_size = sizeof(T);
+
+            consteval setting(const char *key, T default_value) : key(key), default_value(default_value)
+            {
+                validate_key(key);
+            }
+
+            constexpr const void *default_address() const
+            {
+                return &default_value;
+            }
+
+            const char *key;
+            T default_value;
+        };
+
+        template <size_t Capacity>
+        struct setting<text<Capacity>>
+        {
+            using value_type = const char *;
+
+            static constexpr value_kind kind = value_kind::text;
+            static constexpr size_t storage_size = Capacity + 1;
+
+            consteval setting(const char *key, const char *default_value) : key(key), default_value(default_value)
+            {
+                validate_key(key);
+
+                if (!default_value || constant_length(default_value) > Capacity)
+                    invalid_setting_descriptor();
+            }
+
+            constexpr const void *default_address() const
+            {
+                return default_value;
+            }
+
+            const char *key;
+            const char *default_value;
+        };
+
+        class settings_backend
+        {
+        public:
+            virtual ~settings_backend() = default;
+
+            virtual bool read(const char *key, value_kind kind, void *value, size_t size) = 0;
+            virtual bool write(const char *key, value_kind kind, const void *value) = 0;
+            virtual bool commit() = 0;
+        };
+
+        std::unique_ptr<settings_backend> make_nvs_settings_backend(const char *name_space);
+
+        struct memory_settings_backend_implementation;
+
+        // Keeps the values in RAM, for stores that need not survive a reset and for the host
+        // tests. Like NVS, a value only reads back as the kind it was written as.
+        class memory_settings_backend : public settings_backend
+        {
+        public:
+            struct statistics
+            {
+                uint32_t reads;
+                uint32_t writes;
+                uint32_t commits;
+            };
+
+            memory_settings_backend();
+            ~memory_settings_backend() override;
+
+            bool read(const char *key, value_kind kind, void *value, size_t size) override;
+            bool write(const char *key, value_kind kind, const void *value) override;
+            bool commit() override;
+
+            bool contains(const char *key);
+            // Every write fails while set, as with a full partition.
+            void set_failing(bool failing);
+            statistics get_statistics();
+
+        private:
+            std::unique_ptr<memory_settings_backend_implementation> mp_implementation;
+        };
+
+        struct settings_store_implementation;
+
+        class settings_store
+        {
+        public:
+            struct statistics
+            {
+                uint32_t loads;
+                uint32_t writes;
+                uint32_t skipped_writes;
+                uint32_t commits;
+                uint32_t lifetime_writes;
+            };
+
+            struct descriptor
+            {
+                const char *key;
+                value_kind kind;
+                uint16_t offset;
+                uint16_t size;
+                const void *default_value;
+            };
+
+            static constexpr uint32_t DEFAULT_DEBOUNCE_MS = 2000;
+
+            settings_store(const settings_store &) = delete;
+            settings_store(settings_store &&) = delete;
+            settings_store &operator=(const settings_store &) = delete;
+            settings_store &operator=(settings_store &&) = delete;
+
+            void flush();
+            statistics get_statistics();
+
+        protected:
+            settings_store(std::unique_ptr<settings_backend> backend, const descriptor *descriptors, size_t count,
+                           uint8_t *arena, uint32_t *loaded, uint32_t *dirty, uint32_t debounce_ms);
+            ~settings_store();
+
+            void shutdown();
+            void read(size_t index, void *value);
+            const char *read_text(size_t index);
+            void write(size_t index, const void *value, size_t size);
+
+        private:
+            std::unique_ptr<settings_store_implementation> mp_implementation;
+        };
+
+        template <const auto &...Settings>
+        class settings : public settings_store
+        {
+        public:
+            static constexpr size_t COUNT = sizeof...(Settings);
+
+            explicit settings(const char *name_space, uint32_t debounce_ms = DEFAULT_DEBOUNCE_MS)
+                : settings(make_nvs_settings_backend(name_space), debounce_ms)
+            {
+            }
+
+            settings(std::unique_ptr<settings_backend> backend, uint32_t debounce_ms = DEFAULT_DEBOUNCE_MS)
+                : settings_store(std::move(backend), DESCRIPTORS.data(), COUNT, m_arena, m_loaded, m_dirty, debounce_ms)
+            {
+            }
+
+            ~settings()
+            {
+                shutdown();
+            }
+
+            template <const auto &Setting>
+            typename std::remove_cvref_t<decltype(Setting)>::value_type get()
+            {
+                constexpr size_t index = index_of<Setting>();
+
+                static_assert(index < COUNT, "setting is not registered in this store");
+
+                using value_type = typename std::remove_cvref_t<decltype(Setting)>::value_type;
+
+                if constexpr (std::is_same_v<value_type, const char *>)
+                    return read_text(index);
+                else
+                {
+                    value_type value;
+
+                    read(index, &value);
+
+                    return value;
+                }
+            }
+
+            template <const auto &Setting>
+            void set(typename std::remove_cvref_t<decltype(Setting)>::value_type value)
+            {
+                constexpr size_t index = index_of<Setting>();
+
+                static_assert(index < COUNT, "setting is not registered in this store");
+
+                using value_type = typename std::remove_cvref_t<decltype(Setting)>::value_type;
+
+                if constexpr (std::is_same_v<value_type, const char *>)
+                    write(index, value ? value : "", value ? strlen(value) : 0);
+                else
+                    write(index, &value, sizeof(value));
+            }
+
+        private:
+            static_assert(COUNT > 0, "a settings store needs at least one setting");
+
+            static constexpr size_t MASK_WORDS = (COUNT + 31) / 32;
+
+            template <const auto &Setting>
+            static consteval size_t index_of()
+            {
+                constexpr const void *addresses[] = {&Settings...};
+
+                for (size_t i = 0; i < COUNT; i++)
+                    if (addresses[i] == &Setting)
+                        return i;
+
+                return COUNT;
+            }
+
+            static consteval bool unique_keys()
+            {
+                constexpr const char *keys[] = {Settings.key...};
+
+                for (size_t i = 0; i < COUNT; i++)
+                    for (size_t j = i + 1; j < COUNT; j++)
+                    {
+                        size_t k = 0;
+
+                        while (keys[i][k] && keys[i][k] == keys[j][k])
+                            k++;
+
+                        if (keys[i][k] == keys[j][k])
+                            return false;
+                    }
+
+                return true;
+            }
+
+            static_assert(unique_keys(), "setting keys must be unique within a store");
+
+            static constexpr std::array<descriptor, COUNT> DESCRIPTORS = []
+            {
+                std::array<descriptor, COUNT> descriptors = {
+                    descriptor{
+                        .key = Settings.key,
+                        .kind = std::remove_cvref_t<decltype(Settings)>::kind,
+                        .offset = 0,
+                        .size = static_cast<uint16_t>(std::remove_cvref_t<decltype(Settings)>::storage_size),
+                        .default_value = Settings.default_address(),
+                    }...,
+                };
+
+                size_t offset = 0;
+
+                for (auto &d : descriptors)
+                {
+                    d.offset = static_cast<uint16_t>(offset);
+
+                    offset = (offset + d.size + 7) & ~static_cast<size_t>(7);
+                }
+
+                return descriptors;
+            }();
+
+            static constexpr size_t ARENA_SIZE = DESCRIPTORS[COUNT - 1].offset + DESCRIPTORS[COUNT - 1].size;
+
+            alignas(8) uint8_t m_arena[ARENA_SIZE] = {};
+            uint32_t m_loaded[MASK_WORDS] = {};
+            uint32_t m_dirty[MASK_WORDS] = {};
+        };
+    }
+}
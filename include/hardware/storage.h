@@ -1,5 +1,9 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <future>
+
 namespace hardware
 {
     namespace storage
@@ -8,10 +12,37 @@ namespace hardware
         {
             nvs,
             internal,
+            log,
+            journal,
+        };
+
+        struct mount_options
+        {
+            bool format_if_failed = true;
+            bool grow = false;
+            bool read_only = false;
+            bool deferred = false;
+
+            // NVS: encrypts entries with keys protected by the HMAC eFuse key, which needs
+            // CONFIG_NVS_ENCRYPTION and provision_encryption_key() having run once. Fails instead
+            // of burning the key. There is no migration: entries written in plaintext before, the
+            // Wi-Fi credentials among them, are unreadable afterwards and have to be entered
+            // again. Internal: loads the key encrypted_file uses.
+            bool encrypted = false;
         };
 
         void mount(const type storage_type);
         void mount(const type storage_type, const char *mount_point);
+        std::shared_future<bool> mount(const type storage_type, const char *mount_point, const mount_options &options);
         void unmount(const type storage_type);
+
+        bool ready(const type storage_type);
+        bool wait(const type storage_type, uint32_t timeout_ms = UINT32_MAX);
+        bool usage(const type storage_type, size_t &total_bytes, size_t &used_bytes);
+
+        // Generates the HMAC key behind encrypted storage and burns it into eFuse key block
+        // CONFIG_NVS_SEC_HMAC_EFUSE_KEY_ID. Irreversible, meant for the factory or a first boot
+        // setup step. True if the key is in place, including when it already was.
+        bool provision_encryption_key();
     }
-}
\ No newline at end of file
+}
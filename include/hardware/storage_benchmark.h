@@ -0,0 +1,104 @@
+#pragma once
+
+#include "hardware/storage.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace hardware
+{
+    namespace storage
+    {
+        namespace benchmark
+        {
+            struct throughput
+            {
+                uint32_t bytes;
+                uint32_t elapsed_us;
+
+                uint32_t kib_per_second() const
+                {
+                    return elapsed_us ? static_cast<uint32_t>((uint64_t(bytes) * 1000000 / 1024) / elapsed_us) : 0;
+                }
+            };
+
+            struct latency
+            {
+                uint32_t count;
+                uint32_t min_us;
+                uint32_t max_us;
+                uint64_t total_us;
+
+                void add(uint32_t sample_us);
+
+                uint32_t average_us() const
+                {
+                    return count ? static_cast<uint32_t>(total_us / count) : 0;
+                }
+            };
+
+            struct options
+            {
+                const char *mount_point;
+                // Used for every mount the benchmark does, the mount time included.
+                mount_options mount;
+                size_t file_size;
+                size_t block_size;
+                size_t small_files;
+                size_t small_file_size;
+                size_t fsync_iterations;
+                size_t nvs_entries;
+                uint8_t fill_percent;
+                uint32_t seed;
+            };
+
+            static constexpr size_t NVS_FILL_STAGES = 4;
+
+            struct results
+            {
+                uint8_t fill_percent;
+                uint32_t mount_us;
+
+                throughput sequential_write;
+                throughput sequential_read;
+                throughput random_write;
+                throughput random_read;
+
+                // Same pattern as the sequential pair, through encrypted_file.
+                throughput encrypted_write;
+                throughput encrypted_read;
+
+                latency file_create;
+                latency file_delete;
+                latency fsync;
+
+                latency nvs_set[NVS_FILL_STAGES];
+                latency nvs_get;
+            };
+
+            static constexpr options DEFAULT_OPTIONS = {
+                .mount_point = "/storage",
+                .mount = {
+                    .format_if_failed = true,
+                    .grow = true,
+                },
+                .file_size = 256 * 1024,
+                .block_size = 4096,
+                .small_files = 64,
+                .small_file_size = 128,
+                .fsync_iterations = 32,
+                .nvs_entries = 128,
+                .fill_percent = 0,
+                .seed = 0x2545f491,
+            };
+
+            // Runs every benchmark against the mounted LittleFS partition and NVS. Filler
+            // files are added until the partition reaches fill_percent and are kept, so a
+            // sweep over rising fill levels only writes the difference; remove() drops them.
+            // Failed calls are logged and leave their bytes and samples out of the results.
+            results run(const options &opts = DEFAULT_OPTIONS);
+            void remove(const options &opts = DEFAULT_OPTIONS);
+            void print(const results &result);
+        }
+    }
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#include <sdkconfig.h>
+
+namespace hardware
+{
+    // Begin, end and instant events from the hot paths, timestamped with the cycle counter
+    // and recorded into a ring per core in internal RAM. A record is a few dozen cycles and
+    // takes no lock, the rings are only ever claimed with an atomic increment, so tasks and
+    // ISRs trace alike. Everything is built only with CONFIG_HARDWARE_TRACE, otherwise the
+    // HARDWARE_TRACE_* macros compile to nothing. tools/trace_decode.py turns a dump into
+    // Chrome trace JSON for Perfetto.
+    namespace trace
+    {
+        enum class event : uint8_t
+        {
+            DISPLAY_SET_BITMAP,
+            DISPLAY_TRANSFER_DONE,
+            BUTTON_TICK,
+            BUTTON_KEY,
+            GRAPHICS_TIMER_HANDLER,
+            GRAPHICS_FLUSH_WAIT,
+            GRAPHICS_BLEND_SPLIT,
+            GRAPHICS_BLEND_HELPER,
+            WIFI_EVENT,
+            WIFI_IP_EVENT,
+            WIFI_POLL,
+            WIFI_RECONFIGURE,
+            ESPNOW_RECEIVE,
+            ESPNOW_TRANSMIT,
+            ESPNOW_POLL,
+            BATTERY_READ,
+            WRITER_FLUSH,
+            JOURNAL_COMMIT,
+            SETTINGS_FLUSH,
+            STORAGE_MOUNT,
+            RING_LOG_APPEND,
+            RING_LOG_FLUSH,
+            COMPRESSION_COMPRESS,
+            COMPRESSION_DECOMPRESS,
+            ENCRYPTION_STORE,
+            ENCRYPTION_LOAD,
+            SCHEDULER_JOB,
+            SCHEDULER_POLL,
+            ASSETS_FIND,
+            ASSETS_OPEN,
+            OTA_FETCH,
+            OTA_WRITE,
+            PROVISIONING_DNS,
+            PROVISIONING_SCAN,
+            PROVISIONING_CONNECT,
+            COUNT,
+        };
+
+        enum class phase : uint8_t
+        {
+            BEGIN,
+            END,
+            INSTANT,
+        };
+
+        // The argument is free for the event to use, e.g. a size or an event id.
+        void record(event id, phase kind, uint16_t arg = 0);
+
+        // Ends the event when it goes out of scope, see HARDWARE_TRACE_SCOPE.
+        class scope
+        {
+        public:
+            explicit scope(event id, uint16_t arg = 0) : m_id(id)
+            {
+                record(id, phase::BEGIN, arg);
+            }
+
+            ~scope()
+            {
+                record(m_id, phase::END);
+            }
+
+            scope(const scope &) = delete;
+            scope &operator=(const scope &) = delete;
+
+        private:
+            event m_id;
+        };
+
+        // Recording starts enabled.
+        void set_enabled(bool enabled);
+        void clear();
+
+        // Writes the binary dump: the event names, then every core's ring oldest first along
+        // with a cycle counter and esp_timer reading taken on that core, which the decoder
+        // lines the cores up with. Recording pauses meanwhile. Returns the number of events.
+        size_t write(FILE *output);
+
+        // Writes the dump to a file, e.g. on the LittleFS partition.
+        bool save(const char *path);
+    }
+}
+
+#define HARDWARE_TRACE_CONCAT_INNER(a, b) a##b
+#define HARDWARE_TRACE_CONCAT(a, b) HARDWARE_TRACE_CONCAT_INNER(a, b)
+
+#if CONFIG_HARDWARE_TRACE
+#define HARDWARE_TRACE_BEGIN(id, ...) ::hardware::trace::record(::hardware::trace::event::id, ::hardware::trace::phase::BEGIN __VA_OPT__(, ) __VA_ARGS__)
+#define HARDWARE_TRACE_END(id) ::hardware::trace::record(::hardware::trace::event::id, ::hardware::trace::phase::END)
+#define HARDWARE_TRACE_INSTANT(id, ...) ::hardware::trace::record(::hardware::trace::event::id, ::hardware::trace::phase::INSTANT __VA_OPT__(, ) __VA_ARGS__)
+#define HARDWARE_TRACE_SCOPE(id, ...) \
+    const ::hardware::trace::scope HARDWARE_TRACE_CONCAT(trace_scope_, __LINE__)(::hardware::trace::event::id __VA_OPT__(, ) __VA_ARGS__)
+#else
+#define HARDWARE_TRACE_BEGIN(id, ...) ((void)0)
+#define HARDWARE_TRACE_END(id) ((void)0)
+#define HARDWARE_TRACE_INSTANT(id, ...) ((void)0)
+#define HARDWARE_TRACE_SCOPE(id, ...) ((void)0)
+#endif
@@ -1,5 +1,9 @@
 #pragma once
 
+#include "hardware/bus.h"
+
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 
 namespace hardware
@@ -9,10 +13,29 @@ namespace hardware
     class wifi
     {
     public:
+        using restart_done_callback_t = void (*)(void *);
+
+        struct access_point_info
+        {
+            char ssid[33];
+            int8_t rssi;
+            uint8_t channel;
+            bool secure;
+        };
+
         enum class mode : uint8_t
         {
             ACCESS_POINT,
             STATION,
+            PEER,
+        };
+
+        enum class event : uint8_t
+        {
+            ACCESS_POINT_STARTED,
+            CONNECTED,
+            // Three failed connection attempts, the next poll() restarts as access point.
+            ACCESS_POINT_FALLBACK,
         };
 
         static wifi &get()
@@ -34,6 +57,8 @@ namespace hardware
 
         void set_mode(mode m);
         mode get_mode();
+        // The mode the driver runs in, which trails get_mode() until the restart applying it is done.
+        mode get_active_mode();
 
         void set_ssid(const char *ssid);
         const char *get_ssid();
@@ -44,17 +69,31 @@ namespace hardware
         const char *get_ip();
         const char *get_netmask();
         const char *get_gateway();
+        uint8_t get_channel();
+        bool is_default_access_point();
+
+        bool start_scan();
+        bool is_scanning();
+        size_t get_scan_results(access_point_info *results, size_t capacity);
 
         void poll();
-        void restart();
+
+        // Published from the event loop task. poll() reacts to the same events through flags
+        // of its own, so none is lost to a full queue however late it runs.
+        static bus::channel<event> &events();
+        void restart(restart_done_callback_t on_restart_done = nullptr, void *user_data = nullptr);
 
     private:
         static wifi *sp_instance;
 
+        static void restart_task(void *arg);
+
         wifi();
 
         void start();
         void stop();
+        void reconfigure();
+        void process_restart_requests();
 
         std::unique_ptr<wifi_implementation> mp_implementation;
     };
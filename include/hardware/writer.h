@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace hardware
+{
+    namespace storage
+    {
+        struct writer_implementation;
+
+        class writer
+        {
+        public:
+            enum class memory
+            {
+                internal,
+                external,
+            };
+
+            struct options
+            {
+                // Rounded up to a power of two.
+                size_t buffer_size;
+                size_t flush_threshold;
+                uint32_t flush_interval_ms;
+                memory buffer_memory;
+                bool truncate;
+            };
+
+            struct statistics
+            {
+                uint64_t bytes_accepted;
+                uint64_t bytes_flushed;
+                uint32_t bytes_dropped;
+                uint32_t flushes;
+                uint32_t syncs;
+                uint32_t max_flush_us;
+            };
+
+            static constexpr options DEFAULT_OPTIONS = {
+                .buffer_size = 16 * 1024,
+                .flush_threshold = 8 * 1024,
+                .flush_interval_ms = 1000,
+                .buffer_memory = memory::external,
+                .truncate = false,
+            };
+
+            explicit writer(const char *path, const options &opts = DEFAULT_OPTIONS);
+            ~writer();
+
+            writer(const writer &) = delete;
+            writer(writer &&) = delete;
+            writer &operator=(const writer &) = delete;
+            writer &operator=(writer &&) = delete;
+
+            bool is_open();
+            size_t write(const void *data, size_t size);
+            // False on timeout, or when data was lost to a failed write since the last sync.
+            bool sync(uint32_t timeout_ms);
+
+            statistics get_statistics();
+
+        private:
+            std::unique_ptr<writer_implementation> mp_implementation;
+        };
+    }
+}
@@ -46,7 +46,7 @@
  *=========================*/
 
 /*1: use custom malloc/free, 0: use the built-in `lv_mem_alloc()` and `lv_mem_free()`*/
-#define LV_MEM_CUSTOM 0
+#define LV_MEM_CUSTOM 1
 #if LV_MEM_CUSTOM == 0
     /*Size of the memory available for `lv_mem_alloc()` in bytes (>= 2kB)*/
     #define LV_MEM_SIZE (1U * 1024U * 1024U)          /*[bytes]*/
@@ -60,10 +60,11 @@
     #endif
 
 #else       /*LV_MEM_CUSTOM*/
-    #define LV_MEM_CUSTOM_INCLUDE <stdlib.h>   /*Header for the dynamic memory function*/
-    #define LV_MEM_CUSTOM_ALLOC   malloc
-    #define LV_MEM_CUSTOM_FREE    free
-    #define LV_MEM_CUSTOM_REALLOC realloc
+    /*Small allocations from internal SRAM slabs, large ones from PSRAM, see hardware/graphics_memory.h*/
+    #define LV_MEM_CUSTOM_INCLUDE "hardware/graphics_memory.h"   /*Header for the dynamic memory function*/
+    #define LV_MEM_CUSTOM_ALLOC   graphics_memory_alloc
+    #define LV_MEM_CUSTOM_FREE    graphics_memory_free
+    #define LV_MEM_CUSTOM_REALLOC graphics_memory_realloc
 #endif     /*LV_MEM_CUSTOM*/
 
 /*Number of the intermediate memory buffer used during rendering and other internal processing mechanisms.
@@ -0,0 +1,347 @@
+#include "hardware/assets.h"
+#include "hardware/trace.h"
+
+#include <cinttypes>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <lvgl.h>
+
+namespace hardware
+{
+    namespace assets
+    {
+        constexpr const char *TAG = "assets";
+        constexpr const char *PARTITION_LABEL = "assets";
+
+        constexpr uint32_t PACK_MAGIC = 0x50414352; // "RCAP"
+        constexpr uint16_t PACK_VERSION = 1;
+
+        // Layout shared with tools/pack_assets.py, all fields little endian.
+        struct __attribute__((packed)) pack_header
+        {
+            uint32_t magic;
+            uint16_t version;
+            uint16_t entry_count;
+            uint32_t slot_count;
+            uint32_t index_offset;
+            uint32_t total_size;
+        };
+
+        struct __attribute__((packed)) pack_entry
+        {
+            uint32_t hash;
+            uint32_t offset;
+            uint32_t size;
+            uint16_t width;
+            uint16_t height;
+            uint8_t kind;
+            uint8_t format;
+            uint16_t reserved;
+        };
+
+        struct __attribute__((packed)) font_header
+        {
+            uint16_t line_height;
+            int16_t base_line;
+            int8_t underline_position;
+            int8_t underline_thickness;
+            uint8_t bpp;
+            uint8_t bitmap_format;
+            uint16_t cmap_count;
+            uint16_t reserved;
+            uint32_t glyph_dsc_offset;
+            uint32_t glyph_bitmap_offset;
+            uint32_t cmap_offset;
+        };
+
+        struct __attribute__((packed)) font_cmap
+        {
+            uint32_t range_start;
+            uint16_t range_length;
+            uint16_t glyph_id_start;
+            uint16_t list_length;
+            uint8_t type;
+            uint8_t reserved;
+            uint32_t unicode_list_offset;
+            uint32_t glyph_id_ofs_list_offset;
+        };
+
+        static_assert(sizeof(pack_header) == 20);
+        static_assert(sizeof(pack_entry) == 20);
+        static_assert(sizeof(font_header) == 24);
+        static_assert(sizeof(font_cmap) == 20);
+        static_assert(sizeof(lv_font_fmt_txt_glyph_dsc_t) == 8, "asset fonts require LV_FONT_FMT_TXT_LARGE 0");
+
+        // Only the descriptors live in RAM, glyph data and cmap lists are read from the mapping.
+        struct font_holder
+        {
+            lv_font_t font = {};
+            lv_font_fmt_txt_dsc_t dsc = {};
+            lv_font_fmt_txt_glyph_cache_t cache = {};
+            std::unique_ptr<lv_font_fmt_txt_cmap_t[]> cmaps;
+        };
+
+        static std::mutex s_mutex;
+        static esp_partition_mmap_handle_t s_mmap_handle = 0;
+        static const uint8_t *sp_base = nullptr;
+        static const pack_header *sp_header = nullptr;
+        static const pack_entry *sp_index = nullptr;
+        static lv_img_decoder_t *sp_decoder = nullptr;
+        static std::map<uint32_t, std::unique_ptr<font_holder>> s_fonts;
+
+        static bool resolve_image(const void *src, asset &result)
+        {
+            if (lv_img_src_get_type(src) != LV_IMG_SRC_FILE)
+                return false;
+
+            const char *path = static_cast<const char *>(src);
+            const size_t prefix_length = strlen(IMAGE_PREFIX);
+
+            if (strncmp(path, IMAGE_PREFIX, prefix_length))
+                return false;
+
+            return find(path + prefix_length, result) && result.type == kind::image;
+        }
+
+        static lv_res_t decoder_info(lv_img_decoder_t *decoder, const void *src, lv_img_header_t *header)
+        {
+            asset image;
+
+            if (!resolve_image(src, image))
+                return LV_RES_INV;
+
+            header->always_zero = 0;
+            header->cf = image.format;
+            header->w = image.width;
+            header->h = image.height;
+
+            return LV_RES_OK;
+        }
+
+        static lv_res_t decoder_open(lv_img_decoder_t *decoder, lv_img_decoder_dsc_t *dsc)
+        {
+            HARDWARE_TRACE_SCOPE(ASSETS_OPEN);
+
+            asset image;
+
+            if (!resolve_image(dsc->src, image))
+                return LV_RES_INV;
+
+            switch (image.format)
+            {
+            case LV_IMG_CF_TRUE_COLOR:
+            case LV_IMG_CF_TRUE_COLOR_ALPHA:
+            case LV_IMG_CF_TRUE_COLOR_CHROMA_KEYED:
+            case LV_IMG_CF_RGB565A8:
+                dsc->img_data = image.data;
+
+                return LV_RES_OK;
+
+            default:
+                ESP_LOGW(TAG, "%s: color format %u cannot be drawn in place", static_cast<const char *>(dsc->src), image.format);
+
+                return LV_RES_INV;
+            }
+        }
+
+        bool mount()
+        {
+            std::lock_guard<std::mutex> lock(s_mutex);
+
+            if (sp_base)
+                return true;
+
+            const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, PARTITION_LABEL);
+
+            if (!partition)
+            {
+                ESP_LOGE(TAG, "partition %s not found", PARTITION_LABEL);
+
+                return false;
+            }
+
+            pack_header header;
+
+            ESP_ERROR_CHECK(esp_partition_read(partition, 0, &header, sizeof(header)));
+
+            if (header.magic != PACK_MAGIC || header.version != PACK_VERSION)
+            {
+                ESP_LOGW(TAG, "no asset pack in %s", PARTITION_LABEL);
+
+                return false;
+            }
+
+            if (!header.slot_count || (header.slot_count & (header.slot_count - 1)) || header.total_size > partition->size ||
+                header.index_offset + header.slot_count * sizeof(pack_entry) > header.total_size)
+            {
+                ESP_LOGE(TAG, "corrupted asset pack header");
+
+                return false;
+            }
+
+            const void *mapping = nullptr;
+
+            if (esp_partition_mmap(partition, 0, header.total_size, ESP_PARTITION_MMAP_DATA, &mapping, &s_mmap_handle) != ESP_OK)
+            {
+                ESP_LOGE(TAG, "failed to map %" PRIu32 " bytes", header.total_size);
+
+                return false;
+            }
+
+            sp_base = static_cast<const uint8_t *>(mapping);
+            sp_header = reinterpret_cast<const pack_header *>(sp_base);
+            sp_index = reinterpret_cast<const pack_entry *>(sp_base + header.index_offset);
+
+            sp_decoder = lv_img_decoder_create();
+            lv_img_decoder_set_info_cb(sp_decoder, decoder_info);
+            lv_img_decoder_set_open_cb(sp_decoder, decoder_open);
+
+            ESP_LOGI(TAG, "mapped %u assets, %" PRIu32 " bytes", header.entry_count, header.total_size);
+
+            return true;
+        }
+
+        void unmount()
+        {
+            std::lock_guard<std::mutex> lock(s_mutex);
+
+            if (!sp_base)
+                return;
+
+            lv_img_decoder_delete(sp_decoder);
+            lv_img_cache_invalidate_src(nullptr);
+
+            s_fonts.clear();
+
+            esp_partition_munmap(s_mmap_handle);
+
+            sp_decoder = nullptr;
+            sp_index = nullptr;
+            sp_header = nullptr;
+            sp_base = nullptr;
+        }
+
+        bool mounted()
+        {
+            return sp_base;
+        }
+
+        bool find(uint32_t name_hash, asset &result)
+        {
+            HARDWARE_TRACE_SCOPE(ASSETS_FIND);
+
+            if (!sp_base)
+                return false;
+
+            const uint32_t mask = sp_header->slot_count - 1;
+
+            for (uint32_t probe = 0, slot = name_hash & mask; probe <= mask; probe++, slot = (slot + 1) & mask)
+            {
+                const pack_entry &entry = sp_index[slot];
+
+                if (!entry.hash)
+                    return false;
+
+                if (entry.hash != name_hash)
+                    continue;
+
+                if (entry.offset + entry.size > sp_header->total_size)
+                    return false;
+
+                result = {
+                    .data = sp_base + entry.offset,
+                    .size = entry.size,
+                    .type = static_cast<kind>(entry.kind),
+                    .format = entry.format,
+                    .width = entry.width,
+                    .height = entry.height,
+                };
+
+                return true;
+            }
+
+            return false;
+        }
+
+        bool find(const char *name, asset &result)
+        {
+            return find(hash(name), result);
+        }
+
+        const lv_font_t *font(const char *name)
+        {
+            const uint32_t name_hash = hash(name);
+
+            std::lock_guard<std::mutex> lock(s_mutex);
+
+            if (auto it = s_fonts.find(name_hash); it != s_fonts.end())
+                return &it->second->font;
+
+            asset data;
+
+            if (!find(name_hash, data) || data.type != kind::font || data.size < sizeof(font_header))
+                return nullptr;
+
+            const auto header = reinterpret_cast<const font_header *>(data.data);
+
+            if (header->cmap_offset + header->cmap_count * sizeof(font_cmap) > data.size ||
+                header->glyph_dsc_offset > data.size || header->glyph_bitmap_offset > data.size)
+            {
+                ESP_LOGE(TAG, "%s: corrupted font", name);
+
+                return nullptr;
+            }
+
+            auto holder = std::make_unique<font_holder>();
+            auto records = reinterpret_cast<const font_cmap *>(data.data + header->cmap_offset);
+
+            holder->cmaps = std::make_unique<lv_font_fmt_txt_cmap_t[]>(header->cmap_count);
+
+            for (size_t i = 0; i < header->cmap_count; i++)
+            {
+                const font_cmap &record = records[i];
+
+                holder->cmaps[i] = {
+                    .range_start = record.range_start,
+                    .range_length = record.range_length,
+                    .glyph_id_start = record.glyph_id_start,
+                    .unicode_list = record.unicode_list_offset ? reinterpret_cast<const uint16_t *>(data.data + record.unicode_list_offset) : nullptr,
+                    .glyph_id_ofs_list = record.glyph_id_ofs_list_offset ? data.data + record.glyph_id_ofs_list_offset : nullptr,
+                    .list_length = record.list_length,
+                    .type = static_cast<lv_font_fmt_txt_cmap_type_t>(record.type),
+                };
+            }
+
+            lv_font_fmt_txt_dsc_t &dsc = holder->dsc;
+
+            dsc.glyph_bitmap = data.data + header->glyph_bitmap_offset;
+            dsc.glyph_dsc = reinterpret_cast<const lv_font_fmt_txt_glyph_dsc_t *>(data.data + header->glyph_dsc_offset);
+            dsc.cmaps = holder->cmaps.get();
+            dsc.kern_dsc = nullptr;
+            dsc.kern_scale = 0;
+            dsc.cmap_num = header->cmap_count;
+            dsc.bpp = header->bpp;
+            dsc.kern_classes = 0;
+            dsc.bitmap_format = header->bitmap_format;
+            dsc.cache = &holder->cache;
+
+            lv_font_t &font = holder->font;
+
+            font.get_glyph_dsc = lv_font_get_glyph_dsc_fmt_txt;
+            font.get_glyph_bitmap = lv_font_get_bitmap_fmt_txt;
+            font.line_height = header->line_height;
+            font.base_line = header->base_line;
+            font.subpx = LV_FONT_SUBPX_NONE;
+            font.underline_position = header->underline_position;
+            font.underline_thickness = header->underline_thickness;
+            font.dsc = &holder->dsc;
+
+            return &s_fonts.emplace(name_hash, std::move(holder)).first->second->font;
+        }
+    }
+}
@@ -1,4 +1,5 @@
 #include "hardware/battery.h"
+#include "hardware/trace.h"
 
 #include <esp_adc/adc_oneshot.h>
 
@@ -55,6 +56,8 @@ namespace hardware
 
     uint32_t battery::voltage_level()
     {
+        HARDWARE_TRACE_SCOPE(BATTERY_READ);
+
         auto implementation = static_cast<battery_implementation *>(mp_implementation);
 
         int adc_raw = 0;
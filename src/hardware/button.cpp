@@ -1,15 +1,26 @@
 #include "hardware/button.h"
+#include "hardware/trace.h"
 
 #include <algorithm>
+#include <mutex>
+
 #include <esp_timer.h>
 
 namespace hardware
 {
     std::vector<std::unique_ptr<button>> button::s_buttons;
-    std::vector<button::key_event> button::s_key_events;
+    button::key_event button::s_pending = {};
+
+    constexpr int64_t DEBOUNCE_MS = 100;
+
+    // The buttons are added and removed by the app while the input task ticks them.
+    static std::mutex s_buttons_mutex;
+    static bus::subscriber<button::key_event, 8> s_polled_keys;
 
     void button::add(gpio_num_t pin, uint32_t id)
     {
+        std::lock_guard<std::mutex> lock(s_buttons_mutex);
+
         for (auto &btn : s_buttons)
             if (btn->m_pin == pin)
             {
@@ -28,40 +39,69 @@ namespace hardware
             return btn->m_pin == pin;
         };
 
+        std::lock_guard<std::mutex> lock(s_buttons_mutex);
+
         s_buttons.erase(std::remove_if(s_buttons.begin(), s_buttons.end(), predicate), s_buttons.end());
     }
 
     void button::tick()
     {
+        HARDWARE_TRACE_SCOPE(BUTTON_TICK);
+
+        const int64_t now = esp_timer_get_time() / 1000LL;
+
+        std::lock_guard<std::mutex> lock(s_buttons_mutex);
+
         for (auto &btn : s_buttons)
             if (btn->m_last_state == gpio_get_level(btn->m_pin))
             {
                 btn->m_last_state = !btn->m_last_state;
 
-                s_key_events.push_back({btn->m_id, btn->m_last_state, (esp_timer_get_time() / 1000LL)});
+                // An edge the other way ends the chord collected so far.
+                if (s_pending.id && s_pending.state != btn->m_last_state)
+                    publish_pending();
+
+                if (!s_pending.id)
+                    s_pending = {.id = 0, .state = btn->m_last_state, .timestamp = now};
+
+                s_pending.id |= btn->m_id;
             }
+
+        if (s_pending.id && now - s_pending.timestamp > DEBOUNCE_MS)
+            publish_pending();
+    }
+
+    void button::publish_pending()
+    {
+        HARDWARE_TRACE_INSTANT(BUTTON_KEY, s_pending.id);
+
+        key_events().publish(s_pending);
+
+        s_pending = {};
     }
 
     const button::key_event button::get_data()
     {
-        button::tick();
+        // Subscribed with the first call, so only apps that poll pay for the queue.
+        static const bool s_subscribed = s_polled_keys.subscribe(key_events());
 
         key_event data{.id = 0, .state = false, .timestamp = 0};
 
-        if (s_key_events.size() && ((esp_timer_get_time() / 1000LL) - s_key_events.front().timestamp > 100))
-        {
-            auto same_state_it = s_key_events.begin() + 1;
-            data = s_key_events.front();
+        tick();
 
-            while (same_state_it != s_key_events.end() && same_state_it->state == data.state)
-                data.id |= same_state_it++->id;
-
-            s_key_events.erase(s_key_events.begin(), same_state_it);
-        }
+        if (s_subscribed)
+            s_polled_keys.receive(data);
 
         return data;
     }
 
+    bus::channel<button::key_event> &button::key_events()
+    {
+        static constinit bus::topic<key_event> s_topic{"button.key"};
+
+        return s_topic;
+    }
+
     button::button(gpio_num_t pin, uint32_t id) : m_pin(pin),
                                                   m_id(id),
                                                   m_last_state(false)
@@ -0,0 +1,629 @@
+#include "hardware/compression.h"
+#include "hardware/storage.h"
+#include "hardware/trace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <esp_log.h>
+
+namespace hardware
+{
+    namespace storage
+    {
+        namespace lz4
+        {
+            constexpr size_t MIN_MATCH = 4;
+            constexpr size_t LAST_LITERALS = 5;
+            constexpr size_t MATCH_FIND_LIMIT = 12;
+            constexpr size_t MAX_DISTANCE = 0xffff;
+
+            static uint32_t read32(const uint8_t *data)
+            {
+                uint32_t value;
+
+                memcpy(&value, data, sizeof(value));
+
+                return value;
+            }
+
+            static size_t hash(uint32_t sequence)
+            {
+                return (sequence * 2654435761U) >> (32 - 12);
+            }
+
+            static uint8_t *write_length(uint8_t *output, const uint8_t *end, size_t length)
+            {
+                for (; length >= 255; length -= 255)
+                {
+                    if (output >= end)
+                        return nullptr;
+
+                    *output++ = 255;
+                }
+
+                if (output >= end)
+                    return nullptr;
+
+                *output++ = length;
+
+                return output;
+            }
+
+            static uint8_t *write_sequence(uint8_t *output, const uint8_t *end, const uint8_t *literals, size_t literal_length,
+                                           size_t offset, size_t match_length)
+            {
+                if (output >= end)
+                    return nullptr;
+
+                uint8_t *token = output++;
+
+                *token = std::min<size_t>(literal_length, 15) << 4;
+
+                if (literal_length >= 15 && !(output = write_length(output, end, literal_length - 15)))
+                    return nullptr;
+
+                if (static_cast<size_t>(end - output) < literal_length)
+                    return nullptr;
+
+                memcpy(output, literals, literal_length);
+                output += literal_length;
+
+                // The last sequence of a block only carries literals.
+                if (!match_length)
+                    return output;
+
+                if (end - output < 2)
+                    return nullptr;
+
+                *output++ = offset;
+                *output++ = offset >> 8;
+
+                match_length -= MIN_MATCH;
+
+                *token |= std::min<size_t>(match_length, 15);
+
+                if (match_length >= 15 && !(output = write_length(output, end, match_length - 15)))
+                    return nullptr;
+
+                return output;
+            }
+
+            size_t compress(const uint8_t *input, size_t size, uint8_t *output, size_t capacity, uint16_t *hash_table)
+            {
+                if (size > MAX_BLOCK_SIZE)
+                    return 0;
+
+                const uint8_t *const end = output + capacity;
+                uint8_t *out = output;
+                size_t anchor = 0;
+
+                if (size >= MATCH_FIND_LIMIT + 1)
+                {
+                    memset(hash_table, 0, HASH_ENTRIES * sizeof(uint16_t));
+
+                    const size_t match_limit = size - LAST_LITERALS;
+                    size_t position = 0;
+
+                    while (position < size - MATCH_FIND_LIMIT)
+                    {
+                        const uint32_t sequence = read32(input + position);
+                        const size_t slot = hash(sequence);
+                        const size_t candidate = hash_table[slot];
+
+                        hash_table[slot] = position;
+
+                        if (candidate >= position || position - candidate > MAX_DISTANCE || read32(input + candidate) != sequence)
+                        {
+                            position++;
+
+                            continue;
+                        }
+
+                        size_t length = MIN_MATCH;
+
+                        while (position + length < match_limit && input[candidate + length] == input[position + length])
+                            length++;
+
+                        if (!(out = write_sequence(out, end, input + anchor, position - anchor, position - candidate, length)))
+                            return 0;
+
+                        position += length;
+                        anchor = position;
+                    }
+                }
+
+                if (!(out = write_sequence(out, end, input + anchor, size - anchor, 0, 0)))
+                    return 0;
+
+                return out - output;
+            }
+
+            size_t decompress(const uint8_t *input, size_t size, uint8_t *output, size_t capacity)
+            {
+                const uint8_t *in = input;
+                const uint8_t *const in_end = input + size;
+                uint8_t *out = output;
+                uint8_t *const out_end = output + capacity;
+
+                auto read_length = [&](size_t length) -> size_t
+                {
+                    if (length != 15)
+                        return length;
+
+                    for (uint8_t byte = 255; byte == 255;)
+                    {
+                        if (in >= in_end)
+                            return SIZE_MAX;
+
+                        byte = *in++;
+                        length += byte;
+                    }
+
+                    return length;
+                };
+
+                while (in < in_end)
+                {
+                    const uint8_t token = *in++;
+                    const size_t literal_length = read_length(token >> 4);
+
+                    if (literal_length > static_cast<size_t>(in_end - in) || literal_length > static_cast<size_t>(out_end - out))
+                        return 0;
+
+                    memcpy(out, in, literal_length);
+                    in += literal_length;
+                    out += literal_length;
+
+                    if (in == in_end)
+                        break;
+
+                    if (in_end - in < 2)
+                        return 0;
+
+                    const size_t offset = in[0] | (in[1] << 8);
+
+                    in += 2;
+
+                    const size_t match_length = read_length(token & 0x0f);
+
+                    if (match_length == SIZE_MAX || !offset || offset > static_cast<size_t>(out - output) ||
+                        match_length + MIN_MATCH > static_cast<size_t>(out_end - out))
+                        return 0;
+
+                    // Matches may overlap the bytes they produce, so copy forward byte by byte.
+                    const uint8_t *match = out - offset;
+
+                    for (size_t i = 0; i < match_length + MIN_MATCH; i++)
+                        *out++ = *match++;
+                }
+
+                return out - output;
+            }
+        }
+
+        constexpr const char *TAG = "compression";
+        constexpr uint32_t FILE_MAGIC = 0x315a4352;  // "RCZ1"
+        constexpr uint32_t INDEX_MAGIC = 0x495a4352; // "RCZI"
+        constexpr uint32_t STORED_FLAG = 0x80000000;
+        constexpr uint16_t BLOCK_MARKER = 0xb10c;
+
+        struct __attribute__((packed)) file_header
+        {
+            uint32_t magic;
+            uint32_t block_size;
+            uint64_t reserved;
+        };
+
+        struct __attribute__((packed)) block_header
+        {
+            uint32_t stored_size;
+            uint16_t raw_size;
+            uint16_t marker;
+        };
+
+        struct __attribute__((packed)) file_trailer
+        {
+            uint32_t index_offset;
+            uint32_t block_count;
+            uint64_t size;
+            uint32_t reserved;
+            uint32_t magic;
+        };
+
+        struct compressed_writer_implementation
+        {
+            bool write_all(const void *data, size_t size)
+            {
+                const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+                while (size)
+                {
+                    const ssize_t written = ::write(m_fd, bytes, size);
+
+                    if (written <= 0)
+                        return false;
+
+                    bytes += written;
+                    size -= written;
+                    m_offset += written;
+                }
+
+                return true;
+            }
+
+            bool flush_block()
+            {
+                if (!m_fill)
+                    return true;
+
+                HARDWARE_TRACE_SCOPE(COMPRESSION_COMPRESS, m_fill);
+
+                const size_t compressed = lz4::compress(m_block.data(), m_fill, m_output.data(), m_fill - 1, m_hash_table.data());
+
+                block_header header = {
+                    .stored_size = static_cast<uint32_t>(compressed ? compressed : m_fill | STORED_FLAG),
+                    .raw_size = static_cast<uint16_t>(m_fill),
+                    .marker = BLOCK_MARKER,
+                };
+
+                m_index.push_back(m_offset);
+
+                const bool written = write_all(&header, sizeof(header)) &&
+                                     write_all(compressed ? m_output.data() : m_block.data(), compressed ? compressed : m_fill);
+
+                m_statistics.blocks++;
+                m_statistics.stored_blocks += compressed ? 0 : 1;
+                m_statistics.output_bytes += sizeof(header) + (compressed ? compressed : m_fill);
+
+                m_fill = 0;
+
+                return written;
+            }
+
+            int m_fd = -1;
+            size_t m_block_size = 0;
+            uint32_t m_offset = 0;
+            uint64_t m_size = 0;
+
+            std::vector<uint8_t> m_block;
+            std::vector<uint8_t> m_output;
+            std::vector<uint16_t> m_hash_table;
+            std::vector<uint32_t> m_index;
+            size_t m_fill = 0;
+
+            compressed_writer::statistics m_statistics = {};
+        };
+
+        compressed_writer::compressed_writer(const char *path, size_t block_size) : mp_implementation(std::make_unique<compressed_writer_implementation>())
+        {
+            auto implementation = mp_implementation.get();
+
+            implementation->m_block_size = std::clamp<size_t>(block_size, 256, lz4::MAX_BLOCK_SIZE);
+
+            wait(type::internal);
+
+            implementation->m_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+            if (implementation->m_fd < 0)
+            {
+                ESP_LOGE(TAG, "failed to create %s", path);
+
+                return;
+            }
+
+            implementation->m_block.resize(implementation->m_block_size);
+            implementation->m_output.resize(implementation->m_block_size);
+            implementation->m_hash_table.resize(lz4::HASH_ENTRIES);
+
+            const file_header header = {
+                .magic = FILE_MAGIC,
+                .block_size = static_cast<uint32_t>(implementation->m_block_size),
+                .reserved = 0,
+            };
+
+            implementation->write_all(&header, sizeof(header));
+        }
+
+        compressed_writer::~compressed_writer()
+        {
+            close();
+        }
+
+        bool compressed_writer::is_open()
+        {
+            return mp_implementation->m_fd >= 0;
+        }
+
+        size_t compressed_writer::write(const void *data, size_t size)
+        {
+            auto implementation = mp_implementation.get();
+
+            if (implementation->m_fd < 0)
+                return 0;
+
+            const uint8_t *bytes = static_cast<const uint8_t *>(data);
+            size_t done = 0;
+
+            while (done < size)
+            {
+                const size_t chunk = std::min(size - done, implementation->m_block_size - implementation->m_fill);
+
+                memcpy(implementation->m_block.data() + implementation->m_fill, bytes + done, chunk);
+
+                implementation->m_fill += chunk;
+                done += chunk;
+
+                if (implementation->m_fill == implementation->m_block_size && !implementation->flush_block())
+                    break;
+            }
+
+            implementation->m_size += done;
+            implementation->m_statistics.input_bytes += done;
+
+            return done;
+        }
+
+        bool compressed_writer::close()
+        {
+            auto implementation = mp_implementation.get();
+
+            if (implementation->m_fd < 0)
+                return false;
+
+            bool result = implementation->flush_block();
+
+            const file_trailer trailer = {
+                .index_offset = implementation->m_offset,
+                .block_count = static_cast<uint32_t>(implementation->m_index.size()),
+                .size = implementation->m_size,
+                .reserved = 0,
+                .magic = INDEX_MAGIC,
+            };
+
+            result = result && implementation->write_all(implementation->m_index.data(), implementation->m_index.size() * sizeof(uint32_t));
+            result = result && implementation->write_all(&trailer, sizeof(trailer));
+
+            ::close(implementation->m_fd);
+
+            implementation->m_fd = -1;
+
+            return result;
+        }
+
+        compressed_writer::statistics compressed_writer::get_statistics()
+        {
+            return mp_implementation->m_statistics;
+        }
+
+        struct compressed_reader_implementation
+        {
+            // Returns a pointer to size bytes at offset, either straight into the mapping or copied into scratch.
+            const uint8_t *fetch(uint64_t offset, size_t size, uint8_t *scratch)
+            {
+                if (offset + size > m_file_size)
+                    return nullptr;
+
+                if (mp_data)
+                    return mp_data + offset;
+
+                if (pread(m_fd, scratch, size, offset) != static_cast<ssize_t>(size))
+                    return nullptr;
+
+                return scratch;
+            }
+
+            bool copy(uint64_t offset, void *destination, size_t size)
+            {
+                const uint8_t *source = fetch(offset, size, static_cast<uint8_t *>(destination));
+
+                if (!source)
+                    return false;
+
+                if (source != destination)
+                    memcpy(destination, source, size);
+
+                return true;
+            }
+
+            bool load_index()
+            {
+                file_header header;
+                file_trailer trailer;
+
+                if (!copy(0, &header, sizeof(header)) || header.magic != FILE_MAGIC || !header.block_size ||
+                    header.block_size > lz4::MAX_BLOCK_SIZE)
+                    return false;
+
+                m_block_size = header.block_size;
+
+                if (m_file_size >= sizeof(header) + sizeof(trailer) && copy(m_file_size - sizeof(trailer), &trailer, sizeof(trailer)) &&
+                    trailer.magic == INDEX_MAGIC &&
+                    trailer.index_offset + uint64_t(trailer.block_count) * sizeof(uint32_t) + sizeof(trailer) == m_file_size)
+                {
+                    m_index.resize(trailer.block_count);
+                    m_size = trailer.size;
+
+                    return copy(trailer.index_offset, m_index.data(), trailer.block_count * sizeof(uint32_t));
+                }
+
+                // No index, the writer did not get to close the file: walk the block headers.
+                ESP_LOGW(TAG, "rebuilding block index");
+
+                m_size = 0;
+
+                for (uint64_t offset = sizeof(header); offset + sizeof(block_header) <= m_file_size;)
+                {
+                    block_header block;
+
+                    if (!copy(offset, &block, sizeof(block)))
+                        break;
+
+                    const uint32_t stored = block.stored_size & ~STORED_FLAG;
+
+                    if (block.marker != BLOCK_MARKER || !block.raw_size || block.raw_size > m_block_size ||
+                        offset + sizeof(block) + stored > m_file_size)
+                        break;
+
+                    m_index.push_back(offset);
+                    m_size += block.raw_size;
+
+                    offset += sizeof(block) + stored;
+
+                    // Only the final block may be short.
+                    if (block.raw_size < m_block_size)
+                        break;
+                }
+
+                return true;
+            }
+
+            bool load_block(size_t block)
+            {
+                if (block == m_cached_block)
+                    return true;
+
+                HARDWARE_TRACE_SCOPE(COMPRESSION_DECOMPRESS, block);
+
+                block_header header;
+
+                if (!copy(m_index[block], &header, sizeof(header)))
+                    return false;
+
+                const uint32_t stored = header.stored_size & ~STORED_FLAG;
+
+                // A stored block is copied as it is into the block buffer, so it has to be exactly
+                // as large as the data it claims to hold.
+                if (header.marker != BLOCK_MARKER || header.raw_size > m_block_size || stored > lz4::bound(m_block_size) ||
+                    ((header.stored_size & STORED_FLAG) && stored != header.raw_size))
+                    return false;
+
+                const uint8_t *payload = fetch(m_index[block] + sizeof(header), stored, m_compressed.data());
+
+                if (!payload)
+                    return false;
+
+                if (header.stored_size & STORED_FLAG)
+                    memcpy(m_block.data(), payload, stored);
+                else if (lz4::decompress(payload, stored, m_block.data(), m_block_size) != header.raw_size)
+                    return false;
+
+                m_cached_block = block;
+                m_cached_size = header.raw_size;
+
+                return true;
+            }
+
+            int m_fd = -1;
+            const uint8_t *mp_data = nullptr;
+            uint64_t m_file_size = 0;
+
+            size_t m_block_size = 0;
+            uint64_t m_size = 0;
+            std::vector<uint32_t> m_index;
+
+            std::vector<uint8_t> m_block;
+            std::vector<uint8_t> m_compressed;
+            size_t m_cached_block = SIZE_MAX;
+            size_t m_cached_size = 0;
+            bool m_valid = false;
+        };
+
+        static void prepare(compressed_reader_implementation *implementation)
+        {
+            if (!implementation->load_index())
+            {
+                ESP_LOGE(TAG, "not a compressed file");
+
+                return;
+            }
+
+            implementation->m_block.resize(implementation->m_block_size);
+
+            if (!implementation->mp_data)
+                implementation->m_compressed.resize(lz4::bound(implementation->m_block_size));
+
+            implementation->m_valid = true;
+        }
+
+        compressed_reader::compressed_reader(const char *path) : mp_implementation(std::make_unique<compressed_reader_implementation>())
+        {
+            auto implementation = mp_implementation.get();
+
+            wait(type::internal);
+
+            implementation->m_fd = open(path, O_RDONLY);
+
+            if (implementation->m_fd < 0)
+            {
+                ESP_LOGE(TAG, "failed to open %s", path);
+
+                return;
+            }
+
+            const off_t size = lseek(implementation->m_fd, 0, SEEK_END);
+
+            implementation->m_file_size = size > 0 ? size : 0;
+
+            prepare(implementation);
+        }
+
+        compressed_reader::compressed_reader(const uint8_t *data, size_t size) : mp_implementation(std::make_unique<compressed_reader_implementation>())
+        {
+            mp_implementation->mp_data = data;
+            mp_implementation->m_file_size = size;
+
+            prepare(mp_implementation.get());
+        }
+
+        compressed_reader::~compressed_reader()
+        {
+            if (mp_implementation->m_fd >= 0)
+                close(mp_implementation->m_fd);
+        }
+
+        bool compressed_reader::is_open()
+        {
+            return mp_implementation->m_valid;
+        }
+
+        uint64_t compressed_reader::size()
+        {
+            return mp_implementation->m_size;
+        }
+
+        size_t compressed_reader::read(uint64_t offset, void *data, size_t size)
+        {
+            auto implementation = mp_implementation.get();
+
+            if (!implementation->m_valid)
+                return 0;
+
+            uint8_t *out = static_cast<uint8_t *>(data);
+            size_t done = 0;
+
+            // Every block but the last holds exactly block_size bytes, so the block is found by division.
+            while (done < size && offset < implementation->m_size)
+            {
+                const size_t block = offset / implementation->m_block_size;
+                const size_t within = offset % implementation->m_block_size;
+
+                if (block >= implementation->m_index.size() || !implementation->load_block(block) || within >= implementation->m_cached_size)
+                    break;
+
+                const size_t chunk = std::min(size - done, implementation->m_cached_size - within);
+
+                memcpy(out + done, implementation->m_block.data() + within, chunk);
+
+                done += chunk;
+                offset += chunk;
+            }
+
+            return done;
+        }
+    }
+}
@@ -1,9 +1,11 @@
 #include "hardware/display.h"
+#include "hardware/trace.h"
 
 #include <driver/gpio.h>
 #include <esp_lcd_panel_io.h>
 #include <esp_lcd_panel_ops.h>
 #include <esp_lcd_panel_vendor.h>
+#include <esp_timer.h>
 
 constexpr gpio_num_t PIN_LCD_BACKLIGHT = GPIO_NUM_38;
 constexpr gpio_num_t PIN_LCD_CS = GPIO_NUM_6;
@@ -24,6 +26,8 @@ constexpr gpio_num_t PIN_LCD_WR = GPIO_NUM_8;
 constexpr uint16_t LCD_PIXELS_WIDTH = 320;
 constexpr uint16_t LCD_PIXELS_HEIGHT = 170;
 constexpr uint8_t LCD_COLOR_SIZE = 2;
+constexpr uint16_t LCD_TRANSFER_LINES = 40;
+constexpr size_t LCD_MAX_TRANSFER_BYTES = LCD_COLOR_SIZE * LCD_PIXELS_WIDTH * LCD_TRANSFER_LINES;
 
 namespace hardware
 {
@@ -68,7 +72,7 @@ namespace hardware
                     PIN_LCD_D7,
                 },
             .bus_width = 8,
-            .max_transfer_bytes = LCD_COLOR_SIZE * LCD_PIXELS_WIDTH * 16,
+            .max_transfer_bytes = LCD_MAX_TRANSFER_BYTES,
             .psram_trans_align = 32,
             .sram_trans_align = 4,
         };
@@ -79,7 +83,12 @@ namespace hardware
         {
             auto disp = static_cast<display *>(user_ctx);
 
-            disp->m_on_transfer_done_callback(disp->m_on_transfer_done_user_data);
+            HARDWARE_TRACE_INSTANT(DISPLAY_TRANSFER_DONE);
+
+            if (disp->m_on_transfer_done_callback)
+                disp->m_on_transfer_done_callback(disp->m_on_transfer_done_user_data);
+
+            transfer_events().publish({esp_timer_get_time()});
 
             return false;
         };
@@ -152,6 +161,11 @@ namespace hardware
         return LCD_PIXELS_HEIGHT;
     }
 
+    size_t display::max_transfer_bytes()
+    {
+        return LCD_MAX_TRANSFER_BYTES;
+    }
+
     void display::set_backlight(brightness_level level)
     {
         switch (level)
@@ -169,6 +183,13 @@ namespace hardware
         }
     }
 
+    bus::channel<display::transfer_event> &display::transfer_events()
+    {
+        static constinit bus::topic<transfer_event> s_topic{"display.transfer"};
+
+        return s_topic;
+    }
+
     void display::set_transfer_done_callback(transfer_done_callback_t on_transfer_done, void *user_data)
     {
         m_on_transfer_done_callback = on_transfer_done;
@@ -177,6 +198,8 @@ namespace hardware
 
     void display::set_bitmap(uint16_t x1, uint16_t x2, uint16_t y1, uint16_t y2, uint16_t *data)
     {
+        HARDWARE_TRACE_SCOPE(DISPLAY_SET_BITMAP, y2 - y1 + 1);
+
         esp_lcd_panel_draw_bitmap(mp_implementation->panel_handle, x1, y1, x2 + 1, y2 + 1, data);
     }
 }
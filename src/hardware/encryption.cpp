@@ -0,0 +1,432 @@
+#include "hardware/encryption.h"
+#include "hardware/storage.h"
+#include "hardware/trace.h"
+
+#include "encryption_key.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <esp_heap_caps.h>
+#include <esp_hmac.h>
+#include <esp_log.h>
+#include <mbedtls/aes.h>
+#include <mbedtls/sha256.h>
+#include <sdkconfig.h>
+
+namespace hardware
+{
+    namespace storage
+    {
+        constexpr const char *TAG = "encryption";
+        constexpr const char *FILE_KEY_PURPOSE = "littlefs";
+        constexpr uint32_t FILE_MAGIC = 0x31454352; // "RCE1"
+        constexpr size_t KEY_CHECK_SIZE = 16;
+        constexpr size_t IV_SIZE = 16;
+
+        struct __attribute__((packed)) file_header
+        {
+            uint32_t magic;
+            uint32_t block_size;
+            uint64_t size;
+            uint8_t key_check[KEY_CHECK_SIZE];
+        };
+
+        static_assert(sizeof(file_header) == 32);
+
+        static std::mutex s_key_mutex;
+        static uint8_t s_file_key[ENCRYPTION_KEY_SIZE];
+        static bool s_file_key_loaded = false;
+
+        bool derive_key(const char *purpose, uint8_t (&key)[ENCRYPTION_KEY_SIZE])
+        {
+#ifdef CONFIG_NVS_SEC_KEY_PROTECT_USING_HMAC
+            const auto key_id = static_cast<hmac_key_id_t>(CONFIG_NVS_SEC_HMAC_EFUSE_KEY_ID);
+            const esp_err_t error = key_id < HMAC_KEY_MAX ? esp_hmac_calculate(key_id, purpose, strlen(purpose), key) : ESP_ERR_INVALID_ARG;
+
+            if (error != ESP_OK)
+                ESP_LOGE(TAG, "HMAC key %d unavailable: %s", CONFIG_NVS_SEC_HMAC_EFUSE_KEY_ID, esp_err_to_name(error));
+
+            return error == ESP_OK;
+#else
+            ESP_LOGE(TAG, "no HMAC eFuse key configured");
+
+            return false;
+#endif
+        }
+
+        bool load_file_key()
+        {
+            std::lock_guard<std::mutex> lock(s_key_mutex);
+
+            if (!s_file_key_loaded)
+                s_file_key_loaded = derive_key(FILE_KEY_PURPOSE, s_file_key);
+
+            return s_file_key_loaded;
+        }
+
+        struct encrypted_file_implementation
+        {
+            encrypted_file_implementation()
+            {
+                mbedtls_aes_init(&m_encrypt);
+                mbedtls_aes_init(&m_decrypt);
+                mbedtls_aes_init(&m_essiv);
+            }
+
+            ~encrypted_file_implementation()
+            {
+                mbedtls_aes_free(&m_encrypt);
+                mbedtls_aes_free(&m_decrypt);
+                mbedtls_aes_free(&m_essiv);
+
+                heap_caps_free(m_plain);
+                heap_caps_free(m_cipher);
+            }
+
+            bool open(const char *path, encrypted_file::mode open_mode, const uint8_t (&key)[ENCRYPTION_KEY_SIZE])
+            {
+                uint8_t digest[32];
+
+                // ESSIV: initialisation vectors are the block number encrypted with a hash of the key.
+                mbedtls_sha256(key, sizeof(key), digest, 0);
+
+                if (mbedtls_aes_setkey_enc(&m_encrypt, key, 256) || mbedtls_aes_setkey_dec(&m_decrypt, key, 256) ||
+                    mbedtls_aes_setkey_enc(&m_essiv, digest, 256))
+                    return false;
+
+                mbedtls_sha256(digest, sizeof(digest), digest, 0);
+                memcpy(m_key_check, digest, sizeof(m_key_check));
+
+                m_plain = static_cast<uint8_t *>(heap_caps_malloc(encrypted_file::BLOCK_SIZE, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL));
+                m_cipher = static_cast<uint8_t *>(heap_caps_malloc(encrypted_file::BLOCK_SIZE, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL));
+
+                if (!m_plain || !m_cipher)
+                {
+                    ESP_LOGE(TAG, "not enough DMA memory for block buffers");
+
+                    return false;
+                }
+
+                m_writable = open_mode != encrypted_file::mode::read;
+
+                const int flags = open_mode == encrypted_file::mode::read    ? O_RDONLY
+                                  : open_mode == encrypted_file::mode::write ? O_RDWR | O_CREAT | O_TRUNC
+                                                                             : O_RDWR | O_CREAT;
+
+                wait(type::internal);
+
+                m_fd = ::open(path, flags, 0644);
+
+                if (m_fd < 0)
+                {
+                    ESP_LOGE(TAG, "failed to open %s", path);
+
+                    return false;
+                }
+
+                file_header header;
+                const ssize_t count = pread(m_fd, &header, sizeof(header), 0);
+
+                if (count == 0 && m_writable)
+                {
+                    m_size = 0;
+                    m_header_dirty = true;
+
+                    return true;
+                }
+
+                if (count != sizeof(header) || header.magic != FILE_MAGIC || header.block_size != encrypted_file::BLOCK_SIZE)
+                {
+                    ESP_LOGE(TAG, "%s is not an encrypted file", path);
+
+                    return false;
+                }
+
+                if (memcmp(header.key_check, m_key_check, sizeof(m_key_check)))
+                {
+                    ESP_LOGE(TAG, "%s was encrypted with a different key", path);
+
+                    return false;
+                }
+
+                m_size = header.size;
+
+                return true;
+            }
+
+            void initialisation_vector(uint64_t block, uint8_t (&iv)[IV_SIZE])
+            {
+                uint8_t sector[IV_SIZE] = {};
+
+                for (size_t i = 0; i < sizeof(block); i++)
+                    sector[i] = block >> (8 * i);
+
+                mbedtls_aes_crypt_ecb(&m_essiv, MBEDTLS_AES_ENCRYPT, sector, iv);
+            }
+
+            static off_t block_offset(uint64_t block)
+            {
+                return sizeof(file_header) + block * encrypted_file::BLOCK_SIZE;
+            }
+
+            uint64_t stored_blocks() const
+            {
+                return (m_size + encrypted_file::BLOCK_SIZE - 1) / encrypted_file::BLOCK_SIZE;
+            }
+
+            bool store_block()
+            {
+                if (!m_block_dirty)
+                    return true;
+
+                HARDWARE_TRACE_SCOPE(ENCRYPTION_STORE, m_block);
+
+                uint8_t iv[IV_SIZE];
+
+                initialisation_vector(m_block, iv);
+
+                if (mbedtls_aes_crypt_cbc(&m_encrypt, MBEDTLS_AES_ENCRYPT, encrypted_file::BLOCK_SIZE, iv, m_plain, m_cipher) ||
+                    pwrite(m_fd, m_cipher, encrypted_file::BLOCK_SIZE, block_offset(m_block)) != static_cast<ssize_t>(encrypted_file::BLOCK_SIZE))
+                {
+                    ESP_LOGE(TAG, "failed to store block %llu", static_cast<unsigned long long>(m_block));
+
+                    return false;
+                }
+
+                m_block_dirty = false;
+
+                return true;
+            }
+
+            // With whole set, the caller overwrites the block entirely and nothing is read.
+            bool load_block(uint64_t block, bool whole)
+            {
+                if (m_block_valid && m_block == block)
+                    return true;
+
+                HARDWARE_TRACE_SCOPE(ENCRYPTION_LOAD, block);
+
+                if (!store_block())
+                    return false;
+
+                m_block_valid = false;
+                m_block = block;
+
+                if (whole || block >= stored_blocks())
+                    memset(m_plain, 0, encrypted_file::BLOCK_SIZE);
+                else
+                {
+                    uint8_t iv[IV_SIZE];
+
+                    initialisation_vector(block, iv);
+
+                    if (pread(m_fd, m_cipher, encrypted_file::BLOCK_SIZE, block_offset(block)) != static_cast<ssize_t>(encrypted_file::BLOCK_SIZE) ||
+                        mbedtls_aes_crypt_cbc(&m_decrypt, MBEDTLS_AES_DECRYPT, encrypted_file::BLOCK_SIZE, iv, m_cipher, m_plain))
+                    {
+                        ESP_LOGE(TAG, "failed to load block %llu", static_cast<unsigned long long>(block));
+
+                        return false;
+                    }
+                }
+
+                m_block_valid = true;
+
+                return true;
+            }
+
+            bool flush()
+            {
+                if (!store_block())
+                    return false;
+
+                if (!m_header_dirty)
+                    return true;
+
+                file_header header = {
+                    .magic = FILE_MAGIC,
+                    .block_size = encrypted_file::BLOCK_SIZE,
+                    .size = m_size,
+                    .key_check = {},
+                };
+
+                memcpy(header.key_check, m_key_check, sizeof(header.key_check));
+
+                if (pwrite(m_fd, &header, sizeof(header), 0) != sizeof(header))
+                    return false;
+
+                m_header_dirty = false;
+
+                return true;
+            }
+
+            int m_fd = -1;
+            bool m_writable = false;
+            uint64_t m_size = 0;
+            bool m_header_dirty = false;
+            uint8_t m_key_check[KEY_CHECK_SIZE] = {};
+
+            mbedtls_aes_context m_encrypt;
+            mbedtls_aes_context m_decrypt;
+            mbedtls_aes_context m_essiv;
+
+            uint8_t *m_plain = nullptr;
+            uint8_t *m_cipher = nullptr;
+            uint64_t m_block = 0;
+            bool m_block_valid = false;
+            bool m_block_dirty = false;
+        };
+
+        encrypted_file::encrypted_file(const char *path, mode open_mode) : mp_implementation(std::make_unique<encrypted_file_implementation>())
+        {
+            uint8_t key[ENCRYPTION_KEY_SIZE];
+
+            {
+                std::lock_guard<std::mutex> lock(s_key_mutex);
+
+                if (!s_file_key_loaded)
+                {
+                    ESP_LOGE(TAG, "internal storage was not mounted with encryption");
+
+                    return;
+                }
+
+                memcpy(key, s_file_key, sizeof(key));
+            }
+
+            if (!mp_implementation->open(path, open_mode, key))
+                close();
+
+            memset(key, 0, sizeof(key));
+        }
+
+        encrypted_file::encrypted_file(const char *path, mode open_mode, const uint8_t (&key)[ENCRYPTION_KEY_SIZE])
+            : mp_implementation(std::make_unique<encrypted_file_implementation>())
+        {
+            if (!mp_implementation->open(path, open_mode, key))
+                close();
+        }
+
+        encrypted_file::~encrypted_file()
+        {
+            close();
+        }
+
+        bool encrypted_file::is_open()
+        {
+            return mp_implementation->m_fd >= 0;
+        }
+
+        uint64_t encrypted_file::size()
+        {
+            return mp_implementation->m_size;
+        }
+
+        size_t encrypted_file::read(uint64_t offset, void *data, size_t size)
+        {
+            auto implementation = mp_implementation.get();
+
+            if (implementation->m_fd < 0 || offset >= implementation->m_size)
+                return 0;
+
+            size = std::min<uint64_t>(size, implementation->m_size - offset);
+
+            auto out = static_cast<uint8_t *>(data);
+            size_t done = 0;
+
+            while (done < size)
+            {
+                const uint64_t position = offset + done;
+                const size_t within = position % BLOCK_SIZE;
+                const size_t chunk = std::min(size - done, BLOCK_SIZE - within);
+
+                if (!implementation->load_block(position / BLOCK_SIZE, false))
+                    break;
+
+                memcpy(out + done, implementation->m_plain + within, chunk);
+
+                done += chunk;
+            }
+
+            return done;
+        }
+
+        size_t encrypted_file::write(uint64_t offset, const void *data, size_t size)
+        {
+            auto implementation = mp_implementation.get();
+
+            if (implementation->m_fd < 0 || !implementation->m_writable)
+                return 0;
+
+            // A gap up to the write has to exist as encrypted zeros, not as the zeros the file
+            // system would fill it with.
+            while (implementation->m_size < offset)
+            {
+                static constexpr uint8_t ZEROS[256] = {};
+
+                const uint64_t gap = offset - implementation->m_size;
+
+                if (!write(implementation->m_size, ZEROS, std::min<uint64_t>(gap, sizeof(ZEROS))))
+                    return 0;
+            }
+
+            auto in = static_cast<const uint8_t *>(data);
+            size_t done = 0;
+
+            while (done < size)
+            {
+                const uint64_t position = offset + done;
+                const size_t within = position % BLOCK_SIZE;
+                const size_t chunk = std::min(size - done, BLOCK_SIZE - within);
+                const bool whole = chunk == BLOCK_SIZE || (!within && position + chunk >= implementation->m_size);
+
+                if (!implementation->load_block(position / BLOCK_SIZE, whole))
+                    break;
+
+                memcpy(implementation->m_plain + within, in + done, chunk);
+
+                implementation->m_block_dirty = true;
+
+                done += chunk;
+
+                if (position + chunk > implementation->m_size)
+                {
+                    implementation->m_size = position + chunk;
+                    implementation->m_header_dirty = true;
+                }
+            }
+
+            return done;
+        }
+
+        bool encrypted_file::flush()
+        {
+            auto implementation = mp_implementation.get();
+
+            if (implementation->m_fd < 0)
+                return false;
+
+            return !implementation->m_writable || implementation->flush();
+        }
+
+        bool encrypted_file::close()
+        {
+            auto implementation = mp_implementation.get();
+
+            if (implementation->m_fd < 0)
+                return false;
+
+            const bool flushed = flush();
+
+            ::close(implementation->m_fd);
+
+            implementation->m_fd = -1;
+
+            return flushed;
+        }
+    }
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+namespace hardware
+{
+    namespace storage
+    {
+        // Derives the key used by encrypted_file objects opened without an explicit key.
+        bool load_file_key();
+    }
+}
@@ -0,0 +1,235 @@
+#include "hardware/espnow.h"
+#include "hardware/wifi.h"
+#include "hardware/trace.h"
+
+#include "hardware/espnow_protocol.h"
+
+#include <cinttypes>
+#include <cstring>
+
+#include <freertos/FreeRTOS.h>
+#include <esp_log.h>
+#include <esp_mac.h>
+#include <esp_now.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
+
+namespace hardware
+{
+    constexpr const char *TAG = "espnow";
+    constexpr size_t RX_POOL_SIZE = 16;
+
+    using espnow_protocol::BROADCAST_MAC;
+
+    static_assert(espnow::MAX_PAYLOAD_SIZE == espnow_protocol::MAX_PAYLOAD_SIZE);
+    static_assert(espnow_protocol::FRAME_SIZE == ESP_NOW_MAX_DATA_LEN);
+
+    // The link's view of the radio.
+    struct espnow_port
+    {
+        bool send(const uint8_t *mac, const uint8_t *frame, size_t size)
+        {
+            HARDWARE_TRACE_SCOPE(ESPNOW_TRANSMIT, size);
+
+            return esp_now_send(mac, frame, size) == ESP_OK;
+        }
+
+        bool add(const uint8_t *mac)
+        {
+            esp_now_peer_info_t peer_info = {};
+
+            memcpy(peer_info.peer_addr, mac, ESP_NOW_ETH_ALEN);
+            peer_info.channel = 0;
+            peer_info.ifidx = m_interface;
+            peer_info.encrypt = false;
+
+            const esp_err_t error = esp_now_add_peer(&peer_info);
+
+            if (error == ESP_ERR_ESPNOW_EXIST)
+                return esp_now_mod_peer(&peer_info) == ESP_OK;
+
+            return error == ESP_OK;
+        }
+
+        void remove(const uint8_t *mac)
+        {
+            esp_now_del_peer(mac);
+        }
+
+        int64_t now_us()
+        {
+            return esp_timer_get_time();
+        }
+
+        void lock()
+        {
+            taskENTER_CRITICAL(&m_lock);
+        }
+
+        void unlock()
+        {
+            taskEXIT_CRITICAL(&m_lock);
+        }
+
+        wifi_interface_t m_interface = WIFI_IF_STA;
+        portMUX_TYPE m_lock = portMUX_INITIALIZER_UNLOCKED;
+    };
+
+    struct espnow_implementation
+    {
+        // The interface of the mode the driver runs in, a mode that is set but not applied yet
+        // has no interface up to send on.
+        static wifi_interface_t current_interface()
+        {
+            return wifi::get().get_active_mode() == wifi::mode::ACCESS_POINT ? WIFI_IF_AP : WIFI_IF_STA;
+        }
+
+        static void on_paired(const uint8_t *mac, void *user_data)
+        {
+            auto implementation = static_cast<espnow_implementation *>(user_data);
+
+            ESP_LOGI(TAG, "paired with " MACSTR, MAC2STR(mac));
+
+            if (implementation->m_on_paired_callback)
+                implementation->m_on_paired_callback(mac, implementation->m_on_paired_user_data);
+        }
+
+        espnow_port m_port;
+        espnow_protocol::link<espnow_port, ESP_NOW_MAX_TOTAL_PEER_NUM, RX_POOL_SIZE> m_link{m_port};
+
+        espnow::paired_callback_t m_on_paired_callback = nullptr;
+        void *m_on_paired_user_data = nullptr;
+    };
+
+    espnow *espnow::sp_instance = nullptr;
+
+    static espnow_implementation *sp_implementation = nullptr;
+
+    static void espnow_receive_callback(const esp_now_recv_info_t *info, const uint8_t *data, int size)
+    {
+        HARDWARE_TRACE_SCOPE(ESPNOW_RECEIVE, size);
+
+        if (sp_implementation && size > 0)
+            sp_implementation->m_link.on_receive(info->src_addr, data, size);
+    }
+
+    static void espnow_send_callback(const uint8_t *mac, esp_now_send_status_t status)
+    {
+        if (sp_implementation)
+            sp_implementation->m_link.on_send_done(mac, status == ESP_NOW_SEND_SUCCESS);
+    }
+
+    espnow::espnow() : mp_implementation(std::make_unique<espnow_implementation>())
+    {
+        mp_implementation->m_port.m_interface = espnow_implementation::current_interface();
+        mp_implementation->m_link.set_paired_callback(espnow_implementation::on_paired, mp_implementation.get());
+
+        sp_implementation = mp_implementation.get();
+
+        ESP_ERROR_CHECK(esp_now_init());
+        ESP_ERROR_CHECK(esp_now_register_recv_cb(espnow_receive_callback));
+        ESP_ERROR_CHECK(esp_now_register_send_cb(espnow_send_callback));
+
+        if (!mp_implementation->m_port.add(BROADCAST_MAC))
+            ESP_LOGE(TAG, "failed to register broadcast peer");
+
+        ESP_LOGI(TAG, "started on channel %hhu", wifi::get().get_channel());
+    }
+
+    espnow::~espnow()
+    {
+        ESP_ERROR_CHECK(esp_now_unregister_send_cb());
+        ESP_ERROR_CHECK(esp_now_unregister_recv_cb());
+        ESP_ERROR_CHECK(esp_now_deinit());
+
+        sp_implementation = nullptr;
+    }
+
+    bool espnow::add_peer(const uint8_t *mac)
+    {
+        return mp_implementation->m_link.add_peer(mac);
+    }
+
+    bool espnow::remove_peer(const uint8_t *mac)
+    {
+        return mp_implementation->m_link.remove_peer(mac);
+    }
+
+    bool espnow::get_stats(const uint8_t *mac, peer_stats &stats)
+    {
+        espnow_protocol::peer_stats current;
+
+        if (!mp_implementation->m_link.get_stats(mac, current))
+            return false;
+
+        stats = {
+            .sent = current.sent,
+            .delivered = current.delivered,
+            .failed = current.failed,
+            .received = current.received,
+            .lost = current.lost,
+            .rtt_us = current.rtt_us,
+            .rtt_min_us = current.rtt_min_us,
+            .rtt_max_us = current.rtt_max_us,
+        };
+
+        return true;
+    }
+
+    void espnow::start_pairing(uint32_t duration_ms)
+    {
+        mp_implementation->m_link.start_pairing(duration_ms);
+    }
+
+    void espnow::stop_pairing()
+    {
+        mp_implementation->m_link.stop_pairing();
+    }
+
+    bool espnow::send(const uint8_t *mac, const void *data, size_t size)
+    {
+        return mp_implementation->m_link.send(mac, data, size);
+    }
+
+    bool espnow::ping(const uint8_t *mac)
+    {
+        return mp_implementation->m_link.ping(mac);
+    }
+
+    void espnow::set_receive_callback(receive_callback_t on_receive, void *user_data)
+    {
+        mp_implementation->m_link.set_receive_callback(on_receive, user_data);
+    }
+
+    void espnow::set_send_done_callback(send_done_callback_t on_send_done, void *user_data)
+    {
+        mp_implementation->m_link.set_send_done_callback(on_send_done, user_data);
+    }
+
+    void espnow::set_paired_callback(paired_callback_t on_paired, void *user_data)
+    {
+        mp_implementation->m_on_paired_callback = on_paired;
+        mp_implementation->m_on_paired_user_data = user_data;
+    }
+
+    void espnow::poll()
+    {
+        HARDWARE_TRACE_SCOPE(ESPNOW_POLL);
+
+        auto implementation = mp_implementation.get();
+
+        const wifi_interface_t interface = espnow_implementation::current_interface();
+
+        if (interface != implementation->m_port.m_interface)
+        {
+            implementation->m_port.m_interface = interface;
+
+            implementation->m_port.add(BROADCAST_MAC);
+            implementation->m_link.for_each_peer([implementation](espnow_protocol::peer &p)
+                                                 { implementation->m_port.add(p.mac); });
+        }
+
+        if (const uint32_t dropped = implementation->m_link.poll())
+            ESP_LOGW(TAG, "dropped %" PRIu32 " packets, receive pool exhausted", dropped);
+    }
+}
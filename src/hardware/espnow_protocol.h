@@ -0,0 +1,565 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace hardware
+{
+    namespace espnow_protocol
+    {
+        constexpr size_t MAC_SIZE = 6;
+        constexpr size_t FRAME_SIZE = 250;
+        constexpr uint8_t FRAME_MAGIC = 0xe5;
+
+        enum class frame_type : uint8_t
+        {
+            data,
+            ping,
+            pong,
+            pair_request,
+            pair_response,
+        };
+
+        struct __attribute__((packed)) frame_header
+        {
+            uint8_t magic;
+            frame_type type;
+            uint16_t sequence;
+            uint32_t timestamp;
+        };
+
+        constexpr size_t MAX_PAYLOAD_SIZE = FRAME_SIZE - sizeof(frame_header);
+
+        inline size_t encode(uint8_t *frame, frame_type type, uint16_t sequence, uint32_t timestamp, const void *payload, size_t size)
+        {
+            if (size > MAX_PAYLOAD_SIZE)
+                return 0;
+
+            const frame_header header = {
+                .magic = FRAME_MAGIC,
+                .type = type,
+                .sequence = sequence,
+                .timestamp = timestamp,
+            };
+
+            memcpy(frame, &header, sizeof(header));
+
+            if (size)
+                memcpy(frame + sizeof(header), payload, size);
+
+            return sizeof(header) + size;
+        }
+
+        inline bool decode(const uint8_t *frame, size_t size, frame_header &header)
+        {
+            if (size < sizeof(frame_header))
+                return false;
+
+            memcpy(&header, frame, sizeof(header));
+
+            return header.magic == FRAME_MAGIC && header.type <= frame_type::pair_response;
+        }
+
+        struct peer_stats
+        {
+            uint32_t sent;
+            uint32_t delivered;
+            uint32_t failed;
+            uint32_t received;
+            uint32_t lost;
+            uint32_t rtt_us;
+            uint32_t rtt_min_us;
+            uint32_t rtt_max_us;
+        };
+
+        struct peer
+        {
+            uint8_t mac[MAC_SIZE];
+            uint16_t tx_sequence;
+            uint16_t rx_sequence;
+            bool rx_synchronized;
+            bool used;
+            peer_stats stats;
+        };
+
+        template <size_t Capacity>
+        class peer_table
+        {
+        public:
+            peer *find(const uint8_t *mac)
+            {
+                for (auto &p : m_peers)
+                    if (p.used && !memcmp(p.mac, mac, MAC_SIZE))
+                        return &p;
+
+                return nullptr;
+            }
+
+            peer *add(const uint8_t *mac)
+            {
+                if (auto existing = find(mac))
+                    return existing;
+
+                for (auto &p : m_peers)
+                    if (!p.used)
+                    {
+                        p = {};
+                        p.used = true;
+                        memcpy(p.mac, mac, MAC_SIZE);
+
+                        return &p;
+                    }
+
+                return nullptr;
+            }
+
+            bool remove(const uint8_t *mac)
+            {
+                auto p = find(mac);
+
+                if (!p)
+                    return false;
+
+                p->used = false;
+
+                return true;
+            }
+
+            template <typename Function>
+            void for_each(Function function)
+            {
+                for (auto &p : m_peers)
+                    if (p.used)
+                        function(p);
+            }
+
+            static void on_sent(peer &p)
+            {
+                p.stats.sent++;
+            }
+
+            static void on_send_done(peer &p, bool delivered)
+            {
+                if (delivered)
+                    p.stats.delivered++;
+                else
+                    p.stats.failed++;
+            }
+
+            static void on_received(peer &p, uint16_t sequence)
+            {
+                p.stats.received++;
+
+                if (p.rx_synchronized)
+                {
+                    const uint16_t gap = sequence - p.rx_sequence;
+
+                    if (gap == 0 || gap >= 0x8000)
+                        return;
+
+                    p.stats.lost += gap - 1;
+                }
+
+                p.rx_sequence = sequence;
+                p.rx_synchronized = true;
+            }
+
+            static void on_round_trip(peer &p, uint32_t rtt_us)
+            {
+                if (!p.stats.rtt_us)
+                {
+                    p.stats.rtt_us = rtt_us;
+                    p.stats.rtt_min_us = rtt_us;
+                    p.stats.rtt_max_us = rtt_us;
+
+                    return;
+                }
+
+                p.stats.rtt_us = p.stats.rtt_us - (p.stats.rtt_us >> 3) + (rtt_us >> 3);
+
+                if (rtt_us < p.stats.rtt_min_us)
+                    p.stats.rtt_min_us = rtt_us;
+
+                if (rtt_us > p.stats.rtt_max_us)
+                    p.stats.rtt_max_us = rtt_us;
+            }
+
+        private:
+            std::array<peer, Capacity> m_peers = {};
+        };
+
+        struct packet
+        {
+            uint8_t mac[MAC_SIZE];
+            frame_type type;
+            uint8_t size;
+            uint16_t sequence;
+            uint8_t data[MAX_PAYLOAD_SIZE];
+        };
+
+        template <size_t Capacity>
+        class packet_pool
+        {
+            static_assert(Capacity && !(Capacity & (Capacity - 1)), "capacity must be a power of two");
+
+        public:
+            packet *acquire()
+            {
+                const uint32_t head = m_head.load(std::memory_order_relaxed);
+
+                if (head - m_tail.load(std::memory_order_acquire) == Capacity)
+                    return nullptr;
+
+                return &m_packets[head & (Capacity - 1)];
+            }
+
+            void commit()
+            {
+                m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            }
+
+            packet *front()
+            {
+                const uint32_t tail = m_tail.load(std::memory_order_relaxed);
+
+                if (tail == m_head.load(std::memory_order_acquire))
+                    return nullptr;
+
+                return &m_packets[tail & (Capacity - 1)];
+            }
+
+            void release()
+            {
+                m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            }
+
+        private:
+            std::array<packet, Capacity> m_packets = {};
+            std::atomic<uint32_t> m_head = 0;
+            std::atomic<uint32_t> m_tail = 0;
+        };
+
+        constexpr uint8_t BROADCAST_MAC[MAC_SIZE] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+        constexpr int64_t PAIRING_INTERVAL_US = 100 * 1000;
+
+        // Everything about a link except the radio: sequencing, statistics, pairing and the
+        // receive pool. The port supplies the rest,
+        //
+        //     bool send(const uint8_t *mac, const uint8_t *frame, size_t size);
+        //     bool add(const uint8_t *mac);
+        //     void remove(const uint8_t *mac);
+        //     int64_t now_us();
+        //     void lock();
+        //     void unlock();
+        //
+        // where the lock has to hold off the radio callbacks, which call on_receive() and
+        // on_send_done(). Everything else belongs to the task that calls poll(). hardware::espnow
+        // plugs in ESP-NOW, the host tests a simulated medium.
+        template <typename Port, size_t Peers, size_t PoolSize>
+        class link
+        {
+        public:
+            using receive_callback_t = void (*)(const uint8_t *mac, const uint8_t *data, size_t size, void *user_data);
+            using send_done_callback_t = void (*)(const uint8_t *mac, bool delivered, void *user_data);
+            using paired_callback_t = void (*)(const uint8_t *mac, void *user_data);
+
+            explicit link(Port &port) : m_port(port)
+            {
+            }
+
+            bool add_peer(const uint8_t *mac)
+            {
+                m_port.lock();
+
+                const bool added = m_peers.add(mac) != nullptr;
+
+                m_port.unlock();
+
+                if (!added)
+                    return false;
+
+                if (m_port.add(mac))
+                    return true;
+
+                m_port.lock();
+
+                m_peers.remove(mac);
+
+                m_port.unlock();
+
+                return false;
+            }
+
+            bool remove_peer(const uint8_t *mac)
+            {
+                m_port.lock();
+
+                const bool removed = m_peers.remove(mac);
+
+                m_port.unlock();
+
+                if (removed)
+                    m_port.remove(mac);
+
+                return removed;
+            }
+
+            bool get_stats(const uint8_t *mac, peer_stats &stats)
+            {
+                m_port.lock();
+
+                auto p = m_peers.find(mac);
+
+                if (p)
+                    stats = p->stats;
+
+                m_port.unlock();
+
+                return p != nullptr;
+            }
+
+            // Not locked, peers are only added and removed by the polling task.
+            template <typename Function>
+            void for_each_peer(Function function)
+            {
+                m_peers.for_each(function);
+            }
+
+            void start_pairing(uint32_t duration_ms)
+            {
+                const int64_t now = m_port.now_us();
+
+                m_pairing_deadline = now + duration_ms * 1000LL;
+                m_next_pairing_beacon = now;
+            }
+
+            void stop_pairing()
+            {
+                m_pairing_deadline = 0;
+            }
+
+            bool is_pairing() const
+            {
+                return m_pairing_deadline > m_port.now_us();
+            }
+
+            bool send(const uint8_t *mac, const void *data, size_t size)
+            {
+                return transmit(mac, frame_type::data, static_cast<uint32_t>(m_port.now_us()), data, size);
+            }
+
+            bool ping(const uint8_t *mac)
+            {
+                return transmit(mac, frame_type::ping, static_cast<uint32_t>(m_port.now_us()), nullptr, 0);
+            }
+
+            void set_receive_callback(receive_callback_t on_receive, void *user_data)
+            {
+                mp_on_receive = on_receive;
+                mp_on_receive_user_data = user_data;
+            }
+
+            void set_send_done_callback(send_done_callback_t on_send_done, void *user_data)
+            {
+                mp_on_send_done = on_send_done;
+                mp_on_send_done_user_data = user_data;
+            }
+
+            void set_paired_callback(paired_callback_t on_paired, void *user_data)
+            {
+                mp_on_paired = on_paired;
+                mp_on_paired_user_data = user_data;
+            }
+
+            // From the radio's receive callback.
+            void on_receive(const uint8_t *mac, const uint8_t *data, size_t size)
+            {
+                frame_header header;
+
+                if (!decode(data, size, header))
+                    return;
+
+                const uint8_t *payload = data + sizeof(header);
+                const size_t payload_size = size - sizeof(header);
+
+                if (header.type == frame_type::pair_request || header.type == frame_type::pair_response)
+                {
+                    if (is_pairing())
+                        enqueue(mac, header, nullptr, 0);
+
+                    return;
+                }
+
+                m_port.lock();
+
+                auto p = m_peers.find(mac);
+
+                if (p)
+                {
+                    if (header.type == frame_type::pong)
+                        m_peers.on_round_trip(*p, static_cast<uint32_t>(m_port.now_us()) - header.timestamp);
+                    else
+                        m_peers.on_received(*p, header.sequence);
+                }
+
+                m_port.unlock();
+
+                if (!p)
+                    return;
+
+                if (header.type == frame_type::ping)
+                    transmit(mac, frame_type::pong, header.timestamp, nullptr, 0);
+                else if (header.type == frame_type::data)
+                    enqueue(mac, header, payload, payload_size);
+            }
+
+            // From the radio's send callback.
+            void on_send_done(const uint8_t *mac, bool delivered)
+            {
+                m_port.lock();
+
+                auto p = m_peers.find(mac);
+
+                if (p)
+                    m_peers.on_send_done(*p, delivered);
+
+                m_port.unlock();
+
+                if (p && mp_on_send_done)
+                    mp_on_send_done(mac, delivered, mp_on_send_done_user_data);
+            }
+
+            // Sends the pairing beacon when due and hands queued packets to the callbacks.
+            // Returns how many packets were dropped on a full pool since the previous call.
+            uint32_t poll()
+            {
+                if (is_pairing() && m_port.now_us() >= m_next_pairing_beacon)
+                {
+                    m_next_pairing_beacon = m_port.now_us() + PAIRING_INTERVAL_US;
+
+                    transmit(BROADCAST_MAC, frame_type::pair_request, 0, nullptr, 0);
+                }
+
+                while (auto received = m_rx_pool.front())
+                {
+                    switch (received->type)
+                    {
+                    case frame_type::pair_request:
+                    case frame_type::pair_response:
+                    {
+                        m_port.lock();
+
+                        const bool known = m_peers.find(received->mac) != nullptr;
+
+                        m_port.unlock();
+
+                        if (!known && add_peer(received->mac) && mp_on_paired)
+                            mp_on_paired(received->mac, mp_on_paired_user_data);
+
+                        if (received->type == frame_type::pair_request)
+                            transmit(received->mac, frame_type::pair_response, 0, nullptr, 0);
+
+                        break;
+                    }
+
+                    case frame_type::data:
+                    {
+                        if (mp_on_receive)
+                            mp_on_receive(received->mac, received->data, received->size, mp_on_receive_user_data);
+
+                        break;
+                    }
+
+                    default:
+                        break;
+                    }
+
+                    m_rx_pool.release();
+                }
+
+                return m_dropped.exchange(0);
+            }
+
+        private:
+            bool transmit(const uint8_t *mac, frame_type type, uint32_t timestamp, const void *payload, size_t size)
+            {
+                uint8_t frame[FRAME_SIZE];
+                uint16_t sequence = 0;
+
+                // Before taking a sequence number, the peer would count a frame never sent as lost.
+                if (size > MAX_PAYLOAD_SIZE)
+                    return false;
+
+                m_port.lock();
+
+                auto p = m_peers.find(mac);
+
+                if (p)
+                {
+                    sequence = p->tx_sequence++;
+
+                    m_peers.on_sent(*p);
+                }
+
+                m_port.unlock();
+
+                const size_t frame_size = encode(frame, type, sequence, timestamp, payload, size);
+
+                if (!frame_size)
+                    return false;
+
+                if (m_port.send(mac, frame, frame_size))
+                    return true;
+
+                m_port.lock();
+
+                if ((p = m_peers.find(mac)))
+                    m_peers.on_send_done(*p, false);
+
+                m_port.unlock();
+
+                return false;
+            }
+
+            void enqueue(const uint8_t *mac, const frame_header &header, const uint8_t *payload, size_t size)
+            {
+                auto target = m_rx_pool.acquire();
+
+                if (!target)
+                {
+                    m_dropped++;
+
+                    return;
+                }
+
+                memcpy(target->mac, mac, MAC_SIZE);
+                target->type = header.type;
+                target->sequence = header.sequence;
+                target->size = size;
+
+                if (size)
+                    memcpy(target->data, payload, size);
+
+                m_rx_pool.commit();
+            }
+
+            Port &m_port;
+            peer_table<Peers> m_peers;
+            packet_pool<PoolSize> m_rx_pool;
+            // Set by the app and read from the radio receive callback.
+            std::atomic<int64_t> m_pairing_deadline = 0;
+            int64_t m_next_pairing_beacon = 0;
+            std::atomic<uint32_t> m_dropped = 0;
+
+            receive_callback_t mp_on_receive = nullptr;
+            void *mp_on_receive_user_data = nullptr;
+            send_done_callback_t mp_on_send_done = nullptr;
+            void *mp_on_send_done_user_data = nullptr;
+            paired_callback_t mp_on_paired = nullptr;
+            void *mp_on_paired_user_data = nullptr;
+        };
+    }
+}
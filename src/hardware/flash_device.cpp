@@ -0,0 +1,171 @@
+#include "hardware/flash_device.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <esp_log.h>
+#include <esp_partition.h>
+
+namespace hardware
+{
+    namespace storage
+    {
+        constexpr const char *TAG = "flash_device";
+
+        class partition_flash_device : public flash_device
+        {
+        public:
+            explicit partition_flash_device(const esp_partition_t *partition) : mp_partition(partition)
+            {
+            }
+
+            size_t size() const override
+            {
+                return mp_partition->size;
+            }
+
+            size_t sector_size() const override
+            {
+                return mp_partition->erase_size;
+            }
+
+            bool read(size_t offset, void *data, size_t size) override
+            {
+                return esp_partition_read(mp_partition, offset, data, size) == ESP_OK;
+            }
+
+            bool write(size_t offset, const void *data, size_t size) override
+            {
+                return esp_partition_write(mp_partition, offset, data, size) == ESP_OK;
+            }
+
+            bool erase(size_t offset, size_t size) override
+            {
+                return esp_partition_erase_range(mp_partition, offset, size) == ESP_OK;
+            }
+
+        private:
+            const esp_partition_t *mp_partition;
+        };
+
+        class file_flash_device : public flash_device
+        {
+        public:
+            file_flash_device(FILE *file, size_t size, size_t sector_size) : mp_file(file), m_size(size), m_sector_size(sector_size)
+            {
+            }
+
+            ~file_flash_device() override
+            {
+                fclose(mp_file);
+            }
+
+            size_t size() const override
+            {
+                return m_size;
+            }
+
+            size_t sector_size() const override
+            {
+                return m_sector_size;
+            }
+
+            bool read(size_t offset, void *data, size_t size) override
+            {
+                if (offset + size > m_size || fseek(mp_file, offset, SEEK_SET))
+                    return false;
+
+                return fread(data, 1, size, mp_file) == size;
+            }
+
+            bool write(size_t offset, const void *data, size_t size) override
+            {
+                uint8_t chunk[256];
+
+                for (size_t done = 0; done < size; done += sizeof(chunk))
+                {
+                    const size_t length = std::min(sizeof(chunk), size - done);
+
+                    if (!read(offset + done, chunk, length))
+                        return false;
+
+                    for (size_t i = 0; i < length; i++)
+                        chunk[i] &= static_cast<const uint8_t *>(data)[done + i];
+
+                    if (fseek(mp_file, offset + done, SEEK_SET) || fwrite(chunk, 1, length, mp_file) != length)
+                        return false;
+                }
+
+                return fflush(mp_file) == 0;
+            }
+
+            bool erase(size_t offset, size_t size) override
+            {
+                if (offset % m_sector_size || size % m_sector_size || offset + size > m_size)
+                    return false;
+
+                return fill(offset, size);
+            }
+
+            bool fill(size_t offset, size_t size)
+            {
+                uint8_t erased[256];
+
+                memset(erased, 0xff, sizeof(erased));
+
+                if (fseek(mp_file, offset, SEEK_SET))
+                    return false;
+
+                for (size_t done = 0; done < size; done += sizeof(erased))
+                    if (fwrite(erased, 1, std::min(sizeof(erased), size - done), mp_file) == 0)
+                        return false;
+
+                return fflush(mp_file) == 0;
+            }
+
+        private:
+            FILE *mp_file;
+            size_t m_size;
+            size_t m_sector_size;
+        };
+
+        std::unique_ptr<flash_device> make_partition_flash_device(const char *partition_label)
+        {
+            // Labels are unique across the table, any type goes, e.g. the running app slot as a delta OTA base.
+            const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY, partition_label);
+
+            if (!partition)
+            {
+                ESP_LOGE(TAG, "partition %s not found", partition_label);
+
+                return nullptr;
+            }
+
+            return std::make_unique<partition_flash_device>(partition);
+        }
+
+        std::unique_ptr<flash_device> make_file_flash_device(const char *path, size_t size, size_t sector_size)
+        {
+            FILE *file = fopen(path, "r+b");
+            const bool created = !file;
+
+            if (created)
+                file = fopen(path, "w+b");
+
+            if (!file)
+            {
+                ESP_LOGE(TAG, "failed to open %s", path);
+
+                return nullptr;
+            }
+
+            auto device = std::make_unique<file_flash_device>(file, size, sector_size);
+
+            if (created && !device->fill(0, size))
+                return nullptr;
+
+            return device;
+        }
+    }
+}
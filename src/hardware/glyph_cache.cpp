@@ -0,0 +1,280 @@
+#include "hardware/glyph_cache.h"
+
+#include "hardware/graphics.h"
+
+#include <cstring>
+#include <map>
+#include <memory>
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <lvgl.h>
+
+namespace hardware
+{
+    namespace graphics
+    {
+        namespace glyph_cache
+        {
+            constexpr const char *TAG = "glyph_cache";
+            constexpr size_t BUCKET_COUNT = 512;
+
+            // The bitmap follows the header in the same PSRAM allocation.
+            struct entry
+            {
+                entry *bucket_next;
+                entry *newer;
+                entry *older;
+                const lv_font_t *font;
+                uint32_t codepoint;
+                uint32_t size;
+
+                uint8_t *data()
+                {
+                    return reinterpret_cast<uint8_t *>(this + 1);
+                }
+            };
+
+            // The copy handed out by wrap(), LVGL passes it back to the bitmap callback.
+            struct wrapped_font
+            {
+                lv_font_t font;
+                const lv_font_t *original;
+            };
+
+            // Only touched by the render task or with the graphics lock held.
+            static entry **sp_buckets = nullptr;
+            static entry *sp_newest = nullptr;
+            static entry *sp_oldest = nullptr;
+            static statistics s_statistics = {};
+            static std::map<const lv_font_t *, std::unique_ptr<wrapped_font>> s_fonts;
+
+            static size_t bucket_of(const lv_font_t *font, uint32_t codepoint)
+            {
+                const uint32_t value = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(font) >> 2) * 0x9e3779b1 ^ codepoint * 0x85ebca6b;
+
+                return (value ^ (value >> 15)) & (BUCKET_COUNT - 1);
+            }
+
+            // Decoded bitmaps are packed without row padding, 3 bpp glyphs are expanded to 4 bpp.
+            static size_t bitmap_size(const lv_font_glyph_dsc_t &glyph)
+            {
+                const size_t bits = glyph.bpp == 3 ? 4 : glyph.bpp;
+
+                return (static_cast<size_t>(glyph.box_w) * glyph.box_h * bits + 7) / 8;
+            }
+
+            static void unlink_lru(entry *item)
+            {
+                (item->newer ? item->newer->older : sp_newest) = item->older;
+                (item->older ? item->older->newer : sp_oldest) = item->newer;
+            }
+
+            static void link_newest(entry *item)
+            {
+                item->newer = nullptr;
+                item->older = sp_newest;
+
+                (sp_newest ? sp_newest->newer : sp_oldest) = item;
+
+                sp_newest = item;
+            }
+
+            static void evict(entry *item)
+            {
+                for (entry **link = &sp_buckets[bucket_of(item->font, item->codepoint)]; *link; link = &(*link)->bucket_next)
+                {
+                    if (*link == item)
+                    {
+                        *link = item->bucket_next;
+
+                        break;
+                    }
+                }
+
+                unlink_lru(item);
+
+                s_statistics.used_bytes -= sizeof(entry) + item->size;
+                s_statistics.entries--;
+
+                heap_caps_free(item);
+            }
+
+            static const uint8_t *cached_bitmap(const lv_font_t *font, uint32_t codepoint)
+            {
+                const lv_font_t *original = reinterpret_cast<const wrapped_font *>(font)->original;
+
+                if (!sp_buckets)
+                    return original->get_glyph_bitmap(original, codepoint);
+
+                entry **bucket = &sp_buckets[bucket_of(original, codepoint)];
+
+                for (entry *item = *bucket; item; item = item->bucket_next)
+                {
+                    if (item->font == original && item->codepoint == codepoint)
+                    {
+                        if (item != sp_newest)
+                        {
+                            unlink_lru(item);
+                            link_newest(item);
+                        }
+
+                        s_statistics.hits++;
+
+                        return item->data();
+                    }
+                }
+
+                s_statistics.misses++;
+
+                const uint8_t *bitmap = original->get_glyph_bitmap(original, codepoint);
+                lv_font_glyph_dsc_t glyph;
+
+                // The descriptor lookup hits the font's own cache, LVGL just asked for it.
+                if (!bitmap || !original->get_glyph_dsc(original, &glyph, codepoint, 0))
+                    return bitmap;
+
+                const size_t size = bitmap_size(glyph);
+                const size_t required = sizeof(entry) + size;
+
+                if (!size || required > s_statistics.budget_bytes)
+                {
+                    s_statistics.uncached++;
+
+                    return bitmap;
+                }
+
+                while (sp_oldest && s_statistics.used_bytes + required > s_statistics.budget_bytes)
+                {
+                    evict(sp_oldest);
+
+                    s_statistics.evictions++;
+                }
+
+                auto item = static_cast<entry *>(heap_caps_malloc(required, MALLOC_CAP_SPIRAM));
+
+                if (!item)
+                {
+                    s_statistics.uncached++;
+
+                    return bitmap;
+                }
+
+                item->bucket_next = *bucket;
+                item->font = original;
+                item->codepoint = codepoint;
+                item->size = size;
+
+                memcpy(item->data(), bitmap, size);
+
+                *bucket = item;
+
+                link_newest(item);
+
+                s_statistics.used_bytes += required;
+                s_statistics.entries++;
+
+                return item->data();
+            }
+
+            bool start(size_t budget_bytes)
+            {
+                const bool locked = lock();
+
+                if (!sp_buckets)
+                    sp_buckets = static_cast<entry **>(heap_caps_calloc(BUCKET_COUNT, sizeof(entry *), MALLOC_CAP_INTERNAL));
+
+                s_statistics.budget_bytes = budget_bytes;
+
+                // A smaller budget takes effect right away.
+                while (sp_oldest && s_statistics.used_bytes > budget_bytes)
+                {
+                    evict(sp_oldest);
+
+                    s_statistics.evictions++;
+                }
+
+                if (locked)
+                    unlock();
+
+                if (!sp_buckets)
+                {
+                    ESP_LOGE(TAG, "not enough memory for the glyph table");
+
+                    return false;
+                }
+
+                ESP_LOGI(TAG, "%u KiB glyph budget", static_cast<unsigned>(budget_bytes / 1024));
+
+                return true;
+            }
+
+            void stop()
+            {
+                const bool locked = lock();
+
+                clear();
+
+                heap_caps_free(sp_buckets);
+
+                sp_buckets = nullptr;
+
+                if (locked)
+                    unlock();
+            }
+
+            void clear()
+            {
+                const bool locked = lock();
+
+                while (sp_oldest)
+                    evict(sp_oldest);
+
+                if (locked)
+                    unlock();
+            }
+
+            const lv_font_t *wrap(const lv_font_t *font)
+            {
+                if (!font)
+                    return nullptr;
+
+                if (font->get_glyph_bitmap == cached_bitmap)
+                    return font;
+
+                if (font->get_glyph_bitmap == lv_font_get_bitmap_fmt_txt &&
+                    static_cast<const lv_font_fmt_txt_dsc_t *>(font->dsc)->bitmap_format == LV_FONT_FMT_TXT_PLAIN)
+                    return font;
+
+                const bool locked = lock();
+
+                std::unique_ptr<wrapped_font> &wrapper = s_fonts[font];
+
+                // Wrappers are never freed, styles may hold on to them.
+                if (!wrapper)
+                {
+                    wrapper = std::make_unique<wrapped_font>();
+                    wrapper->font = *font;
+                    wrapper->font.get_glyph_bitmap = cached_bitmap;
+                    wrapper->original = font;
+                }
+
+                if (locked)
+                    unlock();
+
+                return &wrapper->font;
+            }
+
+            statistics get_statistics()
+            {
+                const bool locked = lock();
+                const statistics result = s_statistics;
+
+                if (locked)
+                    unlock();
+
+                return result;
+            }
+        }
+    }
+}
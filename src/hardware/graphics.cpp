@@ -0,0 +1,234 @@
+#include "hardware/graphics.h"
+
+#include "hardware/display.h"
+#include "hardware/graphics_blend.h"
+#include "hardware/trace.h"
+#include "graphics_parallel.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <lvgl.h>
+
+namespace hardware
+{
+    namespace graphics
+    {
+        constexpr const char *TAG = "graphics";
+        constexpr uint32_t MIN_SLEEP_MS = 1;
+        constexpr uint32_t FLUSH_WAIT_MS = 10;
+
+        static SemaphoreHandle_t s_mutex = nullptr;
+        static TaskHandle_t sp_task = nullptr;
+        static std::atomic<bool> s_running = false;
+        static SemaphoreHandle_t s_stopped = nullptr;
+        static options s_options = {};
+
+        static lv_disp_draw_buf_t s_draw_buffer;
+        static lv_disp_drv_t s_driver;
+        static lv_disp_t *sp_display = nullptr;
+        static lv_color_t *sp_buffers[2] = {};
+
+        // Largest stripe height that fits a single transfer, preferring one that divides
+        // the screen height so no frame ends with a small leftover stripe.
+        static uint16_t stripe_lines(display &screen, uint16_t max_lines)
+        {
+            const size_t line_bytes = screen.width() * sizeof(lv_color_t);
+            const uint16_t limit = std::clamp<size_t>(std::min<size_t>(max_lines, screen.max_transfer_bytes() / line_bytes), 1, screen.height());
+
+            for (uint16_t lines = limit; lines > limit / 2; lines--)
+                if (screen.height() % lines == 0)
+                    return lines;
+
+            return limit;
+        }
+
+        static void flush(lv_disp_drv_t *driver, const lv_area_t *area, lv_color_t *pixels)
+        {
+            display::get().set_bitmap(area->x1, area->x2, area->y1, area->y2, reinterpret_cast<uint16_t *>(pixels));
+        }
+
+        // Runs in the bus interrupt.
+        static void transfer_done(void *user_data)
+        {
+            auto driver = static_cast<lv_disp_drv_t *>(user_data);
+            BaseType_t woken = pdFALSE;
+
+            lv_disp_flush_ready(driver);
+
+            if (sp_task)
+                vTaskNotifyGiveFromISR(sp_task, &woken);
+
+            portYIELD_FROM_ISR(woken);
+        }
+
+        // Called by LVGL while both buffers are busy, blocks instead of spinning.
+        static void wait_for_flush(lv_disp_drv_t *driver)
+        {
+            HARDWARE_TRACE_SCOPE(GRAPHICS_FLUSH_WAIT);
+
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(FLUSH_WAIT_MS));
+        }
+
+        static void render_task(void *arg)
+        {
+            while (s_running)
+            {
+                uint32_t next_ms = s_options.max_sleep_ms;
+
+                if (lock())
+                {
+                    HARDWARE_TRACE_BEGIN(GRAPHICS_TIMER_HANDLER);
+
+                    next_ms = lv_timer_handler();
+
+                    HARDWARE_TRACE_END(GRAPHICS_TIMER_HANDLER);
+
+                    unlock();
+                }
+
+                ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(std::clamp(next_ms, MIN_SLEEP_MS, s_options.max_sleep_ms)));
+            }
+
+            xSemaphoreGive(s_stopped);
+
+            vTaskDelete(nullptr);
+        }
+
+        bool start(const options &opts)
+        {
+            if (sp_display)
+                return true;
+
+            display &screen = display::get();
+            const uint16_t lines = stripe_lines(screen, opts.max_buffer_lines);
+            const size_t pixels = static_cast<size_t>(screen.width()) * lines;
+
+            s_options = opts;
+
+            if (!lv_is_initialized())
+                lv_init();
+
+            s_mutex = xSemaphoreCreateRecursiveMutex();
+            s_stopped = xSemaphoreCreateBinary();
+
+            for (auto &buffer : sp_buffers)
+                buffer = static_cast<lv_color_t *>(heap_caps_malloc(pixels * sizeof(lv_color_t), MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL));
+
+            if (!s_mutex || !s_stopped || !sp_buffers[0] || !sp_buffers[1])
+            {
+                ESP_LOGE(TAG, "not enough memory for %u line draw buffers", lines);
+
+                stop();
+
+                return false;
+            }
+
+            lv_disp_draw_buf_init(&s_draw_buffer, sp_buffers[0], sp_buffers[1], pixels);
+            lv_disp_drv_init(&s_driver);
+
+            s_driver.hor_res = screen.width();
+            s_driver.ver_res = screen.height();
+            s_driver.flush_cb = flush;
+            s_driver.wait_cb = wait_for_flush;
+            s_driver.draw_buf = &s_draw_buffer;
+
+            screen.set_transfer_done_callback(transfer_done, &s_driver);
+
+            sp_display = lv_disp_drv_register(&s_driver);
+
+            // Before the split, so both halves run the vector kernels.
+            if (opts.accelerated_blend)
+                blend::install(&s_driver);
+
+            if (opts.blend_core >= 0 && opts.blend_core != opts.core)
+                parallel::start(&s_driver, opts.blend_core, opts.priority, opts.min_blend_pixels);
+
+            s_running = true;
+
+            if (xTaskCreatePinnedToCore(render_task, "graphics", opts.stack_size, nullptr, opts.priority, &sp_task, opts.core) != pdPASS)
+            {
+                ESP_LOGE(TAG, "failed to start the render task");
+
+                s_running = false;
+
+                stop();
+
+                return false;
+            }
+
+            ESP_LOGI(TAG, "%ux%u, two %u line buffers on core %d", screen.width(), screen.height(), lines, opts.core);
+
+            return true;
+        }
+
+        void stop()
+        {
+            if (sp_task)
+            {
+                s_running = false;
+
+                xTaskNotifyGive(sp_task);
+                xSemaphoreTake(s_stopped, portMAX_DELAY);
+
+                sp_task = nullptr;
+            }
+
+            parallel::stop();
+
+            if (sp_display)
+            {
+                display::get().set_transfer_done_callback(nullptr, nullptr);
+
+                lv_disp_remove(sp_display);
+
+                sp_display = nullptr;
+            }
+
+            for (auto &buffer : sp_buffers)
+            {
+                heap_caps_free(buffer);
+
+                buffer = nullptr;
+            }
+
+            if (s_stopped)
+                vSemaphoreDelete(s_stopped);
+
+            if (s_mutex)
+                vSemaphoreDelete(s_mutex);
+
+            s_stopped = nullptr;
+            s_mutex = nullptr;
+        }
+
+        bool lock(uint32_t timeout_ms)
+        {
+            if (!s_mutex)
+                return false;
+
+            return xSemaphoreTakeRecursive(s_mutex, timeout_ms == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms)) == pdTRUE;
+        }
+
+        void unlock()
+        {
+            xSemaphoreGiveRecursive(s_mutex);
+        }
+
+        void wake()
+        {
+            if (sp_task)
+                xTaskNotifyGive(sp_task);
+        }
+
+        lv_disp_t *get_display()
+        {
+            return sp_display;
+        }
+    }
+}
@@ -0,0 +1,455 @@
+#include "hardware/graphics_blend.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <memory>
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <lvgl.h>
+#include <sdkconfig.h>
+
+static_assert(LV_COLOR_DEPTH == 16 && LV_COLOR_16_SWAP, "the blend kernels expect swapped RGB565");
+static_assert(LV_COLOR_MIX_ROUND_OFS == 0, "the blend kernels round like LV_COLOR_MIX_ROUND_OFS 0");
+
+#if CONFIG_IDF_TARGET_ESP32S3
+extern "C"
+{
+    void graphics_blend_fill_pie(uint16_t *dest, const uint16_t *color, size_t blocks);
+    void graphics_blend_copy_pie(uint16_t *dest, const uint16_t *src, size_t blocks);
+    void graphics_blend_mix_pie(uint16_t *dest, const uint16_t *src, size_t blocks, const uint16_t *constants, int32_t src_step);
+}
+#endif
+
+namespace hardware
+{
+    namespace graphics
+    {
+        namespace blend
+        {
+            constexpr const char *TAG = "graphics_blend";
+            constexpr size_t VECTOR_PIXELS = 8;
+            constexpr size_t VECTOR_BYTES = 16;
+            // Misaligned sources are copied to an aligned buffer on the stack this many pixels at a time.
+            constexpr size_t STAGE_PIXELS = 128;
+            constexpr size_t VERIFY_PIXELS = 96;
+
+            // xorshift32, deterministic so runs stay comparable between builds.
+            class xorshift
+            {
+            public:
+                explicit xorshift(uint32_t seed) : m_state(seed ? seed : 1)
+                {
+                }
+
+                uint32_t next()
+                {
+                    m_state ^= m_state << 13;
+                    m_state ^= m_state >> 17;
+                    m_state ^= m_state << 5;
+
+                    return m_state;
+                }
+
+            private:
+                uint32_t m_state;
+            };
+
+            namespace reference
+            {
+                // LV_UDIV255, exact for every sum of two channels weighted by opa and 255 - opa.
+                static inline uint32_t divide_255(uint32_t value)
+                {
+                    return (value * 0x8081) >> 23;
+                }
+
+                // In the swapped layout green is split into bits 0-2 (high) and 13-15 (low).
+                static inline uint32_t green(uint16_t pixel)
+                {
+                    return ((pixel & 7) << 3) | (pixel >> 13);
+                }
+
+                template <typename divide>
+                static inline uint16_t blend_pixel(uint16_t fg, uint16_t bg, uint32_t fg_weight, uint32_t bg_weight, divide scale)
+                {
+                    const uint32_t r = scale(((fg >> 3) & 31) * fg_weight + ((bg >> 3) & 31) * bg_weight);
+                    const uint32_t g = scale(green(fg) * fg_weight + green(bg) * bg_weight);
+                    const uint32_t b = scale(((fg >> 8) & 31) * fg_weight + ((bg >> 8) & 31) * bg_weight);
+
+                    return static_cast<uint16_t>(r << 3 | b << 8 | g >> 3 | (g & 7) << 13);
+                }
+
+                // lv_color_premult followed by lv_color_mix_premult, what LVGL fills with.
+                static inline uint16_t mix_premultiplied_pixel(uint16_t fg, uint16_t bg, uint32_t opa)
+                {
+                    return blend_pixel(fg, bg, opa, 255 - opa, divide_255);
+                }
+
+                // lv_color_mix, what LVGL blends images with. In 16 bit with LV_COLOR_MIX_ROUND_OFS 0
+                // it takes the opacity in 32 steps and divides by shifting.
+                static inline uint16_t mix_pixel(uint16_t fg, uint16_t bg, uint32_t opa)
+                {
+                    const uint32_t weight = (opa + 4) >> 3;
+
+                    return blend_pixel(fg, bg, weight, 32 - weight, [](uint32_t value) { return value >> 5; });
+                }
+
+                void fill(uint16_t *dest, uint16_t color, size_t count)
+                {
+                    std::fill_n(dest, count, color);
+                }
+
+                void fill_mix(uint16_t *dest, uint16_t color, uint8_t opa, size_t count)
+                {
+                    for (size_t i = 0; i < count; i++)
+                        dest[i] = mix_premultiplied_pixel(color, dest[i], opa);
+                }
+
+                void copy(uint16_t *dest, const uint16_t *src, size_t count)
+                {
+                    memcpy(dest, src, count * sizeof(uint16_t));
+                }
+
+                void mix(uint16_t *dest, const uint16_t *src, uint8_t opa, size_t count)
+                {
+                    for (size_t i = 0; i < count; i++)
+                        dest[i] = mix_pixel(src[i], dest[i], opa);
+                }
+            }
+
+#if CONFIG_IDF_TARGET_ESP32S3
+            // The kernel computes (fg * weight + bg * inverse) * multiplier >> 23 per channel.
+            struct alignas(VECTOR_BYTES) mix_constants
+            {
+                uint16_t vectors[4][VECTOR_PIXELS];
+
+                mix_constants(uint16_t weight, uint16_t inverse, uint16_t multiplier)
+                {
+                    std::fill_n(vectors[0], VECTOR_PIXELS, 8192);
+                    std::fill_n(vectors[1], VECTOR_PIXELS, weight);
+                    std::fill_n(vectors[2], VECTOR_PIXELS, inverse);
+                    std::fill_n(vectors[3], VECTOR_PIXELS, multiplier);
+                }
+
+                // LV_UDIV255 of the sum, as lv_color_mix_premult.
+                static mix_constants premultiplied(uint8_t opa)
+                {
+                    return mix_constants(opa, 255 - opa, 0x8081);
+                }
+
+                // lv_color_mix's weights out of 32 scaled to out of 256, 0x8000 with SAR = 23 then
+                // shifts the sum right by 8.
+                static mix_constants stepped(uint8_t opa)
+                {
+                    const uint16_t weight = ((opa + 4) >> 3) << 3;
+
+                    return mix_constants(weight, 256 - weight, 0x8000);
+                }
+            };
+
+            // Pixels before dest reaches a 16 byte boundary.
+            static size_t head_pixels(const uint16_t *dest, size_t count)
+            {
+                return std::min(count, ((VECTOR_BYTES - (reinterpret_cast<uintptr_t>(dest) & (VECTOR_BYTES - 1))) & (VECTOR_BYTES - 1)) / sizeof(uint16_t));
+            }
+
+            static bool aligned(const void *pointer)
+            {
+                return !(reinterpret_cast<uintptr_t>(pointer) & (VECTOR_BYTES - 1));
+            }
+
+            void fill(uint16_t *dest, uint16_t color, size_t count)
+            {
+                const size_t head = head_pixels(dest, count);
+                const size_t blocks = (count - head) / VECTOR_PIXELS;
+
+                reference::fill(dest, color, head);
+                graphics_blend_fill_pie(dest + head, &color, blocks);
+                reference::fill(dest + head + blocks * VECTOR_PIXELS, color, count - head - blocks * VECTOR_PIXELS);
+            }
+
+            void fill_mix(uint16_t *dest, uint16_t color, uint8_t opa, size_t count)
+            {
+                const size_t head = head_pixels(dest, count);
+                const size_t blocks = (count - head) / VECTOR_PIXELS;
+                const auto constants = mix_constants::premultiplied(opa);
+                alignas(VECTOR_BYTES) uint16_t colors[VECTOR_PIXELS];
+
+                std::fill_n(colors, VECTOR_PIXELS, color);
+
+                reference::fill_mix(dest, color, opa, head);
+                graphics_blend_mix_pie(dest + head, colors, blocks, constants.vectors[0], 0);
+                reference::fill_mix(dest + head + blocks * VECTOR_PIXELS, color, opa, count - head - blocks * VECTOR_PIXELS);
+            }
+
+            void copy(uint16_t *dest, const uint16_t *src, size_t count)
+            {
+                const size_t head = head_pixels(dest, count);
+
+                if (!aligned(src + head))
+                {
+                    reference::copy(dest, src, count);
+
+                    return;
+                }
+
+                const size_t blocks = (count - head) / VECTOR_PIXELS;
+
+                reference::copy(dest, src, head);
+                graphics_blend_copy_pie(dest + head, src + head, blocks);
+                reference::copy(dest + head + blocks * VECTOR_PIXELS, src + head + blocks * VECTOR_PIXELS, count - head - blocks * VECTOR_PIXELS);
+            }
+
+            void mix(uint16_t *dest, const uint16_t *src, uint8_t opa, size_t count)
+            {
+                const size_t head = head_pixels(dest, count);
+                const size_t blocks = (count - head) / VECTOR_PIXELS;
+                const auto constants = mix_constants::stepped(opa);
+
+                reference::mix(dest, src, opa, head);
+
+                dest += head;
+                src += head;
+
+                if (aligned(src))
+                {
+                    graphics_blend_mix_pie(dest, src, blocks, constants.vectors[0], VECTOR_BYTES);
+                }
+                else
+                {
+                    alignas(VECTOR_BYTES) uint16_t staged[STAGE_PIXELS];
+
+                    for (size_t done = 0; done < blocks;)
+                    {
+                        const size_t step = std::min(blocks - done, STAGE_PIXELS / VECTOR_PIXELS);
+
+                        memcpy(staged, src + done * VECTOR_PIXELS, step * VECTOR_BYTES);
+                        graphics_blend_mix_pie(dest + done * VECTOR_PIXELS, staged, step, constants.vectors[0], VECTOR_BYTES);
+
+                        done += step;
+                    }
+                }
+
+                reference::mix(dest + blocks * VECTOR_PIXELS, src + blocks * VECTOR_PIXELS, opa, count - head - blocks * VECTOR_PIXELS);
+            }
+#else
+            void fill(uint16_t *dest, uint16_t color, size_t count)
+            {
+                reference::fill(dest, color, count);
+            }
+
+            void fill_mix(uint16_t *dest, uint16_t color, uint8_t opa, size_t count)
+            {
+                reference::fill_mix(dest, color, opa, count);
+            }
+
+            void copy(uint16_t *dest, const uint16_t *src, size_t count)
+            {
+                reference::copy(dest, src, count);
+            }
+
+            void mix(uint16_t *dest, const uint16_t *src, uint8_t opa, size_t count)
+            {
+                reference::mix(dest, src, opa, count);
+            }
+#endif
+
+            // Same clipping and strides as lv_draw_sw_blend_basic, which keeps everything else.
+            static void accelerated_blend(lv_draw_ctx_t *draw_context, const lv_draw_sw_blend_dsc_t *dsc)
+            {
+                const lv_disp_t *disp = _lv_refr_get_disp_refreshing();
+
+                if ((dsc->mask_buf && dsc->mask_res != LV_DRAW_MASK_RES_FULL_COVER) || dsc->blend_mode != LV_BLEND_MODE_NORMAL ||
+                    disp->driver->set_px_cb || disp->driver->screen_transp)
+                {
+                    lv_draw_sw_blend_basic(draw_context, dsc);
+
+                    return;
+                }
+
+                lv_area_t area;
+
+                if (dsc->opa <= LV_OPA_MIN || !_lv_area_intersect(&area, dsc->blend_area, draw_context->clip_area))
+                    return;
+
+                const lv_area_t *buffer_area = draw_context->buf_area;
+                const lv_coord_t dest_stride = lv_area_get_width(buffer_area);
+                const lv_coord_t width = lv_area_get_width(&area);
+                auto dest = reinterpret_cast<uint16_t *>(draw_context->buf) + dest_stride * (area.y1 - buffer_area->y1) + (area.x1 - buffer_area->x1);
+
+                if (!dsc->src_buf)
+                {
+                    for (lv_coord_t y = area.y1; y <= area.y2; y++, dest += dest_stride)
+                    {
+                        if (dsc->opa >= LV_OPA_MAX)
+                            fill(dest, dsc->color.full, width);
+                        else
+                            fill_mix(dest, dsc->color.full, dsc->opa, width);
+                    }
+
+                    return;
+                }
+
+                const lv_coord_t src_stride = lv_area_get_width(dsc->blend_area);
+                auto src = reinterpret_cast<const uint16_t *>(dsc->src_buf) + src_stride * (area.y1 - dsc->blend_area->y1) + (area.x1 - dsc->blend_area->x1);
+
+                for (lv_coord_t y = area.y1; y <= area.y2; y++, dest += dest_stride, src += src_stride)
+                {
+                    if (dsc->opa >= LV_OPA_MAX)
+                        copy(dest, src, width);
+                    else
+                        mix(dest, src, dsc->opa, width);
+                }
+            }
+
+            uint32_t verify(uint32_t seed, uint32_t rounds)
+            {
+                xorshift random(seed);
+                uint32_t mismatches = 0;
+                // One spare vector on each side to shift the start by every possible alignment.
+                uint16_t src[VERIFY_PIXELS + VECTOR_PIXELS], expected[VERIFY_PIXELS + VECTOR_PIXELS], actual[VERIFY_PIXELS + VECTOR_PIXELS];
+
+                for (uint32_t round = 0; round < rounds; round++)
+                {
+                    const size_t dest_offset = random.next() % VECTOR_PIXELS;
+                    const size_t src_offset = random.next() % VECTOR_PIXELS;
+                    const size_t count = random.next() % (VERIFY_PIXELS + 1);
+                    const uint16_t color = random.next();
+                    const uint8_t opa = random.next();
+
+                    for (size_t i = 0; i < VERIFY_PIXELS + VECTOR_PIXELS; i++)
+                    {
+                        src[i] = random.next();
+                        expected[i] = actual[i] = random.next();
+                    }
+
+                    switch (round % 4)
+                    {
+                    case 0:
+                        reference::fill(expected + dest_offset, color, count);
+                        fill(actual + dest_offset, color, count);
+                        break;
+
+                    case 1:
+                        reference::fill_mix(expected + dest_offset, color, opa, count);
+                        fill_mix(actual + dest_offset, color, opa, count);
+                        break;
+
+                    case 2:
+                        reference::copy(expected + dest_offset, src + src_offset, count);
+                        copy(actual + dest_offset, src + src_offset, count);
+                        break;
+
+                    default:
+                        reference::mix(expected + dest_offset, src + src_offset, opa, count);
+                        mix(actual + dest_offset, src + src_offset, opa, count);
+                        break;
+                    }
+
+                    for (size_t i = 0; i < VERIFY_PIXELS + VECTOR_PIXELS; i++)
+                        mismatches += expected[i] != actual[i];
+                }
+
+                return mismatches;
+            }
+
+            bool install(lv_disp_drv_t *driver)
+            {
+                if (!driver->draw_ctx || driver->draw_ctx_size != sizeof(lv_draw_sw_ctx_t))
+                {
+                    ESP_LOGW(TAG, "not the software renderer, keeping LVGL's blending");
+
+                    return false;
+                }
+
+                const uint32_t mismatches = verify();
+
+                if (mismatches)
+                {
+                    ESP_LOGE(TAG, "%" PRIu32 " pixels differ from the reference, keeping LVGL's blending", mismatches);
+
+                    return false;
+                }
+
+                reinterpret_cast<lv_draw_sw_ctx_t *>(driver->draw_ctx)->blend = accelerated_blend;
+
+                return true;
+            }
+
+            template <typename kernel>
+            static uint32_t measure(uint32_t iterations, kernel run)
+            {
+                const int64_t start = esp_timer_get_time();
+
+                for (uint32_t i = 0; i < iterations; i++)
+                    run(static_cast<uint8_t>(64 + i % 128));
+
+                return static_cast<uint32_t>(esp_timer_get_time() - start);
+            }
+
+            results benchmark(size_t pixels, uint32_t iterations)
+            {
+                results result = {};
+                auto free = [](uint16_t *buffer) { heap_caps_free(buffer); };
+                auto allocate = [&]() {
+                    return std::unique_ptr<uint16_t, decltype(free)>(
+                        static_cast<uint16_t *>(heap_caps_aligned_alloc(VECTOR_BYTES, pixels * sizeof(uint16_t), MALLOC_CAP_INTERNAL)), free);
+                };
+                auto dest = allocate();
+                auto src = allocate();
+
+                if (!dest || !src)
+                {
+                    ESP_LOGE(TAG, "not enough memory for %u pixel buffers", static_cast<unsigned>(pixels));
+
+                    return result;
+                }
+
+                xorshift random(pixels);
+
+                for (size_t i = 0; i < pixels; i++)
+                    src.get()[i] = dest.get()[i] = random.next();
+
+                uint16_t *d = dest.get();
+                const uint16_t *s = src.get();
+
+                result.pixels = pixels;
+                result.iterations = iterations;
+                result.mismatches = verify();
+
+                result.fill.reference_us = measure(iterations, [&](uint8_t value) { reference::fill(d, value, pixels); });
+                result.fill.accelerated_us = measure(iterations, [&](uint8_t value) { fill(d, value, pixels); });
+                result.fill_mix.reference_us = measure(iterations, [&](uint8_t opa) { reference::fill_mix(d, 0x1f00, opa, pixels); });
+                result.fill_mix.accelerated_us = measure(iterations, [&](uint8_t opa) { fill_mix(d, 0x1f00, opa, pixels); });
+                result.copy.reference_us = measure(iterations, [&](uint8_t) { reference::copy(d, s, pixels); });
+                result.copy.accelerated_us = measure(iterations, [&](uint8_t) { copy(d, s, pixels); });
+                result.mix.reference_us = measure(iterations, [&](uint8_t opa) { reference::mix(d, s, opa, pixels); });
+                result.mix.accelerated_us = measure(iterations, [&](uint8_t opa) { mix(d, s, opa, pixels); });
+
+                return result;
+            }
+
+            static void print_timing(const char *name, const results &result, const timing &value)
+            {
+                const uint64_t total = uint64_t(result.pixels) * result.iterations;
+
+                ESP_LOGI(TAG, "%-9s reference %" PRIu32 "us, accelerated %" PRIu32 "us, %" PRIu32 " vs %" PRIu32 " Mpx/s", name,
+                         value.reference_us, value.accelerated_us,
+                         value.reference_us ? static_cast<uint32_t>(total / value.reference_us) : 0,
+                         value.accelerated_us ? static_cast<uint32_t>(total / value.accelerated_us) : 0);
+            }
+
+            void print(const results &result)
+            {
+                ESP_LOGI(TAG, "%" PRIu32 " pixels x %" PRIu32 ", %" PRIu32 " mismatches", result.pixels, result.iterations, result.mismatches);
+
+                print_timing("fill", result, result.fill);
+                print_timing("fill_mix", result, result.fill_mix);
+                print_timing("copy", result, result.copy);
+                print_timing("mix", result, result.mix);
+            }
+        }
+    }
+}
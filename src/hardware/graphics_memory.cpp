@@ -0,0 +1,280 @@
+#include "hardware/graphics_memory.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <freertos/FreeRTOS.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_memory_utils.h>
+
+namespace hardware
+{
+    namespace graphics
+    {
+        constexpr const char *TAG = "graphics_memory";
+        constexpr size_t MAX_SLABS = MEMORY_INTERNAL_BUDGET / MEMORY_SLAB_SIZE;
+        constexpr size_t LARGEST_CLASS = MEMORY_CLASS_SIZES[MEMORY_CLASS_COUNT - 1];
+        constexpr uint32_t INTERNAL_CAPS = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+        constexpr uint32_t EXTERNAL_CAPS = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+
+        struct free_block
+        {
+            free_block *next;
+        };
+
+        struct slab
+        {
+            uint8_t *base;
+            uint8_t size_class;
+        };
+
+        // Slabs are only ever added, so they can be looked up without holding the lock.
+        static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+        static slab s_slabs[MAX_SLABS];
+        static volatile size_t s_slab_count = 0;
+        static free_block *sp_free_blocks[MEMORY_CLASS_COUNT] = {};
+        static memory_statistics s_statistics = {};
+
+        static int size_class(size_t size)
+        {
+            for (size_t i = 0; i < MEMORY_CLASS_COUNT; i++)
+                if (size <= MEMORY_CLASS_SIZES[i])
+                    return i;
+
+            return -1;
+        }
+
+        static const slab *find_slab(const void *data)
+        {
+            auto address = static_cast<const uint8_t *>(data);
+
+            for (size_t i = 0; i < s_slab_count; i++)
+                if (address >= s_slabs[i].base && address < s_slabs[i].base + MEMORY_SLAB_SIZE)
+                    return &s_slabs[i];
+
+            return nullptr;
+        }
+
+        static void account(memory_tier &tier, size_t bytes)
+        {
+            tier.used_bytes += bytes;
+            tier.peak_bytes = std::max(tier.peak_bytes, tier.used_bytes);
+            tier.allocations++;
+        }
+
+        // Called with the lock held.
+        static void *pop_block(int index)
+        {
+            free_block *block = sp_free_blocks[index];
+
+            if (!block)
+                return nullptr;
+
+            sp_free_blocks[index] = block->next;
+
+            s_statistics.blocks_free[index]--;
+            s_statistics.blocks_used[index]++;
+
+            account(s_statistics.internal, MEMORY_CLASS_SIZES[index]);
+
+            return block;
+        }
+
+        static void *allocate_block(int index)
+        {
+            void *block = nullptr;
+
+            portENTER_CRITICAL(&s_lock);
+            block = pop_block(index);
+            portEXIT_CRITICAL(&s_lock);
+
+            if (block || s_slab_count >= MAX_SLABS)
+                return block;
+
+            auto memory = static_cast<uint8_t *>(heap_caps_malloc(MEMORY_SLAB_SIZE, INTERNAL_CAPS));
+
+            if (!memory)
+                return nullptr;
+
+            portENTER_CRITICAL(&s_lock);
+
+            if (s_slab_count < MAX_SLABS)
+            {
+                const size_t block_size = MEMORY_CLASS_SIZES[index];
+                const size_t blocks = MEMORY_SLAB_SIZE / block_size;
+
+                for (size_t i = 0; i < blocks; i++)
+                {
+                    auto entry = reinterpret_cast<free_block *>(memory + i * block_size);
+
+                    entry->next = sp_free_blocks[index];
+                    sp_free_blocks[index] = entry;
+                }
+
+                s_slabs[s_slab_count] = {memory, static_cast<uint8_t>(index)};
+                s_slab_count = s_slab_count + 1;
+
+                s_statistics.slabs++;
+                s_statistics.blocks_free[index] += blocks;
+
+                memory = nullptr;
+            }
+
+            block = pop_block(index);
+
+            portEXIT_CRITICAL(&s_lock);
+
+            // Another task used up the budget in the meantime.
+            heap_caps_free(memory);
+
+            return block;
+        }
+
+        static memory_tier &tier_of(const void *data)
+        {
+            return esp_ptr_external_ram(data) ? s_statistics.external : s_statistics.internal;
+        }
+
+        static void *allocate_heap(size_t size)
+        {
+            void *data = heap_caps_malloc(size, EXTERNAL_CAPS);
+
+            if (!data)
+                data = heap_caps_malloc(size, INTERNAL_CAPS);
+
+            portENTER_CRITICAL(&s_lock);
+
+            if (data)
+                account(tier_of(data), heap_caps_get_allocated_size(data));
+            else
+                s_statistics.external.failures++;
+
+            portEXIT_CRITICAL(&s_lock);
+
+            return data;
+        }
+
+        static void release(void *data, const slab *owner)
+        {
+            portENTER_CRITICAL(&s_lock);
+
+            if (owner)
+            {
+                auto block = static_cast<free_block *>(data);
+
+                block->next = sp_free_blocks[owner->size_class];
+                sp_free_blocks[owner->size_class] = block;
+
+                s_statistics.blocks_free[owner->size_class]++;
+                s_statistics.blocks_used[owner->size_class]--;
+                s_statistics.internal.used_bytes -= MEMORY_CLASS_SIZES[owner->size_class];
+            }
+            else
+                tier_of(data).used_bytes -= heap_caps_get_allocated_size(data);
+
+            portEXIT_CRITICAL(&s_lock);
+
+            if (!owner)
+                heap_caps_free(data);
+        }
+
+        memory_statistics get_memory_statistics()
+        {
+            portENTER_CRITICAL(&s_lock);
+
+            const memory_statistics result = s_statistics;
+
+            portEXIT_CRITICAL(&s_lock);
+
+            return result;
+        }
+
+        void print_memory_statistics()
+        {
+            const memory_statistics statistics = get_memory_statistics();
+
+            ESP_LOGI(TAG, "internal %u bytes (peak %u, %lu allocations, %u slabs), external %u bytes (peak %u, %lu allocations, %lu failures)",
+                     static_cast<unsigned>(statistics.internal.used_bytes), static_cast<unsigned>(statistics.internal.peak_bytes),
+                     static_cast<unsigned long>(statistics.internal.allocations), static_cast<unsigned>(statistics.slabs),
+                     static_cast<unsigned>(statistics.external.used_bytes), static_cast<unsigned>(statistics.external.peak_bytes),
+                     static_cast<unsigned long>(statistics.external.allocations), static_cast<unsigned long>(statistics.external.failures));
+
+            for (size_t i = 0; i < MEMORY_CLASS_COUNT; i++)
+                if (statistics.blocks_used[i] || statistics.blocks_free[i])
+                    ESP_LOGI(TAG, "%4u byte blocks: %lu used, %lu free", static_cast<unsigned>(MEMORY_CLASS_SIZES[i]),
+                             static_cast<unsigned long>(statistics.blocks_used[i]), static_cast<unsigned long>(statistics.blocks_free[i]));
+        }
+    }
+}
+
+using namespace hardware::graphics;
+
+extern "C" void *graphics_memory_alloc(size_t size)
+{
+    const int index = size_class(size);
+
+    if (index >= 0)
+    {
+        if (void *block = allocate_block(index))
+            return block;
+    }
+
+    return allocate_heap(size);
+}
+
+extern "C" void graphics_memory_free(void *data)
+{
+    if (data)
+        release(data, find_slab(data));
+}
+
+extern "C" void *graphics_memory_realloc(void *data, size_t size)
+{
+    if (!data)
+        return graphics_memory_alloc(size);
+
+    if (!size)
+    {
+        graphics_memory_free(data);
+
+        return nullptr;
+    }
+
+    const slab *owner = find_slab(data);
+    const int index = size_class(size);
+
+    if (owner && index == owner->size_class)
+        return data;
+
+    const size_t previous = owner ? MEMORY_CLASS_SIZES[owner->size_class] : heap_caps_get_allocated_size(data);
+
+    // Large buffers grow in place where the heap allows it.
+    if (!owner && size > LARGEST_CLASS)
+    {
+        void *resized = heap_caps_realloc(data, size, esp_ptr_external_ram(data) ? EXTERNAL_CAPS : INTERNAL_CAPS);
+
+        if (!resized)
+            return nullptr;
+
+        portENTER_CRITICAL(&s_lock);
+
+        tier_of(resized).used_bytes += heap_caps_get_allocated_size(resized);
+        tier_of(data).used_bytes -= previous;
+
+        portEXIT_CRITICAL(&s_lock);
+
+        return resized;
+    }
+
+    void *moved = graphics_memory_alloc(size);
+
+    if (!moved)
+        return nullptr;
+
+    memcpy(moved, data, std::min(previous, size));
+
+    graphics_memory_free(data);
+
+    return moved;
+}
@@ -0,0 +1,177 @@
+#include "graphics_parallel.h"
+#include "hardware/trace.h"
+
+#include <atomic>
+#include <cinttypes>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include <lvgl.h>
+
+namespace hardware
+{
+    namespace graphics
+    {
+        namespace parallel
+        {
+            constexpr const char *TAG = "graphics_parallel";
+            constexpr uint32_t STACK_SIZE = 3072;
+
+            using blend_function = void (*)(lv_draw_ctx_t *, const lv_draw_sw_blend_dsc_t *);
+
+            // The lower band, blended through a copy of the draw context clipped to its rows.
+            struct job
+            {
+                lv_draw_sw_ctx_t context;
+                lv_area_t clip;
+                const lv_draw_sw_blend_dsc_t *dsc;
+            };
+
+            static lv_draw_sw_ctx_t *sp_context = nullptr;
+            static blend_function sp_blend = nullptr;
+            static TaskHandle_t sp_task = nullptr;
+            static SemaphoreHandle_t s_ready = nullptr;
+            static SemaphoreHandle_t s_done = nullptr;
+            static std::atomic<bool> s_running = false;
+            static uint32_t s_min_pixels = 0;
+            static job s_job;
+
+            static void helper_task(void *arg)
+            {
+                while (true)
+                {
+                    xSemaphoreTake(s_ready, portMAX_DELAY);
+
+                    if (!s_running)
+                        break;
+
+                    HARDWARE_TRACE_BEGIN(GRAPHICS_BLEND_HELPER);
+
+                    sp_blend(&s_job.context.base_draw, s_job.dsc);
+
+                    HARDWARE_TRACE_END(GRAPHICS_BLEND_HELPER);
+
+                    xSemaphoreGive(s_done);
+                }
+
+                xSemaphoreGive(s_done);
+
+                vTaskDelete(nullptr);
+            }
+
+            static void parallel_blend(lv_draw_ctx_t *draw_context, const lv_draw_sw_blend_dsc_t *dsc)
+            {
+                lv_area_t area;
+
+                // Small blends, like the single rows of masked drawing, cost less than the handover.
+                if (!_lv_area_intersect(&area, dsc->blend_area, draw_context->clip_area) || lv_area_get_height(&area) < 2 ||
+                    lv_area_get_size(&area) < s_min_pixels)
+                {
+                    sp_blend(draw_context, dsc);
+
+                    return;
+                }
+
+                HARDWARE_TRACE_SCOPE(GRAPHICS_BLEND_SPLIT, lv_area_get_height(&area));
+
+                const lv_coord_t middle = area.y1 + lv_area_get_height(&area) / 2;
+                const lv_area_t *clip = draw_context->clip_area;
+                lv_area_t upper = area;
+
+                upper.y2 = middle - 1;
+
+                s_job.context = *reinterpret_cast<lv_draw_sw_ctx_t *>(draw_context);
+                s_job.clip = area;
+                s_job.clip.y1 = middle;
+                s_job.context.base_draw.clip_area = &s_job.clip;
+                s_job.dsc = dsc;
+
+                xSemaphoreGive(s_ready);
+
+                draw_context->clip_area = &upper;
+
+                sp_blend(draw_context, dsc);
+
+                draw_context->clip_area = clip;
+
+                // The descriptor and its buffers belong to the caller, hold it until both are done.
+                xSemaphoreTake(s_done, portMAX_DELAY);
+            }
+
+            bool start(lv_disp_drv_t *driver, int core, uint32_t priority, uint32_t min_pixels)
+            {
+                if (sp_context)
+                    return true;
+
+                if (!driver->draw_ctx || driver->draw_ctx_size != sizeof(lv_draw_sw_ctx_t))
+                {
+                    ESP_LOGW(TAG, "not the software renderer, blending stays on one core");
+
+                    return false;
+                }
+
+                s_ready = xSemaphoreCreateBinary();
+                s_done = xSemaphoreCreateBinary();
+
+                if (!s_ready || !s_done)
+                {
+                    stop();
+
+                    return false;
+                }
+
+                sp_context = reinterpret_cast<lv_draw_sw_ctx_t *>(driver->draw_ctx);
+                sp_blend = sp_context->blend;
+                s_min_pixels = min_pixels;
+                s_running = true;
+
+                if (xTaskCreatePinnedToCore(helper_task, "graphics_blend", STACK_SIZE, nullptr, priority, &sp_task, core) != pdPASS)
+                {
+                    ESP_LOGE(TAG, "failed to start the blend task");
+
+                    s_running = false;
+
+                    stop();
+
+                    return false;
+                }
+
+                sp_context->blend = parallel_blend;
+
+                ESP_LOGI(TAG, "blending from %" PRIu32 " pixels on core %d as well", min_pixels, core);
+
+                return true;
+            }
+
+            // Called with the graphics lock held or the render task stopped, so no blend is running.
+            void stop()
+            {
+                if (sp_context)
+                    sp_context->blend = sp_blend;
+
+                if (sp_task)
+                {
+                    s_running = false;
+
+                    xSemaphoreGive(s_ready);
+                    xSemaphoreTake(s_done, portMAX_DELAY);
+
+                    sp_task = nullptr;
+                }
+
+                if (s_ready)
+                    vSemaphoreDelete(s_ready);
+
+                if (s_done)
+                    vSemaphoreDelete(s_done);
+
+                s_ready = nullptr;
+                s_done = nullptr;
+                sp_context = nullptr;
+                sp_blend = nullptr;
+            }
+        }
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+
+struct _lv_disp_drv_t;
+
+namespace hardware
+{
+    namespace graphics
+    {
+        // Splits large blends of the software renderer into an upper and a lower band. The
+        // render task blends the upper one while a helper task on the other core blends the
+        // lower one into the same draw buffer, each clipped to its own rows.
+        namespace parallel
+        {
+            bool start(_lv_disp_drv_t *driver, int core, uint32_t priority, uint32_t min_pixels);
+            void stop();
+        }
+    }
+}
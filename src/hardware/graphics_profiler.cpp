@@ -0,0 +1,513 @@
+#include "hardware/graphics_profiler.h"
+
+#include "hardware/graphics.h"
+#include "hardware/storage.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <vector>
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <lvgl.h>
+
+namespace hardware
+{
+    namespace graphics
+    {
+        namespace profiler
+        {
+            constexpr const char *TAG = "graphics_profiler";
+
+            struct type_name
+            {
+                const lv_obj_class_t *type;
+                const char *name;
+            };
+
+            // lv_obj_class_t carries no name, so the common widgets are listed here.
+            static const type_name TYPE_NAMES[] = {
+                {&lv_obj_class, "obj"},
+#if LV_USE_LABEL
+                {&lv_label_class, "label"},
+#endif
+#if LV_USE_BTN
+                {&lv_btn_class, "btn"},
+#endif
+#if LV_USE_IMG
+                {&lv_img_class, "img"},
+#endif
+#if LV_USE_ARC
+                {&lv_arc_class, "arc"},
+#endif
+#if LV_USE_BAR
+                {&lv_bar_class, "bar"},
+#endif
+#if LV_USE_SLIDER
+                {&lv_slider_class, "slider"},
+#endif
+#if LV_USE_LINE
+                {&lv_line_class, "line"},
+#endif
+#if LV_USE_CANVAS
+                {&lv_canvas_class, "canvas"},
+#endif
+#if LV_USE_BTNMATRIX
+                {&lv_btnmatrix_class, "btnmatrix"},
+#endif
+#if LV_USE_CHECKBOX
+                {&lv_checkbox_class, "checkbox"},
+#endif
+#if LV_USE_DROPDOWN
+                {&lv_dropdown_class, "dropdown"},
+#endif
+#if LV_USE_ROLLER
+                {&lv_roller_class, "roller"},
+#endif
+#if LV_USE_SWITCH
+                {&lv_switch_class, "switch"},
+#endif
+#if LV_USE_TEXTAREA
+                {&lv_textarea_class, "textarea"},
+#endif
+#if LV_USE_TABLE
+                {&lv_table_class, "table"},
+#endif
+#if LV_USE_CHART
+                {&lv_chart_class, "chart"},
+#endif
+#if LV_USE_METER
+                {&lv_meter_class, "meter"},
+#endif
+#if LV_USE_SPINNER
+                {&lv_spinner_class, "spinner"},
+#endif
+#if LV_USE_LED
+                {&lv_led_class, "led"},
+#endif
+            };
+
+            struct total
+            {
+                const void *key;
+                const lv_obj_class_t *type;
+                uint64_t draw_us;
+                uint64_t pixels;
+                uint32_t draws;
+            };
+
+            // Everything below is only touched by the render task or with the graphics lock held.
+            static bool s_running = false;
+            static options s_options = {};
+            static void (*sp_previous_monitor)(lv_disp_drv_t *, uint32_t, uint32_t) = nullptr;
+
+            static frame *sp_frames = nullptr;
+            static sample *sp_samples = nullptr;
+            static uint32_t s_frames_written = 0;
+            static uint32_t s_samples_written = 0;
+
+            static frame s_frame = {};
+            static int64_t s_frame_start_us = 0;
+            static int64_t s_draw_start_us = 0;
+
+            static const char *name_of(const lv_obj_class_t *type)
+            {
+                for (const type_name &entry : TYPE_NAMES)
+                    if (entry.type == type)
+                        return entry.name;
+
+                return "?";
+            }
+
+            static void record(lv_obj_t *object, lv_event_t *event, bool main)
+            {
+                const int64_t now = esp_timer_get_time();
+                const uint32_t elapsed = now - s_draw_start_us;
+                uint32_t pixels = 0;
+
+                // The post phase draws over the same area, only the main phase counts pixels.
+                if (main)
+                {
+                    lv_area_t coords;
+                    lv_area_t drawn;
+
+                    lv_obj_get_coords(object, &coords);
+
+                    if (_lv_area_intersect(&drawn, &coords, lv_event_get_draw_ctx(event)->clip_area))
+                        pixels = lv_area_get_size(&drawn);
+                }
+
+                sp_samples[s_samples_written % SAMPLE_HISTORY] = {
+                    .frame = s_frame.index,
+                    .object = object,
+                    .type = lv_obj_get_class(object),
+                    .draw_us = elapsed,
+                    .pixels = pixels,
+                };
+
+                s_samples_written++;
+
+                s_frame.draw_us += elapsed;
+                s_frame.pixels += pixels;
+                s_frame.draws++;
+            }
+
+            static void object_event(lv_event_t *event)
+            {
+                if (!s_running)
+                    return;
+
+                lv_obj_t *object = lv_event_get_target(event);
+
+                switch (lv_event_get_code(event))
+                {
+                case LV_EVENT_CHILD_CREATED:
+                    attach(static_cast<lv_obj_t *>(lv_event_get_param(event)));
+                    break;
+
+                case LV_EVENT_DRAW_MAIN_BEGIN:
+                case LV_EVENT_DRAW_POST_BEGIN:
+                    s_draw_start_us = esp_timer_get_time();
+
+                    if (!s_frame_start_us)
+                        s_frame_start_us = s_draw_start_us;
+                    break;
+
+                case LV_EVENT_DRAW_MAIN_END:
+                    record(object, event, true);
+                    break;
+
+                case LV_EVENT_DRAW_POST_END:
+                    record(object, event, false);
+                    break;
+
+                default:
+                    break;
+                }
+            }
+
+            // LVGL calls this once a refresh has been rendered and flushed.
+            static void frame_done(lv_disp_drv_t *driver, uint32_t time_ms, uint32_t pixels)
+            {
+                if (s_running && s_frame_start_us)
+                {
+                    s_frame.render_us = esp_timer_get_time() - s_frame_start_us;
+
+                    sp_frames[s_frames_written % FRAME_HISTORY] = s_frame;
+
+                    s_frames_written++;
+
+                    s_frame = {s_frame.index + 1, 0, 0, 0, 0};
+                    s_frame_start_us = 0;
+                }
+
+                if (sp_previous_monitor)
+                    sp_previous_monitor(driver, time_ms, pixels);
+            }
+
+            static void detach(lv_obj_t *root)
+            {
+                lv_obj_remove_event_cb(root, object_event);
+
+                for (uint32_t i = 0; i < lv_obj_get_child_cnt(root); i++)
+                    detach(lv_obj_get_child(root, i));
+            }
+
+            template <typename Function>
+            static void for_each_root(lv_disp_t *display, Function function)
+            {
+                for (uint32_t i = 0; i < display->screen_cnt; i++)
+                    function(display->screens[i]);
+
+                function(lv_disp_get_layer_top(display));
+                function(lv_disp_get_layer_sys(display));
+            }
+
+            template <typename T>
+            static size_t copy_ring(const T *ring, uint32_t written, size_t history, T *result, size_t count)
+            {
+                const size_t available = std::min<size_t>({written, history, count});
+
+                for (size_t i = 0; i < available; i++)
+                    result[i] = ring[(written - available + i) % history];
+
+                return available;
+            }
+
+            // Sums the samples per object or per type, sorted by draw time, most expensive first.
+            static std::vector<total> aggregate(std::vector<sample> samples, bool by_type)
+            {
+                auto key = [by_type](const sample &value) -> const void * { return by_type ? static_cast<const void *>(value.type) : value.object; };
+                std::vector<total> totals;
+
+                std::sort(samples.begin(), samples.end(), [&](const sample &a, const sample &b) { return key(a) < key(b); });
+
+                for (const sample &value : samples)
+                {
+                    if (totals.empty() || totals.back().key != key(value))
+                        totals.push_back({key(value), value.type, 0, 0, 0});
+
+                    totals.back().draw_us += value.draw_us;
+                    totals.back().pixels += value.pixels;
+                    totals.back().draws++;
+                }
+
+                std::sort(totals.begin(), totals.end(), [](const total &a, const total &b) { return a.draw_us > b.draw_us; });
+
+                return totals;
+            }
+
+            static void print_totals(FILE *output, const std::vector<total> &totals, uint64_t draw_us, size_t frames, bool by_type)
+            {
+                for (size_t i = 0; i < std::min(totals.size(), REPORT_ENTRIES); i++)
+                {
+                    const total &entry = totals[i];
+
+                    if (by_type)
+                        fprintf(output, "  %-10s", name_of(entry.type));
+                    else
+                        fprintf(output, "  %-10s %p", name_of(entry.type), entry.key);
+
+                    fprintf(output, " %5.1f%% %7" PRIu32 " us/frame %8" PRIu32 " px/frame %5" PRIu32 " draws\n",
+                            draw_us ? 100.0 * entry.draw_us / draw_us : 0.0,
+                            static_cast<uint32_t>(entry.draw_us / frames), static_cast<uint32_t>(entry.pixels / frames), entry.draws);
+                }
+            }
+
+            bool start(const options &opts)
+            {
+                if (!lock())
+                    return false;
+
+                lv_disp_t *display = get_display();
+
+                if (!display)
+                {
+                    unlock();
+
+                    return false;
+                }
+
+                if (!sp_frames)
+                    sp_frames = static_cast<frame *>(heap_caps_malloc(FRAME_HISTORY * sizeof(frame), MALLOC_CAP_SPIRAM));
+
+                if (!sp_samples)
+                    sp_samples = static_cast<sample *>(heap_caps_malloc(SAMPLE_HISTORY * sizeof(sample), MALLOC_CAP_SPIRAM));
+
+                if (!sp_frames || !sp_samples)
+                {
+                    ESP_LOGE(TAG, "not enough memory for the profiling rings");
+
+                    unlock();
+
+                    return false;
+                }
+
+                if (!s_running)
+                {
+                    sp_previous_monitor = display->driver->monitor_cb;
+                    display->driver->monitor_cb = frame_done;
+                }
+
+                s_options = opts;
+                s_running = true;
+
+                clear();
+
+                for_each_root(display, attach);
+
+                // Draw everything once so the first frame has a full picture.
+                lv_obj_invalidate(lv_disp_get_scr_act(display));
+
+                unlock();
+
+                ESP_LOGI(TAG, "profiling with a %" PRIu32 " us frame budget", opts.frame_budget_us);
+
+                return true;
+            }
+
+            void stop()
+            {
+                if (!s_running || !lock())
+                    return;
+
+                lv_disp_t *display = get_display();
+
+                if (display)
+                {
+                    for_each_root(display, detach);
+
+                    display->driver->monitor_cb = sp_previous_monitor;
+                }
+
+                sp_previous_monitor = nullptr;
+                s_running = false;
+
+                unlock();
+            }
+
+            void attach(lv_obj_t *root)
+            {
+                if (!root)
+                    return;
+
+                // Removing first keeps this idempotent for objects that are already attached.
+                lv_obj_remove_event_cb(root, object_event);
+                lv_obj_add_event_cb(root, object_event, LV_EVENT_ALL, nullptr);
+
+                for (uint32_t i = 0; i < lv_obj_get_child_cnt(root); i++)
+                    attach(lv_obj_get_child(root, i));
+            }
+
+            void clear()
+            {
+                const bool locked = lock();
+
+                s_frames_written = 0;
+                s_samples_written = 0;
+                s_frame = {};
+                s_frame_start_us = 0;
+
+                if (locked)
+                    unlock();
+            }
+
+            size_t get_frames(frame *result, size_t count)
+            {
+                if (!sp_frames)
+                    return 0;
+
+                const bool locked = lock();
+                const size_t copied = copy_ring(sp_frames, s_frames_written, FRAME_HISTORY, result, count);
+
+                if (locked)
+                    unlock();
+
+                return copied;
+            }
+
+            size_t get_samples(sample *result, size_t count)
+            {
+                if (!sp_samples)
+                    return 0;
+
+                const bool locked = lock();
+                const size_t copied = copy_ring(sp_samples, s_samples_written, SAMPLE_HISTORY, result, count);
+
+                if (locked)
+                    unlock();
+
+                return copied;
+            }
+
+            void report(FILE *output)
+            {
+                std::vector<frame> frames(FRAME_HISTORY);
+                std::vector<sample> samples(SAMPLE_HISTORY);
+
+                frames.resize(get_frames(frames.data(), frames.size()));
+                samples.resize(get_samples(samples.data(), samples.size()));
+
+                if (frames.empty())
+                {
+                    fprintf(output, "no frames profiled\n");
+
+                    return;
+                }
+
+                // Only frames whose samples are all still in the sample ring are attributed.
+                const uint32_t first_sampled = samples.empty() ? UINT32_MAX : samples.front().frame + 1;
+                uint64_t render_us = 0;
+                uint64_t draw_us = 0;
+                uint32_t over_budget = 0;
+                const frame *slowest = nullptr;
+                size_t sampled_frames = 0;
+
+                for (const frame &value : frames)
+                {
+                    render_us += value.render_us;
+
+                    if (value.render_us > s_options.frame_budget_us)
+                        over_budget++;
+
+                    if (value.index >= first_sampled)
+                    {
+                        draw_us += value.draw_us;
+                        sampled_frames++;
+
+                        if (!slowest || value.render_us > slowest->render_us)
+                            slowest = &value;
+                    }
+                }
+
+                const auto longest = std::max_element(frames.begin(), frames.end(), [](const frame &a, const frame &b) { return a.render_us < b.render_us; });
+
+                fprintf(output, "%u frames: render avg %" PRIu32 " us, max %" PRIu32 " us, %" PRIu32 " over the %" PRIu32 " us budget\n",
+                        static_cast<unsigned>(frames.size()), static_cast<uint32_t>(render_us / frames.size()), longest->render_us,
+                        over_budget, s_options.frame_budget_us);
+
+                if (!sampled_frames)
+                    return;
+
+                // Drops the partly overwritten oldest frame and the one still being rendered.
+                std::erase_if(samples, [first_sampled, last = frames.back().index](const sample &value) { return value.frame < first_sampled || value.frame > last; });
+
+                fprintf(output, "by type, %u frames:\n", static_cast<unsigned>(sampled_frames));
+                print_totals(output, aggregate(samples, true), draw_us, sampled_frames, true);
+
+                fprintf(output, "by object:\n");
+                print_totals(output, aggregate(samples, false), draw_us, sampled_frames, false);
+
+                std::erase_if(samples, [slowest](const sample &value) { return value.frame != slowest->index; });
+
+                fprintf(output, "slowest frame %" PRIu32 ": render %" PRIu32 " us, draw %" PRIu32 " us, %" PRIu32 " px, %u draws\n",
+                        slowest->index, slowest->render_us, slowest->draw_us, slowest->pixels, slowest->draws);
+                print_totals(output, aggregate(samples, false), slowest->draw_us, 1, false);
+            }
+
+            void print()
+            {
+                report(stdout);
+            }
+
+            bool save(const char *path)
+            {
+                storage::wait(storage::type::internal);
+
+                FILE *file = fopen(path, "w");
+
+                if (!file)
+                {
+                    ESP_LOGE(TAG, "failed to open %s", path);
+
+                    return false;
+                }
+
+                report(file);
+
+                std::vector<frame> frames(FRAME_HISTORY);
+                std::vector<sample> samples(SAMPLE_HISTORY);
+
+                frames.resize(get_frames(frames.data(), frames.size()));
+                samples.resize(get_samples(samples.data(), samples.size()));
+
+                fprintf(file, "\nframe,render_us,draw_us,pixels,draws\n");
+
+                for (const frame &value : frames)
+                    fprintf(file, "%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%u\n", value.index, value.render_us, value.draw_us, value.pixels, value.draws);
+
+                fprintf(file, "\nframe,object,type,draw_us,pixels\n");
+
+                for (const sample &value : samples)
+                    fprintf(file, "%" PRIu32 ",%p,%s,%" PRIu32 ",%" PRIu32 "\n", value.frame, value.object, name_of(value.type), value.draw_us, value.pixels);
+
+                const bool written = !ferror(file);
+
+                fclose(file);
+
+                return written;
+            }
+        }
+    }
+}
@@ -0,0 +1,621 @@
+#include "hardware/journal.h"
+#include "hardware/trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+#include <esp_timer.h>
+
+namespace hardware
+{
+    namespace storage
+    {
+        constexpr const char *TAG = "journal";
+        constexpr uint32_t CHECKPOINT_MAGIC = 0x504b434a; // "JCKP"
+        constexpr uint16_t RECORD_MAGIC = 0x4c4a;         // "JL"
+        constexpr uint8_t REMOVED = 0xff;
+        constexpr size_t RECORD_ALIGNMENT = 4;
+        constexpr size_t ENTRY_OVERHEAD = 2;
+        constexpr uint32_t COMMIT_TASK_STACK_SIZE = 3072;
+
+        struct __attribute__((packed)) checkpoint_header
+        {
+            uint32_t magic;
+            uint32_t generation;
+            uint32_t count;
+            uint32_t size;
+            uint32_t data_crc;
+            uint32_t crc;
+        };
+
+        // Followed by the key, the value, padding to RECORD_ALIGNMENT and a CRC32 of all of it.
+        struct __attribute__((packed)) record_header
+        {
+            uint16_t magic;
+            uint8_t key_length;
+            uint8_t value_size;
+            uint32_t generation;
+        };
+
+        static uint32_t crc32(const void *data, size_t size, uint32_t crc = 0)
+        {
+            return esp_rom_crc32_le(crc, static_cast<const uint8_t *>(data), size);
+        }
+
+        static bool erased(const void *data, size_t size)
+        {
+            const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+            return std::all_of(bytes, bytes + size, [](uint8_t byte)
+                               { return byte == 0xff; });
+        }
+
+        static constexpr size_t record_size(size_t key_length, size_t value_size)
+        {
+            const size_t body = sizeof(record_header) + key_length + value_size;
+
+            return (body + RECORD_ALIGNMENT - 1) / RECORD_ALIGNMENT * RECORD_ALIGNMENT + sizeof(uint32_t);
+        }
+
+        struct journal_implementation
+        {
+            struct value
+            {
+                uint8_t size;
+                bool dirty;
+                bool removed;
+                uint8_t data[journal::MAX_VALUE_SIZE];
+            };
+
+            size_t log_offset() const
+            {
+                return 2 * m_slot_size;
+            }
+
+            bool ensure_erased(size_t end)
+            {
+                while (m_erased_end < end)
+                {
+                    if (!m_device->erase(log_offset() + m_erased_end, m_sector_size))
+                        return false;
+
+                    m_erased_end += m_sector_size;
+                    m_statistics.erases++;
+                }
+
+                return true;
+            }
+
+            void append_record(const std::string &key, const value &entry)
+            {
+                const uint8_t value_size = entry.removed ? 0 : entry.size;
+                const size_t start = m_buffer.size();
+                const size_t size = record_size(key.size(), value_size);
+
+                m_buffer.resize(start + size, 0);
+
+                uint8_t *out = m_buffer.data() + start;
+                const record_header header = {
+                    .magic = RECORD_MAGIC,
+                    .key_length = static_cast<uint8_t>(key.size()),
+                    .value_size = entry.removed ? REMOVED : entry.size,
+                    .generation = m_generation,
+                };
+
+                memcpy(out, &header, sizeof(header));
+                memcpy(out + sizeof(header), key.data(), key.size());
+                memcpy(out + sizeof(header) + key.size(), entry.data, value_size);
+
+                const uint32_t crc = crc32(out, size - sizeof(uint32_t));
+
+                memcpy(out + size - sizeof(uint32_t), &crc, sizeof(crc));
+            }
+
+            void settle()
+            {
+                for (auto it = m_values.begin(); it != m_values.end();)
+                {
+                    if (it->second.removed)
+                        it = m_values.erase(it);
+                    else
+                    {
+                        it->second.dirty = false;
+                        ++it;
+                    }
+                }
+            }
+
+            bool timed_commit()
+            {
+                const int64_t start = esp_timer_get_time();
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+
+                const bool result = commit();
+
+                m_statistics.max_commit_us = std::max<uint32_t>(m_statistics.max_commit_us, esp_timer_get_time() - start);
+
+                return result;
+            }
+
+            bool commit()
+            {
+                HARDWARE_TRACE_SCOPE(JOURNAL_COMMIT);
+
+                m_buffer.clear();
+
+                uint32_t records = 0;
+
+                for (const auto &[key, entry] : m_values)
+                {
+                    if (!entry.dirty)
+                        continue;
+
+                    append_record(key, entry);
+                    records++;
+                }
+
+                if (!records)
+                    return true;
+
+                if (m_head + m_buffer.size() > m_log_size)
+                    return checkpoint();
+
+                if (!ensure_erased(m_head + m_buffer.size()) || !m_device->write(log_offset() + m_head, m_buffer.data(), m_buffer.size()))
+                {
+                    ESP_LOGE(TAG, "failed to append %lu records", static_cast<unsigned long>(records));
+
+                    // The tail of the log is in an unknown state, the next commit checkpoints instead.
+                    m_head = m_log_size;
+
+                    return false;
+                }
+
+                m_head += m_buffer.size();
+
+                m_statistics.commits++;
+                m_statistics.records_written += records;
+                m_statistics.bytes_written += m_buffer.size();
+
+                settle();
+
+                return true;
+            }
+
+            bool checkpoint()
+            {
+                checkpoint_header header = {
+                    .magic = CHECKPOINT_MAGIC,
+                    .generation = m_generation + 1,
+                    .count = 0,
+                    .size = 0,
+                    .data_crc = 0,
+                    .crc = 0,
+                };
+
+                m_buffer.assign(sizeof(header), 0);
+
+                for (const auto &[key, entry] : m_values)
+                {
+                    if (entry.removed)
+                        continue;
+
+                    m_buffer.push_back(key.size());
+                    m_buffer.push_back(entry.size);
+                    m_buffer.insert(m_buffer.end(), key.begin(), key.end());
+                    m_buffer.insert(m_buffer.end(), entry.data, entry.data + entry.size);
+
+                    header.count++;
+                }
+
+                header.size = m_buffer.size() - sizeof(header);
+                header.data_crc = crc32(m_buffer.data() + sizeof(header), header.size);
+                header.crc = crc32(&header, offsetof(checkpoint_header, crc));
+
+                const size_t slot = header.generation % 2 * m_slot_size;
+
+                // The header goes last, a slot without one is ignored on recovery.
+                if (!m_device->erase(slot, m_slot_size) ||
+                    !m_device->write(slot + sizeof(header), m_buffer.data() + sizeof(header), header.size) ||
+                    !m_device->write(slot, &header, sizeof(header)))
+                {
+                    ESP_LOGE(TAG, "failed to write checkpoint %lu", static_cast<unsigned long>(header.generation));
+
+                    return false;
+                }
+
+                m_generation = header.generation;
+                m_head = 0;
+                m_erased_end = 0;
+
+                m_statistics.checkpoints++;
+                m_statistics.erases += m_slot_size / m_sector_size;
+                m_statistics.bytes_written += m_buffer.size();
+
+                settle();
+
+                return true;
+            }
+
+            bool load_checkpoint(size_t slot, bool apply)
+            {
+                checkpoint_header header;
+
+                if (!m_device->read(slot, &header, sizeof(header)) || header.magic != CHECKPOINT_MAGIC ||
+                    header.crc != crc32(&header, offsetof(checkpoint_header, crc)) || header.size > m_slot_size - sizeof(header))
+                    return false;
+
+                m_buffer.resize(header.size);
+
+                if (!m_device->read(slot + sizeof(header), m_buffer.data(), header.size) || header.data_crc != crc32(m_buffer.data(), header.size))
+                    return false;
+
+                if (!apply)
+                {
+                    m_generation = header.generation;
+
+                    return true;
+                }
+
+                m_values.clear();
+                m_working_size = 0;
+
+                for (size_t offset = 0; offset + ENTRY_OVERHEAD <= header.size;)
+                {
+                    const uint8_t key_length = m_buffer[offset];
+                    const uint8_t value_size = m_buffer[offset + 1];
+
+                    if (key_length > journal::MAX_KEY_LENGTH || value_size > journal::MAX_VALUE_SIZE ||
+                        offset + ENTRY_OVERHEAD + key_length + value_size > header.size)
+                        break;
+
+                    value &entry = m_values[std::string(reinterpret_cast<const char *>(&m_buffer[offset + ENTRY_OVERHEAD]), key_length)];
+
+                    entry = {.size = value_size, .dirty = false, .removed = false, .data = {}};
+                    memcpy(entry.data, &m_buffer[offset + ENTRY_OVERHEAD + key_length], value_size);
+
+                    m_working_size += ENTRY_OVERHEAD + key_length + value_size;
+                    offset += ENTRY_OVERHEAD + key_length + value_size;
+                }
+
+                return true;
+            }
+
+            bool read_record(size_t offset, uint8_t *record, size_t &size)
+            {
+                const auto &header = *reinterpret_cast<const record_header *>(record);
+
+                // Records of an older generation are leftovers from before the last checkpoint.
+                if (header.magic != RECORD_MAGIC || header.generation != m_generation || header.key_length > journal::MAX_KEY_LENGTH ||
+                    (header.value_size != REMOVED && header.value_size > journal::MAX_VALUE_SIZE))
+                    return false;
+
+                size = record_size(header.key_length, header.value_size == REMOVED ? 0 : header.value_size);
+
+                uint32_t crc;
+
+                if (offset + size > m_log_size || !m_device->read(log_offset() + offset, record, size))
+                    return false;
+
+                memcpy(&crc, record + size - sizeof(crc), sizeof(crc));
+
+                return crc == crc32(record, size - sizeof(crc));
+            }
+
+            void replay()
+            {
+                uint8_t record[record_size(journal::MAX_KEY_LENGTH, journal::MAX_VALUE_SIZE)];
+                const auto &header = *reinterpret_cast<const record_header *>(record);
+                bool torn = false;
+
+                m_head = 0;
+
+                while (m_head + sizeof(header) <= m_log_size)
+                {
+                    size_t size = 0;
+
+                    if (!m_device->read(log_offset() + m_head, record, sizeof(header)) || erased(record, sizeof(header)))
+                        break;
+
+                    if (!read_record(m_head, record, size))
+                    {
+                        torn = m_head % m_sector_size != 0;
+
+                        break;
+                    }
+
+                    const std::string key(reinterpret_cast<const char *>(record + sizeof(header)), header.key_length);
+
+                    auto it = m_values.find(key);
+
+                    if (it != m_values.end())
+                    {
+                        m_working_size -= ENTRY_OVERHEAD + key.size() + it->second.size;
+                        m_values.erase(it);
+                    }
+
+                    if (header.value_size != REMOVED)
+                    {
+                        value &entry = m_values[key];
+
+                        entry = {.size = header.value_size, .dirty = false, .removed = false, .data = {}};
+                        memcpy(entry.data, record + sizeof(header) + key.size(), header.value_size);
+
+                        m_working_size += ENTRY_OVERHEAD + key.size() + header.value_size;
+                    }
+
+                    m_head += size;
+                }
+
+                // Programming after a torn record would hit bytes that are not erased.
+                m_erased_end = (m_head + m_sector_size - 1) / m_sector_size * m_sector_size;
+
+                if (torn)
+                {
+                    m_statistics.torn_records++;
+
+                    // Until a checkpoint starts the log over, appending would program over the torn bytes.
+                    if (!checkpoint())
+                        m_head = m_log_size;
+                }
+            }
+
+            void recover()
+            {
+                uint32_t generations[2] = {};
+                bool valid[2];
+
+                for (size_t slot = 0; slot < 2; slot++)
+                {
+                    valid[slot] = load_checkpoint(slot * m_slot_size, false);
+                    generations[slot] = m_generation;
+                }
+
+                if (!valid[0] && !valid[1])
+                {
+                    ESP_LOGI(TAG, "no checkpoint found, formatting");
+
+                    m_values.clear();
+                    m_working_size = 0;
+                    m_generation = 0;
+
+                    checkpoint();
+
+                    return;
+                }
+
+                const size_t newest = !valid[0] || (valid[1] && static_cast<int32_t>(generations[1] - generations[0]) > 0) ? 1 : 0;
+
+                load_checkpoint(newest * m_slot_size, true);
+
+                m_generation = generations[newest];
+
+                replay();
+
+                ESP_LOGI(TAG, "recovered %u keys at generation %lu, log at %u/%u", static_cast<unsigned>(m_values.size()),
+                         static_cast<unsigned long>(m_generation), static_cast<unsigned>(m_head), static_cast<unsigned>(m_log_size));
+            }
+
+            std::mutex m_mutex;
+            std::unique_ptr<flash_device> m_device;
+
+            size_t m_sector_size = 0;
+            size_t m_slot_size = 0;
+            size_t m_log_size = 0;
+
+            uint32_t m_generation = 0;
+            size_t m_head = 0;
+            size_t m_erased_end = 0;
+
+            std::map<std::string, value> m_values;
+            size_t m_working_size = 0;
+            std::vector<uint8_t> m_buffer;
+
+            TaskHandle_t mp_commit_task = nullptr;
+            SemaphoreHandle_t m_commit_task_done = nullptr;
+            uint32_t m_commit_interval_ms = 0;
+            std::atomic<bool> m_stopping = false;
+
+            journal::statistics m_statistics = {};
+        };
+
+        journal *journal::sp_instance = nullptr;
+
+        static void commit_task(void *arg)
+        {
+            auto implementation = static_cast<journal_implementation *>(arg);
+
+            while (!implementation->m_stopping)
+            {
+                ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(implementation->m_commit_interval_ms));
+
+                implementation->timed_commit();
+            }
+
+            xSemaphoreGive(implementation->m_commit_task_done);
+
+            vTaskDelete(nullptr);
+        }
+
+        journal::journal(std::unique_ptr<flash_device> device, uint32_t commit_interval_ms) : mp_implementation(std::make_unique<journal_implementation>())
+        {
+            auto implementation = mp_implementation.get();
+
+            if (!device || device->size() < (2 * CHECKPOINT_SECTORS + 2) * device->sector_size())
+            {
+                ESP_LOGE(TAG, "unusable flash device");
+
+                return;
+            }
+
+            implementation->m_device = std::move(device);
+            implementation->m_sector_size = implementation->m_device->sector_size();
+            implementation->m_slot_size = CHECKPOINT_SECTORS * implementation->m_sector_size;
+            implementation->m_log_size = implementation->m_device->size() / implementation->m_sector_size * implementation->m_sector_size -
+                                         2 * implementation->m_slot_size;
+
+            implementation->recover();
+
+            if (!commit_interval_ms)
+                return;
+
+            implementation->m_commit_interval_ms = commit_interval_ms;
+            implementation->m_commit_task_done = xSemaphoreCreateBinary();
+
+            if (xTaskCreate(commit_task, "storage_journal", COMMIT_TASK_STACK_SIZE, implementation, tskIDLE_PRIORITY + 1, &implementation->mp_commit_task) != pdPASS)
+                implementation->mp_commit_task = nullptr;
+        }
+
+        journal::~journal()
+        {
+            auto implementation = mp_implementation.get();
+
+            if (implementation->mp_commit_task)
+            {
+                implementation->m_stopping = true;
+
+                xTaskNotifyGive(implementation->mp_commit_task);
+                xSemaphoreTake(implementation->m_commit_task_done, portMAX_DELAY);
+            }
+
+            if (implementation->m_commit_task_done)
+                vSemaphoreDelete(implementation->m_commit_task_done);
+
+            if (is_valid())
+                commit();
+        }
+
+        bool journal::is_valid()
+        {
+            return mp_implementation->m_device != nullptr;
+        }
+
+        bool journal::store(const char *key, const void *data, size_t size)
+        {
+            auto implementation = mp_implementation.get();
+            const size_t key_length = strnlen(key, MAX_KEY_LENGTH + 1);
+
+            if (!implementation->m_device || !key_length || key_length > MAX_KEY_LENGTH || size > MAX_VALUE_SIZE)
+                return false;
+
+            std::lock_guard<std::mutex> lock(implementation->m_mutex);
+
+            auto it = implementation->m_values.find(std::string(key, key_length));
+            const bool present = it != implementation->m_values.end() && !it->second.removed;
+            const size_t previous = present ? it->second.size : 0;
+            const size_t working_size = implementation->m_working_size - previous + size + (present ? 0 : ENTRY_OVERHEAD + key_length);
+
+            if (working_size > implementation->m_slot_size - sizeof(checkpoint_header))
+            {
+                ESP_LOGE(TAG, "no room for %s", key);
+
+                return false;
+            }
+
+            if (it == implementation->m_values.end())
+                it = implementation->m_values.emplace(std::string(key, key_length), journal_implementation::value{}).first;
+
+            journal_implementation::value &entry = it->second;
+
+            if (present && entry.size == size && !memcmp(entry.data, data, size))
+                return true;
+
+            if (entry.dirty)
+                implementation->m_statistics.updates_coalesced++;
+
+            entry.size = size;
+            entry.removed = false;
+            entry.dirty = true;
+            memcpy(entry.data, data, size);
+
+            implementation->m_working_size = working_size;
+
+            return true;
+        }
+
+        bool journal::load(const char *key, void *data, size_t &size)
+        {
+            auto implementation = mp_implementation.get();
+
+            std::lock_guard<std::mutex> lock(implementation->m_mutex);
+
+            auto it = implementation->m_values.find(key);
+
+            if (it == implementation->m_values.end() || it->second.removed || it->second.size > size)
+                return false;
+
+            size = it->second.size;
+            memcpy(data, it->second.data, size);
+
+            return true;
+        }
+
+        bool journal::remove(const char *key)
+        {
+            auto implementation = mp_implementation.get();
+
+            std::lock_guard<std::mutex> lock(implementation->m_mutex);
+
+            auto it = implementation->m_values.find(key);
+
+            if (it == implementation->m_values.end() || it->second.removed)
+                return false;
+
+            implementation->m_working_size -= ENTRY_OVERHEAD + it->first.size() + it->second.size;
+
+            it->second.removed = true;
+            it->second.dirty = true;
+
+            return true;
+        }
+
+        bool journal::commit()
+        {
+            auto implementation = mp_implementation.get();
+
+            if (!implementation->m_device)
+                return false;
+
+            return implementation->timed_commit();
+        }
+
+        bool journal::checkpoint()
+        {
+            auto implementation = mp_implementation.get();
+
+            if (!implementation->m_device)
+                return false;
+
+            std::lock_guard<std::mutex> lock(implementation->m_mutex);
+
+            return implementation->checkpoint();
+        }
+
+        journal::statistics journal::get_statistics()
+        {
+            auto implementation = mp_implementation.get();
+
+            std::lock_guard<std::mutex> lock(implementation->m_mutex);
+
+            statistics result = implementation->m_statistics;
+
+            result.keys = implementation->m_values.size();
+            result.generation = implementation->m_generation;
+            result.log_used = implementation->m_head;
+            result.log_size = implementation->m_log_size;
+
+            return result;
+        }
+    }
+}
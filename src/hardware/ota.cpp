@@ -0,0 +1,578 @@
+#include "hardware/ota.h"
+
+#include "hardware/display.h"
+#include "hardware/graphics.h"
+#include "hardware/storage.h"
+#include "hardware/trace.h"
+#include "hardware/wifi.h"
+#include "ota_delta.h"
+#include "ota_source.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <esp_crt_bundle.h>
+#include <esp_heap_caps.h>
+#include <esp_http_client.h>
+#include <esp_log.h>
+#include <esp_ota_ops.h>
+#include <esp_system.h>
+#include <lvgl.h>
+#include <mbedtls/sha256.h>
+
+namespace hardware
+{
+    namespace ota
+    {
+        constexpr const char *TAG = "ota";
+        constexpr size_t CHUNK_SIZE = 4096;
+        constexpr size_t CHUNK_COUNT = 4;
+        constexpr size_t CHUNK_FAILED = SIZE_MAX;
+        constexpr uint32_t TASK_STACK_SIZE = 6144;
+        constexpr uint32_t QUEUE_POLL_MS = 100;
+        constexpr uint32_t HTTP_TIMEOUT_MS = 10000;
+        constexpr uint32_t REBOOT_DELAY_MS = 500;
+        constexpr uint16_t PROGRESS_BAR_HEIGHT = 6;
+        constexpr uint16_t PROGRESS_COLOR_DONE = 0xe007;    // green, byte swapped RGB565
+        constexpr uint16_t PROGRESS_COLOR_PENDING = 0x0842; // dark grey, byte swapped RGB565
+        constexpr uint32_t PROGRESS_LOCK_TIMEOUT_MS = 100;
+        constexpr uint32_t PROGRESS_TRANSFER_TIMEOUT_MS = 100;
+
+        class http_source : public source
+        {
+        public:
+            explicit http_source(const char *url) : m_url(url)
+            {
+            }
+
+            ~http_source() override
+            {
+                if (!mp_client)
+                    return;
+
+                esp_http_client_close(mp_client);
+                esp_http_client_cleanup(mp_client);
+            }
+
+            bool open(size_t &total) override
+            {
+                wifi &network = wifi::get();
+
+                if (network.get_mode() != wifi::mode::STATION || !strcmp(network.get_ip(), "0.0.0.0"))
+                {
+                    ESP_LOGE(TAG, "no network connection");
+
+                    return false;
+                }
+
+                esp_http_client_config_t config = {};
+
+                config.url = m_url.c_str();
+                config.timeout_ms = HTTP_TIMEOUT_MS;
+                config.crt_bundle_attach = esp_crt_bundle_attach;
+
+                mp_client = esp_http_client_init(&config);
+
+                if (!mp_client || esp_http_client_open(mp_client, 0) != ESP_OK)
+                {
+                    ESP_LOGE(TAG, "failed to connect to %s", m_url.c_str());
+
+                    return false;
+                }
+
+                const int64_t length = esp_http_client_fetch_headers(mp_client);
+                const int status_code = esp_http_client_get_status_code(mp_client);
+
+                if (status_code != 200)
+                {
+                    ESP_LOGE(TAG, "server answered %d", status_code);
+
+                    return false;
+                }
+
+                total = length > 0 ? length : 0;
+
+                return true;
+            }
+
+            ssize_t read(uint8_t *data, size_t size) override
+            {
+                return esp_http_client_read(mp_client, reinterpret_cast<char *>(data), size);
+            }
+
+        private:
+            std::string m_url;
+            esp_http_client_handle_t mp_client = nullptr;
+        };
+
+        class file_source : public source
+        {
+        public:
+            explicit file_source(const char *path) : m_path(path)
+            {
+            }
+
+            ~file_source() override
+            {
+                if (m_fd >= 0)
+                    close(m_fd);
+            }
+
+            bool open(size_t &total) override
+            {
+                storage::wait(storage::type::internal);
+
+                m_fd = ::open(m_path.c_str(), O_RDONLY);
+
+                struct stat info;
+
+                if (m_fd < 0 || fstat(m_fd, &info))
+                {
+                    ESP_LOGE(TAG, "failed to open %s", m_path.c_str());
+
+                    return false;
+                }
+
+                total = info.st_size;
+
+                return true;
+            }
+
+            ssize_t read(uint8_t *data, size_t size) override
+            {
+                return ::read(m_fd, data, size);
+            }
+
+        private:
+            std::string m_path;
+            int m_fd = -1;
+        };
+
+        struct chunk
+        {
+            size_t size;
+            uint8_t data[CHUNK_SIZE];
+        };
+
+        struct session
+        {
+            ~session()
+            {
+                if (free_chunks)
+                    vQueueDelete(free_chunks);
+
+                if (full_chunks)
+                    vQueueDelete(full_chunks);
+
+                if (fetch_done)
+                    vSemaphoreDelete(fetch_done);
+
+                heap_caps_free(chunks);
+            }
+
+            std::unique_ptr<source> input;
+            options opts = {};
+            uint8_t expected_sha256[32] = {};
+
+            chunk *chunks = nullptr;
+            QueueHandle_t free_chunks = nullptr;
+            QueueHandle_t full_chunks = nullptr;
+            SemaphoreHandle_t fetch_done = nullptr;
+        };
+
+        static std::atomic<status> s_state = status::idle;
+        static std::atomic<bool> s_cancel = false;
+        static std::atomic<size_t> s_written = 0;
+        static std::atomic<size_t> s_total = 0;
+        static uint16_t *sp_progress_bar = nullptr;
+
+        // While the LVGL port runs, the panel and its transfer done interrupt belong to LVGL, so
+        // the bar is an lv_bar on the top layer. Without it the bar goes straight to the panel,
+        // and the buffer is only redrawn once the previous transfer out of it has finished.
+        class progress_view
+        {
+        public:
+            ~progress_view()
+            {
+                if (m_transfer_pending)
+                    wait_for_transfer();
+
+                if (!mp_bar || !graphics::lock(PROGRESS_LOCK_TIMEOUT_MS))
+                    return;
+
+                lv_obj_del(mp_bar);
+
+                graphics::unlock();
+            }
+
+            void update(size_t written, size_t total)
+            {
+                if (!total)
+                    return;
+
+                if (graphics::get_display())
+                    update_bar(written, total);
+                else
+                    draw(written, total);
+            }
+
+        private:
+            void update_bar(size_t written, size_t total)
+            {
+                if (!graphics::lock(PROGRESS_LOCK_TIMEOUT_MS))
+                    return;
+
+                if (!mp_bar)
+                {
+                    mp_bar = lv_bar_create(lv_disp_get_layer_top(graphics::get_display()));
+
+                    lv_obj_set_size(mp_bar, LV_PCT(100), PROGRESS_BAR_HEIGHT);
+                    lv_obj_align(mp_bar, LV_ALIGN_BOTTOM_MID, 0, 0);
+                    lv_obj_set_style_radius(mp_bar, 0, LV_PART_MAIN);
+                    lv_obj_set_style_radius(mp_bar, 0, LV_PART_INDICATOR);
+                    lv_obj_set_style_bg_color(mp_bar, lv_color_hex(0x404040), LV_PART_MAIN);
+                    lv_obj_set_style_bg_color(mp_bar, lv_color_hex(0x00ff00), LV_PART_INDICATOR);
+                    lv_bar_set_range(mp_bar, 0, 100);
+                }
+
+                lv_bar_set_value(mp_bar, static_cast<uint64_t>(written) * 100 / total, LV_ANIM_OFF);
+
+                graphics::unlock();
+            }
+
+            void draw(size_t written, size_t total)
+            {
+                display &screen = display::get();
+                const uint16_t width = screen.width();
+
+                if (!sp_progress_bar)
+                    sp_progress_bar = static_cast<uint16_t *>(heap_caps_malloc(width * PROGRESS_BAR_HEIGHT * sizeof(uint16_t), MALLOC_CAP_DMA));
+
+                if (!m_subscribed)
+                    m_subscribed = m_transfers.subscribe(display::transfer_events(), xTaskGetCurrentTaskHandle());
+
+                // Without the transfer events there is no telling when the buffer is free again.
+                if (!sp_progress_bar || !m_subscribed)
+                    return;
+
+                if (m_transfer_pending && !wait_for_transfer())
+                    return;
+
+                const uint16_t filled = std::min<size_t>(width, static_cast<uint64_t>(width) * written / total);
+
+                for (uint16_t y = 0; y < PROGRESS_BAR_HEIGHT; y++)
+                    for (uint16_t x = 0; x < width; x++)
+                        sp_progress_bar[y * width + x] = x < filled ? PROGRESS_COLOR_DONE : PROGRESS_COLOR_PENDING;
+
+                screen.set_bitmap(0, width - 1, screen.height() - PROGRESS_BAR_HEIGHT, screen.height() - 1, sp_progress_bar);
+
+                m_transfer_pending = true;
+            }
+
+            bool wait_for_transfer()
+            {
+                display::transfer_event done;
+
+                if (!m_transfers.receive(done, PROGRESS_TRANSFER_TIMEOUT_MS))
+                    return false;
+
+                m_transfer_pending = false;
+
+                return true;
+            }
+
+            lv_obj_t *mp_bar = nullptr;
+            bus::subscriber<display::transfer_event, 4> m_transfers;
+            bool m_subscribed = false;
+            bool m_transfer_pending = false;
+        };
+
+        static void fetch_task(void *arg)
+        {
+            auto current = static_cast<session *>(arg);
+            size_t total = 0;
+            chunk *buffer = nullptr;
+
+            const bool opened = current->input->open(total);
+
+            s_total = total;
+
+            while (!s_cancel)
+            {
+                if (!xQueueReceive(current->free_chunks, &buffer, pdMS_TO_TICKS(QUEUE_POLL_MS)))
+                    continue;
+
+                HARDWARE_TRACE_BEGIN(OTA_FETCH);
+
+                const ssize_t count = opened ? current->input->read(buffer->data, CHUNK_SIZE) : -1;
+
+                HARDWARE_TRACE_END(OTA_FETCH);
+
+                buffer->size = count < 0 ? CHUNK_FAILED : count;
+
+                xQueueSend(current->full_chunks, &buffer, portMAX_DELAY);
+
+                if (count <= 0)
+                    break;
+            }
+
+            xSemaphoreGive(current->fetch_done);
+
+            vTaskDelete(nullptr);
+        }
+
+        static void write_task(void *arg)
+        {
+            std::unique_ptr<session> current(static_cast<session *>(arg));
+
+            const esp_partition_t *target = esp_ota_get_next_update_partition(nullptr);
+            esp_ota_handle_t handle = 0;
+
+            if (!target || esp_ota_begin(target, OTA_WITH_SEQUENTIAL_WRITES, &handle) != ESP_OK)
+            {
+                ESP_LOGE(TAG, "no update partition available");
+
+                s_cancel = true;
+            }
+
+            mbedtls_sha256_context sha256;
+
+            mbedtls_sha256_init(&sha256);
+            mbedtls_sha256_starts(&sha256, 0);
+
+            bool succeeded = !s_cancel;
+            uint32_t last_percent = UINT32_MAX;
+            progress_view view;
+
+            while (succeeded)
+            {
+                chunk *buffer = nullptr;
+
+                if (!xQueueReceive(current->full_chunks, &buffer, pdMS_TO_TICKS(QUEUE_POLL_MS)))
+                {
+                    succeeded = !s_cancel;
+
+                    continue;
+                }
+
+                if (buffer->size == CHUNK_FAILED)
+                {
+                    ESP_LOGE(TAG, "image source failed");
+
+                    succeeded = false;
+
+                    break;
+                }
+
+                if (!buffer->size)
+                    break;
+
+                HARDWARE_TRACE_BEGIN(OTA_WRITE, buffer->size);
+
+                mbedtls_sha256_update(&sha256, buffer->data, buffer->size);
+
+                const esp_err_t written = esp_ota_write(handle, buffer->data, buffer->size);
+
+                HARDWARE_TRACE_END(OTA_WRITE);
+
+                if (written != ESP_OK)
+                {
+                    ESP_LOGE(TAG, "flash write failed at %u", static_cast<unsigned>(s_written.load()));
+
+                    succeeded = false;
+
+                    break;
+                }
+
+                s_written += buffer->size;
+
+                xQueueSend(current->free_chunks, &buffer, portMAX_DELAY);
+
+                const uint32_t percent = s_total ? s_written * 100 / s_total : 0;
+
+                if (current->opts.show_progress && percent != last_percent)
+                    view.update(s_written, s_total);
+
+                last_percent = percent;
+            }
+
+            s_cancel = s_cancel || !succeeded;
+
+            xSemaphoreTake(current->fetch_done, portMAX_DELAY);
+
+            uint8_t digest[32];
+
+            mbedtls_sha256_finish(&sha256, digest);
+            mbedtls_sha256_free(&sha256);
+
+            if (succeeded && current->opts.sha256 && memcmp(digest, current->expected_sha256, sizeof(digest)))
+            {
+                ESP_LOGE(TAG, "SHA-256 mismatch");
+
+                succeeded = false;
+            }
+
+            if (handle)
+            {
+                if (succeeded)
+                    succeeded = esp_ota_end(handle) == ESP_OK && esp_ota_set_boot_partition(target) == ESP_OK;
+                else
+                    esp_ota_abort(handle);
+            }
+
+            ESP_LOGI(TAG, "update %s after %u bytes", succeeded ? "succeeded" : "failed", static_cast<unsigned>(s_written.load()));
+
+            const bool reboot = succeeded && current->opts.reboot;
+
+            current.reset();
+
+            s_state = succeeded ? status::succeeded : status::failed;
+
+            if (reboot)
+            {
+                vTaskDelay(pdMS_TO_TICKS(REBOOT_DELAY_MS));
+
+                esp_restart();
+            }
+
+            vTaskDelete(nullptr);
+        }
+
+        bool start(std::unique_ptr<source> input, const options &opts)
+        {
+            status expected = s_state.load();
+
+            if (expected == status::running || !s_state.compare_exchange_strong(expected, status::running))
+                return false;
+
+            auto current = std::make_unique<session>();
+
+            current->input = std::move(input);
+            current->opts = opts;
+
+            if (opts.sha256)
+                memcpy(current->expected_sha256, opts.sha256, sizeof(current->expected_sha256));
+
+            current->chunks = static_cast<chunk *>(heap_caps_malloc(CHUNK_COUNT * sizeof(chunk), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+            current->free_chunks = xQueueCreate(CHUNK_COUNT, sizeof(chunk *));
+            current->full_chunks = xQueueCreate(CHUNK_COUNT, sizeof(chunk *));
+            current->fetch_done = xSemaphoreCreateBinary();
+
+            if (!current->chunks || !current->free_chunks || !current->full_chunks || !current->fetch_done)
+            {
+                ESP_LOGE(TAG, "not enough memory for the update buffers");
+
+                s_state = status::failed;
+
+                return false;
+            }
+
+            for (size_t i = 0; i < CHUNK_COUNT; i++)
+            {
+                chunk *buffer = &current->chunks[i];
+
+                xQueueSend(current->free_chunks, &buffer, 0);
+            }
+
+            s_cancel = false;
+            s_written = 0;
+            s_total = 0;
+
+            session *shared = current.release();
+
+            if (xTaskCreate(write_task, "ota_write", TASK_STACK_SIZE, shared, tskIDLE_PRIORITY + 2, nullptr) != pdPASS)
+            {
+                delete shared;
+
+                s_state = status::failed;
+
+                return false;
+            }
+
+            // Fetching only runs once the writer exists, it owns the session and frees it.
+            if (xTaskCreate(fetch_task, "ota_fetch", TASK_STACK_SIZE, shared, tskIDLE_PRIORITY + 2, nullptr) != pdPASS)
+            {
+                s_cancel = true;
+
+                xSemaphoreGive(shared->fetch_done);
+            }
+
+            return true;
+        }
+
+        bool start_from_url(const char *url, const options &opts)
+        {
+            return start(std::make_unique<http_source>(url), opts);
+        }
+
+        bool start_from_file(const char *path, const options &opts)
+        {
+            return start(std::make_unique<file_source>(path), opts);
+        }
+
+        static std::unique_ptr<source> make_delta(std::unique_ptr<source> patch)
+        {
+            return std::make_unique<delta_source>(std::move(patch), storage::make_partition_flash_device(esp_ota_get_running_partition()->label));
+        }
+
+        bool start_delta_from_url(const char *url, const options &opts)
+        {
+            return start(make_delta(std::make_unique<http_source>(url)), opts);
+        }
+
+        bool start_delta_from_file(const char *path, const options &opts)
+        {
+            return start(make_delta(std::make_unique<file_source>(path)), opts);
+        }
+
+        void cancel()
+        {
+            s_cancel = true;
+        }
+
+        progress get_progress()
+        {
+            return {
+                .state = s_state,
+                .written = s_written,
+                .total = s_total,
+            };
+        }
+
+        bool is_pending_verification()
+        {
+            esp_ota_img_states_t state;
+
+            return esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) == ESP_OK && state == ESP_OTA_IMG_PENDING_VERIFY;
+        }
+
+        void confirm(health_check_t check, void *user_data)
+        {
+            if (!is_pending_verification())
+                return;
+
+            if (!check || check(user_data))
+            {
+                ESP_LOGI(TAG, "new image confirmed");
+
+                ESP_ERROR_CHECK(esp_ota_mark_app_valid_cancel_rollback());
+
+                return;
+            }
+
+            ESP_LOGE(TAG, "health check failed, rolling back");
+
+            esp_ota_mark_app_invalid_rollback_and_reboot();
+        }
+    }
+}
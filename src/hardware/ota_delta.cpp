@@ -0,0 +1,244 @@
+#include "ota_delta.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <esp_log.h>
+
+namespace hardware
+{
+    namespace ota
+    {
+        constexpr const char *TAG = "ota_delta";
+        constexpr size_t BASE_CHUNK_SIZE = 256;
+
+        struct __attribute__((packed)) patch_header
+        {
+            uint32_t magic;
+            uint16_t version;
+            uint16_t reserved;
+            uint32_t base_size;
+            uint32_t target_size;
+            uint8_t base_sha256[32];
+            uint8_t target_sha256[32];
+        };
+
+        static_assert(sizeof(patch_header) == 80);
+
+        delta_source::delta_source(std::unique_ptr<source> patch, std::unique_ptr<storage::flash_device> base)
+            : mp_patch(std::move(patch)), mp_base(std::move(base))
+        {
+            mbedtls_sha256_init(&m_sha256);
+        }
+
+        delta_source::~delta_source()
+        {
+            mbedtls_sha256_free(&m_sha256);
+        }
+
+        bool delta_source::open(size_t &total)
+        {
+            size_t patch_size = 0;
+            patch_header header;
+
+            if (!mp_base || !mp_patch->open(patch_size) || !fill(&header, sizeof(header)))
+                return false;
+
+            if (header.magic != MAGIC || header.version != VERSION)
+            {
+                ESP_LOGE(TAG, "not a delta patch");
+
+                return false;
+            }
+
+            if (header.base_size > mp_base->size() || !verify_base(header.base_size, header.base_sha256))
+            {
+                ESP_LOGE(TAG, "patch was made against a different image");
+
+                return false;
+            }
+
+            m_base_size = header.base_size;
+            m_target_size = header.target_size;
+            memcpy(m_target_sha256, header.target_sha256, sizeof(m_target_sha256));
+
+            mbedtls_sha256_starts(&m_sha256, 0);
+
+            ESP_LOGI(TAG, "%u byte patch for a %u byte image", static_cast<unsigned>(patch_size), static_cast<unsigned>(m_target_size));
+
+            total = m_target_size;
+
+            return true;
+        }
+
+        ssize_t delta_source::read(uint8_t *data, size_t size)
+        {
+            size_t done = 0;
+
+            while (done < size)
+            {
+                if (!m_remaining)
+                {
+                    if (m_produced == m_target_size)
+                        break;
+
+                    if (!next_operation())
+                        return -1;
+                }
+
+                const size_t count = std::min({m_remaining, size - done, m_operation == operation::add ? BASE_CHUNK_SIZE : SIZE_MAX});
+                uint8_t *out = data + done;
+
+                switch (m_operation)
+                {
+                case operation::copy:
+                    if (!mp_base->read(m_offset, out, count))
+                        return -1;
+
+                    break;
+
+                case operation::data:
+                    if (!fill(out, count))
+                        return -1;
+
+                    break;
+
+                case operation::add:
+                {
+                    uint8_t difference[BASE_CHUNK_SIZE];
+
+                    if (!mp_base->read(m_offset, out, count) || !fill(difference, count))
+                        return -1;
+
+                    for (size_t i = 0; i < count; i++)
+                        out[i] += difference[i];
+
+                    break;
+                }
+
+                default:
+                    return -1;
+                }
+
+                m_offset += count;
+                m_remaining -= count;
+                m_produced += count;
+                done += count;
+            }
+
+            mbedtls_sha256_update(&m_sha256, data, done);
+
+            if (!done)
+            {
+                uint8_t digest[32];
+
+                mbedtls_sha256_finish(&m_sha256, digest);
+
+                if (memcmp(digest, m_target_sha256, sizeof(digest)))
+                {
+                    ESP_LOGE(TAG, "patched image does not match the target");
+
+                    return -1;
+                }
+            }
+
+            return done;
+        }
+
+        bool delta_source::fill(void *data, size_t size)
+        {
+            auto out = static_cast<uint8_t *>(data);
+
+            while (size)
+            {
+                if (m_consumed == m_buffered)
+                {
+                    const ssize_t count = mp_patch->read(m_buffer, sizeof(m_buffer));
+
+                    if (count <= 0)
+                    {
+                        ESP_LOGE(TAG, "patch ended early");
+
+                        return false;
+                    }
+
+                    m_buffered = count;
+                    m_consumed = 0;
+                }
+
+                const size_t count = std::min(size, m_buffered - m_consumed);
+
+                memcpy(out, m_buffer + m_consumed, count);
+
+                m_consumed += count;
+                out += count;
+                size -= count;
+            }
+
+            return true;
+        }
+
+        bool delta_source::next_operation()
+        {
+            uint8_t code;
+            uint32_t offset = 0;
+            uint32_t length;
+
+            if (!fill(&code, sizeof(code)))
+                return false;
+
+            m_operation = static_cast<operation>(code);
+
+            if (m_operation == operation::copy || m_operation == operation::add)
+            {
+                if (!fill(&offset, sizeof(offset)))
+                    return false;
+            }
+            else if (m_operation != operation::data)
+            {
+                ESP_LOGE(TAG, "unknown patch operation %u", code);
+
+                return false;
+            }
+
+            if (!fill(&length, sizeof(length)))
+                return false;
+
+            const bool reads_base = m_operation != operation::data;
+
+            if (!length || length > m_target_size - m_produced || (reads_base && (offset > m_base_size || length > m_base_size - offset)))
+            {
+                ESP_LOGE(TAG, "patch operation out of range");
+
+                return false;
+            }
+
+            m_offset = offset;
+            m_remaining = length;
+
+            return true;
+        }
+
+        bool delta_source::verify_base(size_t size, const uint8_t *expected)
+        {
+            uint8_t chunk[BASE_CHUNK_SIZE];
+            uint8_t digest[32];
+
+            mbedtls_sha256_starts(&m_sha256, 0);
+
+            for (size_t offset = 0; offset < size; offset += sizeof(chunk))
+            {
+                const size_t count = std::min(sizeof(chunk), size - offset);
+
+                if (!mp_base->read(offset, chunk, count))
+                    return false;
+
+                mbedtls_sha256_update(&m_sha256, chunk, count);
+            }
+
+            mbedtls_sha256_finish(&m_sha256, digest);
+
+            return !memcmp(digest, expected, sizeof(digest));
+        }
+    }
+}
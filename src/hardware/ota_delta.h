@@ -0,0 +1,59 @@
+#pragma once
+
+#include "hardware/flash_device.h"
+#include "ota_source.h"
+
+#include <mbedtls/sha256.h>
+
+namespace hardware
+{
+    namespace ota
+    {
+        // Rebuilds the new image from a patch made by tools/make_delta.py and the image it was
+        // made against. Output is produced in whatever slices the caller asks for, so memory
+        // use is one small patch buffer no matter how large the images are. Only depends on
+        // flash_device, so it runs on the linux target against file backed partition images.
+        class delta_source : public source
+        {
+        public:
+            static constexpr uint32_t MAGIC = 0x50444352; // "RCDP"
+            static constexpr uint16_t VERSION = 1;
+
+            delta_source(std::unique_ptr<source> patch, std::unique_ptr<storage::flash_device> base);
+            ~delta_source() override;
+
+            bool open(size_t &total) override;
+            ssize_t read(uint8_t *data, size_t size) override;
+
+        private:
+            enum class operation : uint8_t
+            {
+                none = 0,
+                copy = 1,
+                data = 2,
+                add = 3,
+            };
+
+            bool fill(void *data, size_t size);
+            bool next_operation();
+            bool verify_base(size_t size, const uint8_t *expected);
+
+            std::unique_ptr<source> mp_patch;
+            std::unique_ptr<storage::flash_device> mp_base;
+
+            uint8_t m_buffer[512];
+            size_t m_buffered = 0;
+            size_t m_consumed = 0;
+
+            size_t m_base_size = 0;
+            size_t m_target_size = 0;
+            size_t m_produced = 0;
+            uint8_t m_target_sha256[32] = {};
+            mbedtls_sha256_context m_sha256;
+
+            operation m_operation = operation::none;
+            size_t m_offset = 0;
+            size_t m_remaining = 0;
+        };
+    }
+}
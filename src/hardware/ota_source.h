@@ -0,0 +1,28 @@
+#pragma once
+
+#include "hardware/ota.h"
+
+#include <memory>
+
+#include <sys/types.h>
+
+namespace hardware
+{
+    namespace ota
+    {
+        // A stream producing the new application image, read from the fetch task.
+        class source
+        {
+        public:
+            virtual ~source() = default;
+
+            // total is the image size when known up front, 0 otherwise.
+            virtual bool open(size_t &total) = 0;
+
+            // Returns the number of bytes read, 0 at the end of the image, negative on error.
+            virtual ssize_t read(uint8_t *data, size_t size) = 0;
+        };
+
+        bool start(std::unique_ptr<source> input, const options &opts);
+    }
+}
@@ -0,0 +1,501 @@
+#include "hardware/provisioning.h"
+#include "hardware/trace.h"
+#include "hardware/wifi.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_http_server.h>
+#include <esp_log.h>
+#include <esp_netif.h>
+#include <esp_timer.h>
+#include <lwip/sockets.h>
+
+extern const uint8_t portal_html_gz_start[] asm("_binary_portal_html_gz_start");
+extern const uint8_t portal_html_gz_end[] asm("_binary_portal_html_gz_end");
+
+namespace hardware
+{
+    namespace provisioning
+    {
+        constexpr const char *TAG = "provisioning";
+        constexpr const char *CONNECTING_PAGE = "<!DOCTYPE html><html><body><h1>Connecting...</h1>"
+                                                "<p>The device will now join the selected network.</p></body></html>";
+        constexpr uint16_t DNS_PORT = 53;
+        constexpr size_t DNS_HEADER_SIZE = 12;
+        constexpr size_t DNS_MAX_PACKET_SIZE = 512;
+        constexpr int64_t SCAN_INTERVAL_US = 10 * 1000 * 1000;
+        constexpr uint64_t APPLY_DELAY_US = 1000 * 1000;
+        constexpr size_t SCAN_MAX_RESULTS = 16;
+        constexpr uint64_t WATCH_INTERVAL_US = 500 * 1000;
+
+        static httpd_handle_t s_server = nullptr;
+        static esp_timer_handle_t s_apply_timer = nullptr;
+        static esp_timer_handle_t s_watch_timer = nullptr;
+        static bus::subscriber<wifi::event, 4> s_events;
+        static TaskHandle_t s_dns_task = nullptr;
+        static int s_dns_socket = -1;
+        static volatile bool s_dns_running = false;
+        static int64_t s_last_scan = 0;
+        static esp_ip4_addr_t s_address = {};
+        static char s_portal_url[24] = {0};
+
+        static size_t build_dns_response(uint8_t *packet, size_t size, size_t capacity)
+        {
+            if (size < DNS_HEADER_SIZE || (packet[2] & 0x80) || !(packet[4] || packet[5]))
+                return 0;
+
+            size_t offset = DNS_HEADER_SIZE;
+
+            while (offset < size && packet[offset])
+            {
+                if (packet[offset] & 0xc0)
+                    return 0;
+
+                offset += packet[offset] + 1;
+            }
+
+            offset += 1 + 4;
+
+            if (offset > size)
+                return 0;
+
+            const uint16_t question_type = (packet[offset - 4] << 8) | packet[offset - 3];
+            const bool answer = question_type == 1;
+
+            packet[2] = 0x84 | (packet[2] & 0x01);
+            packet[3] = 0x00;
+            packet[4] = 0x00;
+            packet[5] = 0x01;
+            packet[6] = 0x00;
+            packet[7] = answer ? 0x01 : 0x00;
+            memset(&packet[8], 0, 4);
+
+            if (!answer)
+                return offset;
+
+            const uint8_t record[] = {
+                0xc0, 0x0c,
+                0x00, 0x01,
+                0x00, 0x01,
+                0x00, 0x00, 0x00, 0x3c,
+                0x00, 0x04,
+                static_cast<uint8_t>(esp_ip4_addr1(&s_address)),
+                static_cast<uint8_t>(esp_ip4_addr2(&s_address)),
+                static_cast<uint8_t>(esp_ip4_addr3(&s_address)),
+                static_cast<uint8_t>(esp_ip4_addr4(&s_address)),
+            };
+
+            if (offset + sizeof(record) > capacity)
+                return 0;
+
+            memcpy(&packet[offset], record, sizeof(record));
+
+            return offset + sizeof(record);
+        }
+
+        static void dns_task(void *arg)
+        {
+            uint8_t packet[DNS_MAX_PACKET_SIZE];
+
+            while (s_dns_running)
+            {
+                sockaddr_in client = {};
+                socklen_t client_size = sizeof(client);
+
+                const int size = recvfrom(s_dns_socket, packet, sizeof(packet), 0, reinterpret_cast<sockaddr *>(&client), &client_size);
+
+                if (size <= 0)
+                    continue;
+
+                HARDWARE_TRACE_SCOPE(PROVISIONING_DNS, size);
+
+                const size_t response_size = build_dns_response(packet, size, sizeof(packet));
+
+                if (response_size)
+                    sendto(s_dns_socket, packet, response_size, 0, reinterpret_cast<sockaddr *>(&client), client_size);
+            }
+
+            close(s_dns_socket);
+
+            s_dns_socket = -1;
+            s_dns_task = nullptr;
+
+            vTaskDelete(nullptr);
+        }
+
+        static bool start_dns()
+        {
+            s_dns_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+            if (s_dns_socket < 0)
+                return false;
+
+            const sockaddr_in address = {
+                .sin_len = sizeof(sockaddr_in),
+                .sin_family = AF_INET,
+                .sin_port = htons(DNS_PORT),
+                .sin_addr = {.s_addr = htonl(INADDR_ANY)},
+                .sin_zero = {},
+            };
+
+            const timeval timeout = {
+                .tv_sec = 0,
+                .tv_usec = 500 * 1000,
+            };
+
+            setsockopt(s_dns_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+            if (bind(s_dns_socket, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) < 0)
+            {
+                close(s_dns_socket);
+
+                s_dns_socket = -1;
+
+                return false;
+            }
+
+            s_dns_running = true;
+
+            if (xTaskCreate(dns_task, "dns", 3072, nullptr, tskIDLE_PRIORITY + 3, &s_dns_task) != pdPASS)
+            {
+                s_dns_running = false;
+
+                close(s_dns_socket);
+
+                s_dns_socket = -1;
+
+                return false;
+            }
+
+            return true;
+        }
+
+        static void stop_dns()
+        {
+            s_dns_running = false;
+
+            while (s_dns_task)
+                vTaskDelay(pdMS_TO_TICKS(50));
+        }
+
+        static void refresh_scan()
+        {
+            auto &w = wifi::get();
+
+            if (w.is_scanning() || esp_timer_get_time() - s_last_scan < SCAN_INTERVAL_US)
+                return;
+
+            if (w.start_scan())
+                s_last_scan = esp_timer_get_time();
+        }
+
+        static size_t escape_json(const char *input, char *output, size_t capacity)
+        {
+            size_t length = 0;
+
+            for (; *input && length + 3 < capacity; input++)
+            {
+                if (static_cast<uint8_t>(*input) < 0x20)
+                    continue;
+
+                if (*input == '"' || *input == '\\')
+                    output[length++] = '\\';
+
+                output[length++] = *input;
+            }
+
+            output[length] = '\0';
+
+            return length;
+        }
+
+        static void decode_url(char *text)
+        {
+            auto hex = [](char c) -> int
+            {
+                if (c >= '0' && c <= '9')
+                    return c - '0';
+
+                if (c >= 'a' && c <= 'f')
+                    return c - 'a' + 10;
+
+                if (c >= 'A' && c <= 'F')
+                    return c - 'A' + 10;
+
+                return -1;
+            };
+
+            char *output = text;
+
+            for (const char *input = text; *input; input++)
+            {
+                if (*input == '+')
+                    *output++ = ' ';
+                else if (*input == '%' && hex(input[1]) >= 0 && hex(input[2]) >= 0)
+                {
+                    *output++ = static_cast<char>((hex(input[1]) << 4) | hex(input[2]));
+
+                    input += 2;
+                }
+                else
+                    *output++ = *input;
+            }
+
+            *output = '\0';
+        }
+
+        static esp_err_t portal_handler(httpd_req_t *req)
+        {
+            refresh_scan();
+
+            httpd_resp_set_type(req, "text/html");
+            httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+            httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+            return httpd_resp_send(req, reinterpret_cast<const char *>(portal_html_gz_start), portal_html_gz_end - portal_html_gz_start);
+        }
+
+        static esp_err_t scan_handler(httpd_req_t *req)
+        {
+            HARDWARE_TRACE_SCOPE(PROVISIONING_SCAN);
+
+            refresh_scan();
+
+            wifi::access_point_info results[SCAN_MAX_RESULTS];
+
+            const size_t count = wifi::get().get_scan_results(results, SCAN_MAX_RESULTS);
+
+            httpd_resp_set_type(req, "application/json");
+            httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+            httpd_resp_sendstr_chunk(req, "[");
+
+            size_t emitted = 0;
+
+            for (size_t i = 0; i < count; i++)
+            {
+                char ssid[2 * sizeof(results[i].ssid)];
+                char entry[128];
+
+                if (!escape_json(results[i].ssid, ssid, sizeof(ssid)))
+                    continue;
+
+                snprintf(entry, sizeof(entry), "%s{\"ssid\":\"%s\",\"rssi\":%d,\"secure\":%s}",
+                         emitted++ ? "," : "", ssid, results[i].rssi, results[i].secure ? "true" : "false");
+
+                httpd_resp_sendstr_chunk(req, entry);
+            }
+
+            httpd_resp_sendstr_chunk(req, "]");
+
+            return httpd_resp_sendstr_chunk(req, nullptr);
+        }
+
+        static esp_err_t connect_handler(httpd_req_t *req)
+        {
+            HARDWARE_TRACE_SCOPE(PROVISIONING_CONNECT);
+
+            char body[320];
+
+            if (req->content_len >= sizeof(body))
+                return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "request too large");
+
+            size_t received = 0;
+
+            while (received < req->content_len)
+            {
+                const int size = httpd_req_recv(req, body + received, req->content_len - received);
+
+                if (size == HTTPD_SOCK_ERR_TIMEOUT)
+                    continue;
+
+                if (size <= 0)
+                    return ESP_FAIL;
+
+                received += size;
+            }
+
+            body[received] = '\0';
+
+            char ssid[3 * 32 + 1] = {0};
+            char password[3 * 63 + 1] = {0};
+
+            if (httpd_query_key_value(body, "ssid", ssid, sizeof(ssid)) != ESP_OK)
+                return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "missing ssid");
+
+            if (httpd_query_key_value(body, "password", password, sizeof(password)) != ESP_OK)
+                password[0] = '\0';
+
+            decode_url(ssid);
+            decode_url(password);
+
+            const size_t ssid_length = strlen(ssid);
+            const size_t password_length = strlen(password);
+
+            if (!ssid_length || ssid_length > 32 || (password_length && (password_length < 8 || password_length > 63)))
+                return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid credentials");
+
+            ESP_LOGI(TAG, "received credentials for %s", ssid);
+
+            auto &w = wifi::get();
+
+            w.set_mode(wifi::mode::STATION);
+            w.set_ssid(ssid);
+            w.set_password(password);
+
+            httpd_resp_set_type(req, "text/html");
+            httpd_resp_sendstr(req, CONNECTING_PAGE);
+
+            esp_timer_stop(s_apply_timer);
+
+            return esp_timer_start_once(s_apply_timer, APPLY_DELAY_US);
+        }
+
+        static esp_err_t redirect_handler(httpd_req_t *req)
+        {
+            httpd_resp_set_status(req, "302 Found");
+            httpd_resp_set_hdr(req, "Location", s_portal_url);
+
+            return httpd_resp_send(req, nullptr, 0);
+        }
+
+        static void on_apply(void *arg)
+        {
+            wifi::get().restart();
+        }
+
+        // The portal outlives the restart into station mode: if the credentials are wrong the
+        // station falls back to the default access point and the portal is reachable again.
+        // It only goes away once the station got an address.
+        static void on_watch(void *arg)
+        {
+            wifi::event received;
+            bool connected = false;
+
+            while (s_events.receive(received))
+            {
+                if (received == wifi::event::CONNECTED)
+                    connected = true;
+                else if (received == wifi::event::ACCESS_POINT_FALLBACK)
+                    ESP_LOGW(TAG, "connection failed, portal stays available");
+            }
+
+            if (connected)
+            {
+                ESP_LOGI(TAG, "connected, closing portal");
+
+                stop();
+            }
+        }
+
+        bool start()
+        {
+            if (s_server)
+                return true;
+
+            auto &w = wifi::get();
+
+            if (!w.is_default_access_point())
+            {
+                ESP_LOGW(TAG, "not running on the default access point");
+
+                return false;
+            }
+
+            esp_netif_ip_info_t ip_info = {};
+
+            ESP_ERROR_CHECK(esp_netif_get_ip_info(esp_netif_get_handle_from_ifkey("WIFI_AP_DEF"), &ip_info));
+
+            s_address = ip_info.ip;
+
+            snprintf(s_portal_url, sizeof(s_portal_url), "http://" IPSTR "/", IP2STR(&s_address));
+
+            // Created once and kept, stop() runs from the watch timer's own callback.
+            if (!s_apply_timer)
+            {
+                const esp_timer_create_args_t apply_args = {
+                    .callback = on_apply,
+                    .arg = nullptr,
+                    .dispatch_method = ESP_TIMER_TASK,
+                    .name = "provisioning",
+                    .skip_unhandled_events = true,
+                };
+
+                const esp_timer_create_args_t watch_args = {
+                    .callback = on_watch,
+                    .arg = nullptr,
+                    .dispatch_method = ESP_TIMER_TASK,
+                    .name = "portal_watch",
+                    .skip_unhandled_events = true,
+                };
+
+                ESP_ERROR_CHECK(esp_timer_create(&apply_args, &s_apply_timer));
+                ESP_ERROR_CHECK(esp_timer_create(&watch_args, &s_watch_timer));
+            }
+
+            wifi::event stale;
+
+            while (s_events.receive(stale))
+                ;
+
+            if (!s_events.subscribe(wifi::events()))
+                ESP_LOGW(TAG, "no room on the wifi events, portal stays up after connecting");
+
+            httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+
+            config.max_open_sockets = 4;
+            config.max_uri_handlers = 4;
+            config.lru_purge_enable = true;
+            config.uri_match_fn = httpd_uri_match_wildcard;
+
+            ESP_ERROR_CHECK(httpd_start(&s_server, &config));
+
+            const httpd_uri_t handlers[] = {
+                {.uri = "/", .method = HTTP_GET, .handler = portal_handler, .user_ctx = nullptr},
+                {.uri = "/scan", .method = HTTP_GET, .handler = scan_handler, .user_ctx = nullptr},
+                {.uri = "/connect", .method = HTTP_POST, .handler = connect_handler, .user_ctx = nullptr},
+                {.uri = "/*", .method = HTTP_GET, .handler = redirect_handler, .user_ctx = nullptr},
+            };
+
+            for (const auto &handler : handlers)
+                ESP_ERROR_CHECK(httpd_register_uri_handler(s_server, &handler));
+
+            if (!start_dns())
+                ESP_LOGW(TAG, "failed to start captive dns responder");
+
+            s_last_scan = 0;
+
+            refresh_scan();
+
+            ESP_ERROR_CHECK(esp_timer_start_periodic(s_watch_timer, WATCH_INTERVAL_US));
+
+            ESP_LOGI(TAG, "portal available at %s", s_portal_url);
+
+            return true;
+        }
+
+        void stop()
+        {
+            if (!s_server)
+                return;
+
+            stop_dns();
+
+            ESP_ERROR_CHECK(httpd_stop(s_server));
+
+            s_server = nullptr;
+
+            esp_timer_stop(s_apply_timer);
+            esp_timer_stop(s_watch_timer);
+
+            s_events.unsubscribe();
+        }
+
+        bool active()
+        {
+            return s_server != nullptr;
+        }
+    }
+}
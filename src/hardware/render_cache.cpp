@@ -0,0 +1,393 @@
+#include "hardware/render_cache.h"
+
+#include "hardware/assets.h"
+#include "hardware/graphics.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <iterator>
+
+#include <esp_log.h>
+#include <esp_memory_utils.h>
+#include <lvgl.h>
+#include <src/misc/lv_gc.h>
+
+// LVGL has no hooks in its caches, the component links with --wrap for these so every call
+// from inside LVGL passes through here first.
+extern "C"
+{
+    _lv_img_cache_entry_t *__real__lv_img_cache_open(const void *src, lv_color_t color, int32_t frame_id);
+    lv_res_t __real_lv_img_decoder_open(lv_img_decoder_dsc_t *dsc, const void *src, lv_color_t color, int32_t frame_id);
+    void __real_lv_img_decoder_close(lv_img_decoder_dsc_t *dsc);
+    lv_grad_t *__real_lv_gradient_get(const lv_grad_dsc_t *gradient, lv_coord_t w, lv_coord_t h);
+}
+
+namespace hardware
+{
+    namespace graphics
+    {
+        namespace render_cache
+        {
+            constexpr const char *TAG = "render_cache";
+            constexpr size_t HISTORY = 64;
+            constexpr uint32_t MIN_WINDOW_LOOKUPS = 8;
+            // Grow once more than 1 in this many lookups had to be rendered again.
+            constexpr uint32_t PRESSURE_RATIO = 20;
+            constexpr size_t MIN_GRADIENT_BYTES = 4 * 1024;
+
+            // Keys of recent misses, a second miss on one of them means it was evicted.
+            struct history
+            {
+                uint32_t keys[HISTORY];
+                size_t next;
+
+                bool seen(uint32_t key) const
+                {
+                    return key && std::find(std::begin(keys), std::end(keys), key) != std::end(keys);
+                }
+
+                void add(uint32_t key)
+                {
+                    keys[next] = key;
+                    next = (next + 1) % HISTORY;
+                }
+            };
+
+            // Only touched by the render task or with the graphics lock held.
+            static statistics s_statistics = {
+                .images = {},
+                .gradients = {},
+                .layers = {},
+                .image_entries = LV_IMG_CACHE_DEF_SIZE,
+                .images_cached = 0,
+                .image_bytes = 0,
+                .gradient_bytes = LV_GRAD_CACHE_DEF_SIZE,
+                .resizes = 0,
+            };
+            static statistics s_window_start = {};
+            static history s_image_history = {};
+            static history s_gradient_history = {};
+            static bool s_inside_image_cache = false;
+
+            static options s_options = {};
+            static lv_timer_t *sp_timer = nullptr;
+            static lv_draw_ctx_t *sp_draw_context = nullptr;
+            static lv_draw_layer_ctx_t *(*sp_layer_init)(lv_draw_ctx_t *, lv_draw_layer_ctx_t *, lv_draw_layer_flags_t) = nullptr;
+
+            static uint32_t image_key(const void *src)
+            {
+                if (lv_img_src_get_type(src) == LV_IMG_SRC_VARIABLE)
+                    return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(src));
+
+                return assets::hash(static_cast<const char *>(src));
+            }
+
+            static void miss(cache_statistics &cache, history &recent, uint32_t key)
+            {
+                cache.misses++;
+
+                if (recent.seen(key))
+                    cache.refetches++;
+                else
+                    recent.add(key);
+            }
+
+            static cache_statistics difference(const cache_statistics &now, const cache_statistics &before)
+            {
+                return {
+                    .lookups = now.lookups - before.lookups,
+                    .hits = now.hits - before.hits,
+                    .misses = now.misses - before.misses,
+                    .evictions = now.evictions - before.evictions,
+                    .refetches = now.refetches - before.refetches,
+                    .uncached = now.uncached - before.uncached,
+                };
+            }
+
+            static bool under_pressure(const cache_statistics &window)
+            {
+                return window.lookups >= MIN_WINDOW_LOOKUPS && (window.refetches + window.uncached) * PRESSURE_RATIO > window.lookups;
+            }
+
+            // Counts the cached images and the decoded data they hold in RAM, images drawn in
+            // place from flash cost nothing.
+            static void scan_images()
+            {
+                size_t bytes = 0;
+                uint16_t cached = 0;
+
+                _lv_img_cache_entry_t *entries = LV_GC_ROOT(_lv_img_cache_array);
+
+                for (uint16_t i = 0; entries && i < s_statistics.image_entries; i++)
+                {
+                    const lv_img_decoder_dsc_t &dsc = entries[i].dec_dsc;
+
+                    if (!dsc.src)
+                        continue;
+
+                    cached++;
+
+                    if (dsc.img_data && (esp_ptr_internal(dsc.img_data) || esp_ptr_external_ram(dsc.img_data)))
+                        bytes += lv_img_buf_get_img_size(dsc.header.w, dsc.header.h, dsc.header.cf);
+                }
+
+                s_statistics.image_bytes = bytes;
+                s_statistics.images_cached = cached;
+            }
+
+            static void set_image_entries(uint16_t entries)
+            {
+                ESP_LOGI(TAG, "image cache %u -> %u entries", s_statistics.image_entries, entries);
+
+                // This drops every cached image, which is why it only happens under pressure.
+                lv_img_cache_set_size(entries);
+
+                s_statistics.image_entries = entries;
+                s_statistics.resizes++;
+            }
+
+            static void set_gradient_bytes(size_t bytes)
+            {
+                ESP_LOGI(TAG, "gradient cache %u -> %u bytes", static_cast<unsigned>(s_statistics.gradient_bytes), static_cast<unsigned>(bytes));
+
+                lv_gradient_set_cache_size(bytes);
+
+                s_statistics.gradient_bytes = bytes;
+                s_statistics.resizes++;
+            }
+
+            static void adapt(lv_timer_t *timer)
+            {
+                const cache_statistics images = difference(s_statistics.images, s_window_start.images);
+                const cache_statistics gradients = difference(s_statistics.gradients, s_window_start.gradients);
+
+                s_window_start = s_statistics;
+
+                scan_images();
+
+                const size_t used = s_statistics.image_bytes + s_statistics.gradient_bytes;
+
+                // Over budget, give back gradient memory first, it is cheaper to recompute.
+                if (used > s_options.memory_budget)
+                {
+                    if (s_statistics.gradient_bytes > MIN_GRADIENT_BYTES)
+                        set_gradient_bytes(std::max(MIN_GRADIENT_BYTES, s_statistics.gradient_bytes / 2));
+                    else if (s_statistics.image_entries > 1)
+                        set_image_entries(s_statistics.image_entries / 2);
+
+                    return;
+                }
+
+                // Only a full image cache can be too small.
+                if (under_pressure(images) && s_statistics.images_cached >= s_statistics.image_entries &&
+                    s_statistics.image_entries < s_options.max_image_entries)
+                {
+                    const uint16_t entries = std::min<uint16_t>(s_options.max_image_entries, std::max(2, s_statistics.image_entries * 2));
+                    const size_t per_entry = s_statistics.images_cached ? s_statistics.image_bytes / s_statistics.images_cached : 0;
+
+                    if (used + per_entry * (entries - s_statistics.image_entries) <= s_options.memory_budget)
+                        set_image_entries(entries);
+                }
+
+                if (under_pressure(gradients))
+                {
+                    const size_t bytes = std::max(MIN_GRADIENT_BYTES, s_statistics.gradient_bytes * 2);
+
+                    if (s_statistics.image_bytes + bytes <= s_options.memory_budget)
+                        set_gradient_bytes(bytes);
+                }
+            }
+
+            static lv_draw_layer_ctx_t *layer_init(lv_draw_ctx_t *draw_context, lv_draw_layer_ctx_t *layer, lv_draw_layer_flags_t flags)
+            {
+                lv_draw_layer_ctx_t *result = sp_layer_init(draw_context, layer, flags);
+                layer_statistics &layers = s_statistics.layers;
+
+                layers.layers++;
+
+                if (!result)
+                {
+                    layers.failures++;
+
+                    return result;
+                }
+
+                const lv_coord_t width = lv_area_get_width(&result->area_full);
+                const uint32_t pixel_size = (flags & LV_DRAW_LAYER_FLAG_HAS_ALPHA) ? LV_IMG_PX_SIZE_ALPHA_BYTE : sizeof(lv_color_t);
+                const uint32_t full = lv_area_get_size(&result->area_full) * pixel_size;
+
+                layers.largest_bytes = std::max(layers.largest_bytes, full);
+
+                if (flags & LV_DRAW_LAYER_FLAG_CAN_SUBDIVIDE)
+                {
+                    // LVGL sizes the rows from the buffer it got, that gives the buffer away.
+                    const uint32_t buffer = result->max_row_with_no_alpha * width * sizeof(lv_color_t);
+
+                    if (full > LV_LAYER_SIMPLE_FALLBACK_BUF_SIZE && buffer <= LV_LAYER_SIMPLE_FALLBACK_BUF_SIZE)
+                        layers.fallbacks++;
+                    else if (full > LV_LAYER_SIMPLE_BUF_SIZE)
+                        layers.chunked++;
+                }
+
+                return result;
+            }
+
+            bool start(const options &opts)
+            {
+                if (!lock())
+                    return false;
+
+                lv_disp_t *display = get_display();
+
+                if (!display || !display->driver->draw_ctx)
+                {
+                    unlock();
+
+                    return false;
+                }
+
+                s_options = opts;
+                s_window_start = s_statistics;
+
+                if (!sp_draw_context)
+                {
+                    sp_draw_context = display->driver->draw_ctx;
+                    sp_layer_init = sp_draw_context->layer_init;
+                    sp_draw_context->layer_init = layer_init;
+                }
+
+                if (opts.adaptive && !sp_timer)
+                    sp_timer = lv_timer_create(adapt, opts.window_ms, nullptr);
+                else if (!opts.adaptive && sp_timer)
+                {
+                    lv_timer_del(sp_timer);
+
+                    sp_timer = nullptr;
+                }
+
+                if (sp_timer)
+                    lv_timer_set_period(sp_timer, opts.window_ms);
+
+                unlock();
+
+                return true;
+            }
+
+            void stop()
+            {
+                if (!lock())
+                    return;
+
+                if (sp_timer)
+                    lv_timer_del(sp_timer);
+
+                if (sp_draw_context)
+                    sp_draw_context->layer_init = sp_layer_init;
+
+                sp_timer = nullptr;
+                sp_draw_context = nullptr;
+                sp_layer_init = nullptr;
+
+                unlock();
+            }
+
+            statistics get_statistics()
+            {
+                const bool locked = lock();
+
+                scan_images();
+
+                const statistics result = s_statistics;
+
+                if (locked)
+                    unlock();
+
+                return result;
+            }
+
+            static void print_cache(const char *name, const cache_statistics &cache)
+            {
+                ESP_LOGI(TAG, "%-9s %" PRIu32 " lookups, %" PRIu32 "%% hits, %" PRIu32 " misses, %" PRIu32 " evictions, %" PRIu32 " refetches, %" PRIu32 " uncached",
+                         name, cache.lookups, cache.lookups ? static_cast<uint32_t>(uint64_t(cache.hits) * 100 / cache.lookups) : 0,
+                         cache.misses, cache.evictions, cache.refetches, cache.uncached);
+            }
+
+            void print_statistics()
+            {
+                const statistics result = get_statistics();
+
+                print_cache("images", result.images);
+                print_cache("gradients", result.gradients);
+
+                ESP_LOGI(TAG, "image cache %u/%u entries, %u bytes decoded, gradient cache %u bytes, %" PRIu32 " resizes",
+                         result.images_cached, result.image_entries, static_cast<unsigned>(result.image_bytes),
+                         static_cast<unsigned>(result.gradient_bytes), result.resizes);
+
+                ESP_LOGI(TAG, "layers %" PRIu32 ", %" PRIu32 " chunked, %" PRIu32 " fallbacks, %" PRIu32 " failures, largest %" PRIu32 " bytes",
+                         result.layers.layers, result.layers.chunked, result.layers.fallbacks, result.layers.failures, result.layers.largest_bytes);
+            }
+        }
+    }
+}
+
+using namespace hardware::graphics::render_cache;
+
+extern "C" _lv_img_cache_entry_t *__wrap__lv_img_cache_open(const void *src, lv_color_t color, int32_t frame_id)
+{
+    const uint32_t misses = s_statistics.images.misses;
+
+    s_inside_image_cache = true;
+
+    _lv_img_cache_entry_t *entry = __real__lv_img_cache_open(src, color, frame_id);
+
+    s_inside_image_cache = false;
+
+    s_statistics.images.lookups++;
+
+    if (s_statistics.images.misses == misses)
+        s_statistics.images.hits++;
+
+    return entry;
+}
+
+extern "C" lv_res_t __wrap_lv_img_decoder_open(lv_img_decoder_dsc_t *dsc, const void *src, lv_color_t color, int32_t frame_id)
+{
+    // Opens from the image cache are its misses, anything else decodes for itself.
+    if (s_inside_image_cache)
+        miss(s_statistics.images, s_image_history, image_key(src));
+
+    return __real_lv_img_decoder_open(dsc, src, color, frame_id);
+}
+
+extern "C" void __wrap_lv_img_decoder_close(lv_img_decoder_dsc_t *dsc)
+{
+    if (s_inside_image_cache)
+        s_statistics.images.evictions++;
+
+    __real_lv_img_decoder_close(dsc);
+}
+
+extern "C" lv_grad_t *__wrap_lv_gradient_get(const lv_grad_dsc_t *gradient, lv_coord_t w, lv_coord_t h)
+{
+    lv_grad_t *item = __real_lv_gradient_get(gradient, w, h);
+
+    if (!item)
+        return item;
+
+    cache_statistics &gradients = s_statistics.gradients;
+
+    gradients.lookups++;
+
+    // LVGL bumps life on every hit, a fresh item still has it at zero.
+    if (item->not_cached)
+    {
+        gradients.misses++;
+        gradients.uncached++;
+    }
+    else if (!item->life)
+        miss(gradients, s_gradient_history, item->key);
+    else
+        gradients.hits++;
+
+    return item;
+}
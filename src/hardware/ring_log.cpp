@@ -0,0 +1,446 @@
+#include "hardware/ring_log.h"
+#include "hardware/trace.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+#include <esp_timer.h>
+
+namespace hardware
+{
+    namespace storage
+    {
+        constexpr const char *TAG = "ring_log";
+        constexpr uint32_t SECTOR_MAGIC = 0x474f4c52; // "RLOG"
+
+        struct __attribute__((packed)) log_record
+        {
+            uint64_t timestamp;
+            uint32_t sequence;
+            uint16_t type;
+            uint8_t size;
+            uint8_t reserved;
+            uint8_t payload[ring_log::PAYLOAD_SIZE];
+            uint32_t crc;
+        };
+
+        struct __attribute__((packed)) sector_header
+        {
+            uint32_t magic;
+            uint32_t sequence;
+            uint64_t first_timestamp;
+            uint32_t first_record;
+            uint8_t reserved[ring_log::RECORD_SIZE - 24];
+            uint32_t crc;
+        };
+
+        static_assert(sizeof(log_record) == ring_log::RECORD_SIZE);
+        static_assert(sizeof(sector_header) == ring_log::RECORD_SIZE);
+
+        template <typename T>
+        static uint32_t checksum(const T &value)
+        {
+            return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(&value), offsetof(T, crc));
+        }
+
+        template <typename T>
+        static bool erased(const T &value)
+        {
+            const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&value);
+
+            return std::all_of(bytes, bytes + sizeof(T), [](uint8_t byte)
+                               { return byte == 0xff; });
+        }
+
+        struct ring_log_implementation
+        {
+            size_t sector_offset(uint32_t sequence) const
+            {
+                const uint32_t distance = m_head_sequence - sequence;
+
+                return ((m_head_sector + m_sectors - distance % m_sectors) % m_sectors) * m_sector_size;
+            }
+
+            bool read_header(uint32_t sequence, sector_header &header)
+            {
+                return m_device->read(sector_offset(sequence), &header, sizeof(header)) &&
+                       header.magic == SECTOR_MAGIC && header.crc == checksum(header) && header.sequence == sequence;
+            }
+
+            void recover()
+            {
+                sector_header header;
+                bool found = false;
+
+                m_tail_sequence = 1;
+                m_head_sequence = 0;
+
+                for (uint32_t sector = 0; sector < m_sectors; sector++)
+                {
+                    if (!m_device->read(sector * m_sector_size, &header, sizeof(header)) ||
+                        header.magic != SECTOR_MAGIC || header.crc != checksum(header))
+                        continue;
+
+                    if (!found || header.sequence > m_head_sequence)
+                    {
+                        m_head_sequence = header.sequence;
+                        m_head_sector = sector;
+                    }
+
+                    if (!found || header.sequence < m_tail_sequence)
+                        m_tail_sequence = header.sequence;
+
+                    found = true;
+                }
+
+                if (!found)
+                {
+                    m_head_sector = m_sectors - 1;
+                    m_next_slot = m_slots;
+
+                    return;
+                }
+
+                // Sectors older than one lap are stale leftovers of an interrupted erase.
+                m_tail_sequence = std::max(m_tail_sequence, m_head_sequence - std::min(m_head_sequence - 1, m_sectors - 1));
+
+                read_header(m_head_sequence, header);
+
+                m_last_timestamp = header.first_timestamp;
+                m_record_sequence = header.first_record;
+                m_next_slot = m_slots;
+
+                log_record record;
+
+                for (uint16_t slot = 1; slot < m_slots; slot++)
+                {
+                    m_device->read(sector_offset(m_head_sequence) + slot * ring_log::RECORD_SIZE, &record, sizeof(record));
+
+                    if (erased(record))
+                    {
+                        m_next_slot = slot;
+
+                        break;
+                    }
+
+                    if (record.crc != checksum(record))
+                    {
+                        m_statistics.torn_records++;
+
+                        continue;
+                    }
+
+                    m_last_timestamp = record.timestamp;
+                    m_record_sequence = record.sequence + 1;
+                }
+
+                ESP_LOGI(TAG, "recovered sectors %lu..%lu, next slot %u, %lu torn records",
+                         static_cast<unsigned long>(m_tail_sequence), static_cast<unsigned long>(m_head_sequence),
+                         m_next_slot, static_cast<unsigned long>(m_statistics.torn_records));
+            }
+
+            bool open_sector()
+            {
+                const uint32_t sector = (m_head_sector + 1) % m_sectors;
+
+                if (!m_device->erase(sector * m_sector_size, m_sector_size))
+                {
+                    ESP_LOGE(TAG, "failed to erase sector %lu", static_cast<unsigned long>(sector));
+
+                    return false;
+                }
+
+                m_statistics.erases++;
+
+                m_head_sector = sector;
+                m_head_sequence++;
+                m_next_slot = 1;
+                m_header_pending = true;
+
+                if (m_head_sequence - m_tail_sequence >= m_sectors)
+                    m_tail_sequence = m_head_sequence - m_sectors + 1;
+
+                return true;
+            }
+
+            bool flush()
+            {
+                if (!m_pending)
+                    return true;
+
+                HARDWARE_TRACE_SCOPE(RING_LOG_FLUSH, m_pending);
+
+                size_t first = m_next_slot;
+
+                if (m_header_pending)
+                {
+                    sector_header &header = *reinterpret_cast<sector_header *>(m_batch.get());
+
+                    memset(&header, 0, sizeof(header));
+
+                    header.magic = SECTOR_MAGIC;
+                    header.sequence = m_head_sequence;
+                    header.first_timestamp = reinterpret_cast<const log_record *>(m_batch.get() + ring_log::RECORD_SIZE)->timestamp;
+                    header.first_record = reinterpret_cast<const log_record *>(m_batch.get() + ring_log::RECORD_SIZE)->sequence;
+                    header.crc = checksum(header);
+
+                    first = 0;
+                }
+
+                const uint8_t *data = m_batch.get() + (m_header_pending ? 0 : ring_log::RECORD_SIZE);
+                const size_t size = (m_pending + (m_header_pending ? 1 : 0)) * ring_log::RECORD_SIZE;
+
+                const bool written = m_device->write(m_head_sector * m_sector_size + first * ring_log::RECORD_SIZE, data, size);
+
+                if (!written)
+                    ESP_LOGE(TAG, "failed to program %u records", static_cast<unsigned>(m_pending));
+
+                m_next_slot += m_pending;
+                m_pending = 0;
+                m_header_pending = false;
+
+                m_statistics.batches++;
+
+                return written;
+            }
+
+            std::mutex m_mutex;
+            std::unique_ptr<flash_device> m_device;
+
+            uint32_t m_sectors = 0;
+            size_t m_sector_size = 0;
+            uint16_t m_slots = 0;
+
+            uint32_t m_head_sector = 0;
+            uint32_t m_head_sequence = 0;
+            uint32_t m_tail_sequence = 1;
+            uint16_t m_next_slot = 0;
+            bool m_header_pending = false;
+
+            uint32_t m_record_sequence = 0;
+            uint64_t m_last_timestamp = 0;
+
+            // Slot 0 is reserved for the sector header, records start at slot 1.
+            std::unique_ptr<uint8_t[]> m_batch;
+            size_t m_batch_records = 0;
+            size_t m_pending = 0;
+
+            ring_log::statistics m_statistics = {};
+        };
+
+        ring_log *ring_log::sp_instance = nullptr;
+
+        ring_log::ring_log(std::unique_ptr<flash_device> device, size_t batch_records) : mp_implementation(std::make_unique<ring_log_implementation>())
+        {
+            auto implementation = mp_implementation.get();
+
+            if (!device || device->sector_size() % RECORD_SIZE || device->size() < 2 * device->sector_size())
+            {
+                ESP_LOGE(TAG, "unusable flash device");
+
+                return;
+            }
+
+            implementation->m_device = std::move(device);
+            implementation->m_sector_size = implementation->m_device->sector_size();
+            implementation->m_sectors = implementation->m_device->size() / implementation->m_sector_size;
+            implementation->m_slots = implementation->m_sector_size / RECORD_SIZE;
+            implementation->m_batch_records = std::clamp<size_t>(batch_records, 1, implementation->m_slots - 1);
+            implementation->m_batch = std::make_unique<uint8_t[]>((implementation->m_batch_records + 1) * RECORD_SIZE);
+
+            implementation->m_statistics.sectors = implementation->m_sectors;
+            implementation->m_statistics.sector_size = implementation->m_sector_size;
+
+            implementation->recover();
+        }
+
+        ring_log::~ring_log()
+        {
+            if (is_valid())
+                flush();
+        }
+
+        bool ring_log::is_valid()
+        {
+            return mp_implementation->m_device != nullptr;
+        }
+
+        bool ring_log::append(uint16_t type, const void *data, size_t size, uint64_t timestamp)
+        {
+            HARDWARE_TRACE_SCOPE(RING_LOG_APPEND, type);
+
+            auto implementation = mp_implementation.get();
+
+            if (!implementation->m_device || size > PAYLOAD_SIZE)
+                return false;
+
+            const int64_t start = esp_timer_get_time();
+
+            std::lock_guard<std::mutex> lock(implementation->m_mutex);
+
+            if (implementation->m_next_slot + implementation->m_pending >= implementation->m_slots)
+            {
+                if (!implementation->flush() || !implementation->open_sector())
+                    return false;
+            }
+
+            auto &record = *reinterpret_cast<log_record *>(implementation->m_batch.get() + (implementation->m_pending + 1) * RECORD_SIZE);
+
+            memset(&record, 0, sizeof(record));
+
+            implementation->m_last_timestamp = std::max(implementation->m_last_timestamp, timestamp);
+
+            record.timestamp = implementation->m_last_timestamp;
+            record.sequence = implementation->m_record_sequence++;
+            record.type = type;
+            record.size = size;
+            memcpy(record.payload, data, size);
+            record.crc = checksum(record);
+
+            implementation->m_pending++;
+            implementation->m_statistics.records_written++;
+
+            bool result = true;
+
+            if (implementation->m_pending == implementation->m_batch_records ||
+                implementation->m_next_slot + implementation->m_pending == implementation->m_slots)
+                result = implementation->flush();
+
+            implementation->m_statistics.max_append_us = std::max<uint32_t>(implementation->m_statistics.max_append_us, esp_timer_get_time() - start);
+
+            return result;
+        }
+
+        bool ring_log::flush()
+        {
+            std::lock_guard<std::mutex> lock(mp_implementation->m_mutex);
+
+            return mp_implementation->flush();
+        }
+
+        void ring_log::clear()
+        {
+            auto implementation = mp_implementation.get();
+
+            if (!implementation->m_device)
+                return;
+
+            std::lock_guard<std::mutex> lock(implementation->m_mutex);
+
+            implementation->m_device->erase(0, implementation->m_sectors * implementation->m_sector_size);
+            implementation->m_pending = 0;
+            implementation->m_header_pending = false;
+
+            implementation->recover();
+        }
+
+        ring_log::cursor ring_log::begin()
+        {
+            std::lock_guard<std::mutex> lock(mp_implementation->m_mutex);
+
+            return {mp_implementation->m_tail_sequence, 1};
+        }
+
+        bool ring_log::seek(uint64_t timestamp, cursor &position)
+        {
+            auto implementation = mp_implementation.get();
+
+            if (!implementation->m_device)
+                return false;
+
+            {
+                std::lock_guard<std::mutex> lock(implementation->m_mutex);
+
+                // Find the last sector starting at or before the timestamp. A sector without a
+                // readable header, the head while its header waits in the batch or a corrupt one,
+                // may start anywhere, so the search goes below it and the scan walks through it.
+                uint32_t low = implementation->m_tail_sequence;
+                uint32_t high = implementation->m_head_sequence;
+
+                position = {low, 1};
+
+                sector_header header;
+
+                while (low <= high && high)
+                {
+                    const uint32_t middle = low + (high - low) / 2;
+
+                    if (!implementation->read_header(middle, header) || header.first_timestamp > timestamp)
+                        high = middle - 1;
+                    else
+                    {
+                        position = {middle, 1};
+                        low = middle + 1;
+                    }
+                }
+            }
+
+            entry record;
+
+            for (cursor next = position; read(next, record); position = next)
+                if (record.timestamp >= timestamp)
+                    return true;
+
+            return false;
+        }
+
+        bool ring_log::read(cursor &position, entry &result)
+        {
+            auto implementation = mp_implementation.get();
+
+            if (!implementation->m_device)
+                return false;
+
+            std::lock_guard<std::mutex> lock(implementation->m_mutex);
+
+            log_record record;
+
+            while (true)
+            {
+                if (position.sector_sequence < implementation->m_tail_sequence)
+                    position = {implementation->m_tail_sequence, 1};
+
+                if (position.sector_sequence > implementation->m_head_sequence ||
+                    (position.sector_sequence == implementation->m_head_sequence && position.slot >= implementation->m_next_slot))
+                    return false;
+
+                if (position.slot >= implementation->m_slots)
+                {
+                    position = {position.sector_sequence + 1, 1};
+
+                    continue;
+                }
+
+                const size_t offset = implementation->sector_offset(position.sector_sequence) + position.slot * RECORD_SIZE;
+
+                position.slot++;
+
+                if (!implementation->m_device->read(offset, &record, sizeof(record)) || erased(record) || record.crc != checksum(record))
+                    continue;
+
+                result.timestamp = record.timestamp;
+                result.sequence = record.sequence;
+                result.type = record.type;
+                result.size = std::min<uint8_t>(record.size, PAYLOAD_SIZE);
+                memcpy(result.data, record.payload, result.size);
+
+                return true;
+            }
+        }
+
+        ring_log::statistics ring_log::get_statistics()
+        {
+            std::lock_guard<std::mutex> lock(mp_implementation->m_mutex);
+
+            auto statistics = mp_implementation->m_statistics;
+
+            statistics.used_sectors = mp_implementation->m_head_sequence ? mp_implementation->m_head_sequence - mp_implementation->m_tail_sequence + 1 : 0;
+
+            return statistics;
+        }
+    }
+}
@@ -0,0 +1,337 @@
+#include "hardware/scheduler.h"
+
+#include "hardware/espnow.h"
+#include "hardware/graphics.h"
+#include "hardware/trace.h"
+#include "hardware/wifi.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstring>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/idf_additions.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+
+namespace hardware
+{
+    namespace scheduler
+    {
+        constexpr const char *TAG = "scheduler";
+        constexpr size_t MAX_TRACKED_TASKS = 32;
+
+        struct job
+        {
+            job_t function;
+            void *arg;
+        };
+
+        struct worker
+        {
+            role kind;
+            task_options opts;
+            TaskHandle_t task;
+            QueueHandle_t queue;
+            SemaphoreHandle_t stopped;
+        };
+
+        // Run time of each task at the previous get_usage(), by task number.
+        struct runtime_sample
+        {
+            UBaseType_t number;
+            configRUN_TIME_COUNTER_TYPE runtime;
+        };
+
+        static worker s_workers[ROLE_COUNT] = {};
+        static options s_options = {};
+        static std::atomic<bool> s_running = false;
+        static bool s_started = false;
+
+        static key_callback_t sp_on_key = nullptr;
+        static void *sp_key_user_data = nullptr;
+        static bus::subscriber<button::key_event, 8> s_keys;
+
+        static runtime_sample s_samples[MAX_TRACKED_TASKS] = {};
+        static size_t s_sample_count = 0;
+        static configRUN_TIME_COUNTER_TYPE s_last_total = 0;
+
+        static void poll(role kind)
+        {
+            HARDWARE_TRACE_SCOPE(SCHEDULER_POLL, static_cast<uint16_t>(kind));
+
+            switch (kind)
+            {
+            case role::INPUT:
+            {
+                button::tick();
+
+                button::key_event event;
+
+                while (s_keys.receive(event))
+                    if (sp_on_key)
+                        sp_on_key(event, sp_key_user_data);
+                break;
+            }
+
+            case role::NETWORK:
+                if (s_options.poll_wifi)
+                    wifi::get().poll();
+
+                if (s_options.poll_espnow)
+                    espnow::get().poll();
+                break;
+
+            default:
+                break;
+            }
+        }
+
+        static void worker_task(void *arg)
+        {
+            auto self = static_cast<worker *>(arg);
+            const TickType_t period = self->opts.period_ms ? pdMS_TO_TICKS(std::max<uint32_t>(self->opts.period_ms, portTICK_PERIOD_MS)) : portMAX_DELAY;
+            TickType_t last_poll = xTaskGetTickCount();
+
+            while (s_running)
+            {
+                TickType_t wait = portMAX_DELAY;
+
+                // Jobs run as they arrive, the polling keeps its own period.
+                if (period != portMAX_DELAY)
+                {
+                    const TickType_t elapsed = xTaskGetTickCount() - last_poll;
+
+                    wait = elapsed < period ? period - elapsed : 0;
+                }
+
+                job item;
+
+                if (xQueueReceive(self->queue, &item, wait) == pdTRUE && item.function)
+                {
+                    HARDWARE_TRACE_BEGIN(SCHEDULER_JOB, static_cast<uint16_t>(self->kind));
+
+                    item.function(item.arg);
+
+                    HARDWARE_TRACE_END(SCHEDULER_JOB);
+                }
+
+                if (period != portMAX_DELAY && xTaskGetTickCount() - last_poll >= period)
+                {
+                    last_poll = xTaskGetTickCount();
+
+                    poll(self->kind);
+                }
+            }
+
+            // vTaskDeleteWithCaps() has to come from another task, stop() does it.
+            xSemaphoreGive(self->stopped);
+
+            vTaskSuspend(nullptr);
+        }
+
+        static bool start_worker(worker &target)
+        {
+            const task_options &opts = target.opts;
+            const UBaseType_t caps = (opts.external_stack ? MALLOC_CAP_SPIRAM : MALLOC_CAP_INTERNAL) | MALLOC_CAP_8BIT;
+
+            target.queue = xQueueCreate(std::max<uint8_t>(opts.queue_length, 1), sizeof(job));
+            target.stopped = xSemaphoreCreateBinary();
+
+            if (!target.queue || !target.stopped)
+                return false;
+
+            if (xTaskCreatePinnedToCoreWithCaps(worker_task, opts.name, opts.stack_size, &target, opts.priority, &target.task, opts.core, caps) != pdPASS)
+            {
+                ESP_LOGE(TAG, "failed to start %s", opts.name);
+
+                target.task = nullptr;
+
+                return false;
+            }
+
+            return true;
+        }
+
+        static void stop_worker(worker &target)
+        {
+            if (target.task)
+            {
+                const job wake = {};
+
+                // A full queue refuses the wake up, the worker is then busy and sees s_running soon.
+                do
+                    xQueueSend(target.queue, &wake, 0);
+                while (xSemaphoreTake(target.stopped, pdMS_TO_TICKS(10)) != pdTRUE);
+
+                vTaskDeleteWithCaps(target.task);
+
+                target.task = nullptr;
+            }
+
+            if (target.queue)
+                vQueueDelete(target.queue);
+
+            if (target.stopped)
+                vSemaphoreDelete(target.stopped);
+
+            target.queue = nullptr;
+            target.stopped = nullptr;
+        }
+
+        bool start(const options &opts)
+        {
+            if (s_started)
+                return true;
+
+            s_options = opts;
+
+            const task_options &render = opts.tasks[static_cast<size_t>(role::RENDER)];
+            graphics::options graphics_options = graphics::DEFAULT_OPTIONS;
+
+            graphics_options.core = render.core;
+            graphics_options.priority = render.priority;
+            graphics_options.stack_size = render.stack_size;
+            graphics_options.blend_core = render.core == 0 ? 1 : 0;
+
+            if (!graphics::start(graphics_options))
+                return false;
+
+            s_started = true;
+            s_running = true;
+
+            s_keys.subscribe(button::key_events());
+
+            for (size_t i = 0; i < ROLE_COUNT; i++)
+            {
+                s_workers[i].kind = static_cast<role>(i);
+                s_workers[i].opts = opts.tasks[i];
+
+                if (s_workers[i].kind == role::RENDER)
+                    continue;
+
+                if (!start_worker(s_workers[i]))
+                {
+                    stop();
+
+                    return false;
+                }
+            }
+
+            for (const auto &target : opts.tasks)
+                ESP_LOGI(TAG, "%-8s core %d, priority %" PRIu32 ", %" PRIu32 " byte %s stack", target.name, target.core, target.priority, target.stack_size,
+                         target.external_stack && &target != &render ? "PSRAM" : "internal");
+
+            return true;
+        }
+
+        void stop()
+        {
+            s_running = false;
+
+            for (auto &target : s_workers)
+                stop_worker(target);
+
+            s_keys.unsubscribe();
+
+            if (s_started)
+                graphics::stop();
+
+            s_started = false;
+        }
+
+        void set_key_callback(key_callback_t on_key, void *user_data)
+        {
+            sp_on_key = on_key;
+            sp_key_user_data = user_data;
+        }
+
+        bool post(role target, job_t function, void *arg, uint32_t timeout_ms)
+        {
+            if (target >= role::COUNT || target == role::RENDER)
+                return false;
+
+            QueueHandle_t queue = s_workers[static_cast<size_t>(target)].queue;
+            const job item = {function, arg};
+
+            return function && queue && xQueueSend(queue, &item, timeout_ms == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms)) == pdTRUE;
+        }
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY && CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+        size_t get_usage(task_usage *usage, size_t capacity)
+        {
+            UBaseType_t count = uxTaskGetNumberOfTasks() + 2;
+            auto status = static_cast<TaskStatus_t *>(heap_caps_malloc(count * sizeof(TaskStatus_t), MALLOC_CAP_DEFAULT));
+
+            if (!status)
+                return 0;
+
+            configRUN_TIME_COUNTER_TYPE total = 0;
+
+            count = uxTaskGetSystemState(status, count, &total);
+
+            const configRUN_TIME_COUNTER_TYPE window = total - s_last_total;
+            runtime_sample samples[MAX_TRACKED_TASKS];
+            size_t sample_count = 0;
+            size_t filled = 0;
+
+            for (UBaseType_t i = 0; i < count; i++)
+            {
+                const TaskStatus_t &task = status[i];
+                configRUN_TIME_COUNTER_TYPE previous = 0;
+
+                for (size_t j = 0; j < s_sample_count; j++)
+                    if (s_samples[j].number == task.xTaskNumber)
+                        previous = s_samples[j].runtime;
+
+                if (sample_count < MAX_TRACKED_TASKS)
+                    samples[sample_count++] = {task.xTaskNumber, task.ulRunTimeCounter};
+
+                if (filled >= capacity)
+                    continue;
+
+                task_usage &entry = usage[filled++];
+                const configRUN_TIME_COUNTER_TYPE used = task.ulRunTimeCounter - previous;
+
+                strlcpy(entry.name, task.pcTaskName, sizeof(entry.name));
+                entry.core = xTaskGetCoreID(task.xHandle);
+                entry.priority = task.uxCurrentPriority;
+                entry.stack_free = task.usStackHighWaterMark;
+                entry.runtime_us = static_cast<uint32_t>(used);
+                entry.cpu_percent = window ? static_cast<uint8_t>(std::min<configRUN_TIME_COUNTER_TYPE>(used * 100 / window, 100)) : 0;
+            }
+
+            std::copy_n(samples, sample_count, s_samples);
+            s_sample_count = sample_count;
+            s_last_total = total;
+
+            heap_caps_free(status);
+
+            return filled;
+        }
+#else
+        size_t get_usage(task_usage *usage, size_t capacity)
+        {
+            ESP_LOGW(TAG, "enable CONFIG_FREERTOS_USE_TRACE_FACILITY and CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS for task usage");
+
+            return 0;
+        }
+#endif
+
+        void print_usage()
+        {
+            task_usage usage[MAX_TRACKED_TASKS];
+            const size_t count = get_usage(usage, MAX_TRACKED_TASKS);
+
+            std::sort(usage, usage + count, [](const task_usage &a, const task_usage &b) { return a.runtime_us > b.runtime_us; });
+
+            for (size_t i = 0; i < count; i++)
+                ESP_LOGI(TAG, "%-16s core %2d, priority %2" PRIu32 ", %3u%%, %8" PRIu32 "us, %5" PRIu32 " bytes stack free", usage[i].name,
+                         usage[i].core == tskNO_AFFINITY ? -1 : usage[i].core, usage[i].priority, usage[i].cpu_percent, usage[i].runtime_us, usage[i].stack_free);
+        }
+    }
+}
@@ -0,0 +1,247 @@
+#include "hardware/settings.h"
+#include "hardware/trace.h"
+
+#include <cinttypes>
+#include <mutex>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+namespace hardware
+{
+    namespace storage
+    {
+        constexpr const char *TAG = "settings";
+        constexpr const char *WEAR_KEY = "_writes";
+
+        struct settings_store_implementation
+        {
+            static bool test(const uint32_t *mask, size_t index)
+            {
+                return mask[index / 32] & (1UL << (index % 32));
+            }
+
+            static void assign(uint32_t *mask, size_t index, bool value)
+            {
+                if (value)
+                    mask[index / 32] |= 1UL << (index % 32);
+                else
+                    mask[index / 32] &= ~(1UL << (index % 32));
+            }
+
+            uint8_t *ensure_loaded(size_t index)
+            {
+                const auto &d = m_descriptors[index];
+                uint8_t *slot = m_arena + d.offset;
+
+                if (test(m_loaded, index))
+                    return slot;
+
+                if (!m_backend->read(d.key, d.kind, slot, d.size))
+                {
+                    if (d.kind == value_kind::text)
+                    {
+                        strncpy(reinterpret_cast<char *>(slot), static_cast<const char *>(d.default_value), d.size - 1);
+
+                        slot[d.size - 1] = '\0';
+                    }
+                    else
+                        memcpy(slot, d.default_value, d.size);
+                }
+
+                assign(m_loaded, index, true);
+
+                m_statistics.loads++;
+
+                return slot;
+            }
+
+            void flush()
+            {
+                HARDWARE_TRACE_SCOPE(SETTINGS_FLUSH);
+
+                uint32_t writes = 0;
+
+                for (size_t i = 0; i < m_count; i++)
+                {
+                    if (!test(m_dirty, i))
+                        continue;
+
+                    // A failed write stays dirty and is retried with the next flush.
+                    if (!m_backend->write(m_descriptors[i].key, m_descriptors[i].kind, m_arena + m_descriptors[i].offset))
+                        continue;
+
+                    assign(m_dirty, i, false);
+
+                    writes++;
+                }
+
+                if (!writes)
+                    return;
+
+                m_statistics.writes += writes;
+                m_statistics.lifetime_writes += writes + 1;
+                m_statistics.commits++;
+
+                m_backend->write(WEAR_KEY, value_kind::u32, &m_statistics.lifetime_writes);
+
+                if (!m_backend->commit())
+                    ESP_LOGE(TAG, "commit failed");
+
+                ESP_LOGD(TAG, "committed %" PRIu32 " entries, %" PRIu32 " lifetime writes", writes, m_statistics.lifetime_writes);
+            }
+
+            void schedule()
+            {
+                if (!m_timer)
+                    return flush();
+
+                if (!esp_timer_is_active(m_timer))
+                    ESP_ERROR_CHECK(esp_timer_start_once(m_timer, m_debounce_ms * 1000ULL));
+            }
+
+            std::mutex m_mutex;
+            std::unique_ptr<settings_backend> m_backend;
+            esp_timer_handle_t m_timer = nullptr;
+            uint32_t m_debounce_ms = 0;
+
+            const settings_store::descriptor *m_descriptors = nullptr;
+            size_t m_count = 0;
+            uint8_t *m_arena = nullptr;
+            uint32_t *m_loaded = nullptr;
+            uint32_t *m_dirty = nullptr;
+
+            settings_store::statistics m_statistics = {};
+        };
+
+        settings_store::settings_store(std::unique_ptr<settings_backend> backend, const descriptor *descriptors, size_t count,
+                                       uint8_t *arena, uint32_t *loaded, uint32_t *dirty, uint32_t debounce_ms)
+            : mp_implementation(std::make_unique<settings_store_implementation>())
+        {
+            auto implementation = mp_implementation.get();
+
+            implementation->m_backend = std::move(backend);
+            implementation->m_descriptors = descriptors;
+            implementation->m_count = count;
+            implementation->m_arena = arena;
+            implementation->m_loaded = loaded;
+            implementation->m_dirty = dirty;
+            implementation->m_debounce_ms = debounce_ms;
+
+            if (!implementation->m_backend->read(WEAR_KEY, value_kind::u32, &implementation->m_statistics.lifetime_writes, sizeof(uint32_t)))
+                implementation->m_statistics.lifetime_writes = 0;
+
+            if (!debounce_ms)
+                return;
+
+            const esp_timer_create_args_t timer_args = {
+                .callback = [](void *arg)
+                {
+                    static_cast<settings_store *>(arg)->flush();
+                },
+                .arg = this,
+                .dispatch_method = ESP_TIMER_TASK,
+                .name = "settings",
+                .skip_unhandled_events = true,
+            };
+
+            ESP_ERROR_CHECK(esp_timer_create(&timer_args, &implementation->m_timer));
+        }
+
+        settings_store::~settings_store()
+        {
+            if (mp_implementation->m_timer)
+            {
+                esp_timer_stop(mp_implementation->m_timer);
+                esp_timer_delete(mp_implementation->m_timer);
+            }
+        }
+
+        void settings_store::shutdown()
+        {
+            auto implementation = mp_implementation.get();
+
+            if (implementation->m_timer)
+            {
+                esp_timer_stop(implementation->m_timer);
+                ESP_ERROR_CHECK(esp_timer_delete(implementation->m_timer));
+
+                implementation->m_timer = nullptr;
+            }
+
+            flush();
+        }
+
+        void settings_store::flush()
+        {
+            std::lock_guard<std::mutex> lock(mp_implementation->m_mutex);
+
+            mp_implementation->flush();
+        }
+
+        settings_store::statistics settings_store::get_statistics()
+        {
+            std::lock_guard<std::mutex> lock(mp_implementation->m_mutex);
+
+            return mp_implementation->m_statistics;
+        }
+
+        void settings_store::read(size_t index, void *value)
+        {
+            std::lock_guard<std::mutex> lock(mp_implementation->m_mutex);
+
+            memcpy(value, mp_implementation->ensure_loaded(index), mp_implementation->m_descriptors[index].size);
+        }
+
+        const char *settings_store::read_text(size_t index)
+        {
+            std::lock_guard<std::mutex> lock(mp_implementation->m_mutex);
+
+            return reinterpret_cast<const char *>(mp_implementation->ensure_loaded(index));
+        }
+
+        void settings_store::write(size_t index, const void *value, size_t size)
+        {
+            std::lock_guard<std::mutex> lock(mp_implementation->m_mutex);
+
+            const auto &d = mp_implementation->m_descriptors[index];
+            uint8_t *slot = mp_implementation->ensure_loaded(index);
+
+            if (d.kind == value_kind::text)
+            {
+                if (size > d.size - 1u)
+                {
+                    ESP_LOGW(TAG, "truncating %s to %u characters", d.key, d.size - 1u);
+
+                    size = d.size - 1;
+                }
+
+                if (strlen(reinterpret_cast<const char *>(slot)) == size && !memcmp(slot, value, size))
+                {
+                    mp_implementation->m_statistics.skipped_writes++;
+
+                    return;
+                }
+
+                memcpy(slot, value, size);
+
+                slot[size] = '\0';
+            }
+            else
+            {
+                if (!memcmp(slot, value, size))
+                {
+                    mp_implementation->m_statistics.skipped_writes++;
+
+                    return;
+                }
+
+                memcpy(slot, value, size);
+            }
+
+            settings_store_implementation::assign(mp_implementation->m_dirty, index, true);
+
+            mp_implementation->schedule();
+        }
+    }
+}
@@ -0,0 +1,109 @@
+#include "hardware/settings.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace hardware
+{
+    namespace storage
+    {
+        struct memory_settings_backend_implementation
+        {
+            struct value
+            {
+                value_kind kind;
+                std::vector<uint8_t> bytes;
+            };
+
+            static size_t size_of(value_kind kind, const void *data)
+            {
+                switch (kind)
+                {
+                case value_kind::u8:
+                case value_kind::i8:
+                    return 1;
+
+                case value_kind::u16:
+                case value_kind::i16:
+                    return 2;
+
+                case value_kind::u32:
+                case value_kind::i32:
+                    return 4;
+
+                case value_kind::u64:
+                case value_kind::i64:
+                    return 8;
+
+                case value_kind::text:
+                    return strlen(static_cast<const char *>(data)) + 1;
+                }
+
+                return 0;
+            }
+
+            std::map<std::string, value> m_values;
+            memory_settings_backend::statistics m_statistics = {};
+            bool m_failing = false;
+        };
+
+        memory_settings_backend::memory_settings_backend() : mp_implementation(std::make_unique<memory_settings_backend_implementation>())
+        {
+        }
+
+        memory_settings_backend::~memory_settings_backend() = default;
+
+        bool memory_settings_backend::read(const char *key, value_kind kind, void *value, size_t size)
+        {
+            mp_implementation->m_statistics.reads++;
+
+            const auto found = mp_implementation->m_values.find(key);
+
+            if (found == mp_implementation->m_values.end() || found->second.kind != kind || found->second.bytes.size() > size)
+                return false;
+
+            memcpy(value, found->second.bytes.data(), found->second.bytes.size());
+
+            return true;
+        }
+
+        bool memory_settings_backend::write(const char *key, value_kind kind, const void *value)
+        {
+            if (mp_implementation->m_failing)
+                return false;
+
+            const auto data = static_cast<const uint8_t *>(value);
+
+            mp_implementation->m_values[key] = {kind, std::vector<uint8_t>(data, data + memory_settings_backend_implementation::size_of(kind, value))};
+            mp_implementation->m_statistics.writes++;
+
+            return true;
+        }
+
+        bool memory_settings_backend::commit()
+        {
+            if (mp_implementation->m_failing)
+                return false;
+
+            mp_implementation->m_statistics.commits++;
+
+            return true;
+        }
+
+        bool memory_settings_backend::contains(const char *key)
+        {
+            return mp_implementation->m_values.count(key) != 0;
+        }
+
+        void memory_settings_backend::set_failing(bool failing)
+        {
+            mp_implementation->m_failing = failing;
+        }
+
+        memory_settings_backend::statistics memory_settings_backend::get_statistics()
+        {
+            return mp_implementation->m_statistics;
+        }
+    }
+}
@@ -0,0 +1,137 @@
+#include "hardware/settings.h"
+
+#include <esp_log.h>
+#include <nvs.h>
+
+namespace hardware
+{
+    namespace storage
+    {
+        constexpr const char *TAG = "settings";
+
+        class nvs_settings_backend : public settings_backend
+        {
+        public:
+            explicit nvs_settings_backend(const char *name_space)
+            {
+                ESP_ERROR_CHECK(nvs_open(name_space, NVS_READWRITE, &m_nvs_handle));
+            }
+
+            ~nvs_settings_backend() override
+            {
+                nvs_close(m_nvs_handle);
+            }
+
+            bool read(const char *key, value_kind kind, void *value, size_t size) override
+            {
+                esp_err_t error = ESP_OK;
+
+                switch (kind)
+                {
+                case value_kind::u8:
+                    error = nvs_get_u8(m_nvs_handle, key, static_cast<uint8_t *>(value));
+                    break;
+
+                case value_kind::i8:
+                    error = nvs_get_i8(m_nvs_handle, key, static_cast<int8_t *>(value));
+                    break;
+
+                case value_kind::u16:
+                    error = nvs_get_u16(m_nvs_handle, key, static_cast<uint16_t *>(value));
+                    break;
+
+                case value_kind::i16:
+                    error = nvs_get_i16(m_nvs_handle, key, static_cast<int16_t *>(value));
+                    break;
+
+                case value_kind::u32:
+                    error = nvs_get_u32(m_nvs_handle, key, static_cast<uint32_t *>(value));
+                    break;
+
+                case value_kind::i32:
+                    error = nvs_get_i32(m_nvs_handle, key, static_cast<int32_t *>(value));
+                    break;
+
+                case value_kind::u64:
+                    error = nvs_get_u64(m_nvs_handle, key, static_cast<uint64_t *>(value));
+                    break;
+
+                case value_kind::i64:
+                    error = nvs_get_i64(m_nvs_handle, key, static_cast<int64_t *>(value));
+                    break;
+
+                case value_kind::text:
+                    error = nvs_get_str(m_nvs_handle, key, static_cast<char *>(value), &size);
+                    break;
+                }
+
+                if (error != ESP_OK && error != ESP_ERR_NVS_NOT_FOUND)
+                    ESP_LOGW(TAG, "ignoring stored value of %s: %s", key, esp_err_to_name(error));
+
+                return error == ESP_OK;
+            }
+
+            bool write(const char *key, value_kind kind, const void *value) override
+            {
+                esp_err_t error = ESP_OK;
+
+                switch (kind)
+                {
+                case value_kind::u8:
+                    error = nvs_set_u8(m_nvs_handle, key, *static_cast<const uint8_t *>(value));
+                    break;
+
+                case value_kind::i8:
+                    error = nvs_set_i8(m_nvs_handle, key, *static_cast<const int8_t *>(value));
+                    break;
+
+                case value_kind::u16:
+                    error = nvs_set_u16(m_nvs_handle, key, *static_cast<const uint16_t *>(value));
+                    break;
+
+                case value_kind::i16:
+                    error = nvs_set_i16(m_nvs_handle, key, *static_cast<const int16_t *>(value));
+                    break;
+
+                case value_kind::u32:
+                    error = nvs_set_u32(m_nvs_handle, key, *static_cast<const uint32_t *>(value));
+                    break;
+
+                case value_kind::i32:
+                    error = nvs_set_i32(m_nvs_handle, key, *static_cast<const int32_t *>(value));
+                    break;
+
+                case value_kind::u64:
+                    error = nvs_set_u64(m_nvs_handle, key, *static_cast<const uint64_t *>(value));
+                    break;
+
+                case value_kind::i64:
+                    error = nvs_set_i64(m_nvs_handle, key, *static_cast<const int64_t *>(value));
+                    break;
+
+                case value_kind::text:
+                    error = nvs_set_str(m_nvs_handle, key, static_cast<const char *>(value));
+                    break;
+                }
+
+                if (error != ESP_OK)
+                    ESP_LOGE(TAG, "failed to write %s: %s", key, esp_err_to_name(error));
+
+                return error == ESP_OK;
+            }
+
+            bool commit() override
+            {
+                return nvs_commit(m_nvs_handle) == ESP_OK;
+            }
+
+        private:
+            nvs_handle_t m_nvs_handle = 0;
+        };
+
+        std::unique_ptr<settings_backend> make_nvs_settings_backend(const char *name_space)
+        {
+            return std::make_unique<nvs_settings_backend>(name_space);
+        }
+    }
+}
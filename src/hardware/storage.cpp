@@ -1,63 +1,356 @@
 #include "hardware/storage.h"
 
+#include "hardware/journal.h"
+#include "hardware/ring_log.h"
+#include "hardware/trace.h"
+#include "encryption_key.h"
+
+#include <cinttypes>
 #include <map>
+#include <mutex>
 #include <string>
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include <esp_littlefs.h>
+#include <esp_log.h>
+#include <esp_timer.h>
 #include <nvs_flash.h>
+#include <sdkconfig.h>
 
 namespace hardware
 {
     namespace storage
     {
+        constexpr const char *TAG = "storage";
         constexpr const char *PARTITION_LABEL = "storage";
+        constexpr uint32_t MOUNT_TASK_STACK_SIZE = 4096;
 
-        void mount(const type storage_type)
+#if CONFIG_NVS_ENCRYPTION
+        static esp_err_t read_nvs_keys(nvs_sec_cfg_t &config)
         {
-            if (storage_type != type::nvs)
-                return;
+            nvs_sec_scheme_t *scheme = nvs_flash_get_default_security_scheme();
+
+            if (!scheme)
+            {
+                ESP_LOGE(TAG, "no NVS encryption scheme registered");
+
+                return ESP_ERR_NOT_SUPPORTED;
+            }
+
+            return nvs_flash_read_security_cfg_v2(scheme, &config);
+        }
+#endif
+
+        bool provision_encryption_key()
+        {
+#if CONFIG_NVS_ENCRYPTION
+            nvs_sec_cfg_t config = {};
+            esp_err_t err = read_nvs_keys(config);
+
+            if (err == ESP_ERR_NVS_SEC_HMAC_KEY_NOT_FOUND)
+            {
+                ESP_LOGW(TAG, "burning the storage encryption key into eFuse");
+
+                err = nvs_flash_generate_keys_v2(nvs_flash_get_default_security_scheme(), &config);
+            }
+
+            if (err != ESP_OK)
+                ESP_LOGE(TAG, "no storage encryption key: %s", esp_err_to_name(err));
+
+            return err == ESP_OK;
+#else
+            ESP_LOGE(TAG, "built without CONFIG_NVS_ENCRYPTION");
 
-            esp_err_t err = nvs_flash_init();
+            return false;
+#endif
+        }
+
+        static esp_err_t init_nvs(bool encrypted)
+        {
+            if (!encrypted)
+                return nvs_flash_init_partition(NVS_DEFAULT_PART_NAME);
+
+#if CONFIG_NVS_ENCRYPTION
+            nvs_sec_cfg_t config = {};
+            const esp_err_t err = read_nvs_keys(config);
+
+            // The eFuse key is never burned as a side effect of mounting, see provision_encryption_key().
+            if (err == ESP_ERR_NVS_SEC_HMAC_KEY_NOT_FOUND)
+                ESP_LOGE(TAG, "storage encryption key not provisioned");
+
+            if (err != ESP_OK)
+                return err;
+
+            return nvs_flash_secure_init_partition(NVS_DEFAULT_PART_NAME, &config);
+#else
+            ESP_LOGE(TAG, "built without CONFIG_NVS_ENCRYPTION");
+
+            return ESP_ERR_NOT_SUPPORTED;
+#endif
+        }
+
+        static esp_err_t mount_nvs(bool encrypted)
+        {
+            HARDWARE_TRACE_SCOPE(STORAGE_MOUNT, static_cast<uint16_t>(type::nvs));
+
+            esp_err_t err = init_nvs(encrypted);
 
             if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND)
             {
-                ESP_ERROR_CHECK(nvs_flash_erase());
+                ESP_ERROR_CHECK(nvs_flash_erase_partition(NVS_DEFAULT_PART_NAME));
 
-                err = nvs_flash_init();
+                err = init_nvs(encrypted);
             }
 
-            ESP_ERROR_CHECK(err);
+            return err;
         }
 
-        void mount(const type storage_type, const char *mount_point)
+        void mount(const type storage_type)
         {
-            if (storage_type != type::internal || esp_littlefs_mounted(PARTITION_LABEL))
+            if (storage_type == type::log)
+            {
+                if (!ring_log::get().is_valid())
+                    ESP_LOGE(TAG, "ring log unavailable");
+
+                return;
+            }
+
+            if (storage_type == type::journal)
+            {
+                if (!journal::get().is_valid())
+                    ESP_LOGE(TAG, "journal unavailable");
+
                 return;
+            }
+
+            if (storage_type == type::nvs)
+                ESP_ERROR_CHECK(mount_nvs(false));
+        }
+
+        struct mount_job
+        {
+            std::string mount_point;
+            mount_options options;
+            std::promise<bool> result;
+        };
+
+        static std::mutex s_mutex;
+        static std::shared_future<bool> s_internal_mounted;
+
+        static esp_err_t register_littlefs(const char *mount_point, const mount_options &options)
+        {
+            if (esp_littlefs_mounted(PARTITION_LABEL))
+                return ESP_OK;
 
             const esp_vfs_littlefs_conf_t littlefs_config = {
                 .base_path = mount_point,
                 .partition_label = PARTITION_LABEL,
                 .partition = nullptr,
-                .format_if_mount_failed = true,
-                .read_only = false,
+                .format_if_mount_failed = options.format_if_failed,
+                .read_only = options.read_only,
                 .dont_mount = false,
-                .grow_on_mount = true,
+                .grow_on_mount = options.grow,
+            };
+
+            const int64_t start = esp_timer_get_time();
+            const esp_err_t error = esp_vfs_littlefs_register(&littlefs_config);
+
+            if (error == ESP_OK)
+                ESP_LOGI(TAG, "mounted %s in %" PRId64 "ms", mount_point, (esp_timer_get_time() - start) / 1000);
+            else
+                ESP_LOGE(TAG, "failed to mount %s: %s", mount_point, esp_err_to_name(error));
+
+            return error;
+        }
+
+        static bool mount_internal(const char *mount_point, const mount_options &options)
+        {
+            HARDWARE_TRACE_SCOPE(STORAGE_MOUNT, static_cast<uint16_t>(type::internal));
+
+            if (options.encrypted && !load_file_key())
+                return false;
+
+            return register_littlefs(mount_point, options) == ESP_OK;
+        }
+
+        static void mount_task(void *arg)
+        {
+            auto job = static_cast<mount_job *>(arg);
+
+            job->result.set_value(mount_internal(job->mount_point.c_str(), job->options));
+
+            delete job;
+
+            vTaskDelete(nullptr);
+        }
+
+        void mount(const type storage_type, const char *mount_point)
+        {
+            const mount_options options = {
+                .format_if_failed = true,
+                .grow = true,
             };
 
-            ESP_ERROR_CHECK(esp_vfs_littlefs_register(&littlefs_config));
+            ESP_ERROR_CHECK(mount(storage_type, mount_point, options).get() ? ESP_OK : ESP_FAIL);
+        }
+
+        std::shared_future<bool> mount(const type storage_type, const char *mount_point, const mount_options &options)
+        {
+            std::promise<bool> result;
+
+            if (storage_type == type::nvs)
+            {
+                const esp_err_t err = mount_nvs(options.encrypted);
+
+                if (err != ESP_OK)
+                    ESP_LOGE(TAG, "failed to mount NVS: %s", esp_err_to_name(err));
+
+                result.set_value(err == ESP_OK);
+
+                return result.get_future().share();
+            }
+
+            if (storage_type != type::internal)
+            {
+                mount(storage_type);
+
+                result.set_value(true);
+
+                return result.get_future().share();
+            }
+
+            std::lock_guard<std::mutex> lock(s_mutex);
+
+            // A mount that failed is forgotten, so it can be retried, e.g. with format_if_failed.
+            if (s_internal_mounted.valid())
+            {
+                if (s_internal_mounted.wait_for(std::chrono::seconds(0)) != std::future_status::ready || s_internal_mounted.get())
+                    return s_internal_mounted;
+
+                s_internal_mounted = {};
+            }
+
+            if (!options.deferred)
+            {
+                result.set_value(mount_internal(mount_point, options));
+
+                s_internal_mounted = result.get_future().share();
+
+                return s_internal_mounted;
+            }
+
+            auto job = new mount_job{mount_point, options, std::move(result)};
+
+            s_internal_mounted = job->result.get_future().share();
+
+            if (xTaskCreate(mount_task, "storage_mount", MOUNT_TASK_STACK_SIZE, job, tskIDLE_PRIORITY + 1, nullptr) != pdPASS)
+            {
+                job->result.set_value(false);
+
+                delete job;
+            }
+
+            return s_internal_mounted;
         }
 
         void unmount(const type storage_type)
         {
             if (storage_type == type::nvs)
                 ESP_ERROR_CHECK(nvs_flash_deinit());
+            else if (storage_type == type::log)
+                ring_log::get().flush();
+            else if (storage_type == type::journal)
+                journal::get().commit();
             else if (storage_type == type::internal)
             {
+                std::lock_guard<std::mutex> lock(s_mutex);
+
+                if (s_internal_mounted.valid())
+                    s_internal_mounted.wait();
+
+                s_internal_mounted = {};
+
                 if (!esp_littlefs_mounted(PARTITION_LABEL))
                     return;
 
                 ESP_ERROR_CHECK(esp_vfs_littlefs_unregister(PARTITION_LABEL));
             }
         }
+
+        bool ready(const type storage_type)
+        {
+            return wait(storage_type, 0);
+        }
+
+        bool wait(const type storage_type, uint32_t timeout_ms)
+        {
+            if (storage_type != type::internal)
+                return true;
+
+            std::shared_future<bool> mounted;
+
+            {
+                std::lock_guard<std::mutex> lock(s_mutex);
+
+                mounted = s_internal_mounted;
+            }
+
+            if (!mounted.valid())
+                return esp_littlefs_mounted(PARTITION_LABEL);
+
+            if (timeout_ms == UINT32_MAX)
+                mounted.wait();
+            else if (mounted.wait_for(std::chrono::milliseconds(timeout_ms)) != std::future_status::ready)
+                return false;
+
+            return mounted.get();
+        }
+
+        bool usage(const type storage_type, size_t &total_bytes, size_t &used_bytes)
+        {
+            if (storage_type == type::internal)
+                return esp_littlefs_info(PARTITION_LABEL, &total_bytes, &used_bytes) == ESP_OK;
+
+            if (storage_type == type::log)
+            {
+                ring_log &log = ring_log::get();
+
+                if (!log.is_valid())
+                    return false;
+
+                const auto statistics = log.get_statistics();
+
+                total_bytes = static_cast<size_t>(statistics.sectors) * statistics.sector_size;
+                used_bytes = static_cast<size_t>(statistics.used_sectors) * statistics.sector_size;
+
+                return true;
+            }
+
+            if (storage_type == type::journal)
+            {
+                journal &store = journal::get();
+
+                if (!store.is_valid())
+                    return false;
+
+                const auto statistics = store.get_statistics();
+
+                total_bytes = statistics.log_size;
+                used_bytes = statistics.log_used;
+
+                return true;
+            }
+
+            nvs_stats_t stats;
+
+            if (nvs_get_stats(nullptr, &stats) != ESP_OK)
+                return false;
+
+            total_bytes = stats.total_entries * 32;
+            used_bytes = stats.used_entries * 32;
+
+            return true;
+        }
     }
 }
\ No newline at end of file
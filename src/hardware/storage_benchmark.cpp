@@ -0,0 +1,518 @@
+#include "hardware/storage_benchmark.h"
+
+#include "hardware/encryption.h"
+#include "hardware/storage.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <nvs.h>
+
+namespace hardware
+{
+    namespace storage
+    {
+        namespace benchmark
+        {
+            constexpr const char *TAG = "storage_benchmark";
+            constexpr const char *NVS_NAMESPACE = "bench";
+            constexpr size_t FILL_FILE_SIZE = 64 * 1024;
+            constexpr size_t PATH_LENGTH = 64;
+
+            // xorshift32, deterministic so runs stay comparable between builds.
+            class xorshift
+            {
+            public:
+                explicit xorshift(uint32_t seed) : m_state(seed ? seed : 1)
+                {
+                }
+
+                uint32_t next()
+                {
+                    m_state ^= m_state << 13;
+                    m_state ^= m_state >> 17;
+                    m_state ^= m_state << 5;
+
+                    return m_state;
+                }
+
+            private:
+                uint32_t m_state;
+            };
+
+            void latency::add(uint32_t sample_us)
+            {
+                min_us = count ? std::min(min_us, sample_us) : sample_us;
+                max_us = std::max(max_us, sample_us);
+                total_us += sample_us;
+                count++;
+            }
+
+            static uint32_t elapsed_since(int64_t start)
+            {
+                return static_cast<uint32_t>(esp_timer_get_time() - start);
+            }
+
+            // Returns false after logging, the caller stops the loop it is in.
+            static bool write_block(int fd, const uint8_t *buffer, size_t size, const char *path, uint32_t &bytes)
+            {
+                const ssize_t written = write(fd, buffer, size);
+
+                if (written < 0 || static_cast<size_t>(written) != size)
+                {
+                    ESP_LOGE(TAG, "write to %s failed after %" PRIu32 " bytes", path, bytes);
+
+                    return false;
+                }
+
+                bytes += written;
+
+                return true;
+            }
+
+            static void fill(const options &opts, uint8_t *buffer)
+            {
+                size_t total = 0, used = 0;
+
+                if (!opts.fill_percent || !usage(type::internal, total, used))
+                    return;
+
+                char path[PATH_LENGTH];
+
+                snprintf(path, sizeof(path), "%s/bench_fill", opts.mount_point);
+                mkdir(path, 0755);
+
+                const size_t target = total * std::min<uint8_t>(opts.fill_percent, 95) / 100;
+
+                for (uint32_t index = 0; used + FILL_FILE_SIZE <= target; index++)
+                {
+                    snprintf(path, sizeof(path), "%s/bench_fill/%04" PRIu32, opts.mount_point, index);
+
+                    struct stat info;
+
+                    if (!stat(path, &info))
+                        continue;
+
+                    const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+                    if (fd < 0)
+                        break;
+
+                    uint32_t bytes = 0;
+
+                    while (bytes < FILL_FILE_SIZE && write_block(fd, buffer, std::min(opts.block_size, FILL_FILE_SIZE - bytes), path, bytes))
+                        ;
+
+                    close(fd);
+
+                    // A short filler would be skipped as existing by the next sweep.
+                    if (bytes < FILL_FILE_SIZE)
+                    {
+                        unlink(path);
+
+                        break;
+                    }
+
+                    if (!usage(type::internal, total, used))
+                        break;
+                }
+            }
+
+            static bool measure_mount(const options &opts, results &result)
+            {
+                unmount(type::internal);
+
+                const int64_t start = esp_timer_get_time();
+                const bool mounted = mount(type::internal, opts.mount_point, opts.mount).get();
+
+                result.mount_us = elapsed_since(start);
+
+                return mounted;
+            }
+
+            static void measure_sequential(const options &opts, uint8_t *buffer, results &result)
+            {
+                char path[PATH_LENGTH];
+
+                snprintf(path, sizeof(path), "%s/bench_seq", opts.mount_point);
+
+                int64_t start = esp_timer_get_time();
+                int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+                if (fd < 0)
+                {
+                    ESP_LOGE(TAG, "failed to create %s", path);
+
+                    return;
+                }
+
+                auto &written = result.sequential_write.bytes;
+
+                while (written < opts.file_size && write_block(fd, buffer, std::min(opts.block_size, opts.file_size - written), path, written))
+                    ;
+
+                if (fsync(fd))
+                    ESP_LOGE(TAG, "fsync of %s failed", path);
+
+                close(fd);
+
+                result.sequential_write.elapsed_us = elapsed_since(start);
+
+                start = esp_timer_get_time();
+                fd = open(path, O_RDONLY);
+
+                // Reads back what was written, not whatever else the file may hold.
+                for (ssize_t count = 1; fd >= 0 && count > 0 && result.sequential_read.bytes < written;)
+                {
+                    count = read(fd, buffer, std::min<size_t>(opts.block_size, written - result.sequential_read.bytes));
+
+                    if (count > 0)
+                        result.sequential_read.bytes += count;
+                    else if (count < 0)
+                        ESP_LOGE(TAG, "read from %s failed", path);
+                }
+
+                if (fd >= 0)
+                    close(fd);
+
+                result.sequential_read.elapsed_us = elapsed_since(start);
+            }
+
+            static void measure_encrypted(const options &opts, uint8_t *buffer, results &result)
+            {
+                // A fixed key keeps the numbers independent of how the storage was mounted.
+                static constexpr uint8_t KEY[ENCRYPTION_KEY_SIZE] = {0x42};
+
+                char path[PATH_LENGTH];
+
+                snprintf(path, sizeof(path), "%s/bench_enc", opts.mount_point);
+
+                int64_t start = esp_timer_get_time();
+
+                {
+                    encrypted_file file(path, encrypted_file::mode::write, KEY);
+
+                    for (size_t done = 0; file.is_open() && done < opts.file_size; done += opts.block_size)
+                    {
+                        const size_t size = std::min(opts.block_size, opts.file_size - done);
+                        const size_t written = file.write(done, buffer, size);
+
+                        result.encrypted_write.bytes += written;
+
+                        if (written != size)
+                        {
+                            ESP_LOGE(TAG, "encrypted write to %s failed", path);
+
+                            break;
+                        }
+                    }
+
+                    if (!file.close())
+                        ESP_LOGE(TAG, "closing %s failed", path);
+                }
+
+                result.encrypted_write.elapsed_us = elapsed_since(start);
+
+                start = esp_timer_get_time();
+
+                {
+                    encrypted_file file(path, encrypted_file::mode::read, KEY);
+
+                    for (size_t count = 1; file.is_open() && count;)
+                    {
+                        count = file.read(result.encrypted_read.bytes, buffer, opts.block_size);
+
+                        result.encrypted_read.bytes += count;
+                    }
+                }
+
+                result.encrypted_read.elapsed_us = elapsed_since(start);
+
+                unlink(path);
+            }
+
+            static void measure_random(const options &opts, uint8_t *buffer, results &result)
+            {
+                char path[PATH_LENGTH];
+
+                snprintf(path, sizeof(path), "%s/bench_seq", opts.mount_point);
+
+                const size_t blocks = opts.file_size / opts.block_size;
+
+                if (!blocks)
+                    return;
+
+                xorshift generator(opts.seed);
+
+                int64_t start = esp_timer_get_time();
+                int fd = open(path, O_WRONLY);
+
+                for (size_t i = 0; fd >= 0 && i < blocks; i++)
+                {
+                    if (lseek(fd, (generator.next() % blocks) * opts.block_size, SEEK_SET) < 0 ||
+                        !write_block(fd, buffer, opts.block_size, path, result.random_write.bytes))
+                        break;
+                }
+
+                if (fd >= 0)
+                {
+                    if (fsync(fd))
+                        ESP_LOGE(TAG, "fsync of %s failed", path);
+
+                    close(fd);
+                }
+
+                result.random_write.elapsed_us = elapsed_since(start);
+
+                start = esp_timer_get_time();
+                fd = open(path, O_RDONLY);
+
+                for (size_t i = 0; fd >= 0 && i < blocks; i++)
+                {
+                    if (lseek(fd, (generator.next() % blocks) * opts.block_size, SEEK_SET) < 0)
+                        break;
+
+                    const ssize_t count = read(fd, buffer, opts.block_size);
+
+                    if (count > 0)
+                        result.random_read.bytes += count;
+                }
+
+                if (fd >= 0)
+                    close(fd);
+
+                result.random_read.elapsed_us = elapsed_since(start);
+
+                unlink(path);
+            }
+
+            static void measure_small_files(const options &opts, uint8_t *buffer, results &result)
+            {
+                char path[PATH_LENGTH];
+
+                for (size_t i = 0; i < opts.small_files; i++)
+                {
+                    snprintf(path, sizeof(path), "%s/bench_%03u", opts.mount_point, static_cast<unsigned>(i));
+
+                    const int64_t start = esp_timer_get_time();
+                    const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+                    if (fd < 0)
+                        continue;
+
+                    uint32_t bytes = 0;
+                    const bool written = write_block(fd, buffer, opts.small_file_size, path, bytes);
+
+                    if (close(fd) || !written)
+                        continue;
+
+                    result.file_create.add(elapsed_since(start));
+                }
+
+                for (size_t i = 0; i < opts.small_files; i++)
+                {
+                    snprintf(path, sizeof(path), "%s/bench_%03u", opts.mount_point, static_cast<unsigned>(i));
+
+                    const int64_t start = esp_timer_get_time();
+
+                    if (!unlink(path))
+                        result.file_delete.add(elapsed_since(start));
+                }
+            }
+
+            static void measure_fsync(const options &opts, uint8_t *buffer, results &result)
+            {
+                char path[PATH_LENGTH];
+
+                snprintf(path, sizeof(path), "%s/bench_sync", opts.mount_point);
+
+                const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+                if (fd < 0)
+                    return;
+
+                uint32_t bytes = 0;
+
+                for (size_t i = 0; i < opts.fsync_iterations; i++)
+                {
+                    if (!write_block(fd, buffer, opts.small_file_size, path, bytes))
+                        break;
+
+                    const int64_t start = esp_timer_get_time();
+
+                    if (fsync(fd))
+                    {
+                        ESP_LOGE(TAG, "fsync of %s failed", path);
+
+                        break;
+                    }
+
+                    result.fsync.add(elapsed_since(start));
+                }
+
+                close(fd);
+                unlink(path);
+            }
+
+            static void measure_nvs(const options &opts, results &result)
+            {
+                nvs_handle_t handle;
+
+                if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+                {
+                    ESP_LOGE(TAG, "failed to open NVS namespace %s", NVS_NAMESPACE);
+
+                    return;
+                }
+
+                char key[16];
+
+                for (size_t i = 0; i < opts.nvs_entries; i++)
+                {
+                    snprintf(key, sizeof(key), "k%04u", static_cast<unsigned>(i));
+
+                    const int64_t start = esp_timer_get_time();
+
+                    if (nvs_set_u32(handle, key, i) != ESP_OK || nvs_commit(handle) != ESP_OK)
+                        break;
+
+                    result.nvs_set[i * NVS_FILL_STAGES / opts.nvs_entries].add(elapsed_since(start));
+                }
+
+                for (size_t i = 0; i < opts.nvs_entries; i++)
+                {
+                    snprintf(key, sizeof(key), "k%04u", static_cast<unsigned>(i));
+
+                    uint32_t value;
+
+                    const int64_t start = esp_timer_get_time();
+
+                    if (nvs_get_u32(handle, key, &value) == ESP_OK)
+                        result.nvs_get.add(elapsed_since(start));
+                }
+
+                nvs_erase_all(handle);
+                nvs_commit(handle);
+                nvs_close(handle);
+            }
+
+            results run(const options &opts)
+            {
+                results result = {};
+
+                const size_t buffer_size = std::max(opts.block_size, opts.small_file_size);
+                auto buffer = std::make_unique<uint8_t[]>(buffer_size);
+
+                xorshift generator(opts.seed);
+
+                for (size_t i = 0; i < buffer_size; i++)
+                    buffer[i] = generator.next();
+
+                if (!mount(type::internal, opts.mount_point, opts.mount).get())
+                {
+                    ESP_LOGE(TAG, "failed to mount %s", opts.mount_point);
+
+                    return result;
+                }
+
+                fill(opts, buffer.get());
+
+                size_t total = 0, used = 0;
+
+                if (usage(type::internal, total, used) && total)
+                    result.fill_percent = used * 100 / total;
+
+                if (!measure_mount(opts, result))
+                {
+                    ESP_LOGE(TAG, "failed to remount %s", opts.mount_point);
+
+                    return result;
+                }
+
+                measure_sequential(opts, buffer.get(), result);
+                measure_random(opts, buffer.get(), result);
+                measure_encrypted(opts, buffer.get(), result);
+                measure_small_files(opts, buffer.get(), result);
+                measure_fsync(opts, buffer.get(), result);
+                measure_nvs(opts, result);
+
+                return result;
+            }
+
+            void remove(const options &opts)
+            {
+                char path[PATH_LENGTH];
+
+                wait(type::internal);
+
+                for (uint32_t index = 0;; index++)
+                {
+                    snprintf(path, sizeof(path), "%s/bench_fill/%04" PRIu32, opts.mount_point, index);
+
+                    if (unlink(path))
+                        break;
+                }
+
+                snprintf(path, sizeof(path), "%s/bench_fill", opts.mount_point);
+                rmdir(path);
+            }
+
+            static void print_latency(const char *name, const latency &value)
+            {
+                ESP_LOGI(TAG, "%-14s n=%" PRIu32 " min=%" PRIu32 "us avg=%" PRIu32 "us max=%" PRIu32 "us",
+                         name, value.count, value.min_us, value.average_us(), value.max_us);
+            }
+
+            static void print_throughput(const char *name, const throughput &value)
+            {
+                ESP_LOGI(TAG, "%-14s %" PRIu32 " bytes in %" PRIu32 "us, %" PRIu32 " KiB/s",
+                         name, value.bytes, value.elapsed_us, value.kib_per_second());
+            }
+
+            void print(const results &result)
+            {
+                ESP_LOGI(TAG, "fill %u%%, mount %" PRIu32 "us", result.fill_percent, result.mount_us);
+
+                print_throughput("seq write", result.sequential_write);
+                print_throughput("seq read", result.sequential_read);
+                print_throughput("random write", result.random_write);
+                print_throughput("random read", result.random_read);
+                print_throughput("enc write", result.encrypted_write);
+                print_throughput("enc read", result.encrypted_read);
+
+                print_latency("file create", result.file_create);
+                print_latency("file delete", result.file_delete);
+                print_latency("fsync", result.fsync);
+
+                for (size_t i = 0; i < NVS_FILL_STAGES; i++)
+                {
+                    char name[16];
+
+                    snprintf(name, sizeof(name), "nvs set %u/%u", static_cast<unsigned>(i + 1), static_cast<unsigned>(NVS_FILL_STAGES));
+
+                    print_latency(name, result.nvs_set[i]);
+                }
+
+                print_latency("nvs get", result.nvs_get);
+
+                // One machine readable line per run for collecting regressions across builds.
+                printf("storage_benchmark,%u,%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 "\n",
+                       result.fill_percent, result.mount_us,
+                       result.sequential_write.kib_per_second(), result.sequential_read.kib_per_second(),
+                       result.random_write.kib_per_second(), result.random_read.kib_per_second(),
+                       result.file_create.average_us(), result.file_delete.average_us(), result.fsync.average_us(),
+                       result.nvs_set[NVS_FILL_STAGES - 1].average_us(), result.nvs_get.average_us(),
+                       result.encrypted_write.kib_per_second(), result.encrypted_read.kib_per_second());
+            }
+        }
+    }
+}
@@ -0,0 +1,259 @@
+#include "hardware/trace.h"
+
+#include <esp_log.h>
+
+#if CONFIG_HARDWARE_TRACE
+#include "hardware/storage.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iterator>
+
+#include <freertos/FreeRTOS.h>
+#include <esp_attr.h>
+#include <esp_cpu.h>
+#include <esp_ipc.h>
+#include <esp_rom_sys.h>
+#include <esp_timer.h>
+#endif
+
+namespace hardware
+{
+    namespace trace
+    {
+        constexpr const char *TAG = "trace";
+
+#if CONFIG_HARDWARE_TRACE
+        constexpr size_t CAPACITY = CONFIG_HARDWARE_TRACE_EVENTS;
+        constexpr uint32_t MAGIC = 0x52545748; // "HWTR"
+        constexpr uint16_t VERSION = 1;
+
+        static_assert(CAPACITY && !(CAPACITY & (CAPACITY - 1)), "CONFIG_HARDWARE_TRACE_EVENTS must be a power of two");
+
+        constexpr const char *EVENT_NAMES[] = {
+            "display.set_bitmap",
+            "display.transfer_done",
+            "button.tick",
+            "button.key",
+            "graphics.timer_handler",
+            "graphics.flush_wait",
+            "graphics.blend_split",
+            "graphics.blend_helper",
+            "wifi.event",
+            "wifi.ip_event",
+            "wifi.poll",
+            "wifi.reconfigure",
+            "espnow.receive",
+            "espnow.transmit",
+            "espnow.poll",
+            "battery.read",
+            "writer.flush",
+            "journal.commit",
+            "settings.flush",
+            "storage.mount",
+            "ring_log.append",
+            "ring_log.flush",
+            "compression.compress",
+            "compression.decompress",
+            "encryption.store",
+            "encryption.load",
+            "scheduler.job",
+            "scheduler.poll",
+            "assets.find",
+            "assets.open",
+            "ota.fetch",
+            "ota.write",
+            "provisioning.dns",
+            "provisioning.scan",
+            "provisioning.connect",
+        };
+
+        static_assert(std::size(EVENT_NAMES) == static_cast<size_t>(event::COUNT), "every event needs a name");
+
+        // The dump layout, all little endian, read by tools/trace_decode.py.
+        struct file_header
+        {
+            uint32_t magic;
+            uint16_t version;
+            uint8_t cores;
+            uint8_t events;
+            uint32_t cycles_per_us;
+            uint32_t capacity;
+        };
+
+        struct core_header
+        {
+            uint32_t anchor_cycles;
+            // Events claimed since the last clear(), anything beyond the capacity was overwritten.
+            uint32_t recorded;
+            int64_t anchor_us;
+        };
+
+        struct entry
+        {
+            uint32_t cycles;
+            event id;
+            phase kind;
+            uint16_t arg;
+        };
+
+        static_assert(sizeof(file_header) == 16 && sizeof(core_header) == 16 && sizeof(entry) == 8, "the decoder expects packed records");
+
+        struct ring
+        {
+            std::atomic<uint32_t> head;
+            entry entries[CAPACITY];
+        };
+
+        static DRAM_ATTR ring s_rings[portNUM_PROCESSORS] = {};
+        static DRAM_ATTR std::atomic<bool> s_enabled = true;
+
+        // A task moved to the other core between the two reads only lands in the other ring.
+        void IRAM_ATTR record(event id, phase kind, uint16_t arg)
+        {
+            if (!s_enabled.load(std::memory_order_relaxed))
+                return;
+
+            ring &target = s_rings[esp_cpu_get_core_id()];
+            const uint32_t slot = target.head.fetch_add(1, std::memory_order_relaxed) & (CAPACITY - 1);
+
+            target.entries[slot] = {esp_cpu_get_cycle_count(), id, kind, arg};
+        }
+
+        void set_enabled(bool enabled)
+        {
+            s_enabled = enabled;
+        }
+
+        void clear()
+        {
+            const bool enabled = s_enabled.exchange(false);
+
+            for (auto &target : s_rings)
+                target.head = 0;
+
+            s_enabled = enabled;
+        }
+
+        // Runs on the core being sampled, the cycle counters of the cores are not in step.
+        static void sample_anchor(void *arg)
+        {
+            auto anchor = static_cast<core_header *>(arg);
+
+            anchor->anchor_us = esp_timer_get_time();
+            anchor->anchor_cycles = esp_cpu_get_cycle_count();
+        }
+
+        size_t write(FILE *output)
+        {
+            const bool enabled = s_enabled.exchange(false);
+
+            // Lets records that were already past the enabled check land.
+            esp_rom_delay_us(1);
+
+            const file_header header = {
+                .magic = MAGIC,
+                .version = VERSION,
+                .cores = portNUM_PROCESSORS,
+                .events = static_cast<uint8_t>(event::COUNT),
+                .cycles_per_us = esp_rom_get_cpu_ticks_per_us(),
+                .capacity = CAPACITY,
+            };
+
+            fwrite(&header, sizeof(header), 1, output);
+
+            for (const char *name : EVENT_NAMES)
+            {
+                const uint8_t length = strlen(name);
+
+                fwrite(&length, 1, 1, output);
+                fwrite(name, 1, length, output);
+            }
+
+            size_t written = 0;
+
+            for (int core = 0; core < portNUM_PROCESSORS; core++)
+            {
+                const ring &source = s_rings[core];
+                core_header anchor = {};
+
+#if CONFIG_FREERTOS_UNICORE
+                sample_anchor(&anchor);
+#else
+                if (esp_ipc_call_blocking(core, sample_anchor, &anchor) != ESP_OK)
+                    sample_anchor(&anchor);
+#endif
+
+                anchor.recorded = source.head.load(std::memory_order_acquire);
+
+                const uint32_t count = std::min<uint32_t>(anchor.recorded, CAPACITY);
+                const uint32_t first = (anchor.recorded - count) & (CAPACITY - 1);
+                const uint32_t before_wrap = std::min<uint32_t>(count, CAPACITY - first);
+
+                fwrite(&anchor, sizeof(anchor), 1, output);
+                fwrite(&source.entries[first], sizeof(entry), before_wrap, output);
+                fwrite(&source.entries[0], sizeof(entry), count - before_wrap, output);
+
+                written += count;
+            }
+
+            s_enabled = enabled;
+
+            return written;
+        }
+
+        bool save(const char *path)
+        {
+            storage::wait(storage::type::internal);
+
+            FILE *output = fopen(path, "wb");
+
+            if (!output)
+            {
+                ESP_LOGE(TAG, "failed to open %s", path);
+
+                return false;
+            }
+
+            const size_t written = write(output);
+            const bool success = !ferror(output);
+
+            fclose(output);
+
+            if (success)
+                ESP_LOGI(TAG, "wrote %u events to %s", static_cast<unsigned>(written), path);
+            else
+                ESP_LOGE(TAG, "failed to write %s", path);
+
+            return success;
+        }
+#else
+        void record(event id, phase kind, uint16_t arg)
+        {
+        }
+
+        void set_enabled(bool enabled)
+        {
+        }
+
+        void clear()
+        {
+        }
+
+        size_t write(FILE *output)
+        {
+            ESP_LOGW(TAG, "enable CONFIG_HARDWARE_TRACE to record traces");
+
+            return 0;
+        }
+
+        bool save(const char *path)
+        {
+            ESP_LOGW(TAG, "enable CONFIG_HARDWARE_TRACE to record traces");
+
+            return false;
+        }
+#endif
+    }
+}
@@ -1,12 +1,18 @@
 #include "hardware/wifi.h"
+#include "hardware/settings.h"
+#include "hardware/trace.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstring>
+#include <mutex>
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include <esp_log.h>
 #include <esp_err.h>
 #include <esp_wifi.h>
 #include <esp_mac.h>
-#include <nvs_flash.h>
 
 namespace hardware
 {
@@ -15,142 +21,240 @@ namespace hardware
     constexpr const char *AP_DEFAULT_PASS = "0123456789";
     constexpr uint8_t AP_CHAN = 1;
     constexpr uint8_t AP_MAX_CONN = 3;
+    constexpr uint16_t SCAN_MAX_RECORDS = 16;
+    constexpr size_t MAX_RESTART_CALLBACKS = 4;
+
+    constexpr storage::setting<uint8_t> SETTING_MODE{"mode", static_cast<uint8_t>(wifi::mode::ACCESS_POINT)};
+    constexpr storage::setting<storage::text<32>> SETTING_SSID{"ssid", AP_DEFAULT_SSID};
+    constexpr storage::setting<storage::text<63>> SETTING_PASSWORD{"password", AP_DEFAULT_PASS};
+
+    // What the restart task applies, copied out under the lock so the setters can keep going.
+    struct wifi_config_snapshot
+    {
+        wifi::mode mode;
+        char ssid[33];
+        char password[64];
+    };
+
+    struct restart_callback
+    {
+        wifi::restart_done_callback_t function;
+        void *user_data;
+    };
 
     struct wifi_implementation
     {
-        ~wifi_implementation()
+        void load_config()
         {
-            if (m_ssid)
-                delete[] m_ssid;
+            std::lock_guard<std::mutex> lock(m_config_mutex);
 
-            if (m_password)
-                delete[] m_password;
+            m_mode = static_cast<wifi::mode>(m_settings.get<SETTING_MODE>());
+
+            strlcpy(m_ssid, m_settings.get<SETTING_SSID>(), sizeof(m_ssid));
+            strlcpy(m_password, m_settings.get<SETTING_PASSWORD>(), sizeof(m_password));
+
+            m_flags.config_changed = false;
         }
 
-        void load_config()
+        void save_config()
         {
-            esp_err_t error = ESP_OK;
+            wifi_config_snapshot config;
 
-            error = nvs_get_u8(m_nvs_handle, "mode", reinterpret_cast<uint8_t *>(&m_mode));
+            {
+                std::lock_guard<std::mutex> lock(m_config_mutex);
+
+                if (!m_flags.config_changed)
+                    return;
+
+                m_flags.config_changed = false;
 
-            assert(error == ESP_OK || error == ESP_ERR_NVS_NOT_FOUND);
+                config = snapshot_locked();
+            }
 
-            if (error == ESP_ERR_NVS_NOT_FOUND)
-                m_mode = wifi::mode::ACCESS_POINT;
+            m_settings.set<SETTING_MODE>(static_cast<uint8_t>(config.mode));
+            m_settings.set<SETTING_SSID>(config.ssid);
+            m_settings.set<SETTING_PASSWORD>(config.password);
+        }
 
-            size_t size = 0;
+        void set_mode(wifi::mode m)
+        {
+            std::lock_guard<std::mutex> lock(m_config_mutex);
 
-            error = nvs_get_str(m_nvs_handle, "ssid", nullptr, &size);
+            m_mode = m;
+            m_flags.config_changed = true;
+        }
 
-            assert(error == ESP_OK || error == ESP_ERR_NVS_NOT_FOUND);
+        void set_ssid(const char *ssid)
+        {
+            assert(ssid);
 
-            if (error == ESP_OK)
-            {
-                m_ssid = new char[size];
+            std::lock_guard<std::mutex> lock(m_config_mutex);
 
-                ESP_ERROR_CHECK(nvs_get_str(m_nvs_handle, "ssid", m_ssid, &size));
-            }
-            else
-            {
-                m_ssid = new char[strlen(AP_DEFAULT_SSID) + 1];
+            strlcpy(m_ssid, ssid, sizeof(m_ssid));
 
-                strcpy(m_ssid, AP_DEFAULT_SSID);
-            }
+            m_flags.config_changed = true;
+        }
 
-            size = 0;
+        void set_password(const char *password)
+        {
+            std::lock_guard<std::mutex> lock(m_config_mutex);
 
-            error = nvs_get_str(m_nvs_handle, "password", nullptr, &size);
+            strlcpy(m_password, password ? password : "", sizeof(m_password));
 
-            assert(error == ESP_OK || error == ESP_ERR_NVS_NOT_FOUND);
+            m_flags.config_changed = true;
+        }
 
-            if (error == ESP_OK)
-            {
-                m_password = new char[size];
+        wifi_config_snapshot snapshot()
+        {
+            std::lock_guard<std::mutex> lock(m_config_mutex);
 
-                ESP_ERROR_CHECK(nvs_get_str(m_nvs_handle, "password", m_password, &size));
-            }
-            else
+            return snapshot_locked();
+        }
+
+        wifi_config_snapshot snapshot_locked() const
+        {
+            wifi_config_snapshot config = {.mode = m_mode, .ssid = {}, .password = {}};
+
+            memcpy(config.ssid, m_ssid, sizeof(config.ssid));
+            memcpy(config.password, m_password, sizeof(config.password));
+
+            return config;
+        }
+
+        esp_netif_t *get_interface(wifi::mode m)
+        {
+            if (m == wifi::mode::ACCESS_POINT)
             {
-                if (AP_DEFAULT_PASS)
-                {
-                    m_password = new char[strlen(AP_DEFAULT_PASS) + 1];
+                if (!m_access_point_interface)
+                    m_access_point_interface = esp_netif_create_default_wifi_ap();
 
-                    strcpy(m_password, AP_DEFAULT_PASS);
-                }
-                else
-                    m_password = nullptr;
+                return m_access_point_interface;
             }
+
+            if (!m_station_interface)
+                m_station_interface = esp_netif_create_default_wifi_sta();
+
+            return m_station_interface;
         }
 
-        void save_config()
+        static wifi_interface_t make_config(const wifi_config_snapshot &config, wifi_config_t &wifi_config)
         {
-            if (m_flags.config_changed)
+            if (config.mode == wifi::mode::ACCESS_POINT)
             {
-                m_flags.config_changed = false;
+                strncpy(reinterpret_cast<char *>(wifi_config.ap.ssid), config.ssid, sizeof(wifi_config.ap.ssid));
+                wifi_config.ap.ssid_len = strlen(config.ssid);
+                wifi_config.ap.channel = AP_CHAN;
+                wifi_config.ap.max_connection = AP_MAX_CONN;
 
-                ESP_ERROR_CHECK(nvs_set_u8(m_nvs_handle, "mode", static_cast<uint8_t>(m_mode)));
-                ESP_ERROR_CHECK(nvs_set_str(m_nvs_handle, "ssid", m_ssid));
+                if (strlen(config.password))
+                {
+                    strncpy(reinterpret_cast<char *>(wifi_config.ap.password), config.password, sizeof(wifi_config.ap.password));
 
-                if (m_password)
-                    ESP_ERROR_CHECK(nvs_set_str(m_nvs_handle, "password", m_password));
+#ifdef CONFIG_ESP_WIFI_SOFTAP_SAE_SUPPORT
+                    wifi_config.ap.authmode = WIFI_AUTH_WPA3_PSK;
+                    wifi_config.ap.sae_pwe_h2e = WPA3_SAE_PWE_BOTH;
+#else
+                    wifi_config.ap.authmode = WIFI_AUTH_WPA2_PSK;
+#endif
+                }
                 else
-                    ESP_ERROR_CHECK(nvs_erase_key(m_nvs_handle, "password"));
+                    wifi_config.ap.authmode = WIFI_AUTH_OPEN;
+
+                wifi_config.ap.pmf_cfg = {
+                    .capable = true,
+                    .required = true,
+                };
+
+                return WIFI_IF_AP;
             }
-        }
 
-        void set_mode(wifi::mode m)
-        {
-            m_mode = m;
-            m_flags.config_changed = true;
+            if (config.mode == wifi::mode::PEER)
+                return WIFI_IF_STA;
+
+            strncpy(reinterpret_cast<char *>(wifi_config.sta.ssid), config.ssid, sizeof(wifi_config.sta.ssid));
+            strncpy(reinterpret_cast<char *>(wifi_config.sta.password), config.password, sizeof(wifi_config.sta.password));
+
+            return WIFI_IF_STA;
         }
 
-        void set_ssid(const char *ssid)
+        void configure(const wifi_config_snapshot &config)
         {
-            assert(ssid);
+            wifi_config_t wifi_config = {};
 
-            if (m_ssid)
-                delete[] m_ssid;
+            const wifi_interface_t interface = make_config(config, wifi_config);
 
-            m_ssid = new char[strlen(ssid) + 1];
+            ESP_ERROR_CHECK(esp_wifi_set_mode(interface == WIFI_IF_AP ? WIFI_MODE_AP : WIFI_MODE_STA));
+            ESP_ERROR_CHECK(esp_wifi_set_config(interface, &wifi_config));
 
-            strcpy(m_ssid, ssid);
-
-            m_flags.config_changed = true;
+            m_active_mode = config.mode;
         }
 
-        void set_password(const char *password)
+        void remove_scan_station()
         {
-            if (m_password)
-                delete[] m_password;
+            if (!m_scan_station_added.exchange(false) || m_active_mode != wifi::mode::ACCESS_POINT)
+                return;
 
-            m_password = nullptr;
+            wifi_mode_t driver_mode = WIFI_MODE_NULL;
 
-            if (password)
+            if (esp_wifi_get_mode(&driver_mode) == ESP_OK && driver_mode == WIFI_MODE_APSTA && esp_wifi_set_mode(WIFI_MODE_AP) != ESP_OK)
+                ESP_LOGW(TAG, "failed to switch back to access point mode after the scan");
+        }
+
+        static bool same_credentials(wifi_interface_t interface, const wifi_config_t &lhs, const wifi_config_t &rhs)
+        {
+            auto equal = [](const uint8_t *a, const uint8_t *b, size_t size)
             {
-                m_password = new char[strlen(password) + 1];
+                return !strncmp(reinterpret_cast<const char *>(a), reinterpret_cast<const char *>(b), size);
+            };
 
-                strcpy(m_password, password);
-            }
+            if (interface == WIFI_IF_AP)
+                return equal(lhs.ap.ssid, rhs.ap.ssid, sizeof(lhs.ap.ssid)) &&
+                       equal(lhs.ap.password, rhs.ap.password, sizeof(lhs.ap.password)) &&
+                       lhs.ap.authmode == rhs.ap.authmode;
 
-            m_flags.config_changed = true;
+            return equal(lhs.sta.ssid, rhs.sta.ssid, sizeof(lhs.sta.ssid)) &&
+                   equal(lhs.sta.password, rhs.sta.password, sizeof(lhs.sta.password));
         }
 
         struct
         {
             bool config_changed : 1;
-            bool should_restart : 1;
-            bool info_updated : 1;
         } m_flags = {};
 
-        nvs_handle_t m_nvs_handle = 0;
+        storage::settings<SETTING_MODE, SETTING_SSID, SETTING_PASSWORD> m_settings{TAG};
+        // Guards the mode, SSID and password, written by the app, the portal and the event loop.
+        std::mutex m_config_mutex;
         wifi::mode m_mode = wifi::mode::ACCESS_POINT;
-        char *m_ssid = nullptr;
-        char *m_password = nullptr;
+        char m_ssid[33] = {0};
+        char m_password[64] = {0};
+        // Written by the restart task, read by every caller of get_active_mode().
+        std::atomic<wifi::mode> m_active_mode = wifi::mode::ACCESS_POINT;
         esp_netif_t *m_network_interface = nullptr;
+        esp_netif_t *m_access_point_interface = nullptr;
+        esp_netif_t *m_station_interface = nullptr;
         esp_event_handler_instance_t event_handler_wifi = nullptr;
         esp_event_handler_instance_t event_handler_ip = nullptr;
         uint8_t m_try_count = 0;
         esp_netif_ip_info_t m_ip_info;
+
+        std::atomic<bool> m_reconnecting = false;
+        // Left for poll(), which may run long after the events were published.
+        std::atomic<bool> m_fallback_pending = false;
+        std::atomic<bool> m_info_pending = false;
+
+        std::atomic<bool> m_scanning = false;
+        // The scan switched the access point to APSTA, the station goes again when it is done.
+        std::atomic<bool> m_scan_station_added = false;
+        portMUX_TYPE m_scan_lock = portMUX_INITIALIZER_UNLOCKED;
+        wifi_ap_record_t m_scan_records[SCAN_MAX_RECORDS] = {};
+        uint16_t m_scan_count = 0;
+
+        portMUX_TYPE m_restart_lock = portMUX_INITIALIZER_UNLOCKED;
+        bool m_restart_running = false;
+        bool m_restart_requested = false;
+        // Everyone who asked for the pending restart is told when it is done.
+        restart_callback m_restart_callbacks[MAX_RESTART_CALLBACKS] = {};
+        size_t m_restart_callback_count = 0;
     };
 
     wifi *wifi::sp_instance = nullptr;
@@ -158,6 +262,8 @@ namespace hardware
     static void wifi_event_handler(void *arg, esp_event_base_t event_base,
                                    int32_t event_id, void *event_data)
     {
+        HARDWARE_TRACE_SCOPE(WIFI_EVENT, event_id);
+
         auto impl = static_cast<wifi_implementation *>(arg);
 
         switch (event_id)
@@ -196,6 +302,18 @@ namespace hardware
         {
             auto *event = static_cast<wifi_event_sta_disconnected_t *>(event_data);
 
+            if (impl->m_active_mode != wifi::mode::STATION)
+                break;
+
+            if (impl->m_reconnecting.exchange(false))
+            {
+                ESP_LOGI(TAG, "reconnecting to %s", impl->snapshot().ssid);
+
+                esp_wifi_connect();
+
+                break;
+            }
+
             if (impl->m_try_count == 3)
             {
                 ESP_LOGW(TAG, "failed to connect to %s, switching to access point mode", event->ssid);
@@ -205,7 +323,9 @@ namespace hardware
                 impl->set_password(AP_DEFAULT_PASS);
                 impl->save_config();
 
-                impl->m_flags.should_restart = true;
+                impl->m_fallback_pending = true;
+
+                wifi::events().publish(wifi::event::ACCESS_POINT_FALLBACK);
 
                 return;
             }
@@ -221,7 +341,44 @@ namespace hardware
 
         case WIFI_EVENT_STA_START:
         {
-            esp_wifi_connect();
+            if (impl->m_active_mode == wifi::mode::PEER)
+            {
+                ESP_ERROR_CHECK(esp_wifi_set_channel(AP_CHAN, WIFI_SECOND_CHAN_NONE));
+
+                impl->save_config();
+
+                break;
+            }
+
+            if (impl->m_active_mode == wifi::mode::STATION)
+                esp_wifi_connect();
+
+            break;
+        }
+
+        case WIFI_EVENT_SCAN_DONE:
+        {
+            uint16_t count = SCAN_MAX_RECORDS;
+
+            taskENTER_CRITICAL(&impl->m_scan_lock);
+
+            impl->m_scan_count = 0;
+
+            taskEXIT_CRITICAL(&impl->m_scan_lock);
+
+            if (esp_wifi_scan_get_ap_records(&count, impl->m_scan_records) != ESP_OK)
+                count = 0;
+
+            taskENTER_CRITICAL(&impl->m_scan_lock);
+
+            impl->m_scan_count = count;
+
+            taskEXIT_CRITICAL(&impl->m_scan_lock);
+
+            impl->remove_scan_station();
+            impl->m_scanning = false;
+
+            ESP_LOGI(TAG, "scan found %hu networks", count);
 
             break;
         }
@@ -230,7 +387,9 @@ namespace hardware
         {
             impl->save_config();
 
-            impl->m_flags.info_updated = true;
+            impl->m_info_pending = true;
+
+            wifi::events().publish(wifi::event::ACCESS_POINT_STARTED);
 
             break;
         }
@@ -243,6 +402,8 @@ namespace hardware
     static void ip_event_handler(void *arg, esp_event_base_t event_base,
                                  int32_t event_id, void *event_data)
     {
+        HARDWARE_TRACE_SCOPE(WIFI_IP_EVENT, event_id);
+
         auto impl = static_cast<wifi_implementation *>(arg);
 
         switch (event_id)
@@ -258,7 +419,9 @@ namespace hardware
 
         case IP_EVENT_STA_GOT_IP:
         {
-            impl->m_flags.info_updated = true;
+            impl->m_info_pending = true;
+
+            wifi::events().publish(wifi::event::CONNECTED);
 
             break;
         }
@@ -270,8 +433,6 @@ namespace hardware
 
     wifi::wifi() : mp_implementation(std::make_unique<wifi_implementation>())
     {
-        ESP_ERROR_CHECK(nvs_open(TAG, NVS_READWRITE, &mp_implementation->m_nvs_handle));
-
         mp_implementation->load_config();
 
         ESP_ERROR_CHECK(esp_netif_init());
@@ -282,12 +443,24 @@ namespace hardware
 
     wifi::~wifi()
     {
+        while (true)
+        {
+            taskENTER_CRITICAL(&mp_implementation->m_restart_lock);
+
+            const bool restart_running = mp_implementation->m_restart_running;
+
+            taskEXIT_CRITICAL(&mp_implementation->m_restart_lock);
+
+            if (!restart_running)
+                break;
+
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+
         stop();
 
         ESP_ERROR_CHECK(esp_event_loop_delete_default());
         ESP_ERROR_CHECK(esp_netif_deinit());
-
-        nvs_close(mp_implementation->m_nvs_handle);
     }
 
     void wifi::set_mode(mode m)
@@ -300,6 +473,11 @@ namespace hardware
         return mp_implementation->m_mode;
     }
 
+    wifi::mode wifi::get_active_mode()
+    {
+        return mp_implementation->m_active_mode;
+    }
+
     void wifi::set_ssid(const char *ssid)
     {
         mp_implementation->set_ssid(ssid);
@@ -341,89 +519,258 @@ namespace hardware
         return esp_ip4addr_ntoa(&mp_implementation->m_ip_info.gw, buffer, sizeof(buffer));
     }
 
-    void wifi::poll()
+    bool wifi::is_default_access_point()
     {
-        if (mp_implementation->m_flags.should_restart)
+        return mp_implementation->m_active_mode == mode::ACCESS_POINT && !strcmp(mp_implementation->snapshot().ssid, AP_DEFAULT_SSID);
+    }
+
+    bool wifi::start_scan()
+    {
+        if (!mp_implementation->m_network_interface || mp_implementation->m_active_mode == mode::PEER || mp_implementation->m_scanning.exchange(true))
+            return false;
+
+        if (mp_implementation->m_active_mode == mode::ACCESS_POINT)
         {
-            mp_implementation->m_flags.should_restart = false;
+            wifi_mode_t driver_mode = WIFI_MODE_NULL;
 
-            restart();
+            ESP_ERROR_CHECK(esp_wifi_get_mode(&driver_mode));
+
+            if (driver_mode == WIFI_MODE_AP)
+            {
+                ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_APSTA));
+
+                mp_implementation->m_scan_station_added = true;
+            }
+        }
+
+        const wifi_scan_config_t scan_config = {};
+
+        if (esp_wifi_scan_start(&scan_config, false) != ESP_OK)
+        {
+            mp_implementation->remove_scan_station();
+            mp_implementation->m_scanning = false;
+
+            return false;
         }
 
-        if (mp_implementation->m_flags.info_updated)
+        return true;
+    }
+
+    bool wifi::is_scanning()
+    {
+        return mp_implementation->m_scanning;
+    }
+
+    size_t wifi::get_scan_results(access_point_info *results, size_t capacity)
+    {
+        taskENTER_CRITICAL(&mp_implementation->m_scan_lock);
+
+        const size_t count = std::min<size_t>(capacity, mp_implementation->m_scan_count);
+
+        for (size_t i = 0; i < count; i++)
         {
-            mp_implementation->m_flags.info_updated = false;
+            const auto &record = mp_implementation->m_scan_records[i];
+
+            memcpy(results[i].ssid, record.ssid, sizeof(results[i].ssid));
+            results[i].ssid[sizeof(results[i].ssid) - 1] = '\0';
+            results[i].rssi = record.rssi;
+            results[i].channel = record.primary;
+            results[i].secure = record.authmode != WIFI_AUTH_OPEN;
+        }
+
+        taskEXIT_CRITICAL(&mp_implementation->m_scan_lock);
+
+        return count;
+    }
+
+    uint8_t wifi::get_channel()
+    {
+        uint8_t primary = 0;
+        wifi_second_chan_t secondary = WIFI_SECOND_CHAN_NONE;
+
+        if (esp_wifi_get_channel(&primary, &secondary) != ESP_OK)
+            return 0;
+
+        return primary;
+    }
 
+    void wifi::poll()
+    {
+        HARDWARE_TRACE_SCOPE(WIFI_POLL);
+
+        if (mp_implementation->m_fallback_pending.exchange(false))
+            restart();
+
+        if (mp_implementation->m_info_pending.exchange(false))
             ESP_ERROR_CHECK(esp_netif_get_ip_info(mp_implementation->m_network_interface, &mp_implementation->m_ip_info));
+    }
+
+    bus::channel<wifi::event> &wifi::events()
+    {
+        static constinit bus::topic<event> s_topic{"wifi.event"};
+
+        return s_topic;
+    }
+
+    void wifi::restart(restart_done_callback_t on_restart_done, void *user_data)
+    {
+        auto implementation = mp_implementation.get();
+        bool callback_dropped = false;
+
+        taskENTER_CRITICAL(&implementation->m_restart_lock);
+
+        const bool restart_running = implementation->m_restart_running;
+
+        implementation->m_restart_running = true;
+        implementation->m_restart_requested = true;
+
+        if (on_restart_done)
+        {
+            if (implementation->m_restart_callback_count < MAX_RESTART_CALLBACKS)
+                implementation->m_restart_callbacks[implementation->m_restart_callback_count++] = {on_restart_done, user_data};
+            else
+                callback_dropped = true;
+        }
+
+        taskEXIT_CRITICAL(&implementation->m_restart_lock);
+
+        if (callback_dropped)
+            ESP_LOGE(TAG, "too many restarts pending, the caller will not be notified");
+
+        if (restart_running)
+            return;
+
+        if (xTaskCreate(restart_task, "wifi_restart", 4096, this, tskIDLE_PRIORITY + 2, nullptr) != pdPASS)
+        {
+            ESP_LOGE(TAG, "failed to create restart task, restarting synchronously");
+
+            process_restart_requests();
         }
     }
 
-    void wifi::restart()
+    void wifi::restart_task(void *arg)
     {
-        stop();
-        start();
+        static_cast<wifi *>(arg)->process_restart_requests();
+
+        vTaskDelete(nullptr);
     }
 
-    void wifi::start()
+    void wifi::process_restart_requests()
     {
-        if (mp_implementation->m_network_interface)
+        auto implementation = mp_implementation.get();
+
+        while (true)
         {
-            ESP_LOGW(TAG, "subsystem is already started");
+            taskENTER_CRITICAL(&implementation->m_restart_lock);
+
+            if (!implementation->m_restart_requested)
+            {
+                implementation->m_restart_running = false;
+
+                taskEXIT_CRITICAL(&implementation->m_restart_lock);
+
+                break;
+            }
+
+            implementation->m_restart_requested = false;
+
+            restart_callback callbacks[MAX_RESTART_CALLBACKS];
+            const size_t callback_count = implementation->m_restart_callback_count;
+
+            std::copy_n(implementation->m_restart_callbacks, callback_count, callbacks);
+            implementation->m_restart_callback_count = 0;
+
+            taskEXIT_CRITICAL(&implementation->m_restart_lock);
+
+            reconfigure();
+
+            for (size_t i = 0; i < callback_count; i++)
+                callbacks[i].function(callbacks[i].user_data);
+        }
+    }
+
+    void wifi::reconfigure()
+    {
+        HARDWARE_TRACE_SCOPE(WIFI_RECONFIGURE);
+
+        auto implementation = mp_implementation.get();
+
+        if (!implementation->m_network_interface)
+        {
+            start();
 
             return;
         }
 
-        if (mp_implementation->m_mode == mode::ACCESS_POINT)
-            mp_implementation->m_network_interface = esp_netif_create_default_wifi_ap();
-        else
-            mp_implementation->m_network_interface = esp_netif_create_default_wifi_sta();
+        // Setters called from here on apply with the next restart.
+        const wifi_config_snapshot config = implementation->snapshot();
 
-        const wifi_init_config_t init_config = WIFI_INIT_CONFIG_DEFAULT();
+        if (implementation->m_active_mode != config.mode)
+        {
+            ESP_LOGI(TAG, "switching mode without reinitializing the driver");
 
-        ESP_ERROR_CHECK(esp_wifi_init(&init_config));
-        ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, mp_implementation.get(), &mp_implementation->event_handler_wifi));
-        ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT, ESP_EVENT_ANY_ID, &ip_event_handler, mp_implementation.get(), &mp_implementation->event_handler_ip));
+            ESP_ERROR_CHECK(esp_wifi_stop());
+
+            implementation->m_network_interface = implementation->get_interface(config.mode);
+            implementation->configure(config);
+            implementation->m_try_count = 0;
+
+            ESP_ERROR_CHECK(esp_wifi_start());
+
+            return;
+        }
 
         wifi_config_t wifi_config = {};
+        wifi_config_t active_config = {};
+
+        const wifi_interface_t interface = wifi_implementation::make_config(config, wifi_config);
 
-        if (mp_implementation->m_mode == mode::ACCESS_POINT)
+        ESP_ERROR_CHECK(esp_wifi_get_config(interface, &active_config));
+
+        if (wifi_implementation::same_credentials(interface, wifi_config, active_config))
         {
-            strcpy(reinterpret_cast<char *>(wifi_config.ap.ssid), mp_implementation->m_ssid);
-            wifi_config.ap.ssid_len = strlen(mp_implementation->m_ssid);
-            wifi_config.ap.channel = AP_CHAN;
-            wifi_config.ap.max_connection = AP_MAX_CONN;
+            ESP_LOGI(TAG, "configuration unchanged, nothing to apply");
 
-            if (strlen(mp_implementation->m_password))
-            {
-                strcpy(reinterpret_cast<char *>(wifi_config.ap.password), mp_implementation->m_password);
+            return;
+        }
 
-#ifdef CONFIG_ESP_WIFI_SOFTAP_SAE_SUPPORT
-                wifi_config.ap.authmode = WIFI_AUTH_WPA3_PSK;
-                wifi_config.ap.sae_pwe_h2e = WPA3_SAE_PWE_BOTH;
-#else
-                wifi_config.ap.authmode = WIFI_AUTH_WPA2_PSK;
-#endif
-            }
-            else
-                wifi_config.ap.authmode = WIFI_AUTH_OPEN;
+        ESP_ERROR_CHECK(esp_wifi_set_config(interface, &wifi_config));
 
-            wifi_config.ap.pmf_cfg = {
-                .capable = true,
-                .required = true,
-            };
+        if (interface == WIFI_IF_AP)
+            return;
+
+        implementation->m_try_count = 0;
+        implementation->m_reconnecting = true;
+
+        if (esp_wifi_disconnect() != ESP_OK)
+        {
+            implementation->m_reconnecting = false;
 
-            ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_AP));
-            ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_AP, &wifi_config));
+            esp_wifi_connect();
         }
-        else
+    }
+
+    void wifi::start()
+    {
+        if (mp_implementation->m_network_interface)
         {
-            strcpy(reinterpret_cast<char *>(wifi_config.sta.ssid), mp_implementation->m_ssid);
-            strcpy(reinterpret_cast<char *>(wifi_config.sta.password), mp_implementation->m_password);
+            ESP_LOGW(TAG, "subsystem is already started");
 
-            ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-            ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+            return;
         }
 
+        const wifi_config_snapshot config = mp_implementation->snapshot();
+
+        mp_implementation->m_network_interface = mp_implementation->get_interface(config.mode);
+
+        const wifi_init_config_t init_config = WIFI_INIT_CONFIG_DEFAULT();
+
+        ESP_ERROR_CHECK(esp_wifi_init(&init_config));
+        ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, mp_implementation.get(), &mp_implementation->event_handler_wifi));
+        ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT, ESP_EVENT_ANY_ID, &ip_event_handler, mp_implementation.get(), &mp_implementation->event_handler_ip));
+
+        mp_implementation->configure(config);
+
         mp_implementation->m_try_count = 0;
 
         ESP_ERROR_CHECK(esp_wifi_start());
@@ -442,8 +789,15 @@ namespace hardware
         ESP_ERROR_CHECK(esp_event_handler_instance_unregister(IP_EVENT, ESP_EVENT_ANY_ID, mp_implementation->event_handler_ip));
         ESP_ERROR_CHECK(esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, mp_implementation->event_handler_wifi));
         ESP_ERROR_CHECK(esp_wifi_deinit());
-        esp_netif_destroy_default_wifi(mp_implementation->m_network_interface);
 
+        if (mp_implementation->m_access_point_interface)
+            esp_netif_destroy_default_wifi(mp_implementation->m_access_point_interface);
+
+        if (mp_implementation->m_station_interface)
+            esp_netif_destroy_default_wifi(mp_implementation->m_station_interface);
+
+        mp_implementation->m_access_point_interface = nullptr;
+        mp_implementation->m_station_interface = nullptr;
         mp_implementation->m_network_interface = nullptr;
     }
 }
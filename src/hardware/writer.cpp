@@ -0,0 +1,306 @@
+#include "hardware/writer.h"
+
+#include "hardware/storage.h"
+#include "hardware/trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+namespace hardware
+{
+    namespace storage
+    {
+        constexpr const char *TAG = "writer";
+        constexpr uint32_t FLUSH_TASK_PERIOD_MS = 50;
+
+        struct writer_implementation
+        {
+            size_t used() const
+            {
+                return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+            }
+
+            bool should_flush(int64_t now) const
+            {
+                const size_t pending = used();
+
+                if (m_sync_requested.load())
+                    return true;
+
+                if (!pending)
+                    return false;
+
+                return pending >= m_options.flush_threshold ||
+                       now - m_last_flush >= static_cast<int64_t>(m_options.flush_interval_ms) * 1000;
+            }
+
+            void flush(int64_t now)
+            {
+                HARDWARE_TRACE_SCOPE(WRITER_FLUSH);
+
+                // Taken before the head is read, so everything written before sync() asked for it
+                // is part of this flush.
+                const bool sync_requested = m_sync_requested.exchange(false);
+                const size_t head = m_head.load(std::memory_order_acquire);
+                size_t tail = m_tail.load(std::memory_order_relaxed);
+                size_t flushed = 0;
+
+                const int64_t start = esp_timer_get_time();
+
+                while (tail != head)
+                {
+                    const size_t offset = tail & (m_options.buffer_size - 1);
+                    const size_t chunk = std::min(head - tail, m_options.buffer_size - offset);
+
+                    const ssize_t written = ::write(m_fd, m_buffer + offset, chunk);
+
+                    if (written <= 0)
+                    {
+                        ESP_LOGE(TAG, "write failed, discarding %u bytes", static_cast<unsigned>(head - tail));
+
+                        tail = head;
+                        m_failed = true;
+
+                        break;
+                    }
+
+                    tail += written;
+                    flushed += written;
+                }
+
+                m_tail.store(tail, std::memory_order_release);
+
+                bool synced = false;
+
+                if (sync_requested)
+                    synced = fsync(m_fd) == 0;
+
+                const uint32_t elapsed = esp_timer_get_time() - start;
+
+                taskENTER_CRITICAL(&m_statistics_lock);
+
+                m_statistics.bytes_flushed += flushed;
+                m_statistics.syncs += sync_requested;
+                m_statistics.flushes++;
+                m_statistics.max_flush_us = std::max(m_statistics.max_flush_us, elapsed);
+
+                taskEXIT_CRITICAL(&m_statistics_lock);
+
+                if (sync_requested)
+                {
+                    // Reports every write that failed since the last sync, not just this flush's.
+                    m_sync_result = !m_failed.exchange(false) && synced;
+
+                    xSemaphoreGive(m_synced);
+                }
+
+                m_last_flush = now;
+            }
+
+            writer::options m_options = {};
+            int m_fd = -1;
+            uint8_t *m_buffer = nullptr;
+
+            std::mutex m_producer_mutex;
+            std::atomic<size_t> m_head = 0;
+            std::atomic<size_t> m_tail = 0;
+            std::atomic<bool> m_sync_requested = false;
+            std::atomic<bool> m_failed = false;
+            std::atomic<bool> m_sync_result = false;
+            SemaphoreHandle_t m_synced = nullptr;
+            int64_t m_last_flush = 0;
+
+            // Updated by the producers and the flush task, read by get_statistics().
+            portMUX_TYPE m_statistics_lock = portMUX_INITIALIZER_UNLOCKED;
+            writer::statistics m_statistics = {};
+        };
+
+        static std::mutex s_writers_mutex;
+        static std::vector<writer_implementation *> s_writers;
+        static TaskHandle_t s_flush_task = nullptr;
+
+        static void flush_task(void *arg)
+        {
+            while (true)
+            {
+                ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(FLUSH_TASK_PERIOD_MS));
+
+                const int64_t now = esp_timer_get_time();
+
+                std::lock_guard<std::mutex> lock(s_writers_mutex);
+
+                for (auto w : s_writers)
+                    if (w->should_flush(now))
+                        w->flush(now);
+            }
+        }
+
+        static void wake_flush_task()
+        {
+            if (s_flush_task)
+                xTaskNotifyGive(s_flush_task);
+        }
+
+        writer::writer(const char *path, const options &opts) : mp_implementation(std::make_unique<writer_implementation>())
+        {
+            auto implementation = mp_implementation.get();
+
+            implementation->m_options = opts;
+            // The positions run freely and wrap at 2^32, which only lands on a buffer boundary
+            // for power of two sizes.
+            implementation->m_options.buffer_size = std::bit_ceil(opts.buffer_size);
+            implementation->m_options.flush_threshold = std::min(opts.flush_threshold, implementation->m_options.buffer_size);
+
+            if (implementation->m_options.buffer_size != opts.buffer_size)
+                ESP_LOGW(TAG, "rounding staging buffer of %s up to %u bytes", path, static_cast<unsigned>(implementation->m_options.buffer_size));
+
+            const uint32_t preferred = opts.buffer_memory == memory::external ? MALLOC_CAP_SPIRAM : MALLOC_CAP_INTERNAL;
+            const uint32_t fallback = opts.buffer_memory == memory::external ? MALLOC_CAP_INTERNAL : MALLOC_CAP_SPIRAM;
+
+            const size_t buffer_size = implementation->m_options.buffer_size;
+
+            implementation->m_buffer = static_cast<uint8_t *>(heap_caps_malloc(buffer_size, preferred | MALLOC_CAP_8BIT));
+
+            if (!implementation->m_buffer)
+                implementation->m_buffer = static_cast<uint8_t *>(heap_caps_malloc(buffer_size, fallback | MALLOC_CAP_8BIT));
+
+            if (!implementation->m_buffer)
+            {
+                ESP_LOGE(TAG, "failed to allocate %u byte staging buffer for %s", static_cast<unsigned>(buffer_size), path);
+
+                return;
+            }
+
+            // Files may be opened before a deferred mount has completed.
+            wait(type::internal);
+
+            implementation->m_fd = open(path, O_WRONLY | O_CREAT | (opts.truncate ? O_TRUNC : O_APPEND), 0644);
+
+            if (implementation->m_fd < 0)
+            {
+                ESP_LOGE(TAG, "failed to open %s", path);
+
+                return;
+            }
+
+            implementation->m_synced = xSemaphoreCreateBinary();
+            implementation->m_last_flush = esp_timer_get_time();
+
+            std::lock_guard<std::mutex> lock(s_writers_mutex);
+
+            s_writers.push_back(implementation);
+
+            if (!s_flush_task)
+                xTaskCreate(flush_task, "storage_flush", 4096, nullptr, tskIDLE_PRIORITY + 1, &s_flush_task);
+        }
+
+        writer::~writer()
+        {
+            auto implementation = mp_implementation.get();
+
+            if (implementation->m_fd >= 0)
+            {
+                sync(portMAX_DELAY);
+
+                std::lock_guard<std::mutex> lock(s_writers_mutex);
+
+                s_writers.erase(std::remove(s_writers.begin(), s_writers.end(), implementation), s_writers.end());
+
+                close(implementation->m_fd);
+            }
+
+            if (implementation->m_synced)
+                vSemaphoreDelete(implementation->m_synced);
+
+            heap_caps_free(implementation->m_buffer);
+        }
+
+        bool writer::is_open()
+        {
+            return mp_implementation->m_fd >= 0;
+        }
+
+        size_t writer::write(const void *data, size_t size)
+        {
+            auto implementation = mp_implementation.get();
+
+            if (implementation->m_fd < 0)
+                return 0;
+
+            const size_t capacity = implementation->m_options.buffer_size;
+
+            std::lock_guard<std::mutex> lock(implementation->m_producer_mutex);
+
+            const size_t head = implementation->m_head.load(std::memory_order_relaxed);
+            const size_t free = capacity - (head - implementation->m_tail.load(std::memory_order_acquire));
+            const size_t accepted = std::min(size, free);
+
+            const size_t offset = head & (capacity - 1);
+            const size_t first = std::min(accepted, capacity - offset);
+
+            memcpy(implementation->m_buffer + offset, data, first);
+            memcpy(implementation->m_buffer, static_cast<const uint8_t *>(data) + first, accepted - first);
+
+            implementation->m_head.store(head + accepted, std::memory_order_release);
+
+            taskENTER_CRITICAL(&implementation->m_statistics_lock);
+
+            implementation->m_statistics.bytes_accepted += accepted;
+            implementation->m_statistics.bytes_dropped += size - accepted;
+
+            taskEXIT_CRITICAL(&implementation->m_statistics_lock);
+
+            const size_t pending = head + accepted - implementation->m_tail.load(std::memory_order_relaxed);
+
+            if (accepted < size || (pending >= implementation->m_options.flush_threshold &&
+                                    pending - accepted < implementation->m_options.flush_threshold))
+                wake_flush_task();
+
+            return accepted;
+        }
+
+        bool writer::sync(uint32_t timeout_ms)
+        {
+            auto implementation = mp_implementation.get();
+
+            if (implementation->m_fd < 0)
+                return false;
+
+            xSemaphoreTake(implementation->m_synced, 0);
+
+            implementation->m_sync_requested = true;
+
+            wake_flush_task();
+
+            if (xSemaphoreTake(implementation->m_synced, timeout_ms == portMAX_DELAY ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms)) != pdTRUE)
+                return false;
+
+            return implementation->m_sync_result;
+        }
+
+        writer::statistics writer::get_statistics()
+        {
+            taskENTER_CRITICAL(&mp_implementation->m_statistics_lock);
+
+            const statistics result = mp_implementation->m_statistics;
+
+            taskEXIT_CRITICAL(&mp_implementation->m_statistics_lock);
+
+            return result;
+        }
+    }
+}
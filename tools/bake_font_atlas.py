@@ -0,0 +1,259 @@
+#!/usr/bin/env python3
+"""Bake an LVGL font into a pre-decoded atlas for the asset pack.
+
+    bake_font_atlas.py font.c digits.atlas --text "0123456789.,:-+%" --ranges 0x20-0x7e
+
+The input is a font converted with lv_font_conv to C, usually with compressed
+bitmaps. The selected glyphs are decompressed here, exactly as LVGL would on every
+draw, and written uncompressed in the font layout of pack_assets.py. Add the result
+to the asset manifest as a font with the .atlas path and load it with
+assets::font(); LVGL then draws straight from the flash mapping and the glyph cache
+leaves it alone.
+
+Without --text or --ranges every glyph of the font is baked. 3 bpp fonts come out
+as 4 bpp, which is what LVGL expands them to. Kerning is dropped, as it is for
+fonts packed from TrueType.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from pack_assets import assemble_font, pack_bits, parse_ranges  # noqa: E402
+
+BITMAP_FORMAT_PLAIN = 0
+BITMAP_FORMAT_COMPRESSED = 1
+BITMAP_FORMAT_COMPRESSED_NO_PREFILTER = 2
+
+# How LVGL widens decompressed 3 bpp values to 4 bpp.
+EXPAND_3BPP = (0, 2, 4, 6, 9, 11, 13, 15)
+
+
+def strip_comments(source):
+    return re.sub(r"//[^\n]*", "", re.sub(r"/\*.*?\*/", "", source, flags=re.S))
+
+
+def parse_arrays(source):
+    arrays = {}
+
+    for name, body in re.findall(r"(\w+)\s*\[\s*\]\s*=\s*\{([^{}]*)\}\s*;", source):
+        arrays[name] = [int(value, 0) for value in re.findall(r"-?(?:0x[0-9a-fA-F]+|\d+)", body)]
+
+    return arrays
+
+
+def parse_field(source, name, default=None):
+    match = re.search(r"\." + name + r"\s*=\s*(-?\w+)", source)
+
+    if not match:
+        if default is None:
+            raise ValueError(f"font has no .{name}")
+
+        return default
+
+    value = match.group(1)
+
+    return int(value, 0) if re.fullmatch(r"-?(?:0x[0-9a-fA-F]+|\d+)", value) else value
+
+
+def parse_font(path):
+    with open(path) as file:
+        source = strip_comments(file.read())
+
+    arrays = parse_arrays(source)
+
+    if "glyph_bitmap" not in arrays:
+        raise ValueError(f"{path}: no glyph_bitmap array, is this an lv_font_conv C font?")
+
+    glyph_dsc = [tuple(int(value) for value in match) for match in re.findall(
+        r"\{\s*\.bitmap_index\s*=\s*(\d+),\s*\.adv_w\s*=\s*(\d+),\s*\.box_w\s*=\s*(\d+),\s*\.box_h\s*=\s*(\d+),"
+        r"\s*\.ofs_x\s*=\s*(-?\d+),\s*\.ofs_y\s*=\s*(-?\d+)\s*\}", source)]
+
+    cmaps = re.findall(
+        r"\.range_start\s*=\s*(\d+),\s*\.range_length\s*=\s*(\d+),\s*\.glyph_id_start\s*=\s*(\d+),"
+        r"\s*\.unicode_list\s*=\s*(\w+),\s*\.glyph_id_ofs_list\s*=\s*(\w+),\s*\.list_length\s*=\s*(\d+),\s*\.type\s*=\s*(\w+)", source)
+
+    glyph_ids = {}
+
+    for range_start, range_length, glyph_id_start, unicode_list, ofs_list, list_length, kind in cmaps:
+        range_start, range_length, glyph_id_start = int(range_start), int(range_length), int(glyph_id_start)
+        offsets = arrays.get(ofs_list, [])
+
+        if kind.endswith("FORMAT0_TINY"):
+            entries = ((range_start + i, glyph_id_start + i) for i in range(range_length))
+        elif kind.endswith("FORMAT0_FULL"):
+            entries = ((range_start + i, glyph_id_start + offsets[i]) for i in range(range_length) if offsets[i])
+        elif kind.endswith("SPARSE_TINY"):
+            entries = ((range_start + delta, glyph_id_start + i) for i, delta in enumerate(arrays[unicode_list][:int(list_length)]))
+        elif kind.endswith("SPARSE_FULL"):
+            entries = ((range_start + delta, glyph_id_start + offsets[i]) for i, delta in enumerate(arrays[unicode_list][:int(list_length)]))
+        else:
+            raise ValueError(f"{path}: unknown cmap type {kind}")
+
+        glyph_ids.update(entries)
+
+    return {
+        "bitmap": bytes(arrays["glyph_bitmap"]),
+        "glyph_dsc": glyph_dsc,
+        "glyph_ids": glyph_ids,
+        "bpp": parse_field(source, "bpp"),
+        "bitmap_format": parse_field(source, "bitmap_format", BITMAP_FORMAT_PLAIN),
+        "line_height": parse_field(source, "line_height"),
+        "base_line": parse_field(source, "base_line"),
+        "underline_position": parse_field(source, "underline_position", 0),
+        "underline_thickness": parse_field(source, "underline_thickness", 0),
+    }
+
+
+class BitReader:
+    def __init__(self, data, offset):
+        self.data = data
+        self.position = offset * 8
+
+    def read(self, length):
+        value = 0
+
+        for _ in range(length):
+            byte_index = self.position >> 3
+            byte = self.data[byte_index] if byte_index < len(self.data) else 0
+            value = (value << 1) | ((byte >> (7 - (self.position & 7))) & 1)
+            self.position += 1
+
+        return value
+
+
+class RleDecoder:
+    """Port of the run length decoder in LVGL's lv_font_fmt_txt.c."""
+
+    SINGLE, REPEAT, COUNTER = range(3)
+
+    def __init__(self, data, offset, bpp):
+        self.reader = BitReader(data, offset)
+        self.start = self.reader.position
+        self.bpp = bpp
+        self.state = self.SINGLE
+        self.previous = 0
+        self.count = 0
+
+    def single(self):
+        self.previous = self.reader.read(self.bpp)
+        self.state = self.SINGLE
+
+        return self.previous
+
+    def next(self):
+        if self.state == self.SINGLE:
+            first = self.reader.position == self.start
+            value = self.reader.read(self.bpp)
+
+            if not first and value == self.previous:
+                self.count = 0
+                self.state = self.REPEAT
+
+            self.previous = value
+
+            return value
+
+        if self.state == self.REPEAT:
+            self.count += 1
+
+            if not self.reader.read(1):
+                return self.single()
+
+            if self.count == 11:
+                self.count = self.reader.read(6)
+
+                if not self.count:
+                    return self.single()
+
+                self.state = self.COUNTER
+
+            return self.previous
+
+        self.count -= 1
+
+        if not self.count:
+            return self.single()
+
+        return self.previous
+
+
+def decode_glyph(font, bitmap_index, width, height):
+    bpp = font["bpp"]
+    count = width * height
+
+    if font["bitmap_format"] == BITMAP_FORMAT_PLAIN:
+        reader = BitReader(font["bitmap"], bitmap_index)
+        bits = 4 if bpp == 3 else bpp
+
+        return [reader.read(bits) for _ in range(count)], bits
+
+    decoder = RleDecoder(font["bitmap"], bitmap_index, bpp)
+    prefilter = font["bitmap_format"] == BITMAP_FORMAT_COMPRESSED
+    values = []
+    line = [0] * width
+
+    for y in range(height):
+        row = [decoder.next() for _ in range(width)]
+        line = [a ^ b for a, b in zip(row, line)] if prefilter and y else row
+        values += line
+
+    if bpp == 3:
+        return [EXPAND_3BPP[value] for value in values], 4
+
+    return values, bpp
+
+
+def bake(font, codepoints):
+    glyphs = []
+    bits = 4 if font["bpp"] == 3 else font["bpp"]
+
+    for codepoint in codepoints:
+        glyph_id = font["glyph_ids"].get(codepoint)
+
+        if glyph_id is None or glyph_id >= len(font["glyph_dsc"]):
+            print(f"U+{codepoint:04X} is not in the font, skipped", file=sys.stderr)
+            continue
+
+        bitmap_index, advance, width, height, ofs_x, ofs_y = font["glyph_dsc"][glyph_id]
+        bitmap = b""
+
+        if width and height:
+            values, bits = decode_glyph(font, bitmap_index, width, height)
+            bitmap = pack_bits(values, bits)
+
+        glyphs.append((codepoint, advance, width, height, ofs_x, ofs_y, bitmap))
+
+    if not glyphs:
+        raise ValueError("no glyphs to bake")
+
+    return assemble_font(glyphs, font["line_height"], font["base_line"], font["underline_position"],
+                         font["underline_thickness"], bits), len(glyphs)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("font", help="LVGL C font from lv_font_conv")
+    parser.add_argument("output", help="atlas to write")
+    parser.add_argument("--text", default="", help="characters to bake")
+    parser.add_argument("--ranges", nargs="*", default=[], help="code points to bake, e.g. 0x30-0x39 0xb0")
+    arguments = parser.parse_args()
+
+    try:
+        font = parse_font(arguments.font)
+        codepoints = sorted(set(parse_ranges(arguments.ranges)) | {ord(character) for character in arguments.text})
+        atlas, count = bake(font, codepoints or sorted(font["glyph_ids"]))
+    except ValueError as error:
+        sys.exit(str(error))
+
+    with open(arguments.output, "wb") as file:
+        file.write(atlas)
+
+    print(f"{count} glyphs, {len(atlas)} bytes")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,237 @@
+#!/usr/bin/env python3
+"""Create or apply delta OTA patches between two application images.
+
+    make_delta.py create old.bin new.bin update.patch
+    make_delta.py apply old.bin update.patch new.bin
+
+The old image is the one running on the device; it is read from the active OTA
+slot while the patch is applied, so the old image must match byte for byte.
+
+A patch is an 80 byte header followed by operations, all integers little endian:
+
+    header: magic "RCDP", u16 version, u16 reserved, u32 source size, u32 target size,
+            source SHA-256, target SHA-256
+    COPY    u8 1, u32 source offset, u32 length          copy from the old image
+    DATA    u8 2, u32 length, bytes                      literal bytes
+    ADD     u8 3, u32 source offset, u32 length, bytes   old bytes plus difference, mod 256
+
+ADD covers code that only moved, where most bytes stay equal and the differences
+are mostly zero, which compresses well on the wire.
+"""
+
+import argparse
+import hashlib
+import struct
+import sys
+
+MAGIC = 0x50444352
+VERSION = 1
+HEADER = struct.Struct("<IHHII32s32s")
+
+OP_COPY = 1
+OP_DATA = 2
+OP_ADD = 3
+
+WINDOW = 32
+STEP = 4
+MIN_COPY = 32
+ADD_LOOKAHEAD = 32
+ADD_MIN_EQUAL = ADD_LOOKAHEAD // 2
+EXACT_RESUME = 16
+
+
+def index_source(source):
+    table = {}
+
+    for offset in range(0, len(source) - WINDOW + 1, STEP):
+        table.setdefault(source[offset:offset + WINDOW], offset)
+
+    return table
+
+
+def extend(source, target, source_offset, target_offset):
+    length = 0
+    limit = min(len(source) - source_offset, len(target) - target_offset)
+
+    while length < limit and source[source_offset + length] == target[target_offset + length]:
+        length += 1
+
+    return length
+
+
+def extend_approximate(source, target, source_offset, target_offset):
+    """Length of a region where most bytes match, ending on its last mismatch.
+
+    Stops once EXACT_RESUME bytes in a row are equal, so COPY takes over again, or once
+    more than half of the last ADD_LOOKAHEAD bytes differ.
+    """
+    limit = min(len(source) - source_offset, len(target) - target_offset)
+    mismatches = []
+    run = 0
+
+    for i in range(limit):
+        if source[source_offset + i] == target[target_offset + i]:
+            run += 1
+
+            if run >= EXACT_RESUME:
+                break
+
+            continue
+
+        run = 0
+        mismatches.append(i)
+
+        recent = [m for m in mismatches[-ADD_MIN_EQUAL - 1:] if m > i - ADD_LOOKAHEAD]
+
+        if len(recent) > ADD_MIN_EQUAL:
+            mismatches = [m for m in mismatches if m < recent[0]]
+            break
+
+    return mismatches[-1] + 1 if mismatches else 0
+
+
+def create(source, target):
+    table = index_source(source)
+    operations = []
+    literal_start = 0
+    position = 0
+
+    def flush_literals(end):
+        if end > literal_start:
+            operations.append((OP_DATA, 0, target[literal_start:end]))
+
+    while position + WINDOW <= len(target):
+        candidate = table.get(target[position:position + WINDOW])
+
+        if candidate is None:
+            position += 1
+            continue
+
+        length = extend(source, target, candidate, position)
+
+        if length < MIN_COPY:
+            position += 1
+            continue
+
+        flush_literals(position)
+
+        # Follow the match along the same diagonal, switching between COPY and ADD.
+        while length:
+            operations.append((OP_COPY, candidate, length))
+            candidate += length
+            position += length
+
+            approximate = extend_approximate(source, target, candidate, position)
+
+            if not approximate:
+                break
+
+            difference = bytes((b - a) & 0xFF for a, b in zip(source[candidate:candidate + approximate],
+                                                             target[position:position + approximate]))
+            operations.append((OP_ADD, candidate, difference))
+            candidate += approximate
+            position += approximate
+
+            length = extend(source, target, candidate, position)
+
+        literal_start = position
+
+    flush_literals(len(target))
+
+    patch = bytearray(HEADER.pack(MAGIC, VERSION, 0, len(source), len(target),
+                                  hashlib.sha256(source).digest(), hashlib.sha256(target).digest()))
+
+    for operation, offset, payload in operations:
+        if operation == OP_COPY:
+            patch += struct.pack("<BII", OP_COPY, offset, payload)
+        elif operation == OP_DATA:
+            patch += struct.pack("<BI", OP_DATA, len(payload)) + payload
+        else:
+            patch += struct.pack("<BII", OP_ADD, offset, len(payload)) + payload
+
+    return bytes(patch)
+
+
+def apply(source, patch):
+    magic, version, _, source_size, target_size, source_hash, target_hash = HEADER.unpack_from(patch)
+
+    if magic != MAGIC or version != VERSION:
+        raise ValueError("not a delta patch")
+
+    if hashlib.sha256(source[:source_size]).digest() != source_hash:
+        raise ValueError("patch was made against a different image")
+
+    target = bytearray()
+    position = HEADER.size
+
+    while position < len(patch):
+        operation = patch[position]
+
+        if operation == OP_COPY:
+            offset, length = struct.unpack_from("<II", patch, position + 1)
+            target += source[offset:offset + length]
+            position += 9
+        elif operation == OP_DATA:
+            (length,) = struct.unpack_from("<I", patch, position + 1)
+            target += patch[position + 5:position + 5 + length]
+            position += 5 + length
+        elif operation == OP_ADD:
+            offset, length = struct.unpack_from("<II", patch, position + 1)
+            difference = patch[position + 9:position + 9 + length]
+            target += bytes((a + d) & 0xFF for a, d in zip(source[offset:offset + length], difference))
+            position += 9 + length
+        else:
+            raise ValueError(f"unknown operation {operation} at {position}")
+
+    if len(target) != target_size or hashlib.sha256(target).digest() != target_hash:
+        raise ValueError("patched image does not match the target")
+
+    return bytes(target)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    create_parser = commands.add_parser("create")
+    create_parser.add_argument("source")
+    create_parser.add_argument("target")
+    create_parser.add_argument("patch")
+
+    apply_parser = commands.add_parser("apply")
+    apply_parser.add_argument("source")
+    apply_parser.add_argument("patch")
+    apply_parser.add_argument("target")
+
+    arguments = parser.parse_args()
+
+    with open(arguments.source, "rb") as file:
+        source = file.read()
+
+    if arguments.command == "create":
+        with open(arguments.target, "rb") as file:
+            target = file.read()
+
+        patch = create(source, target)
+
+        with open(arguments.patch, "wb") as file:
+            file.write(patch)
+
+        print(f"{len(target)} byte image, {len(patch)} byte patch ({100 * len(patch) / max(len(target), 1):.1f}%)")
+    else:
+        with open(arguments.patch, "rb") as file:
+            patch = file.read()
+
+        try:
+            target = apply(source, patch)
+        except ValueError as error:
+            sys.exit(str(error))
+
+        with open(arguments.target, "wb") as file:
+            file.write(target)
+
+        print(f"wrote {len(target)} bytes")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,267 @@
+#!/usr/bin/env python3
+"""Build the read-only asset pack flashed to the `assets` partition.
+
+The manifest is a JSON list of entries:
+
+    [
+        {"name": "icons/wifi", "type": "image", "path": "icons/wifi.png"},
+        {"name": "fonts/body", "type": "font", "path": "Inter.ttf", "size": 16, "ranges": ["0x20-0x7e", "0xb0"]},
+        {"name": "fonts/digits", "type": "font", "path": "digits.atlas"},
+        {"name": "sounds/click", "type": "blob", "path": "click.raw"}
+    ]
+
+Images are converted to RGB565 (byte swapped, matching LV_COLOR_16_SWAP) with an
+optional alpha byte, fonts are rasterised to 4 bpp uncompressed glyphs without
+kerning. Fonts with an .atlas path were baked from an LVGL font by
+bake_font_atlas.py and are stored as they are. Flash the result with:
+
+    parttool.py write_partition --partition-name assets --input assets.bin
+"""
+
+import argparse
+import json
+import os
+import struct
+import sys
+
+PACK_MAGIC = 0x50414352
+PACK_VERSION = 1
+PARTITION_SIZE = 0x200000
+ALIGNMENT = 4
+
+KIND_BLOB = 0
+KIND_IMAGE = 1
+KIND_FONT = 2
+
+LV_IMG_CF_TRUE_COLOR = 4
+LV_IMG_CF_TRUE_COLOR_ALPHA = 5
+
+LV_FONT_FMT_TXT_CMAP_FORMAT0_TINY = 2
+
+HEADER = struct.Struct("<IHHIII")
+ENTRY = struct.Struct("<IIIHHBBH")
+FONT_HEADER = struct.Struct("<HhbbBBHHIII")
+FONT_CMAP = struct.Struct("<IHHHBBII")
+
+
+def fnv1a(name):
+    value = 0x811C9DC5
+
+    for byte in name.encode("utf-8"):
+        value = ((value ^ byte) * 0x01000193) & 0xFFFFFFFF
+
+    return value or 1
+
+
+def align(data, alignment=ALIGNMENT):
+    return data + b"\0" * (-len(data) % alignment)
+
+
+def rgb565_swapped(r, g, b):
+    value = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3)
+
+    return struct.pack(">H", value)
+
+
+def pack_image(path):
+    from PIL import Image
+
+    image = Image.open(path)
+    alpha = image.mode in ("RGBA", "LA", "PA") or "transparency" in image.info
+    image = image.convert("RGBA")
+
+    if image.width >= 2048 or image.height >= 2048:
+        raise ValueError(f"{path}: images are limited to 2047x2047")
+
+    data = bytearray()
+
+    for r, g, b, a in image.getdata():
+        data += rgb565_swapped(r, g, b)
+
+        if alpha:
+            data.append(a)
+
+    color_format = LV_IMG_CF_TRUE_COLOR_ALPHA if alpha else LV_IMG_CF_TRUE_COLOR
+
+    return bytes(data), image.width, image.height, color_format
+
+
+def parse_ranges(ranges):
+    codepoints = set()
+
+    for item in ranges:
+        first, _, last = str(item).partition("-")
+        codepoints.update(range(int(first, 0), int(last or first, 0) + 1))
+
+    return sorted(codepoints)
+
+
+def pack_bits(values, bpp):
+    data = bytearray()
+    accumulator = 0
+    bits = 0
+
+    for value in values:
+        accumulator = (accumulator << bpp) | value
+        bits += bpp
+
+        if bits == 8:
+            data.append(accumulator)
+            accumulator = 0
+            bits = 0
+
+    if bits:
+        data.append(accumulator << (8 - bits))
+
+    return bytes(data)
+
+
+def assemble_font(glyphs, line_height, base_line, underline_position, underline_thickness, bpp):
+    """Lay out a font asset from (codepoint, advance, width, height, ofs_x, ofs_y, bitmap) tuples.
+
+    The advance is in 1/16 px and the bitmap packed at bpp without row padding, as
+    lv_font_fmt_txt expects for plain fonts.
+    """
+    glyphs = sorted(glyphs)
+    codepoints = [glyph[0] for glyph in glyphs]
+
+    glyph_dsc = bytearray(8)  # glyph id 0 is reserved
+    bitmaps = bytearray()
+
+    for codepoint, advance, width, height, ofs_x, ofs_y, bitmap in glyphs:
+        if len(bitmaps) >= 1 << 20:
+            raise ValueError("glyph bitmaps exceed 1 MB")
+
+        glyph_dsc += struct.pack("<IBBbb", len(bitmaps) | (min(advance, 0xFFF) << 20), width, height, ofs_x, ofs_y)
+        bitmaps += bitmap
+
+    cmaps = []
+    glyph_id = 1
+    start = 0
+
+    for i in range(1, len(codepoints) + 1):
+        if i == len(codepoints) or codepoints[i] != codepoints[i - 1] + 1:
+            cmaps.append(FONT_CMAP.pack(codepoints[start], i - start, glyph_id, 0, LV_FONT_FMT_TXT_CMAP_FORMAT0_TINY, 0, 0, 0))
+            glyph_id += i - start
+            start = i
+
+    cmap_offset = FONT_HEADER.size
+    glyph_dsc_offset = cmap_offset + len(cmaps) * FONT_CMAP.size
+    glyph_bitmap_offset = glyph_dsc_offset + len(glyph_dsc)
+
+    header = FONT_HEADER.pack(line_height, base_line, underline_position, underline_thickness, bpp, 0,
+                              len(cmaps), 0, glyph_dsc_offset, glyph_bitmap_offset, cmap_offset)
+
+    return header + b"".join(cmaps) + bytes(glyph_dsc) + bytes(bitmaps)
+
+
+def pack_font(path, size, ranges, bpp=4):
+    from PIL import Image, ImageDraw, ImageFont
+
+    font = ImageFont.truetype(path, size)
+    ascent, descent = font.getmetrics()
+    glyphs = []
+
+    for codepoint in parse_ranges(ranges):
+        character = chr(codepoint)
+        left, top, right, bottom = font.getbbox(character, anchor="ls")
+        width, height = max(right - left, 0), max(bottom - top, 0)
+        advance = round(font.getlength(character) * 16)
+        bitmap = b""
+
+        if width and height:
+            canvas = Image.new("L", (width, height))
+            ImageDraw.Draw(canvas).text((-left, -top), character, font=font, fill=255, anchor="ls")
+            bitmap = pack_bits((value >> (8 - bpp) for value in canvas.getdata()), bpp)
+
+        glyphs.append((codepoint, advance, width, height, left, -bottom, bitmap))
+
+    try:
+        return assemble_font(glyphs, ascent + descent, descent, -max(descent // 2, 1), max(size // 16, 1), bpp)
+    except ValueError as error:
+        raise ValueError(f"{path}: {error}") from None
+
+
+def build(manifest, base_directory):
+    slot_count = 1
+
+    while slot_count < len(manifest) * 2:
+        slot_count *= 2
+
+    index_offset = HEADER.size
+    payload = bytearray(align(b"\0" * (index_offset + slot_count * ENTRY.size)))
+    slots = [None] * slot_count
+    hashes = {}
+
+    for item in manifest:
+        name = item["name"]
+        kind = item.get("type", "blob")
+        path = os.path.join(base_directory, item["path"])
+        name_hash = fnv1a(name)
+
+        if name_hash in hashes:
+            raise ValueError(f"{name}: hash collides with {hashes[name_hash]}")
+
+        hashes[name_hash] = name
+        width = height = color_format = 0
+
+        if kind == "image":
+            data, width, height, color_format = pack_image(path)
+            kind_id = KIND_IMAGE
+        elif kind == "font" and path.endswith(".atlas"):
+            with open(path, "rb") as file:
+                data = file.read()
+            kind_id = KIND_FONT
+        elif kind == "font":
+            data = pack_font(path, item["size"], item.get("ranges", ["0x20-0x7e"]), item.get("bpp", 4))
+            kind_id = KIND_FONT
+        elif kind == "blob":
+            with open(path, "rb") as file:
+                data = file.read()
+            kind_id = KIND_BLOB
+        else:
+            raise ValueError(f"{name}: unknown asset type {kind}")
+
+        offset = len(payload)
+        payload += align(data)
+
+        slot = name_hash & (slot_count - 1)
+
+        while slots[slot] is not None:
+            slot = (slot + 1) & (slot_count - 1)
+
+        slots[slot] = ENTRY.pack(name_hash, offset, len(data), width, height, kind_id, color_format, 0)
+
+    for slot, entry in enumerate(slots):
+        if entry:
+            position = index_offset + slot * ENTRY.size
+            payload[position:position + ENTRY.size] = entry
+
+    payload[0:HEADER.size] = HEADER.pack(PACK_MAGIC, PACK_VERSION, len(manifest), slot_count, index_offset, len(payload))
+
+    return bytes(payload)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("manifest", help="JSON manifest, paths are relative to it")
+    parser.add_argument("output", help="asset pack to write")
+    parser.add_argument("--partition-size", type=lambda value: int(value, 0), default=PARTITION_SIZE)
+    arguments = parser.parse_args()
+
+    with open(arguments.manifest) as file:
+        manifest = json.load(file)
+
+    pack = build(manifest, os.path.dirname(os.path.abspath(arguments.manifest)))
+
+    if len(pack) > arguments.partition_size:
+        sys.exit(f"asset pack is {len(pack)} bytes, partition holds {arguments.partition_size}")
+
+    with open(arguments.output, "wb") as file:
+        file.write(pack)
+
+    print(f"{len(manifest)} assets, {len(pack)} bytes")
+
+
+if __name__ == "__main__":
+    main()
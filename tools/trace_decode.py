@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+"""Decode a hardware::trace dump into Chrome trace JSON, for Perfetto or chrome://tracing.
+
+    trace_decode.py trace.bin trace.json
+
+The dump is written by trace::save() on the device, all integers little endian:
+
+    header: magic "HWTR", u16 version, u8 cores, u8 event count, u32 cycles per us,
+            u32 events per core
+    names:  per event, u8 length and the name
+    cores:  per core, u32 anchor cycles, u32 events recorded, i64 anchor us, then the
+            last min(recorded, events per core) events, oldest first
+    event:  u32 cycles, u8 id, u8 phase (0 begin, 1 end, 2 instant), u16 argument
+
+The cycle counters are 32 bits and not in step between the cores, so every core's events
+are timed backwards from its anchor, a cycle counter and esp_timer reading taken on that
+core while dumping. Times are in microseconds since boot. Events more than 2^31 cycles
+apart, about 9 s at 240 MHz, come out too close together, and so does anything recorded
+while the CPU frequency was scaled down.
+
+Matching begin and end events on a core become complete events. Begins whose end was not
+recorded yet stay open, ends whose begin was overwritten are dropped.
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = 0x52545748
+VERSION = 1
+HEADER = struct.Struct("<IHBBII")
+CORE_HEADER = struct.Struct("<IIq")
+EVENT = struct.Struct("<IBBH")
+
+PHASE_BEGIN = 0
+PHASE_END = 1
+PHASE_INSTANT = 2
+
+
+def parse(dump):
+    magic, version, cores, event_count, cycles_per_us, capacity = HEADER.unpack_from(dump, 0)
+
+    if magic != MAGIC or version != VERSION:
+        raise ValueError("not a trace dump")
+
+    position = HEADER.size
+    names = []
+
+    for _ in range(event_count):
+        length = dump[position]
+        names.append(dump[position + 1:position + 1 + length].decode())
+        position += 1 + length
+
+    timelines = []
+
+    for core in range(cores):
+        anchor_cycles, recorded, anchor_us = CORE_HEADER.unpack_from(dump, position)
+        position += CORE_HEADER.size
+
+        count = min(recorded, capacity)
+        records = [EVENT.unpack_from(dump, position + i * EVENT.size) for i in range(count)]
+        position += count * EVENT.size
+
+        # Walks back from the anchor. Deltas are signed, an interrupt that claimed a slot
+        # between another record's claim and its timestamp makes time go back a little.
+        events = []
+        time = 0
+        later = anchor_cycles
+
+        for cycles, event_id, phase, argument in reversed(records):
+            delta = (later - cycles) & 0xFFFFFFFF
+
+            if delta >= 1 << 31:
+                delta -= 1 << 32
+
+            time -= delta
+            later = cycles
+
+            name = names[event_id] if event_id < len(names) else f"event {event_id}"
+            events.append((anchor_us + time / cycles_per_us, name, phase, argument))
+
+        events.reverse()
+        events.sort(key=lambda event: event[0])
+
+        timelines.append({"core": core, "recorded": recorded, "lost": recorded - count, "events": events})
+
+    return timelines
+
+
+def convert(timelines):
+    trace = []
+    durations = {}
+    unmatched = 0
+
+    for timeline in timelines:
+        core = timeline["core"]
+        open_events = {}
+
+        trace.append({"name": "thread_name", "ph": "M", "pid": 0, "tid": core, "args": {"name": f"core {core}"}})
+
+        for time, name, phase, argument in timeline["events"]:
+            if phase == PHASE_BEGIN:
+                open_events.setdefault(name, []).append((time, argument))
+            elif phase == PHASE_END:
+                if not open_events.get(name):
+                    unmatched += 1
+                    continue
+
+                start, start_argument = open_events[name].pop()
+
+                trace.append({"name": name, "ph": "X", "ts": start, "dur": time - start, "pid": 0, "tid": core, "args": {"arg": start_argument}})
+                durations.setdefault(name, []).append(time - start)
+            else:
+                trace.append({"name": name, "ph": "i", "s": "t", "ts": time, "pid": 0, "tid": core, "args": {"arg": argument}})
+
+        for name, starts in open_events.items():
+            for start, argument in starts:
+                trace.append({"name": name, "ph": "B", "ts": start, "pid": 0, "tid": core, "args": {"arg": argument}})
+
+    trace.sort(key=lambda entry: entry.get("ts", 0))
+
+    return {"traceEvents": trace, "displayTimeUnit": "ns"}, durations, unmatched
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("dump")
+    parser.add_argument("output")
+    arguments = parser.parse_args()
+
+    with open(arguments.dump, "rb") as file:
+        dump = file.read()
+
+    try:
+        timelines = parse(dump)
+    except (ValueError, struct.error, IndexError) as error:
+        sys.exit(f"{arguments.dump}: {error}")
+
+    trace, durations, unmatched = convert(timelines)
+
+    with open(arguments.output, "w") as file:
+        json.dump(trace, file)
+
+    for timeline in timelines:
+        print(f"core {timeline['core']}: {len(timeline['events'])} events, {timeline['lost']} overwritten")
+
+    if unmatched:
+        print(f"{unmatched} ends without a begin")
+
+    for name, values in sorted(durations.items(), key=lambda item: -max(item[1])):
+        print(f"{name:<24} {len(values):6} x  mean {sum(values) / len(values):9.1f} us  max {max(values):9.1f} us")
+
+
+if __name__ == "__main__":
+    main()